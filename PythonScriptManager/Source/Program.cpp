@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <thread>
 #include <chrono>
@@ -15,6 +18,10 @@ namespace py = pybind11;
 
 // Include your ScriptManager
 #include "ScriptManager/ScriptManager.h"
+#include "ScriptManager/Buffers/EntitySnapshot.h"
+#include "ScriptManager/Buffers/PacketBuffer.h"
+#include "ScriptManager/Dispatch/AllocationCounter.h"
+#include "ScriptManager/Ipc/WorkerMain.h"
 
 void clear_console() {
 #ifdef _WIN32
@@ -25,9 +32,11 @@ void clear_console() {
 }
 
 void dispatch_events(int dispatch_count) {
+  scripting::attach_thread();
   for (auto loop = 0; loop < dispatch_count; ++loop) {
     scripting::events::random_loadtest_function();
   }
+  scripting::detach_thread();
 }
 
 // Function to handle loadtest command
@@ -97,13 +106,149 @@ double load_test(double last_run_time_seconds, bool multi_threaded) {
   return total_seconds;
 }
 
+// Function to handle loadtest -exec. Runs the same dispatches on executor threads left to the scheduler and then pinned
+// one per CPU, comparing throughput and the latency from posting an event to its handlers finishing.
+void executor_load_test(const std::vector<std::string>& words) {
+  clear_console();
+
+  std::size_t dispatch_count;
+  std::size_t num_threads;
+  std::cout << "Enter the number of dispatches for this test: ";
+  std::cin >> dispatch_count;
+  std::cout << "Number of executor threads: ";
+  std::cin >> num_threads;
+
+  // loadtest -exec [cpu list] [-fifo priority] [-nice value]
+  scripting::executor::ThreadPlacement pinned;
+  std::vector<int> cpus;
+  for (std::size_t i = 1; i < words.size(); ++i) {
+    if (words[i] == "-fifo" && i + 1 < words.size()) {
+      pinned.fifo_priority = std::stoi(words[++i]);
+    }
+    else if (words[i] == "-nice" && i + 1 < words.size()) {
+      pinned.nice = std::stoi(words[++i]);
+    }
+    else if (words[i] != "-exec" && !scripting::executor::parse_cpu_list(words[i], cpus)) {
+      std::cout << "Could not parse CPU list: " << words[i] << std::endl;
+      return;
+    }
+  }
+  if (cpus.empty()) {
+    // Leave CPU 0 to the game thread when there is more than one.
+    const auto hardware = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < num_threads; ++i) {
+      cpus.push_back(hardware > 1 ? static_cast<int>(1 + i % (hardware - 1)) : 0);
+    }
+  }
+
+  const auto run = [&](const std::string& name, const scripting::executor::ExecutorSettings& settings) {
+    if (!scripting::start_executor(settings)) {
+      return;
+    }
+    auto& executor = scripting::ScriptManager::instance().script_executor();
+    std::vector<double> latencies(dispatch_count);
+    const auto in_flight = num_threads * 4;
+    const auto completed = executor.completed();
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < dispatch_count; ++i) {
+      while (executor.submitted() - executor.completed() >= in_flight) {
+        std::this_thread::yield();
+      }
+      const auto posted = std::chrono::steady_clock::now();
+      const auto job = [&latencies, i, posted]() {
+        scripting::events::random_loadtest_function();
+        latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - posted).count();
+      };
+      while (!executor.submit(job)) {
+        std::this_thread::yield();
+      }
+    }
+    while (executor.completed() - completed < dispatch_count) {
+      std::this_thread::yield();
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    scripting::stop_executor();
+
+    std::sort(latencies.begin(), latencies.end());
+    const auto percentile = [&](const double fraction) { return latencies[static_cast<std::size_t>(fraction * (latencies.size() - 1))]; };
+    std::cout << name << ": " << dispatch_count / elapsed << " dispatches per second, latency p50 " << percentile(0.5) << " us p99 "
+      << percentile(0.99) << " us p99.9 " << percentile(0.999) << " us max " << latencies.back() << " us" << std::endl;
+  };
+
+  if (dispatch_count == 0 || num_threads == 0) {
+    return;
+  }
+
+  scripting::executor::ExecutorSettings settings;
+  settings.threads = num_threads;
+  run("Unpinned", settings);
+  for (const auto cpu : cpus) {
+    auto placement = pinned;
+    placement.cpus = { cpu };
+    settings.placements.push_back(placement);
+  }
+  run("Pinned", settings);
+}
+
+// Callbacks for the loadtest -calls command, registered both ways.
+std::size_t count_text(const std::string_view text) {
+  return text.size();
+}
+
+double move_by(const long long mover, const double distance, const bool running) {
+  return running ? distance * 2 : distance + static_cast<double>(mover % 2);
+}
+
+// Function to handle loadtest -calls command
+void call_load_test(const std::vector<std::string>& words) {
+  std::size_t count = 1000000;
+  const auto position = std::find(words.begin(), words.end(), "-calls");
+  if (position + 1 != words.end()) {
+    count = std::stoul(*(position + 1));
+  }
+
+  scripting::gil::GilAcquire acquire;
+  // The same callbacks registered both ways on a module of their own, once per run of the program and kept until exit.
+  static py::handle callbacks;
+  if (!callbacks) {
+    auto module = py::reinterpret_steal<py::module>(PyModule_New("callbacks"));
+    module.def("count_text", &count_text);
+    module.def("move_by", &move_by);
+    scripting::wrappers::def_fastcall<&count_text>(module, "count_text_fast");
+    scripting::wrappers::def_fastcall<&move_by>(module, "move_by_fast");
+    callbacks = module.release();
+  }
+
+  py::dict scope;
+  scope["callbacks"] = callbacks;
+  scope["count"] = count;
+  py::exec(R"python(
+import time
+def time_loop(statement):
+    loop = compile(f"for _ in range(count): {statement}", statement, "exec")
+    start = time.perf_counter()
+    exec(loop, {"callbacks": callbacks, "count": count})
+    return (time.perf_counter() - start) / count * 1e9
+loop = time_loop("pass")
+results = [(name, time_loop(f"callbacks.{name}({arguments})") - loop) for name, arguments in (
+    ("count_text", "'event handled: on_load_4'"), ("count_text_fast", "'event handled: on_load_4'"),
+    ("move_by", "7, 1.5, True"), ("move_by_fast", "7, 1.5, True"))]
+)python", scope);
+
+  std::cout << count << " calls per callback, less the loop:" << std::endl;
+  for (const auto& result : scope["results"]) {
+    const auto [name, nanoseconds] = result.cast<std::pair<std::string, double>>();
+    std::cout << "  " << name << ": " << nanoseconds << " ns" << std::endl;
+  }
+}
+
 // Function to handle example command
 void example() {
   auto user = std::make_shared<User>();
 
   std::string input;
   while (true) {
-    std::cout << "Enter a message to send to python or type exit." << std::endl;
+    std::cout << "Enter a message to send to python, a .command or type exit." << std::endl;
     std::cout << "Input: ";
     std::getline(std::cin, input);
 
@@ -119,11 +264,939 @@ void example() {
       break;
     }
 
+    // Chat commands go straight to the script that registered them.
+    if (input[0] == '.') {
+      if (!scripting::dispatch_command(input, scripting::wrappers::cached(user.get()))) {
+        std::cout << "Unknown command or bad arguments: " << input << std::endl;
+      }
+      continue;
+    }
+
     scripting::events::send_message(user.get(), input);
   }
 }
 
-int main() {
+// Example middleware stage counting handler invocations per event. Stages run with the GIL held so no locking is needed.
+std::unordered_map<std::string, std::size_t> audit_counts;
+
+scripting::middleware::StageResult audit_before(scripting::middleware::DispatchContext& context, void*) {
+  ++audit_counts[context.event_name];
+  return scripting::middleware::StageResult::CONTINUE;
+}
+
+// Function to handle audit command
+void toggle_audit() {
+  auto& middleware = scripting::ScriptManager::instance().middleware();
+  if (middleware.remove_stage("audit")) {
+    std::cout << "Audit disabled. Handler invocations:" << std::endl;
+    for (const auto& count : audit_counts) {
+      std::cout << "   " << count.first << ": " << count.second << std::endl;
+    }
+    audit_counts.clear();
+    return;
+  }
+
+  scripting::middleware::Stage stage;
+  stage.name = "audit";
+  stage.before = &audit_before;
+  middleware.add_stage(std::move(stage));
+  std::cout << "Audit enabled." << std::endl;
+}
+
+// Function to handle nested command
+void nested_dispatch(const std::vector<std::string>& words) {
+  const auto queued = words.size() > 1 && words[1] == "queue";
+  scripting::set_nested_dispatch_policy(queued ? scripting::dispatch::NestedDispatchPolicy::QUEUE : scripting::dispatch::NestedDispatchPolicy::INLINE);
+  std::cout << "Nested dispatch policy: " << (queued ? "queue" : "inline") << std::endl;
+  scripting::dispatch_event("on_nested", 0);
+}
+
+// Function to handle record command
+void toggle_journal(const std::vector<std::string>& words) {
+  if (words.size() < 2) {
+    std::cout << "Recorded " << scripting::stop_journal() << " events." << std::endl;
+    return;
+  }
+
+  if (scripting::start_journal(words[1])) {
+    std::cout << "Recording events to " << words[1] << ", run record again to stop." << std::endl;
+  }
+}
+
+// Function to handle replay command
+void replay_journal(const std::vector<std::string>& words) {
+  if (words.size() < 2) {
+    std::cout << "Usage: replay <directory> [speed]" << std::endl;
+    return;
+  }
+
+  const auto speed = words.size() > 2 ? std::stod(words[2]) : 1.0;
+  const auto stats = scripting::replay_journal(words[1], speed);
+  std::cout << "Replayed " << stats.events << " events in " << stats.seconds << " seconds";
+  if (stats.skipped > 0) {
+    std::cout << " (" << stats.skipped << " skipped, module not loaded)";
+  }
+  std::cout << std::endl;
+  std::cout << "Dispatch latency (us): p50 " << stats.p50 << ", p99 " << stats.p99 << ", p99.9 " << stats.p999 << ", max " << stats.max << std::endl;
+}
+
+// Function to handle bridgebench command. Run "bridgebench recv" in one process and "bridgebench send" in another.
+void bridge_bench(const std::vector<std::string>& words) {
+  if (words.size() < 3 || (words[1] != "send" && words[1] != "recv")) {
+    std::cout << "Usage: bridgebench send <count> [events per second] | bridgebench recv <count>" << std::endl;
+    return;
+  }
+
+  auto& bridge = scripting::ScriptManager::instance().event_bridge();
+  if (!bridge.is_open() && !scripting::start_bridge()) {
+    return;
+  }
+
+  const auto count = std::stoull(words[2]);
+  const auto now = []() { return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); };
+
+  if (words[1] == "send") {
+    const auto rate = words.size() > 3 ? std::stod(words[3]) : 0.0;
+    const auto published = bridge.published();
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned long long i = 0; i < count; ++i) {
+      if (rate > 0.0) {
+        std::this_thread::sleep_until(start + std::chrono::nanoseconds(static_cast<long long>(i * 1e9 / rate)));
+      }
+      bridge.publish("bridge_bench", static_cast<long long>(now()), i);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Sent " << bridge.published() - published << " events in " << elapsed.count() << " seconds (" << count / elapsed.count() << " events/s)" << std::endl;
+    return;
+  }
+
+  std::cout << "Waiting for " << count << " events..." << std::endl;
+  std::vector<scripting::ipc::BridgeEvent> events;
+  std::vector<scripting::serialization::EventValue> values;
+  std::vector<double> latencies;
+  latencies.reserve(count);
+
+  // Throughput runs from the first event's send, stamped by the sender on the same steady clock, to the last receipt.
+  const auto overruns = bridge.overruns();
+  auto last_received = std::chrono::steady_clock::now();
+  long long first_sent = 0, last_received_at = 0;
+  while (latencies.size() < count && std::chrono::steady_clock::now() - last_received < std::chrono::seconds(5)) {
+    events.clear();
+    if (bridge.poll(events, 1024) == 0) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    const auto received_at = now();
+    last_received = std::chrono::steady_clock::now();
+    for (const auto& event : events) {
+      const char* data = event.arguments.data();
+      if (scripting::serialization::EventCodec::decode(data, data + event.arguments.size(), values) && !values.empty()) {
+        const auto sent_at = std::get<long long>(values[0]);
+        first_sent = latencies.empty() ? sent_at : std::min(first_sent, sent_at);
+        last_received_at = received_at;
+        latencies.push_back((received_at - sent_at) / 1000.0);
+      }
+    }
+  }
+
+  if (latencies.empty()) {
+    std::cout << "Received no events, " << bridge.overruns() - overruns << " overruns" << std::endl;
+    return;
+  }
+  const auto elapsed = (last_received_at - first_sent) / 1e9;
+  std::cout << "Received " << latencies.size() << " events in " << elapsed << " seconds from the first send (" << latencies.size() / elapsed << " events/s), "
+    << bridge.overruns() - overruns << " overruns" << std::endl;
+
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << "Latency (us): p50 " << latencies[latencies.size() / 2] << ", p99 " << latencies[latencies.size() * 99 / 100] << ", max " << latencies.back() << std::endl;
+}
+
+// Function to handle worker command, hosting script modules in a separate process.
+void start_worker(const std::vector<std::string>& words) {
+  std::vector<std::string> module_paths(words.begin() + 1, words.end());
+  if (module_paths.empty()) {
+    module_paths.push_back("workerscripts/path_search.py");
+  }
+  scripting::spawn_worker(module_paths);
+}
+
+// Function to handle workerbench command. Sends path requests to the worker hosting path_search.py.
+void worker_bench(const std::vector<std::string>& words) {
+  auto& workers = scripting::ScriptManager::instance().worker_pool();
+  if (workers.size() == 0) {
+    std::cout << "Start a worker first with: worker" << std::endl;
+    return;
+  }
+
+  const auto count = words.size() > 1 ? std::stoull(words[1]) : 1000ull;
+  const auto completed = workers.completed();
+  const auto dropped = workers.dropped();
+  const auto start = std::chrono::steady_clock::now();
+  for (unsigned long long i = 0; i < count; ++i) {
+    scripting::dispatch_event("on_path_request", static_cast<long long>(i), 64);
+    scripting::pump_workers();
+  }
+  const std::chrono::duration<double> sent = std::chrono::steady_clock::now() - start;
+
+  // Keep applying what the worker sends back until it has handled every request.
+  while (workers.completed() - completed < count - (workers.dropped() - dropped) && std::chrono::steady_clock::now() - start < std::chrono::seconds(60)) {
+    if (scripting::pump_workers() == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  scripting::pump_workers();
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "Dispatched " << count << " events in " << sent.count() << " seconds on the game thread, workers handled "
+    << workers.completed() - completed << " in " << elapsed.count() << " seconds, " << workers.dropped() - dropped << " dropped" << std::endl;
+}
+
+// Resident and proportional set size of a process in MiB. Shared pages count fully towards the first and are split
+// between the processes sharing them in the second.
+std::pair<double, double> memory_usage(const std::uint32_t process_id) {
+  double rss = 0.0, pss = 0.0;
+#ifndef _WIN32
+  std::ifstream smaps("/proc/" + std::to_string(process_id) + "/smaps_rollup");
+  std::string line, key;
+  double kilobytes = 0.0;
+  while (std::getline(smaps, line)) {
+    std::istringstream fields(line);
+    if (!(fields >> key >> kilobytes)) {
+      continue;
+    }
+    if (key == "Rss:") {
+      rss = kilobytes / 1024.0;
+    }
+    else if (key == "Pss:") {
+      pss = kilobytes / 1024.0;
+    }
+  }
+#endif
+  return { rss, pss };
+}
+
+// Function to handle forkbench command. Compares starting a worker cold against forking it from a fork server.
+void fork_bench(const std::vector<std::string>& words) {
+  auto& workers = scripting::ScriptManager::instance().worker_pool();
+  if (workers.size() > 0) {
+    std::cout << "forkbench starts its own workers, restart the program to run it after worker" << std::endl;
+    return;
+  }
+
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 4ul;
+  std::vector<std::string> module_paths = { "workerscripts/path_search.py" };
+  for (std::size_t i = 2; i < words.size(); ++i) {
+    if (!std::filesystem::is_directory(words[i])) {
+      module_paths.push_back(words[i]);
+      continue;
+    }
+    for (const auto& entry : std::filesystem::directory_iterator(words[i])) {
+      if (entry.path().extension() == ".py") {
+        module_paths.push_back(entry.path().string());
+      }
+    }
+  }
+
+  using milliseconds = std::chrono::duration<double, std::milli>;
+  const auto first_event = [&]() {
+    const auto completed = workers.completed();
+    const auto start = std::chrono::steady_clock::now();
+    scripting::dispatch_event("on_path_request", 1ll, 8);
+    while (workers.completed() == completed && std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+      scripting::pump_workers();
+    }
+    return milliseconds(std::chrono::steady_clock::now() - start).count();
+  };
+  // Prints each worker's memory and returns the mean per worker.
+  const auto print_memory = [&]() {
+    const auto process_ids = workers.process_ids();
+    std::pair<double, double> total;
+    for (const auto process_id : process_ids) {
+      const auto usage = memory_usage(process_id);
+      std::cout << "  worker " << process_id << ": Rss " << usage.first << " MiB, Pss " << usage.second << " MiB" << std::endl;
+      total.first += usage.first;
+      total.second += usage.second;
+    }
+    const auto workers_measured = static_cast<double>(std::max<std::size_t>(process_ids.size(), 1));
+    return std::make_pair(total.first / workers_measured, total.second / workers_measured);
+  };
+
+  std::cout << "Hosting " << module_paths.size() << " modules per worker" << std::endl;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < count; ++i) {
+    if (!scripting::spawn_worker(module_paths)) {
+      return;
+    }
+  }
+  auto ready = milliseconds(std::chrono::steady_clock::now() - start).count();
+  auto handled = first_event();
+  std::cout << "Cold start: " << count << " workers ready after " << ready << " ms (" << ready / count << " ms each), first event handled "
+    << handled << " ms later" << std::endl;
+  const auto cold = print_memory();
+  workers.stop();
+
+  start = std::chrono::steady_clock::now();
+  if (!scripting::start_fork_server(module_paths)) {
+    return;
+  }
+  std::cout << "Fork server ready after " << milliseconds(std::chrono::steady_clock::now() - start).count() << " ms" << std::endl;
+
+  start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < count; ++i) {
+    if (!scripting::fork_worker()) {
+      return;
+    }
+  }
+  ready = milliseconds(std::chrono::steady_clock::now() - start).count();
+  handled = first_event();
+  std::cout << "Forked: " << count << " workers ready after " << ready << " ms (" << ready / count << " ms each), first event handled "
+    << handled << " ms later" << std::endl;
+  const auto forked = print_memory();
+  workers.stop();
+
+  // Pss is what each worker adds once shared pages are split between the processes sharing them.
+  std::cout << "Per worker, forked against cold: Rss " << forked.first << " against " << cold.first << " MiB, Pss " << forked.second
+    << " against " << cold.second << " MiB" << std::endl;
+}
+
+// Function to handle gilstats command. Prints GIL wait and hold times per thread, or controls the switch interval controller.
+void gil_stats(const std::vector<std::string>& words) {
+  if (words.size() > 1 && words[1] == "reset") {
+    scripting::ScriptManager::instance().reset_gil_stats();
+    std::cout << "GIL statistics reset" << std::endl;
+    return;
+  }
+  if (words.size() > 1 && words[1] == "auto") {
+    scripting::gil::SwitchIntervalSettings settings;
+    if (words.size() > 2) {
+      settings.tick_budget = std::chrono::microseconds(static_cast<long long>(std::stod(words[2]) * 1000));
+    }
+    scripting::start_gil_controller(settings);
+    return;
+  }
+  if (words.size() > 1 && words[1] == "off") {
+    scripting::stop_gil_controller();
+    std::cout << "Switch interval controller stopped" << std::endl;
+    return;
+  }
+
+  const auto micro = [](const std::uint64_t nanoseconds) { return nanoseconds / 1000.0; };
+  const auto print = [&](const std::string& name, const scripting::gil::GilThreadStats& stats) {
+    std::cout << "  " << name << ": " << stats.wait.count() << " acquisitions, wait p50 " << micro(stats.wait.percentile(0.5))
+      << " us p99 " << micro(stats.wait.percentile(0.99)) << " us max " << micro(stats.wait.percentile(1.0))
+      << " us, hold p50 " << micro(stats.hold.percentile(0.5)) << " us p99 " << micro(stats.hold.percentile(0.99))
+      << " us, waited " << stats.wait.total() / 1e6 << " ms held " << stats.hold.total() / 1e6 << " ms" << std::endl;
+  };
+
+  scripting::gil::GilThreadStats total;
+  for (const auto& thread : scripting::gil_stats()) {
+    print(thread.thread_id ? "thread " + std::to_string(thread.thread_id) : std::string("exited threads"), thread);
+    total.wait.merge(thread.wait);
+    total.hold.merge(thread.hold);
+  }
+  print("total", total);
+
+  const auto& controller = scripting::ScriptManager::instance().gil_controller();
+  if (controller.running()) {
+    std::cout << "Switch interval " << controller.interval() * 1000 << " ms after " << controller.adjustments()
+      << " adjustments, last window wait p99 " << micro(controller.window_wait()) << " us" << std::endl;
+  }
+}
+
+// Function to handle jobs command. Scripts submit path searches to the native job pool, which are handed back as events.
+void job_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 1000ul;
+  const auto size = words.size() > 2 ? std::stoi(words[2]) : 64;
+
+  using milliseconds = std::chrono::duration<double, std::milli>;
+  const auto start = std::chrono::steady_clock::now();
+  scripting::dispatch_event("on_sort_demo", 1000000);
+  scripting::dispatch_event("on_job_demo", static_cast<long long>(count), size);
+  const auto submitted = milliseconds(std::chrono::steady_clock::now() - start).count();
+
+  // The game loop: hand back whatever has finished once per tick.
+  std::size_t handed_back = 0;
+  while (handed_back < count + 1 && std::chrono::steady_clock::now() - start < std::chrono::seconds(30)) {
+    const auto pumped = scripting::pump_jobs();
+    if (pumped == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    handed_back += pumped;
+  }
+  const auto finished = milliseconds(std::chrono::steady_clock::now() - start).count();
+  scripting::dispatch_event("on_sort_check");
+
+  const auto& pool = scripting::ScriptManager::instance().script_jobs().pool();
+  std::cout << "Submitted " << count + 1 << " jobs in " << submitted << " ms, " << handed_back << " handed back after " << finished
+    << " ms on " << pool.size() << " threads, " << pool.stolen() << " stolen" << std::endl;
+}
+
+// Function to handle handlebench command
+void handle_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 1000000ul;
+
+  std::vector<std::unique_ptr<User>> users(1000);
+  std::vector<scripting::handles::EntityHandle> handles;
+  for (auto& user : users) {
+    user = std::make_unique<User>();
+    handles.push_back(user->handle());
+  }
+
+  using nanoseconds = std::chrono::duration<double, std::nano>;
+  const auto time = [count](const char* name, const auto& pass) {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+      pass(i % 1000);
+    }
+    std::cout << "  " << name << ": " << nanoseconds(std::chrono::steady_clock::now() - start).count() / count << " ns" << std::endl;
+  };
+
+  std::size_t resolved = 0;
+  std::cout << "Per user, over " << count << " passes:" << std::endl;
+  time("resolve in C++", [&](const std::size_t i) { resolved += User::handles().resolve(handles[i]) != nullptr; });
+  {
+    scripting::gil::GilAcquire acquire;
+    const auto pass = py::eval("lambda value: value");
+    const auto resolve = py::module::import("example_module").attr("resolve");
+    time("pass an int", [&](const std::size_t i) { pass(handles[i].value); });
+    time("pass a handle", [&](const std::size_t i) { pass(handles[i]); });
+    time("pass a cached wrapper", [&](const std::size_t i) { pass(scripting::wrappers::cached(users[i].get())); });
+    time("pass a pointer", [&](const std::size_t i) { pass(py::cast(users[i].get(), py::return_value_policy::reference)); });
+    time("resolve in python", [&](const std::size_t i) { resolved += !resolve(handles[i]).is_none(); });
+
+    // Handles to users that are gone resolve to None, even once their slots are reused.
+    const auto stale = handles.front();
+    users.front().reset();
+    users.front() = std::make_unique<User>();
+    std::cout << "Stale handle resolves to " << py::str(resolve(stale)).cast<std::string>() << ", valid() " << py::str(py::cast(stale).attr("valid")()).cast<std::string>()
+      << ", slot reused by " << py::str(py::cast(users.front()->handle())).cast<std::string>() << std::endl;
+
+    // A user created by a script is owned by its wrapper, so passing it back must not cache the wrapper on the user.
+    auto created = py::module::import("example_module").attr("User")();
+    const auto created_handle = created.cast<User*>()->handle();
+    pass(scripting::wrappers::cached(created.cast<User*>()));
+    resolve(created_handle);
+    const auto cached = created.cast<User*>()->has_python_wrapper();
+    created = py::none();
+    const auto freed = User::handles().resolve(created_handle) == nullptr;
+    std::cout << "Script created user: wrapper cached " << cached << ", freed with its wrapper " << freed
+      << (!cached && freed ? " (passed)" : " (FAILED)") << std::endl;
+  }
+  std::cout << resolved << " resolved, " << User::handles().size() << " live handles" << std::endl;
+}
+
+// Function to handle argpool command
+void argument_pool_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 100000ul;
+
+  static scripting::dispatch::PayloadShape trade({ "item_id", "count", "price", "tax", "seller", "buyer", "slot", "bound" });
+  const auto user = std::make_unique<User>();
+  const auto payload = [](const std::size_t i) {
+    return trade.with(static_cast<std::uint32_t>(i % 500), 3, 1500 + static_cast<int>(i % 7), 45, "Grimlock", "Seraphine", static_cast<int>(i % 50), false);
+  };
+  const auto send = [&](const std::size_t i) {
+    scripting::send_event_to_single_module("pool_example", "on_trade", scripting::wrappers::cached(user.get()), payload(i));
+  };
+  const auto seen = [&](const std::size_t i) {
+    scripting::send_event_to_single_module("pool_example", "on_trade_seen", scripting::wrappers::cached(user.get()), payload(i));
+  };
+  const auto dispatch = [&](const std::size_t i) {
+    scripting::dispatch_event("on_trade", scripting::wrappers::cached(user.get()), payload(i));
+  };
+
+  // Every dispatch logs at info level, which would be timed instead of the dispatches.
+  const auto logger = scripting::get_logger();
+  logger->set_logger(scripting::LOG_INFO, [](const std::string&) {});
+
+  using nanoseconds = std::chrono::duration<double, std::nano>;
+  auto& pool = scripting::ScriptManager::instance().argument_pool();
+  auto& counter = scripting::dispatch::AllocationCounter::instance();
+  const auto time = [&](const char* name, const std::size_t events, const auto& pass) {
+    {
+      scripting::gil::GilAcquire acquire;
+      counter.reset();
+      counter.start();
+    }
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < events; ++i) {
+      pass(i);
+    }
+    const auto elapsed = nanoseconds(std::chrono::steady_clock::now() - start).count();
+    {
+      scripting::gil::GilAcquire acquire;
+      counter.stop();
+    }
+    std::cout << "  " << name << ": " << elapsed / events << " ns, " << static_cast<double>(counter.allocations()) / events << " python allocations" << std::endl;
+  };
+  for (const auto pooled : { false, true }) {
+    {
+      scripting::gil::GilAcquire acquire;
+      pool.set_enabled(pooled);
+    }
+    std::cout << (pooled ? "Pooled" : "Not pooled") << ", per event:" << std::endl;
+    time("to one module", count, send);
+    time("to one module, empty handler", count, seen);
+    time("to every module", count / 10, dispatch);
+  }
+  std::cout << "Tuples: " << pool.allocated() << " allocated, " << pool.reused() << " reused, " << pool.retained() << " kept by scripts" << std::endl;
+
+  // A script that keeps its payload keeps it intact, the pool makes a new one.
+  scripting::send_event_to_single_module("pool_example", "on_keep_trade", scripting::wrappers::cached(user.get()), payload(1));
+  send(2);
+  std::cout << "Payloads: " << trade.allocated() << " allocated, " << trade.reused() << " reused, " << trade.retained() << " kept by scripts" << std::endl;
+
+  logger->set_logger(scripting::LOG_INFO, &scripting::log_debug);
+  scripting::dispatch_event("on_check_trades");
+}
+
+// Items for the lazy command, with more fields than most handlers read.
+struct DemoStats {
+  std::int32_t strength, stamina, dexterity, intelligence;
+  float attack_speed, critical_rate;
+};
+
+struct DemoItem {
+  std::uint32_t id;
+  std::string name;
+  std::string description;
+  std::int32_t level, refine, element;
+  float durability;
+  std::uint32_t owner_id;
+  std::int64_t price;
+  bool bound;
+  DemoStats stats;
+};
+
+namespace scripting {
+  namespace wrappers {
+    template <>
+    struct LazyFields<DemoStats> {
+      static constexpr const char* name = "Stats";
+      static constexpr LazyField fields[] = {
+        lazy_field<&DemoStats::strength>("strength"), lazy_field<&DemoStats::stamina>("stamina"),
+        lazy_field<&DemoStats::dexterity>("dexterity"), lazy_field<&DemoStats::intelligence>("intelligence"),
+        lazy_field<&DemoStats::attack_speed>("attack_speed"), lazy_field<&DemoStats::critical_rate>("critical_rate")
+      };
+    };
+
+    template <>
+    struct LazyFields<DemoItem> {
+      static constexpr const char* name = "Item";
+      static constexpr LazyField fields[] = {
+        lazy_field<&DemoItem::id>("id"), lazy_field<&DemoItem::name>("name"), lazy_field<&DemoItem::description>("description"),
+        lazy_field<&DemoItem::level>("level"), lazy_field<&DemoItem::refine>("refine"), lazy_field<&DemoItem::element>("element"),
+        lazy_field<&DemoItem::durability>("durability"), lazy_field<&DemoItem::owner_id>("owner_id"), lazy_field<&DemoItem::price>("price"),
+        lazy_field<&DemoItem::bound>("bound"), lazy_field<&DemoItem::stats>("stats")
+      };
+    };
+  }
+}
+
+// Function to handle lazy command
+void lazy_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 100000ul;
+
+  std::vector<DemoItem> items(1000);
+  for (std::size_t i = 0; i < items.size(); ++i) {
+    items[i] = { static_cast<std::uint32_t>(i), "Bloody Sword", "A sword forged in the Clockworks", 60, 7, 2, 0.9f, 1234, 250000, true, { 12, 8, 5, 3, 1.2f, 0.05f } };
+  }
+
+  // A handler that keeps its item past the event reads a released proxy.
+  scripting::dispatch_event("on_item_used", scripting::wrappers::lazy(&items[1]));
+  scripting::dispatch_event("on_check_item");
+
+  using nanoseconds = std::chrono::duration<double, std::nano>;
+  scripting::gil::GilAcquire acquire;
+  // Bound the usual way, once per run of the program and kept until exit.
+  static py::handle item_type;
+  if (!item_type) {
+    auto module = py::reinterpret_steal<py::module>(PyModule_New("lazy_bench"));
+    py::class_<DemoStats>(module, "Stats")
+      .def_readonly("strength", &DemoStats::strength).def_readonly("stamina", &DemoStats::stamina)
+      .def_readonly("dexterity", &DemoStats::dexterity).def_readonly("intelligence", &DemoStats::intelligence)
+      .def_readonly("attack_speed", &DemoStats::attack_speed).def_readonly("critical_rate", &DemoStats::critical_rate);
+    py::class_<DemoItem> item(module, "Item");
+    item.def_readonly("id", &DemoItem::id).def_readonly("name", &DemoItem::name).def_readonly("description", &DemoItem::description)
+      .def_readonly("level", &DemoItem::level).def_readonly("refine", &DemoItem::refine).def_readonly("element", &DemoItem::element)
+      .def_readonly("durability", &DemoItem::durability).def_readonly("owner_id", &DemoItem::owner_id).def_readonly("price", &DemoItem::price)
+      .def_readonly("bound", &DemoItem::bound).def_readonly("stats", &DemoItem::stats);
+    item_type = item.release();
+  }
+  const auto namespace_type = py::module::import("types").attr("SimpleNamespace");
+  const auto eager = [&namespace_type](const DemoItem& item) {
+    const auto& stats = item.stats;
+    return namespace_type(py::arg("id") = item.id, py::arg("name") = item.name, py::arg("description") = item.description,
+      py::arg("level") = item.level, py::arg("refine") = item.refine, py::arg("element") = item.element, py::arg("durability") = item.durability,
+      py::arg("owner_id") = item.owner_id, py::arg("price") = item.price, py::arg("bound") = item.bound,
+      py::arg("stats") = namespace_type(py::arg("strength") = stats.strength, py::arg("stamina") = stats.stamina,
+        py::arg("dexterity") = stats.dexterity, py::arg("intelligence") = stats.intelligence,
+        py::arg("attack_speed") = stats.attack_speed, py::arg("critical_rate") = stats.critical_rate));
+  };
+
+  const auto handler = py::module::import("lazy_example").attr("on_item_checked");
+  long long total = 0;
+  const auto time = [&](const char* name, const auto& pass) {
+    total = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+      total += pass(items[i % items.size()]).template cast<long long>();
+    }
+    std::cout << "  " << name << ": " << nanoseconds(std::chrono::steady_clock::now() - start).count() / count << " ns (" << total << ")" << std::endl;
+  };
+  std::cout << "Per event, over " << count << " events:" << std::endl;
+  time("convert every field", [&](const DemoItem& item) { return handler(eager(item)); });
+  time("bound wrapper", [&](const DemoItem& item) { return handler(py::cast(&item, py::return_value_policy::reference)); });
+  time("lazy proxy", [&](const DemoItem& item) {
+    // Taken by the script manager around every dispatch; releases the proxy when the call returns.
+    scripting::wrappers::ProxyLease lease;
+    return handler(scripting::wrappers::lazy(&item));
+  });
+}
+
+// Item definitions for the tables command, laid out like the game's item properties.
+struct DemoItemProp {
+  std::uint32_t id;
+  char name[32];
+  std::int32_t level, job, attack_min, attack_max;
+  std::int64_t price;
+  DemoStats bonus;
+};
+
+namespace scripting {
+  namespace wrappers {
+    template <>
+    struct LazyFields<DemoItemProp> {
+      static constexpr const char* name = "ItemProp";
+      static constexpr LazyField fields[] = {
+        lazy_field<&DemoItemProp::id>("id"), lazy_field<&DemoItemProp::name>("name"), lazy_field<&DemoItemProp::level>("level"),
+        lazy_field<&DemoItemProp::job>("job"), lazy_field<&DemoItemProp::attack_min>("attack_min"),
+        lazy_field<&DemoItemProp::attack_max>("attack_max"), lazy_field<&DemoItemProp::price>("price"),
+        lazy_field<&DemoItemProp::bonus>("bonus")
+      };
+    };
+  }
+}
+
+// Function to handle tables command
+void data_table_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 1000000ul;
+
+  static const char* names[] = { "Bloody Sword", "Flyff Stick", "Pearl Wand", "Tiger Axe", "Angel Bow", "Lusaka's Crystal Sword" };
+  std::vector<DemoItemProp> rows(5000);
+  for (std::size_t i = 0; i < rows.size(); ++i) {
+    auto& row = rows[rows.size() - 1 - i];
+    row = { static_cast<std::uint32_t>(i * 3 + 1), {}, static_cast<std::int32_t>(1 + i % 120), static_cast<std::int32_t>(i % 16),
+      static_cast<std::int32_t>(10 + i % 90), static_cast<std::int32_t>(20 + i % 180), static_cast<std::int64_t>(100 + i * 37),
+      { static_cast<std::int32_t>(i % 12), 0, static_cast<std::int32_t>(i % 7), 0, 0.0f, 0.0f } };
+    std::snprintf(row.name, sizeof(row.name), "%s", names[i % std::size(names)]);
+  }
+  const auto table = std::make_shared<scripting::data::DataTable<DemoItemProp>>("items", std::move(rows), &DemoItemProp::id);
+  scripting::publish_table(table);
+  std::cout << "Native table: " << table->size() << " rows, " << table->size() * sizeof(DemoItemProp) << " bytes of rows" << std::endl;
+
+  scripting::dispatch_event("on_item_looted", 7, 301);
+  scripting::dispatch_event("on_item_looted", 7, 302);
+
+  using nanoseconds = std::chrono::duration<double, std::nano>;
+  auto& counter = scripting::dispatch::AllocationCounter::instance();
+  {
+    scripting::gil::GilAcquire acquire;
+    const auto module = py::module::import("data_example");
+    const auto published = scripting::ScriptManager::instance().data_tables().get("items");
+
+    py::list ids(count);
+    for (std::size_t i = 0; i < count; ++i) {
+      PyList_SET_ITEM(ids.ptr(), static_cast<Py_ssize_t>(i), PyLong_FromUnsignedLong(table->key((i * 7919) % table->size())));
+    }
+
+    const auto time = [&](const char* name, const char* function, const py::object& source) {
+      counter.reset();
+      counter.start();
+      const auto start = std::chrono::steady_clock::now();
+      const auto total = module.attr(function)(source, ids).cast<long long>();
+      const auto elapsed = nanoseconds(std::chrono::steady_clock::now() - start).count();
+      counter.stop();
+      std::cout << "  " << name << ": " << elapsed / count << " ns, " << static_cast<double>(counter.allocations()) / count
+        << " python allocations (" << total << ")" << std::endl;
+    };
+    std::cout << "Per lookup and field read, over " << count << " lookups:" << std::endl;
+    // The first pass makes a view for each row it looks up, later ones reuse them.
+    time("native table, first pass", "highest_level", published);
+    time("native table", "highest_level", published);
+    // Prices are too large for python's shared small ints; rows keep the objects they converted.
+    time("native table, price", "highest_price", published);
+
+    const auto blocks = py::module::import("sys").attr("getallocatedblocks");
+    const auto before = blocks().cast<long long>();
+    const auto copy = module.attr("copy_table")(published);
+    time("dict of dicts", "highest_level_dict", copy);
+    time("dict of dicts, price", "highest_price_dict", copy);
+    std::cout << "The dict of dicts copy: " << blocks().cast<long long>() - before << " python objects, about "
+      << module.attr("copy_size")(copy).cast<long long>() << " bytes, in every module that loads it" << std::endl;
+  }
+
+  const auto identity = [] {
+    scripting::gil::GilAcquire acquire;
+    return py::module::import("data_example").attr("table_identity")().cast<long long>();
+  };
+  const auto before = identity();
+  scripting::reload_script("data_example");
+  std::cout << "Same table after reloading the script: " << (identity() == before ? "yes" : "no") << std::endl;
+}
+
+// Function to handle batch command
+void batch_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 5000ul;
+
+  std::vector<std::unique_ptr<User>> users(count);
+  std::vector<scripting::wrappers::Cached<User>> entities;
+  for (auto& user : users) {
+    user = std::make_unique<User>();
+    entities.push_back(scripting::wrappers::cached(user.get()));
+  }
+  const std::vector<double> elapsed(count, 0.05);
+
+  // Every dispatch logs at info level, which would be timed instead of the dispatches.
+  const auto logger = scripting::get_logger();
+  logger->set_logger(scripting::LOG_INFO, [](const std::string&) {});
+
+  using microseconds = std::chrono::duration<double, std::micro>;
+  const auto time = [count](const char* name, const auto& dispatch) {
+    const auto start = std::chrono::steady_clock::now();
+    dispatch();
+    std::cout << "  " << name << ": " << microseconds(std::chrono::steady_clock::now() - start).count() << " us" << std::endl;
+  };
+  std::cout << "One tick for " << count << " users:" << std::endl;
+  time("dispatch_event per user", [&]() {
+    for (std::size_t i = 0; i < count; ++i) {
+      scripting::dispatch_event("on_user_tick", entities[i], elapsed[i]);
+    }
+  });
+  time("dispatch_batch, per user handler", [&]() { scripting::dispatch_batch("on_user_tick", entities, elapsed); });
+  time("dispatch_batch, batch handler", [&]() { scripting::dispatch_batch("on_user_batch_tick", entities, elapsed); });
+
+  // Columns must have one value per user.
+  scripting::dispatch_batch("on_user_batch_tick", entities, std::vector<double>(count / 2, 0.05));
+
+  logger->set_logger(scripting::LOG_INFO, &scripting::log_debug);
+  scripting::dispatch_event("on_check_ticks");
+}
+
+// Entities for the snapshot command.
+struct DemoMover {
+  std::uint32_t id;
+  float x, y, z;
+  std::uint32_t hp;
+  std::uint32_t contribution;
+};
+
+// Function to handle snapshot command
+void snapshot_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 10000ul;
+
+  std::mt19937 generator(7);
+  std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+  std::uniform_int_distribution<std::uint32_t> hp(1, 2000);
+  std::vector<DemoMover> movers(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    movers[i] = { static_cast<std::uint32_t>(i + 1), position(generator), 0.0f, position(generator), hp(generator), hp(generator) % 50 };
+  }
+
+  using microseconds = std::chrono::duration<double, std::micro>;
+  auto start = std::chrono::steady_clock::now();
+  auto snapshot = std::make_shared<scripting::buffers::EntitySnapshot>();
+  snapshot->add<std::uint32_t>("id", movers, &DemoMover::id)
+    .add<float>("x", movers, &DemoMover::x)
+    .add<float>("z", movers, &DemoMover::z)
+    .add<std::uint32_t>("hp", movers, &DemoMover::hp)
+    .add<std::uint32_t>("contribution", movers, &DemoMover::contribution);
+  std::cout << "Built a snapshot of " << count << " movers in " << microseconds(std::chrono::steady_clock::now() - start).count() << " us" << std::endl;
+
+  scripting::dispatch_event("on_mover_snapshot", snapshot);
+
+  scripting::gil::GilAcquire acquire;
+  // Bound the usual way, once per run of the program and kept until exit.
+  static py::handle mover_type;
+  if (!mover_type) {
+    auto module = py::reinterpret_steal<py::module>(PyModule_New("snapshot_bench"));
+    py::class_<DemoMover> mover(module, "Mover");
+    mover.def_readonly("id", &DemoMover::id);
+    mover.def_readonly("hp", &DemoMover::hp);
+    mover.def_readonly("contribution", &DemoMover::contribution);
+    mover_type = mover.release();
+  }
+  py::list objects;
+  for (auto& mover : movers) {
+    objects.append(py::cast(&mover, py::return_value_policy::reference));
+  }
+
+  const auto script = py::module::import("snapshot_example");
+  const auto time = [](const char* name, const py::object& function, const auto&... args) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto result = function(args...);
+    const auto elapsed = microseconds(std::chrono::steady_clock::now() - start).count();
+    const auto size = py::isinstance<py::list>(result) ? py::len(result) : result.template cast<std::size_t>();
+    std::cout << "  " << name << ": " << elapsed << " us (" << size << ")" << std::endl;
+  };
+  std::cout << "Over " << count << " movers:" << std::endl;
+  time("below 100 hp, bound objects", script.attr("low_hp_objects"), objects, 100);
+  time("below 100 hp, snapshot", script.attr("low_hp_snapshot"), snapshot, 100);
+  time("guild contribution, bound objects", script.attr("guild_total_objects"), objects);
+  time("guild contribution, snapshot", script.attr("guild_total_snapshot"), snapshot);
+}
+
+// Function to handle packets command
+void packet_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 10000ul;
+  const auto size = words.size() > 2 ? std::stoul(words[2]) : 65536ul;
+
+  scripting::buffers::PacketBufferPool pool(std::max(size, 16ul));
+  const auto fill = [size](scripting::buffers::PacketBuffer& buffer, const std::uint16_t opcode) {
+    buffer.resize(size);
+    std::memset(buffer.data(), 7, buffer.size());
+    std::memcpy(buffer.data(), &opcode, sizeof(opcode));
+    const auto length = static_cast<std::uint32_t>(buffer.size() - 6);
+    std::memcpy(buffer.data() + 2, &length, sizeof(length));
+  };
+
+  // Outgoing: the script writes the header in to the game's buffer.
+  auto outgoing = pool.acquire();
+  outgoing->resize(64);
+  scripting::dispatch_event("on_build_packet", scripting::buffers::view(outgoing, true));
+  std::uint16_t opcode;
+  std::memcpy(&opcode, outgoing->data(), sizeof(opcode));
+  std::cout << "Script built a packet with opcode " << opcode << " and body " << std::string(reinterpret_cast<const char*>(outgoing->data() + 6), 4) << std::endl;
+  pool.recycle(std::move(outgoing));
+
+  // A script that keeps a packet past its event: the view is revoked when the buffer is recycled.
+  auto kept = pool.acquire();
+  fill(*kept, 0x0042);
+  scripting::dispatch_event("on_keep_packet", scripting::buffers::view(kept));
+  pool.recycle(std::move(kept));
+  scripting::dispatch_event("on_check_kept");
+  std::cout << pool.orphaned() << " buffers recycled while a script held a slice of them" << std::endl;
+
+  // The same buffer lent read only and writable: scripts can only write through the writable view.
+  auto shared = pool.acquire();
+  fill(*shared, 0x0043);
+  scripting::dispatch_event("on_check_modes", scripting::buffers::view(shared), scripting::buffers::view(shared, true));
+  pool.recycle(std::move(shared));
+
+  using nanoseconds = std::chrono::duration<double, std::nano>;
+  scripting::gil::GilAcquire acquire;
+  const auto handler = py::module::import("packet_example").attr("on_packet");
+  const auto time = [&](const char* name, const auto& pass) {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+      auto buffer = pool.acquire();
+      fill(*buffer, static_cast<std::uint16_t>(i));
+      pass(buffer);
+      pool.recycle(std::move(buffer));
+    }
+    std::cout << "  " << name << ": " << nanoseconds(std::chrono::steady_clock::now() - start).count() / count << " ns" << std::endl;
+  };
+  std::cout << "Per " << size << " byte packet, over " << count << " packets:" << std::endl;
+  time("fill and recycle only", [](const std::unique_ptr<scripting::buffers::PacketBuffer>&) {});
+  time("copy to bytes", [&handler](const std::unique_ptr<scripting::buffers::PacketBuffer>& buffer) {
+    handler(py::bytes(reinterpret_cast<const char*>(buffer->data()), buffer->size()));
+  });
+  time("memoryview", [&handler](const std::unique_ptr<scripting::buffers::PacketBuffer>& buffer) {
+    handler(scripting::buffers::view(buffer));
+  });
+}
+
+// Function to handle stringbench command
+void string_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 1000000ul;
+
+  // Chat heavy traffic: a few verbs and item names repeated, and chat lines, some of them not ASCII.
+  const std::vector<std::string> names = { "trade", "party", "Bloody Sword", "Vigor Potion", "on_message", "attack" };
+  const std::vector<std::string> lines = { "Has anyone seen the Clockworks raid leader today?", "Wir suchen noch einen Heiler f\xc3\xbcr die Gruppe" };
+
+  using nanoseconds = std::chrono::duration<double, std::nano>;
+  const auto time = [count](const char* name, const std::vector<std::string>& texts, const auto& convert) {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; ++i) {
+      convert(std::string_view(texts[i % texts.size()]));
+    }
+    std::cout << "  " << name << ": " << nanoseconds(std::chrono::steady_clock::now() - start).count() / count << " ns" << std::endl;
+  };
+  const auto copy = [](const std::string_view text) { py::cast(std::string(text)); };
+  const auto fast = [](const std::string_view text) { scripting::strings::new_string(text); };
+
+  scripting::gil::GilAcquire acquire;
+  auto& table = scripting::strings::StringTable::instance();
+  const auto intern = [&table](const std::string_view text) { table.get(text); };
+  const auto hits = table.hits();
+  const auto misses = table.misses();
+  std::cout << "Per string, over " << count << " conversions:" << std::endl;
+  time("names, decode a copy", names, copy);
+  time("names, ASCII fast path", names, fast);
+  time("names, string table", names, intern);
+  time("chat lines, decode a copy", lines, copy);
+  time("chat lines, ASCII fast path", lines, fast);
+  time("chat lines, string table", lines, intern);
+  std::cout << table.hits() - hits << " hits, " << table.misses() - misses << " misses, " << table.size() << " strings held, "
+    << table.evictions() << " evictions" << std::endl;
+}
+
+// Bound both ways by the attrbench command.
+struct Sample {
+  unsigned long id = 42;
+  double x = 1.5;
+};
+
+// Function to handle attrbench command
+void attribute_bench(const std::vector<std::string>& words) {
+  const auto count = words.size() > 1 ? std::stoul(words[1]) : 1000000ul;
+
+  scripting::gil::GilAcquire acquire;
+  // The same fields bound both ways on a class of their own, once per run of the program and kept until exit.
+  static py::handle sample_type;
+  if (!sample_type) {
+    const auto module = py::module::import("types").attr("ModuleType")("attrbench");
+    py::class_<Sample> sample(module, "Sample");
+    sample.def(py::init<>());
+    sample.def_readonly("id_property", &Sample::id);
+    sample.def_readonly("x_property", &Sample::x);
+    scripting::wrappers::def_fast_readonly<&Sample::id>(sample, "id");
+    scripting::wrappers::def_fast_readonly<&Sample::x>(sample, "x");
+    sample_type = sample.release();
+  }
+
+  py::dict scope;
+  scope["sample"] = sample_type();
+  scope["count"] = count;
+  py::exec(R"(
+import time
+def read(name):
+    read = compile(f"for _ in range(count): sample.{name}", name, "exec")
+    start = time.perf_counter()
+    exec(read, {"sample": sample, "count": count})
+    return (time.perf_counter() - start) / count * 1e9
+loop = read("__class__")
+results = [(name, read(name) - loop) for name in ("id_property", "id", "x_property", "x")]
+)", scope);
+
+  std::cout << count << " reads per attribute, less the loop:" << std::endl;
+  for (const auto& result : scope["results"]) {
+    const auto [name, nanoseconds] = result.cast<std::pair<std::string, double>>();
+    std::cout << "  sample." << name << ": " << nanoseconds << " ns" << std::endl;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  // Started by the worker pool to host script modules: --worker <channel> <ring capacity> <module paths...>
+  if (argc >= 4 && std::string(argv[1]) == scripting::ipc::WorkerPool::kWorkerSwitch) {
+    return scripting::ipc::run_worker(argv[2], static_cast<std::uint32_t>(std::stoul(argv[3])), std::vector<std::string>(argv + 4, argv + argc));
+  }
+#ifndef _WIN32
+  if (argc >= 4 && std::string(argv[1]) == scripting::ipc::WorkerPool::kForkServerSwitch) {
+    return scripting::ipc::run_fork_server(argv[2], static_cast<std::uint32_t>(std::stoul(argv[3])), std::vector<std::string>(argv + 4, argv + argc));
+  }
+#endif
+
   py::scoped_interpreter guard{};
   py::gil_scoped_release release;
 
@@ -137,9 +1210,51 @@ int main() {
   while (true) {
     std::cout << "loadtest : Run a loadtest of the script manager (-mt: multithreaded execution)" << std::endl;
     std::cout << "   -mt: multi-threaded execution." << std::endl;
+    std::cout << "   -exec [cpu list] [-fifo priority] [-nice value]: compare executor threads left to the scheduler against pinned ones." << std::endl;
+    std::cout << "   -calls [count]: compare script to C++ callbacks registered with module.def against def_fastcall." << std::endl;
     std::cout << std::endl;
     std::cout << "example: Run an example ping/ping script" << std::endl;
     std::cout << std::endl;
+    std::cout << "formulatest: Check native formulas against their python versions" << std::endl;
+    std::cout << std::endl;
+    std::cout << "audit: Toggle a middleware stage counting handler invocations" << std::endl;
+    std::cout << std::endl;
+    std::cout << "nested [inline|queue]: Dispatch an event that dispatches more events from its handler" << std::endl;
+    std::cout << std::endl;
+    std::cout << "record <directory>: Record dispatched events to a journal, run without a directory to stop" << std::endl;
+    std::cout << std::endl;
+    std::cout << "replay <directory> [speed]: Replay a journal at a multiple of its recorded pace (0: as fast as possible)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "bridgebench send|recv <count> [rate]: Measure the cross-process event bridge between two local processes" << std::endl;
+    std::cout << std::endl;
+    std::cout << "worker [module paths]: Host script modules in a worker process (default: workerscripts/path_search.py)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "workerbench [count]: Send path requests to the worker and wait for its results" << std::endl;
+    std::cout << std::endl;
+    std::cout << "forkbench [count] [module paths or directories]: Compare starting workers cold against forking them from a fork server" << std::endl;
+    std::cout << std::endl;
+    std::cout << "jobs [count] [size]: Have scripts submit path searches to the native job pool and wait for them to be handed back" << std::endl;
+    std::cout << std::endl;
+    std::cout << "gilstats [reset|auto [tick ms]|off]: Show GIL wait and hold times per thread, or tune the switch interval to the tick budget" << std::endl;
+    std::cout << std::endl;
+    std::cout << "handlebench [count]: Compare passing users to python as handles, ints, cached wrappers and pointers" << std::endl;
+    std::cout << std::endl;
+    std::cout << "attrbench [count]: Compare reading attributes bound with pybind11 properties against getset slots" << std::endl;
+    std::cout << std::endl;
+    std::cout << "stringbench [count]: Compare converting event text by copying, through the ASCII fast path and through the string table" << std::endl;
+    std::cout << std::endl;
+    std::cout << "packets [count] [size]: Hand packet buffers to scripts as memoryviews and compare with copying them to bytes" << std::endl;
+    std::cout << std::endl;
+    std::cout << "snapshot [count]: Compare scripts aggregating over bound mover objects against a snapshot of their fields" << std::endl;
+    std::cout << std::endl;
+    std::cout << "batch [count]: Compare dispatching a tick to each user against one batch event for every user" << std::endl;
+    std::cout << std::endl;
+    std::cout << "lazy [count]: Compare passing items with every field converted, as bound wrappers and as lazy proxies" << std::endl;
+    std::cout << std::endl;
+    std::cout << "argpool [count]: Count python allocations per dispatch with argument tuples and payloads pooled and not" << std::endl;
+    std::cout << std::endl;
+    std::cout << "tables [count]: Publish an item table and compare script lookups in it against a dict of dicts copy" << std::endl;
+    std::cout << std::endl;
     std::cout << "Enter command: ";
     std::getline(std::cin, input);
 
@@ -159,11 +1274,102 @@ int main() {
         }
       }
 
+      if (std::find(words.begin(), words.end(), "-exec") != words.end()) {
+        executor_load_test(words);
+        continue;
+      }
+      if (std::find(words.begin(), words.end(), "-calls") != words.end()) {
+        call_load_test(words);
+        std::cout << std::endl;
+        continue;
+      }
+
       last_run_time_seconds = load_test(last_run_time_seconds, multi_threading);
     }
     else if (words[0] == "example") {
       example();
     }
+    else if (words[0] == "formulatest") {
+      const auto passed = scripting::check_formula_conformance("formula_conformance");
+      std::cout << "Formula conformance " << (passed ? "passed" : "FAILED") << std::endl;
+      std::cout << std::endl;
+    }
+    else if (words[0] == "audit") {
+      toggle_audit();
+      std::cout << std::endl;
+    }
+    else if (words[0] == "nested") {
+      nested_dispatch(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "record") {
+      toggle_journal(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "replay") {
+      replay_journal(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "bridgebench") {
+      bridge_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "worker") {
+      start_worker(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "workerbench") {
+      worker_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "forkbench") {
+      fork_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "jobs") {
+      job_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "gilstats") {
+      gil_stats(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "handlebench") {
+      handle_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "attrbench") {
+      attribute_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "stringbench") {
+      string_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "packets") {
+      packet_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "snapshot") {
+      snapshot_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "batch") {
+      batch_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "lazy") {
+      lazy_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "argpool") {
+      argument_pool_bench(words);
+      std::cout << std::endl;
+    }
+    else if (words[0] == "tables") {
+      data_table_bench(words);
+      std::cout << std::endl;
+    }
     else if (words[0] == "exit") {
       break;
     }
@@ -172,5 +1378,6 @@ int main() {
     }
   }
 
+  scripting::shutdown();
   return 0;
 }
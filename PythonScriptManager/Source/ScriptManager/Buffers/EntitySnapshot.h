@@ -0,0 +1,143 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+namespace scripting {
+  namespace buffers {
+    /// <summary>
+    /// One field of every entity in a snapshot, stored contiguously. Scripts read it through the buffer protocol as a
+    /// typed, read only memoryview.
+    /// </summary>
+    class Column {
+    public:
+      template <typename T>
+      static std::shared_ptr<Column> make(const std::size_t count) {
+        static_assert(std::is_arithmetic_v<T>, "columns hold numbers");
+        auto column = std::make_shared<Column>();
+        column->format_ = py::format_descriptor<T>::format();
+        column->item_size_ = sizeof(T);
+        column->count_ = count;
+        column->bytes_.reset(new std::uint8_t[count * sizeof(T)]);
+        return column;
+      }
+
+      template <typename T>
+      T* values() { return reinterpret_cast<T*>(bytes_.get()); }
+
+      std::size_t size() const { return count_; }
+      const std::string& format() const { return format_; }
+
+      py::buffer_info buffer_info() {
+        return py::buffer_info(bytes_.get(), static_cast<py::ssize_t>(item_size_), format_, 1, { static_cast<py::ssize_t>(count_) },
+          { static_cast<py::ssize_t>(item_size_) }, true);
+      }
+
+    private:
+      std::string format_;
+      std::size_t item_size_ = 0;
+      std::size_t count_ = 0;
+      std::unique_ptr<std::uint8_t[]> bytes_;
+    };
+
+    /// <summary>
+    /// Selected fields of a set of entities, copied in to one column per field, so scripts aggregating over many
+    /// entities read plain arrays instead of one bound object and attribute at a time.
+    /// A snapshot does not change once handed to scripts; publish a new one each time instead.
+    /// </summary>
+    class EntitySnapshot {
+    public:
+      /// <summary>
+      /// Add a column holding getter(entity) for each entity, in the entities' order.
+      /// </summary>
+      /// <typeparam name="T">The column's type, such as std::uint32_t for ids or float for positions</typeparam>
+      /// <param name="name">Name scripts read the column by</param>
+      /// <param name="entities">The entities, or pointers to them; the same ones for every column</param>
+      /// <param name="getter">A member pointer, or a callable taking an entity</param>
+      template <typename T, typename Range, typename Getter>
+      EntitySnapshot& add(const std::string& name, const Range& entities, Getter getter) {
+        const auto count = static_cast<std::size_t>(std::distance(std::begin(entities), std::end(entities)));
+        if (columns_.empty()) {
+          size_ = count;
+        }
+        else if (count != size_) {
+          throw std::invalid_argument("column " + name + " has " + std::to_string(count) + " entities, not " + std::to_string(size_));
+        }
+
+        auto column = Column::make<T>(count);
+        auto values = column->template values<T>();
+        for (const auto& entity : entities) {
+          *values++ = static_cast<T>(std::invoke(getter, entity));
+        }
+        columns_.emplace_back(name, std::move(column));
+        return *this;
+      }
+
+      /// <summary>
+      /// Number of entities.
+      /// </summary>
+      std::size_t size() const { return size_; }
+
+      std::shared_ptr<Column> column(const std::string& name) const {
+        for (const auto& [column_name, column] : columns_) {
+          if (column_name == name) {
+            return column;
+          }
+        }
+        throw py::key_error("no column named " + name);
+      }
+
+      std::vector<std::string> names() const {
+        std::vector<std::string> names;
+        for (const auto& column : columns_) {
+          names.push_back(column.first);
+        }
+        return names;
+      }
+
+      /// <summary>
+      /// A typed memoryview of a column, which keeps the column alive. Must be called with the GIL held.
+      /// </summary>
+      py::object view(const std::string& name) const {
+        const auto column = py::cast(this->column(name));
+        const auto view = PyMemoryView_FromObject(column.ptr());
+        if (!view) {
+          throw py::error_already_set();
+        }
+        return py::reinterpret_steal<py::object>(view);
+      }
+
+      static void apply_class_definitions(const py::module& module) {
+        py::class_<Column, std::shared_ptr<Column>>(module, "Column", py::buffer_protocol())
+          .def_buffer(&Column::buffer_info)
+          .def("__len__", &Column::size)
+          .def_property_readonly("format", &Column::format);
+
+        py::class_<EntitySnapshot, std::shared_ptr<EntitySnapshot>>(module, "EntitySnapshot")
+          .def("__len__", &EntitySnapshot::size)
+          .def("__getitem__", &EntitySnapshot::view, py::arg("name"))
+          .def("view", &EntitySnapshot::view, py::arg("name"))
+          .def("column", &EntitySnapshot::column, py::arg("name"))
+          .def("names", [](const EntitySnapshot& snapshot) {
+            py::list names;
+            for (const auto& name : snapshot.names()) {
+              names.append(name);
+            }
+            return names;
+          });
+      }
+
+    private:
+      std::size_t size_ = 0;
+      std::vector<std::pair<std::string, std::shared_ptr<Column>>> columns_;
+    };
+  }
+}
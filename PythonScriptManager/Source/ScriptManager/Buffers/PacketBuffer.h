@@ -0,0 +1,324 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Gil\ThreadState.h"
+
+namespace scripting {
+  namespace buffers {
+    /// <summary>
+    /// What a buffer's python exporter lends out: the bytes while the buffer is lent, and the bytes themselves once the
+    /// buffer is recycled while a script still holds a view of them, freed when the last view is released.
+    /// Whether the bytes are writable is fixed when the exporter is made, as scripts can reach it through any view's obj.
+    /// </summary>
+    struct BufferLease {
+      explicit BufferLease(const bool writable) : writable(writable) {}
+
+      std::uint8_t* data = nullptr;
+      std::size_t size = 0;
+      const bool writable;
+      Py_ssize_t exports = 0;
+      std::shared_ptr<std::uint8_t[]> orphaned;
+    };
+
+    /// <summary>
+    /// The object behind every memoryview of a packet buffer. Implements the buffer protocol over its lease.
+    /// </summary>
+    struct ExporterObject {
+      PyObject_HEAD
+      BufferLease* lease;
+    };
+
+    inline PyTypeObject*& exporter_type() {
+      static PyTypeObject* type = nullptr;
+      return type;
+    }
+
+    namespace exporter_slots {
+      inline int get_buffer(PyObject* self, Py_buffer* view, const int flags) {
+        const auto lease = reinterpret_cast<ExporterObject*>(self)->lease;
+        if (!lease->data) {
+          PyErr_SetString(PyExc_BufferError, "the packet buffer has been recycled");
+          view->obj = nullptr;
+          return -1;
+        }
+        if (PyBuffer_FillInfo(view, self, lease->data, static_cast<Py_ssize_t>(lease->size), lease->writable ? 0 : 1, flags) < 0) {
+          return -1;
+        }
+        ++lease->exports;
+        return 0;
+      }
+
+      inline void release_buffer(PyObject* self, Py_buffer*) {
+        const auto lease = reinterpret_cast<ExporterObject*>(self)->lease;
+        if (--lease->exports == 0) {
+          lease->orphaned.reset();
+        }
+      }
+
+      inline void dealloc(PyObject* self) {
+        const auto type = Py_TYPE(self);
+        delete reinterpret_cast<ExporterObject*>(self)->lease;
+        PyObject_Free(self);
+        Py_DECREF(type);
+      }
+    }
+
+    /// <summary>
+    /// Create the exporter type. Scripts only ever see it as a memoryview's obj.
+    /// </summary>
+    inline py::object make_exporter_type() {
+      static PyType_Slot slots[] = {
+        { Py_tp_dealloc, reinterpret_cast<void*>(&exporter_slots::dealloc) },
+        { Py_bf_getbuffer, reinterpret_cast<void*>(&exporter_slots::get_buffer) },
+        { Py_bf_releasebuffer, reinterpret_cast<void*>(&exporter_slots::release_buffer) },
+        { 0, nullptr }
+      };
+      static PyType_Spec spec = {
+        "example_module.PacketBuffer", static_cast<int>(sizeof(ExporterObject)), 0,
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION, slots
+      };
+
+      const auto type = PyType_FromSpec(&spec);
+      if (!type) {
+        throw py::error_already_set();
+      }
+      exporter_type() = reinterpret_cast<PyTypeObject*>(type);
+      return py::reinterpret_steal<py::object>(type);
+    }
+
+    class PacketBufferPool;
+
+    /// <summary>
+    /// A byte buffer from a PacketBufferPool, such as a received or outgoing packet, that can be handed to scripts as a
+    /// memoryview without copying. Only used by one thread at a time.
+    /// </summary>
+    class PacketBuffer {
+    public:
+      explicit PacketBuffer(const std::size_t capacity) : bytes_(new std::uint8_t[capacity]), capacity_(capacity) {}
+      PacketBuffer(const PacketBuffer&) = delete;
+      PacketBuffer& operator=(const PacketBuffer&) = delete;
+
+      ~PacketBuffer() {
+        // Once the interpreter is finalized its views are already gone.
+        if ((exporters_[0] || exporters_[1]) && Py_IsInitialized()) {
+          gil::GilAcquire acquire;
+          revoke(false);
+        }
+      }
+
+      std::uint8_t* data() { return bytes_.get(); }
+      const std::uint8_t* data() const { return bytes_.get(); }
+      std::size_t size() const { return size_; }
+      std::size_t capacity() const { return capacity_; }
+
+      /// <summary>
+      /// Set the number of bytes in use, at most the capacity. Views made before see the old size.
+      /// </summary>
+      void resize(const std::size_t size) { size_ = std::min(size, capacity_); }
+
+      /// <summary>
+      /// Copy bytes in to the buffer, replacing its contents.
+      /// </summary>
+      void assign(const void* data, const std::size_t size) {
+        resize(size);
+        std::memcpy(bytes_.get(), data, size_);
+      }
+
+      /// <summary>
+      /// A memoryview of the bytes in use, valid until the buffer is recycled. Must be called with the GIL held.
+      /// </summary>
+      /// <param name="writable">Whether scripts may write to the bytes through this view</param>
+      py::object memoryview(const bool writable) {
+        // One exporter per mode, so lending a writable view never makes an earlier read only one writable.
+        auto& exporter = exporters_[writable ? 1 : 0];
+        if (!exporter) {
+          const auto created = PyObject_New(ExporterObject, exporter_type());
+          if (!created) {
+            throw py::error_already_set();
+          }
+          created->lease = new BufferLease(writable);
+          exporter = reinterpret_cast<PyObject*>(created);
+        }
+
+        const auto lease = reinterpret_cast<ExporterObject*>(exporter)->lease;
+        lease->data = bytes_.get();
+        lease->size = size_;
+        const auto view = PyMemoryView_FromObject(exporter);
+        if (!view) {
+          throw py::error_already_set();
+        }
+        views_.push_back(view);
+        return py::reinterpret_borrow<py::object>(view);
+      }
+
+      /// <summary>
+      /// Whether views of the buffer have been handed out since it was last recycled.
+      /// </summary>
+      bool lent() const { return !views_.empty(); }
+
+    private:
+      friend class PacketBufferPool;
+
+      /// <summary>
+      /// Release every view handed out so scripts that kept one get an error on use. Views a script made from them,
+      /// such as slices, keep the bytes alive: they are given to the exporter and the buffer gets new ones.
+      /// Must be called with the GIL held.
+      /// </summary>
+      /// <param name="keep_exporter">Keep the exporters for the next time the buffer is lent, if nothing else can reach them</param>
+      void revoke(const bool keep_exporter) {
+        static const auto release = PyUnicode_InternFromString("release");
+        for (const auto view : views_) {
+          const auto result = PyObject_CallMethodNoArgs(view, release);
+          if (!result) {
+            // Something holds a buffer from this very view; the exports check below covers it.
+            PyErr_Clear();
+          }
+          Py_XDECREF(result);
+          Py_DECREF(view);
+        }
+        views_.clear();
+
+        // Both exporters may still be exported from, so they share the orphaned bytes.
+        std::shared_ptr<std::uint8_t[]> orphaned;
+        for (auto& exporter : exporters_) {
+          if (!exporter) {
+            continue;
+          }
+          const auto lease = reinterpret_cast<ExporterObject*>(exporter)->lease;
+          lease->data = nullptr;
+          if (keep_exporter && lease->exports == 0 && Py_REFCNT(exporter) == 1) {
+            continue;
+          }
+          if (lease->exports > 0) {
+            if (!orphaned) {
+              orphaned = std::move(bytes_);
+              bytes_.reset(new std::uint8_t[capacity_]);
+              ++orphaned_;
+            }
+            lease->orphaned = orphaned;
+          }
+          Py_DECREF(exporter);
+          exporter = nullptr;
+        }
+      }
+
+      std::unique_ptr<std::uint8_t[]> bytes_;
+      std::size_t capacity_;
+      std::size_t size_ = 0;
+      // Read only and writable.
+      PyObject* exporters_[2] = { nullptr, nullptr };
+      std::vector<PyObject*> views_;
+      std::size_t orphaned_ = 0;
+    };
+
+    /// <summary>
+    /// Recycles packet buffers of one capacity. Buffers handed to scripts are revoked when recycled, so a view a
+    /// script kept can never reach bytes that hold a later packet.
+    /// </summary>
+    class PacketBufferPool {
+    public:
+      explicit PacketBufferPool(const std::size_t capacity) : capacity_(capacity) {}
+      PacketBufferPool(const PacketBufferPool&) = delete;
+      PacketBufferPool& operator=(const PacketBufferPool&) = delete;
+
+      /// <summary>
+      /// Take a free buffer, or allocate one.
+      /// </summary>
+      std::unique_ptr<PacketBuffer> acquire() {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (!free_.empty()) {
+            auto buffer = std::move(free_.back());
+            free_.pop_back();
+            buffer->size_ = 0;
+            return buffer;
+          }
+        }
+        return std::make_unique<PacketBuffer>(capacity_);
+      }
+
+      /// <summary>
+      /// Give a buffer back for reuse, revoking its views first. Takes the GIL if the buffer was handed to scripts.
+      /// </summary>
+      void recycle(std::unique_ptr<PacketBuffer> buffer) {
+        if (!buffer) {
+          return;
+        }
+        if (buffer->lent()) {
+          if (Py_IsInitialized()) {
+            gil::GilAcquire acquire;
+            buffer->revoke(true);
+            orphaned_ += buffer->orphaned_;
+            buffer->orphaned_ = 0;
+          }
+          else {
+            // Views of the buffer went with the interpreter.
+            buffer->exporters_[0] = buffer->exporters_[1] = nullptr;
+            buffer->views_.clear();
+          }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(buffer));
+      }
+
+      std::size_t capacity() const { return capacity_; }
+
+      /// <summary>
+      /// Number of buffers recycled while a script still held a view of them, whose bytes were left to the view.
+      /// </summary>
+      std::size_t orphaned() const { return orphaned_; }
+
+    private:
+      std::size_t capacity_;
+      std::mutex mutex_;
+      std::vector<std::unique_ptr<PacketBuffer>> free_;
+      std::size_t orphaned_ = 0;
+    };
+
+    /// <summary>
+    /// Passes a packet buffer to python as a memoryview: dispatch_event("on_packet", buffers::view(buffer)).
+    /// </summary>
+    struct View {
+      PacketBuffer* buffer;
+      bool writable;
+    };
+
+    inline View view(PacketBuffer* buffer, const bool writable = false) {
+      return { buffer, writable };
+    }
+
+    inline View view(const std::unique_ptr<PacketBuffer>& buffer, const bool writable = false) {
+      return { buffer.get(), writable };
+    }
+  }
+}
+
+namespace pybind11 {
+  namespace detail {
+    /// <summary>
+    /// Converts View arguments to a memoryview of the buffer, or None for no buffer.
+    /// </summary>
+    template <>
+    struct type_caster<scripting::buffers::View> {
+      PYBIND11_TYPE_CASTER(scripting::buffers::View, const_name("memoryview"));
+
+      // Only ever passed from C++ to python.
+      bool load(handle, bool) { return false; }
+
+      static handle cast(const scripting::buffers::View& value, return_value_policy, handle) {
+        if (!value.buffer) {
+          return none().release();
+        }
+        return value.buffer->memoryview(value.writable).release();
+      }
+    };
+  }
+}
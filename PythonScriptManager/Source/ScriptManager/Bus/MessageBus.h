@@ -0,0 +1,255 @@
+#pragma once
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Dispatch\DispatchScope.h"
+
+namespace scripting {
+  namespace bus {
+    /// <summary>
+    /// A script-to-script publish/subscribe bus.
+    /// Scripts publish straight to their subscribers inside the interpreter instead of going through a bound C++
+    /// function and dispatch_event, which would re-acquire the GIL and scan every module by name.
+    /// Deferred messages and the publish depth are kept per thread, as dispatches on different threads interleave
+    /// whenever they give up the GIL. Every method must be called with the GIL held.
+    /// </summary>
+    class MessageBus {
+    public:
+      // Deferred messages delivered in one drain before the rest are dropped, guards against publish loops.
+      static constexpr std::size_t kMaxDeferredPerDrain = 10000;
+
+      // Publishing deeper than this from inside subscribers is deferred automatically.
+      static constexpr int kMaxPublishDepth = 16;
+
+      /// <summary>
+      /// Subscribe a callable to a topic. The callable receives the published payload.
+      /// </summary>
+      void subscribe(const py::str& topic, const py::object& callback) {
+        const auto key = intern(topic);
+        auto& entry = topics_[key.ptr()];
+        entry.key = key;
+
+        auto subscribers = entry.subscribers ? std::make_shared<Subscribers>(*entry.subscribers) : std::make_shared<Subscribers>();
+        subscribers->push_back(callback);
+        entry.subscribers = std::move(subscribers);
+      }
+
+      /// <summary>
+      /// Remove a callable from a topic.
+      /// </summary>
+      /// <returns>true if the callable was subscribed.</returns>
+      bool unsubscribe(const py::str& topic, const py::object& callback) {
+        const auto it = topics_.find(intern(topic).ptr());
+        if (it == topics_.end()) {
+          return false;
+        }
+
+        auto subscribers = std::make_shared<Subscribers>();
+        for (const auto& subscriber : *it->second.subscribers) {
+          if (!subscriber.equal(callback)) {
+            subscribers->push_back(subscriber);
+          }
+        }
+
+        const auto removed = subscribers->size() != it->second.subscribers->size();
+        if (subscribers->empty()) {
+          topics_.erase(it);
+        }
+        else {
+          it->second.subscribers = std::move(subscribers);
+        }
+        return removed;
+      }
+
+      /// <summary>
+      /// A topic key and one subscriber to it.
+      /// </summary>
+      using Subscription = std::pair<py::object, py::object>;
+
+      /// <summary>
+      /// Every subscription made by callables defined in a module, taken before the module is reloaded.
+      /// </summary>
+      std::vector<Subscription> module_subscriptions(const std::string& module_name) const {
+        std::vector<Subscription> subscriptions;
+        for (const auto& topic : topics_) {
+          for (const auto& subscriber : *topic.second.subscribers) {
+            if (py::hasattr(subscriber, "__module__") && py::isinstance<py::str>(subscriber.attr("__module__")) &&
+              subscriber.attr("__module__").cast<std::string>() == module_name) {
+              subscriptions.emplace_back(topic.second.key, subscriber);
+            }
+          }
+        }
+        return subscriptions;
+      }
+
+      /// <summary>
+      /// Remove exactly these subscriptions, matching callables by identity so those a reloaded module made again are
+      /// kept. Topics left without subscribers are dropped, as unsubscribe does.
+      /// </summary>
+      void unsubscribe_all(const std::vector<Subscription>& subscriptions) {
+        for (const auto& [key, callback] : subscriptions) {
+          const auto it = topics_.find(key.ptr());
+          if (it == topics_.end()) {
+            continue;
+          }
+
+          auto subscribers = std::make_shared<Subscribers>(*it->second.subscribers);
+          const auto found = std::find_if(subscribers->begin(), subscribers->end(), [&callback](const py::object& subscriber) {
+            return subscriber.is(callback);
+          });
+          if (found == subscribers->end()) {
+            continue;
+          }
+
+          subscribers->erase(found);
+          if (subscribers->empty()) {
+            topics_.erase(it);
+          }
+          else {
+            it->second.subscribers = std::move(subscribers);
+          }
+        }
+      }
+
+      /// <summary>
+      /// Publish a payload to a topic.
+      /// </summary>
+      /// <param name="topic">The topic name</param>
+      /// <param name="payload">Any python object, handed to subscribers as is</param>
+      /// <param name="defer">Deliver at the end of the current event dispatch instead of immediately</param>
+      /// <returns>The number of subscribers the payload was delivered to, zero if it was deferred.</returns>
+      std::size_t publish(const py::str& topic, const py::object& payload, const bool defer) {
+        // Deferred delivery needs an enclosing dispatch to flush it, outside of one deliver straight away.
+        if (dispatch::DispatchScope::active()) {
+          auto& thread = current_thread();
+          if (defer || thread.depth >= kMaxPublishDepth) {
+            thread.deferred.push_back({ topic, payload });
+            return 0;
+          }
+        }
+        return deliver(topic, payload);
+      }
+
+      /// <summary>
+      /// Deliver every message the current thread deferred, including any published while draining.
+      /// Called at the end of the outermost dispatch. Throws py::error_already_set if the warning about dropped
+      /// messages is turned in to an error.
+      /// </summary>
+      void drain_deferred() {
+        const auto found = threads_.find(std::this_thread::get_id());
+        if (found == threads_.end()) {
+          return;
+        }
+
+        std::size_t delivered = 0;
+        // Delivering may publish, and rehash the map, so look the thread up again each time.
+        while (!current_thread().deferred.empty()) {
+          auto& deferred = current_thread().deferred;
+          if (++delivered > kMaxDeferredPerDrain) {
+            deferred.clear();
+            if (PyErr_WarnEx(PyExc_RuntimeWarning, "bus: too many deferred messages in one dispatch, dropping the rest", 1) < 0) {
+              throw py::error_already_set();
+            }
+            break;
+          }
+
+          const auto message = std::move(deferred.front());
+          deferred.pop_front();
+          deliver(message.topic, message.payload);
+        }
+
+        const auto& thread = current_thread();
+        if (thread.depth == 0 && thread.deferred.empty()) {
+          threads_.erase(std::this_thread::get_id());
+        }
+      }
+
+      /// <summary>
+      /// Drop every subscriber and every thread's deferred messages.
+      /// </summary>
+      void clear() {
+        threads_.clear();
+        topics_.clear();
+      }
+
+      static void apply_class_definitions(const py::module& module) {
+        py::class_<MessageBus>(module, "MessageBus")
+          .def("subscribe", &MessageBus::subscribe, py::arg("topic"), py::arg("callback"))
+          .def("unsubscribe", &MessageBus::unsubscribe, py::arg("topic"), py::arg("callback"))
+          .def("publish", &MessageBus::publish, py::arg("topic"), py::arg("payload") = py::none(), py::arg("defer") = false);
+      }
+
+    private:
+      using Subscribers = std::vector<py::object>;
+
+      struct Message {
+        py::str topic;
+        py::object payload;
+      };
+
+      struct ThreadState {
+        std::deque<Message> deferred;
+        int depth = 0;
+      };
+
+      ThreadState& current_thread() {
+        return threads_[std::this_thread::get_id()];
+      }
+
+      struct Topic {
+        // Keeps the interned topic string, and so the map key, alive.
+        py::object key;
+        std::shared_ptr<const Subscribers> subscribers;
+      };
+
+      /// <summary>
+      /// Topics are keyed by their interned python string so lookups hash a pointer rather than the text.
+      /// String literals in scripts are already interned, making this a flag check.
+      /// </summary>
+      static py::object intern(const py::str& topic) {
+        auto key = topic.inc_ref().ptr();
+        PyUnicode_InternInPlace(&key);
+        return py::reinterpret_steal<py::object>(key);
+      }
+
+      std::size_t deliver(const py::str& topic, const py::object& payload) {
+        const auto it = topics_.find(intern(topic).ptr());
+        if (it == topics_.end()) {
+          return 0;
+        }
+
+        // Hold the current subscriber list, subscribers may change it while we iterate.
+        const auto subscribers = it->second.subscribers;
+
+        ++current_thread().depth;
+        for (const auto& subscriber : *subscribers) {
+          const auto result = PyObject_CallOneArg(subscriber.ptr(), payload.ptr());
+          if (result) {
+            Py_DECREF(result);
+          }
+          else {
+            // A failing subscriber should not stop the others or propagate to the publisher.
+            PyErr_Print();
+          }
+        }
+        auto& thread = current_thread();
+        if (--thread.depth == 0 && thread.deferred.empty()) {
+          threads_.erase(std::this_thread::get_id());
+        }
+
+        return subscribers->size();
+      }
+
+      std::unordered_map<PyObject*, Topic> topics_;
+      // Only threads that deferred a message or are delivering one have an entry.
+      std::unordered_map<std::thread::id, ThreadState> threads_;
+    };
+  }
+}
@@ -0,0 +1,392 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+namespace scripting {
+  namespace commands {
+    enum class ArgumentType : unsigned char {
+      STRING = 0,
+      INT,
+      FLOAT,
+      // Joins every remaining token with a single space. Only valid as the last argument.
+      REST
+    };
+
+    /// <summary>
+    /// A single argument in a command's signature.
+    /// Specs are written as "str", "int", "float" or "rest" with an optional trailing "?" for optional arguments.
+    /// </summary>
+    struct ArgumentSpec {
+      ArgumentType type = ArgumentType::STRING;
+      bool optional = false;
+    };
+
+    using CommandArgument = std::variant<std::string, long long, double>;
+
+    /// <summary>
+    /// A chat command registered by a script.
+    /// </summary>
+    struct Command {
+      std::string name;
+      std::string owner_module;
+      std::vector<ArgumentSpec> arguments;
+
+      // Only touched with the GIL held.
+      py::object handler;
+    };
+
+    enum class RouteResult {
+      ROUTED = 0,
+      NOT_A_COMMAND,
+      UNKNOWN_COMMAND,
+      AMBIGUOUS_COMMAND,
+      BAD_ARGUMENTS
+    };
+
+    /// <summary>
+    /// Routes prefixed chat lines to the single script handler that owns the command.
+    /// Tokenizing, trie lookup and argument validation are pure C++ so rejected lines never touch the GIL.
+    /// </summary>
+    class CommandRouter {
+    public:
+      explicit CommandRouter(std::string prefix = ".") : prefix_(std::move(prefix)) {
+        rebuild_trie();
+      }
+
+      /// <summary>
+      /// Parse an argument spec string such as "int" or "str?".
+      /// </summary>
+      /// <returns>false if the spec is not recognised.</returns>
+      static bool parse_spec(std::string spec, ArgumentSpec& result) {
+        result.optional = !spec.empty() && spec.back() == '?';
+        if (result.optional) {
+          spec.pop_back();
+        }
+
+        static const std::unordered_map<std::string, ArgumentType> types = {
+          { "str", ArgumentType::STRING }, { "int", ArgumentType::INT },
+          { "float", ArgumentType::FLOAT }, { "rest", ArgumentType::REST }
+        };
+        const auto it = types.find(spec);
+        if (it == types.end()) {
+          return false;
+        }
+        result.type = it->second;
+        return true;
+      }
+
+      /// <summary>
+      /// Register or replace a command. Must be called with the GIL held.
+      /// </summary>
+      /// <param name="command">The command to register</param>
+      /// <param name="error">Set to the reason the command was rejected</param>
+      /// <returns>true if the command was registered.</returns>
+      bool register_command(Command command, std::string& error) {
+        if (command.name.empty() || command.name.find_first_of(" \t\"'") != std::string::npos) {
+          error = "invalid command name '" + command.name + "'";
+          return false;
+        }
+
+        auto seen_optional = false;
+        for (std::size_t i = 0; i < command.arguments.size(); ++i) {
+          const auto& argument = command.arguments[i];
+          if (argument.type == ArgumentType::REST && i + 1 != command.arguments.size()) {
+            error = "'rest' must be the last argument";
+            return false;
+          }
+          if (seen_optional && !argument.optional) {
+            error = "required arguments can not follow optional ones";
+            return false;
+          }
+          seen_optional = seen_optional || argument.optional;
+        }
+
+        const auto name = command.name;
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        commands_[name] = std::make_shared<const Command>(std::move(command));
+        rebuild_trie();
+        return true;
+      }
+
+      /// <summary>
+      /// Remove a command. Must be called with the GIL held.
+      /// </summary>
+      bool unregister_command(const std::string& name) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (commands_.erase(name) == 0) {
+          return false;
+        }
+        rebuild_trie();
+        return true;
+      }
+
+      /// <summary>
+      /// Every command a module owns, taken before the module is reloaded.
+      /// </summary>
+      std::vector<std::shared_ptr<const Command>> module_commands(const std::string& module_name) const {
+        std::vector<std::shared_ptr<const Command>> commands;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& item : commands_) {
+          if (item.second->owner_module == module_name) {
+            commands.push_back(item.second);
+          }
+        }
+        return commands;
+      }
+
+      /// <summary>
+      /// Remove commands that are still registered as they were, leaving any registered again under the same name
+      /// since. Used once a module has reloaded, to drop the commands it no longer registers. Must be called with the
+      /// GIL held.
+      /// </summary>
+      void unregister_commands(const std::vector<std::shared_ptr<const Command>>& commands) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& command : commands) {
+          const auto it = commands_.find(command->name);
+          if (it != commands_.end() && it->second == command) {
+            commands_.erase(it);
+          }
+        }
+        rebuild_trie();
+      }
+
+      /// <summary>
+      /// Remove every command. Must be called with the GIL held.
+      /// </summary>
+      void clear() {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        commands_.clear();
+        rebuild_trie();
+      }
+
+      /// <summary>
+      /// Resolve a chat line to its command and typed arguments. Does not require the GIL.
+      /// Command names may be abbreviated to any unique prefix.
+      /// </summary>
+      /// <param name="line">The raw chat line including the prefix</param>
+      /// <param name="command">Set to the resolved command, also when its arguments are rejected. Release it with the GIL held</param>
+      /// <param name="arguments">Set to the parsed arguments</param>
+      RouteResult route(const std::string_view line, std::shared_ptr<const Command>& command, std::vector<CommandArgument>& arguments) const {
+        if (line.size() <= prefix_.size() || line.compare(0, prefix_.size(), prefix_) != 0) {
+          return RouteResult::NOT_A_COMMAND;
+        }
+
+        std::vector<std::string> tokens;
+        if (!tokenize(line.substr(prefix_.size()), tokens) || tokens.empty()) {
+          return RouteResult::BAD_ARGUMENTS;
+        }
+
+        {
+          std::shared_lock<std::shared_mutex> lock(mutex_);
+          const auto result = lookup(tokens.front(), command);
+          if (result != RouteResult::ROUTED) {
+            return result;
+          }
+        }
+
+        return parse_arguments(*command, tokens, arguments) ? RouteResult::ROUTED : RouteResult::BAD_ARGUMENTS;
+      }
+
+      /// <summary>
+      /// Split a command line in to tokens with POSIX shell quoting rules, matching shlex.split.
+      /// </summary>
+      /// <returns>false on an unterminated quote or trailing escape.</returns>
+      static bool tokenize(const std::string_view text, std::vector<std::string>& tokens) {
+        std::string token;
+        auto in_token = false;
+        char quote = 0;
+
+        for (std::size_t i = 0; i < text.size(); ++i) {
+          const auto c = text[i];
+
+          if (quote == '\'') {
+            if (c == '\'') {
+              quote = 0;
+            }
+            else {
+              token += c;
+            }
+            continue;
+          }
+
+          if (quote == '"') {
+            if (c == '"') {
+              quote = 0;
+            }
+            else if (c == '\\' && i + 1 < text.size() && (text[i + 1] == '"' || text[i + 1] == '\\')) {
+              token += text[++i];
+            }
+            else {
+              token += c;
+            }
+            continue;
+          }
+
+          if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            if (in_token) {
+              tokens.push_back(std::move(token));
+              token.clear();
+              in_token = false;
+            }
+            continue;
+          }
+
+          in_token = true;
+          if (c == '\'' || c == '"') {
+            quote = c;
+          }
+          else if (c == '\\') {
+            if (i + 1 >= text.size()) {
+              return false;
+            }
+            token += text[++i];
+          }
+          else {
+            token += c;
+          }
+        }
+
+        if (quote != 0) {
+          return false;
+        }
+        if (in_token) {
+          tokens.push_back(std::move(token));
+        }
+        return true;
+      }
+
+    private:
+      struct TrieNode {
+        std::vector<std::pair<char, std::int32_t>> children;
+        std::shared_ptr<const Command> command;
+
+        // Number of commands at or below this node and the command to use when that number is one.
+        std::size_t command_count = 0;
+        std::shared_ptr<const Command> sole_command;
+      };
+
+      void rebuild_trie() {
+        trie_.assign(1, TrieNode());
+        for (const auto& item : commands_) {
+          std::int32_t index = 0;
+          for (const auto c : item.first) {
+            ++trie_[index].command_count;
+            trie_[index].sole_command = item.second;
+
+            auto& children = trie_[index].children;
+            const auto child = std::find_if(children.begin(), children.end(), [c](const auto& entry) { return entry.first == c; });
+            if (child != children.end()) {
+              index = child->second;
+            }
+            else {
+              const auto next = static_cast<std::int32_t>(trie_.size());
+              children.emplace_back(c, next);
+              trie_.emplace_back();
+              index = next;
+            }
+          }
+          ++trie_[index].command_count;
+          trie_[index].sole_command = item.second;
+          trie_[index].command = item.second;
+        }
+      }
+
+      RouteResult lookup(const std::string& name, std::shared_ptr<const Command>& command) const {
+        std::int32_t index = 0;
+        for (const auto c : name) {
+          const auto& children = trie_[index].children;
+          const auto child = std::find_if(children.begin(), children.end(), [c](const auto& entry) { return entry.first == c; });
+          if (child == children.end()) {
+            return RouteResult::UNKNOWN_COMMAND;
+          }
+          index = child->second;
+        }
+
+        const auto& node = trie_[index];
+        if (node.command) {
+          command = node.command;
+          return RouteResult::ROUTED;
+        }
+        if (node.command_count == 1) {
+          command = node.sole_command;
+          return RouteResult::ROUTED;
+        }
+        return node.command_count == 0 ? RouteResult::UNKNOWN_COMMAND : RouteResult::AMBIGUOUS_COMMAND;
+      }
+
+      static bool parse_arguments(const Command& command, const std::vector<std::string>& tokens, std::vector<CommandArgument>& arguments) {
+        arguments.clear();
+        std::size_t token = 1;
+
+        for (const auto& spec : command.arguments) {
+          if (token >= tokens.size()) {
+            if (spec.optional) {
+              break;
+            }
+            return false;
+          }
+
+          const auto& text = tokens[token];
+          switch (spec.type) {
+          case ArgumentType::STRING:
+            arguments.emplace_back(text);
+            break;
+
+          case ArgumentType::INT: {
+            long long value = 0;
+            const auto begin = text.data() + (text.size() > 1 && text[0] == '+' ? 1 : 0);
+            const auto result = std::from_chars(begin, text.data() + text.size(), value);
+            if (result.ec != std::errc() || result.ptr != text.data() + text.size()) {
+              return false;
+            }
+            arguments.emplace_back(value);
+            break;
+          }
+
+          case ArgumentType::FLOAT: {
+            double value = 0.0;
+            const auto begin = text.data() + (text.size() > 1 && text[0] == '+' ? 1 : 0);
+            const auto result = std::from_chars(begin, text.data() + text.size(), value);
+            if (result.ec != std::errc() || result.ptr != text.data() + text.size()) {
+              return false;
+            }
+            arguments.emplace_back(value);
+            break;
+          }
+
+          case ArgumentType::REST: {
+            std::string rest = text;
+            for (auto i = token + 1; i < tokens.size(); ++i) {
+              rest += ' ';
+              rest += tokens[i];
+            }
+            arguments.emplace_back(std::move(rest));
+            token = tokens.size();
+            continue;
+          }
+          }
+          ++token;
+        }
+
+        // Surplus tokens mean the caller used the command incorrectly.
+        return token >= tokens.size();
+      }
+
+      std::string prefix_;
+      mutable std::shared_mutex mutex_;
+      std::unordered_map<std::string, std::shared_ptr<const Command>> commands_;
+      std::vector<TrieNode> trie_;
+    };
+  }
+}
@@ -0,0 +1,608 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Wrappers\LazyProxy.h"
+
+namespace scripting {
+  namespace data {
+    /// <summary>
+    /// Definitions of one kind, such as items, monsters or skills, held as rows sorted by id in contiguous memory with
+    /// an open addressing index over the ids. A table never changes once built; publish a new one to change the data.
+    /// </summary>
+    class DataTableBase {
+    public:
+      static constexpr std::uint32_t kEmpty = 0xFFFFFFFF;
+
+      virtual ~DataTableBase() = default;
+
+      const std::string& name() const { return name_; }
+      std::size_t size() const { return keys_.size(); }
+      std::uint32_t key(const std::size_t index) const { return keys_[index]; }
+      const void* row(const std::size_t index) const { return rows_ + index * row_size_; }
+
+      /// <summary>
+      /// The fields scripts can read from a row. Must be called with the GIL held.
+      /// </summary>
+      const wrappers::LazyTable& fields() const { return fields_(); }
+
+      /// <summary>
+      /// Position of the row with an id, or -1 when there is none.
+      /// </summary>
+      Py_ssize_t find(const std::uint32_t key) const {
+        auto slot = hash(key) & mask_;
+        while (true) {
+          const auto index = slots_[slot];
+          if (index == kEmpty) {
+            return -1;
+          }
+          if (keys_[index] == key) {
+            return static_cast<Py_ssize_t>(index);
+          }
+          slot = (slot + 1) & mask_;
+        }
+      }
+
+    protected:
+      explicit DataTableBase(std::string name) : name_(std::move(name)) {}
+
+      // At most half full, so probes stay short.
+      void build_index() {
+        std::size_t capacity = 8;
+        while (capacity < keys_.size() * 2) {
+          capacity *= 2;
+        }
+        slots_.assign(capacity, kEmpty);
+        mask_ = capacity - 1;
+        for (std::size_t index = 0; index < keys_.size(); ++index) {
+          auto slot = hash(keys_[index]) & mask_;
+          while (slots_[slot] != kEmpty) {
+            slot = (slot + 1) & mask_;
+          }
+          slots_[slot] = static_cast<std::uint32_t>(index);
+        }
+      }
+
+      // Ids are often dense or share low bits, so spread them with a multiply.
+      static std::size_t hash(const std::uint32_t key) {
+        return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32);
+      }
+
+      std::string name_;
+      std::vector<std::uint32_t> keys_;
+      std::vector<std::uint32_t> slots_;
+      std::size_t mask_ = 0;
+      const std::uint8_t* rows_ = nullptr;
+      std::size_t row_size_ = 0;
+      wrappers::LazyTable& (*fields_)() = nullptr;
+    };
+
+    /// <summary>
+    /// A table of Row definitions. Scripts read each row's fields through the same field table lazy proxies use, so
+    /// Row needs a wrappers::LazyFields specialization. Can be built on any thread.
+    /// </summary>
+    template <typename Row>
+    class DataTable : public DataTableBase {
+    public:
+      /// <summary>
+      /// Build a table from rows in any order. Throws std::invalid_argument when two rows share an id.
+      /// </summary>
+      /// <param name="name">Name scripts look the table up by</param>
+      /// <param name="rows">The definitions</param>
+      /// <param name="key">A member pointer, or a callable taking a row, giving each row's id</param>
+      template <typename Key>
+      DataTable(std::string name, std::vector<Row> rows, Key key) : DataTableBase(std::move(name)), storage_(std::move(rows)) {
+        static_assert(wrappers::has_lazy_fields<Row>::value, "data table rows need a wrappers::LazyFields specialization");
+        std::sort(storage_.begin(), storage_.end(), [&key](const Row& left, const Row& right) {
+          return static_cast<std::uint32_t>(std::invoke(key, left)) < static_cast<std::uint32_t>(std::invoke(key, right));
+        });
+
+        keys_.reserve(storage_.size());
+        for (const auto& row : storage_) {
+          const auto id = static_cast<std::uint32_t>(std::invoke(key, row));
+          if (!keys_.empty() && keys_.back() == id) {
+            throw std::invalid_argument("table " + name_ + " has more than one row with id " + std::to_string(id));
+          }
+          keys_.push_back(id);
+        }
+
+        rows_ = reinterpret_cast<const std::uint8_t*>(storage_.data());
+        row_size_ = sizeof(Row);
+        fields_ = &wrappers::lazy_table<Row>;
+        build_index();
+      }
+
+      /// <summary>
+      /// The row with an id, or nullptr.
+      /// </summary>
+      const Row* find_row(const std::uint32_t key) const {
+        const auto index = find(key);
+        return index < 0 ? nullptr : &storage_[static_cast<std::size_t>(index)];
+      }
+
+      /// <summary>
+      /// Every row, in id order.
+      /// </summary>
+      const std::vector<Row>& rows() const { return storage_; }
+
+    private:
+      std::vector<Row> storage_;
+    };
+
+    /// <summary>
+    /// The python object scripts look a table up through. Holds the row views handed out so far, one per row, so
+    /// looking up a row scripts have seen before allocates nothing.
+    /// </summary>
+    struct TableObject {
+      PyObject_HEAD
+      std::shared_ptr<const DataTableBase> table;
+      PyObject** views;
+    };
+
+    /// <summary>
+    /// A table's rows as a sequence in id order.
+    /// </summary>
+    struct RowsObject {
+      PyObject_HEAD
+      PyObject* table;
+    };
+
+    /// <summary>
+    /// One row, or a struct nested in one, read as attributes. Keeps its table's data alive, so a script may keep it
+    /// past a reload. Rows never change, so each field is converted once and kept, one slot per field.
+    /// </summary>
+    struct RowObject {
+      PyObject_VAR_HEAD
+      const void* row;
+      const wrappers::LazyTable* fields;
+      std::uint32_t key;
+      bool nested;
+      std::shared_ptr<const DataTableBase> table;
+      PyObject* cache[1];
+    };
+
+    inline PyTypeObject*& table_type() {
+      static PyTypeObject* type = nullptr;
+      return type;
+    }
+
+    inline PyTypeObject*& rows_type() {
+      static PyTypeObject* type = nullptr;
+      return type;
+    }
+
+    inline PyTypeObject*& row_type() {
+      static PyTypeObject* type = nullptr;
+      return type;
+    }
+
+    namespace row_slots {
+      /// <summary>
+      /// Make a view of a row or nested struct. Returns a new reference. Must be called with the GIL held.
+      /// </summary>
+      inline PyObject* new_view(const void* object, const wrappers::LazyTable& fields, const std::uint32_t key, const bool nested,
+        const std::shared_ptr<const DataTableBase>& table) {
+        const auto view = PyObject_NewVar(RowObject, row_type(), static_cast<Py_ssize_t>(fields.count));
+        if (!view) {
+          return nullptr;
+        }
+        view->row = object;
+        view->fields = &fields;
+        view->key = key;
+        view->nested = nested;
+        new (&view->table) std::shared_ptr<const DataTableBase>(table);
+        for (std::size_t i = 0; i < fields.count; ++i) {
+          view->cache[i] = nullptr;
+        }
+        return reinterpret_cast<PyObject*>(view);
+      }
+
+      // Nested structs get views of their own, which never expire, rather than lazy proxies lent for one dispatch.
+      inline PyObject* convert(RowObject* row, const std::size_t index) {
+        const auto& field = row->fields->fields[index];
+        if (!field.nested) {
+          return field.convert(row->row);
+        }
+        const auto object = field.nested(row->row);
+        if (!object) {
+          Py_RETURN_NONE;
+        }
+        return new_view(object, field.nested_table(), row->key, true, row->table);
+      }
+
+      inline PyObject* get_attribute(PyObject* self, PyObject* name) {
+        const auto row = reinterpret_cast<RowObject*>(self);
+        const auto& fields = *row->fields;
+        auto index = fields.count;
+        for (std::size_t i = 0; i < fields.count; ++i) {
+          if (fields.names[i] == name) {
+            index = i;
+            break;
+          }
+        }
+        if (index == fields.count && PyUnicode_Check(name)) {
+          for (std::size_t i = 0; i < fields.count; ++i) {
+            if (PyUnicode_Compare(fields.names[i], name) == 0) {
+              index = i;
+              break;
+            }
+          }
+        }
+        if (index == fields.count) {
+          return PyObject_GenericGetAttr(self, name);
+        }
+
+        if (!row->cache[index]) {
+          row->cache[index] = convert(row, index);
+          if (!row->cache[index]) {
+            return nullptr;
+          }
+        }
+        Py_INCREF(row->cache[index]);
+        return row->cache[index];
+      }
+
+      inline PyObject* repr(PyObject* self) {
+        const auto row = reinterpret_cast<RowObject*>(self);
+        if (row->nested) {
+          return PyUnicode_FromFormat("<%s of %s %u>", row->fields->name, row->table->fields().name, static_cast<unsigned int>(row->key));
+        }
+        return PyUnicode_FromFormat("<%s %u>", row->fields->name, static_cast<unsigned int>(row->key));
+      }
+
+      inline PyObject* dir(PyObject* self, PyObject*) {
+        const auto& fields = *reinterpret_cast<RowObject*>(self)->fields;
+        const auto names = PyList_New(static_cast<Py_ssize_t>(fields.count));
+        if (!names) {
+          return nullptr;
+        }
+        for (std::size_t i = 0; i < fields.count; ++i) {
+          Py_INCREF(fields.names[i]);
+          PyList_SET_ITEM(names, static_cast<Py_ssize_t>(i), fields.names[i]);
+        }
+        return names;
+      }
+
+      inline void dealloc(PyObject* self) {
+        const auto type = Py_TYPE(self);
+        const auto row = reinterpret_cast<RowObject*>(self);
+        for (Py_ssize_t i = 0; i < Py_SIZE(row); ++i) {
+          Py_XDECREF(row->cache[i]);
+        }
+        row->table.~shared_ptr();
+        PyObject_Free(self);
+        Py_DECREF(type);
+      }
+    }
+
+    namespace table_slots {
+      /// <summary>
+      /// The view of the row at a position, made the first time it is asked for. Returns a new reference.
+      /// </summary>
+      inline PyObject* row_view(TableObject* table, const Py_ssize_t index) {
+        auto& view = table->views[index];
+        if (!view) {
+          const auto position = static_cast<std::size_t>(index);
+          view = row_slots::new_view(table->table->row(position), table->table->fields(), table->table->key(position), false, table->table);
+          if (!view) {
+            return nullptr;
+          }
+        }
+        Py_INCREF(view);
+        return view;
+      }
+
+      /// <summary>
+      /// Position of the row with a python id, or -1 with no error set when there is none.
+      /// </summary>
+      inline Py_ssize_t find(TableObject* table, PyObject* key) {
+        // bool is an int subclass, but True is not an id.
+        if (!PyLong_Check(key) || PyBool_Check(key)) {
+          return -1;
+        }
+        int overflow = 0;
+        const auto id = PyLong_AsLongLongAndOverflow(key, &overflow);
+        if (overflow != 0 || id < 0 || id >= DataTableBase::kEmpty) {
+          return -1;
+        }
+        return table->table->find(static_cast<std::uint32_t>(id));
+      }
+
+      inline PyObject* subscript(PyObject* self, PyObject* key) {
+        const auto table = reinterpret_cast<TableObject*>(self);
+        const auto index = find(table, key);
+        if (index < 0) {
+          PyErr_SetObject(PyExc_KeyError, key);
+          return nullptr;
+        }
+        return row_view(table, index);
+      }
+
+      inline Py_ssize_t length(PyObject* self) {
+        return static_cast<Py_ssize_t>(reinterpret_cast<TableObject*>(self)->table->size());
+      }
+
+      inline int contains(PyObject* self, PyObject* key) {
+        return find(reinterpret_cast<TableObject*>(self), key) >= 0 ? 1 : 0;
+      }
+
+      inline PyObject* get(PyObject* self, PyObject* const* args, const Py_ssize_t count) {
+        if (count < 1 || count > 2) {
+          PyErr_SetString(PyExc_TypeError, "get takes an id and an optional default");
+          return nullptr;
+        }
+        const auto table = reinterpret_cast<TableObject*>(self);
+        const auto index = find(table, args[0]);
+        if (index >= 0) {
+          return row_view(table, index);
+        }
+        const auto fallback = count == 2 ? args[1] : Py_None;
+        Py_INCREF(fallback);
+        return fallback;
+      }
+
+      inline PyObject* keys(PyObject* self, PyObject*) {
+        const auto& table = *reinterpret_cast<TableObject*>(self)->table;
+        const auto keys = PyList_New(static_cast<Py_ssize_t>(table.size()));
+        if (!keys) {
+          return nullptr;
+        }
+        for (std::size_t i = 0; i < table.size(); ++i) {
+          const auto key = PyLong_FromUnsignedLong(table.key(i));
+          if (!key) {
+            Py_DECREF(keys);
+            return nullptr;
+          }
+          PyList_SET_ITEM(keys, static_cast<Py_ssize_t>(i), key);
+        }
+        return keys;
+      }
+
+      inline PyObject* values(PyObject* self, PyObject*) {
+        const auto rows = PyObject_New(RowsObject, rows_type());
+        if (!rows) {
+          return nullptr;
+        }
+        Py_INCREF(self);
+        rows->table = self;
+        return reinterpret_cast<PyObject*>(rows);
+      }
+
+      inline PyObject* items(PyObject* self, PyObject*) {
+        const auto table = reinterpret_cast<TableObject*>(self);
+        const auto size = static_cast<Py_ssize_t>(table->table->size());
+        const auto items = PyList_New(size);
+        if (!items) {
+          return nullptr;
+        }
+        for (Py_ssize_t i = 0; i < size; ++i) {
+          const auto key = PyLong_FromUnsignedLong(table->table->key(static_cast<std::size_t>(i)));
+          const auto row = key ? row_view(table, i) : nullptr;
+          const auto item = row ? PyTuple_Pack(2, key, row) : nullptr;
+          Py_XDECREF(key);
+          Py_XDECREF(row);
+          if (!item) {
+            Py_DECREF(items);
+            return nullptr;
+          }
+          PyList_SET_ITEM(items, i, item);
+        }
+        return items;
+      }
+
+      // Iterating a mapping gives its keys.
+      inline PyObject* iterate(PyObject* self) {
+        const auto list = keys(self, nullptr);
+        if (!list) {
+          return nullptr;
+        }
+        const auto iterator = PyObject_GetIter(list);
+        Py_DECREF(list);
+        return iterator;
+      }
+
+      inline PyObject* name(PyObject* self, void*) {
+        const auto& name = reinterpret_cast<TableObject*>(self)->table->name();
+        return PyUnicode_FromStringAndSize(name.data(), static_cast<Py_ssize_t>(name.size()));
+      }
+
+      inline PyObject* repr(PyObject* self) {
+        const auto& table = *reinterpret_cast<TableObject*>(self)->table;
+        return PyUnicode_FromFormat("<DataTable %s, %zd rows>", table.name().c_str(), static_cast<Py_ssize_t>(table.size()));
+      }
+
+      inline void dealloc(PyObject* self) {
+        const auto type = Py_TYPE(self);
+        const auto table = reinterpret_cast<TableObject*>(self);
+        if (table->views) {
+          const auto size = table->table->size();
+          for (std::size_t i = 0; i < size; ++i) {
+            Py_XDECREF(table->views[i]);
+          }
+          delete[] table->views;
+        }
+        table->table.~shared_ptr();
+        PyObject_Free(self);
+        Py_DECREF(type);
+      }
+    }
+
+    namespace rows_slots {
+      inline Py_ssize_t length(PyObject* self) {
+        return table_slots::length(reinterpret_cast<RowsObject*>(self)->table);
+      }
+
+      // Negative positions are counted from the end before this is called.
+      inline PyObject* item(PyObject* self, const Py_ssize_t index) {
+        const auto table = reinterpret_cast<TableObject*>(reinterpret_cast<RowsObject*>(self)->table);
+        if (index < 0 || index >= static_cast<Py_ssize_t>(table->table->size())) {
+          PyErr_SetString(PyExc_IndexError, "row position out of range");
+          return nullptr;
+        }
+        return table_slots::row_view(table, index);
+      }
+
+      inline PyObject* repr(PyObject* self) {
+        const auto& table = *reinterpret_cast<TableObject*>(reinterpret_cast<RowsObject*>(self)->table)->table;
+        return PyUnicode_FromFormat("<DataRows %s, %zd rows>", table.name().c_str(), static_cast<Py_ssize_t>(table.size()));
+      }
+
+      inline void dealloc(PyObject* self) {
+        const auto type = Py_TYPE(self);
+        Py_DECREF(reinterpret_cast<RowsObject*>(self)->table);
+        PyObject_Free(self);
+        Py_DECREF(type);
+      }
+    }
+
+    inline py::object make_type(PyType_Spec& spec, PyTypeObject*& type) {
+      const auto object = PyType_FromSpec(&spec);
+      if (!object) {
+        throw py::error_already_set();
+      }
+      type = reinterpret_cast<PyTypeObject*>(object);
+      return py::reinterpret_steal<py::object>(object);
+    }
+
+    /// <summary>
+    /// Create the table, rows and row types, registering tables as mappings. Scripts get tables from
+    /// example_module.table and cannot create any of them.
+    /// </summary>
+    inline void apply_type_definitions(py::module& module) {
+      static PyMethodDef row_methods[] = {
+        { "__dir__", &row_slots::dir, METH_NOARGS, nullptr },
+        { nullptr, nullptr, 0, nullptr }
+      };
+      static PyType_Slot row_type_slots[] = {
+        { Py_tp_dealloc, reinterpret_cast<void*>(&row_slots::dealloc) },
+        { Py_tp_getattro, reinterpret_cast<void*>(&row_slots::get_attribute) },
+        { Py_tp_repr, reinterpret_cast<void*>(&row_slots::repr) },
+        { Py_tp_methods, row_methods },
+        { 0, nullptr }
+      };
+      static PyType_Spec row_spec = {
+        "example_module.DataRow", static_cast<int>(offsetof(RowObject, cache)), static_cast<int>(sizeof(PyObject*)),
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION, row_type_slots
+      };
+
+      static PyType_Slot rows_type_slots[] = {
+        { Py_tp_dealloc, reinterpret_cast<void*>(&rows_slots::dealloc) },
+        { Py_tp_repr, reinterpret_cast<void*>(&rows_slots::repr) },
+        { Py_sq_length, reinterpret_cast<void*>(&rows_slots::length) },
+        { Py_sq_item, reinterpret_cast<void*>(&rows_slots::item) },
+        { 0, nullptr }
+      };
+      static PyType_Spec rows_spec = {
+        "example_module.DataRows", static_cast<int>(sizeof(RowsObject)), 0,
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION | Py_TPFLAGS_SEQUENCE, rows_type_slots
+      };
+
+      static PyMethodDef table_methods[] = {
+        { "get", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(&table_slots::get)), METH_FASTCALL, nullptr },
+        { "keys", &table_slots::keys, METH_NOARGS, nullptr },
+        { "values", &table_slots::values, METH_NOARGS, nullptr },
+        { "items", &table_slots::items, METH_NOARGS, nullptr },
+        { nullptr, nullptr, 0, nullptr }
+      };
+      static PyGetSetDef table_getset[] = {
+        { "name", &table_slots::name, nullptr, nullptr, nullptr },
+        { nullptr, nullptr, nullptr, nullptr, nullptr }
+      };
+      static PyType_Slot table_type_slots[] = {
+        { Py_tp_dealloc, reinterpret_cast<void*>(&table_slots::dealloc) },
+        { Py_tp_repr, reinterpret_cast<void*>(&table_slots::repr) },
+        { Py_tp_iter, reinterpret_cast<void*>(&table_slots::iterate) },
+        { Py_mp_subscript, reinterpret_cast<void*>(&table_slots::subscript) },
+        { Py_mp_length, reinterpret_cast<void*>(&table_slots::length) },
+        { Py_sq_contains, reinterpret_cast<void*>(&table_slots::contains) },
+        { Py_tp_methods, table_methods },
+        { Py_tp_getset, table_getset },
+        { 0, nullptr }
+      };
+      static PyType_Spec table_spec = {
+        "example_module.DataTable", static_cast<int>(sizeof(TableObject)), 0,
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION | Py_TPFLAGS_MAPPING, table_type_slots
+      };
+
+      module.attr("DataRow") = make_type(row_spec, row_type());
+      module.attr("DataRows") = make_type(rows_spec, rows_type());
+      module.attr("DataTable") = make_type(table_spec, table_type());
+
+      const auto abc = py::module::import("collections.abc");
+      abc.attr("Mapping").attr("register")(module.attr("DataTable"));
+      abc.attr("Sequence").attr("register")(module.attr("DataRows"));
+    }
+
+    /// <summary>
+    /// The tables published to scripts, by name. Lives outside every script module, so one copy of the data serves
+    /// all of them and reloading a script keeps it. Only used with the GIL held.
+    /// </summary>
+    class DataTables {
+    public:
+      DataTables() = default;
+      DataTables(const DataTables&) = delete;
+      DataTables& operator=(const DataTables&) = delete;
+
+      /// <summary>
+      /// Publish a table under its name, replacing the table published before. Scripts that kept the old table or
+      /// its rows go on reading the old data until they look the table up again.
+      /// </summary>
+      void publish(std::shared_ptr<const DataTableBase> table) {
+        if (!table_type()) {
+          py::module::import("example_module");
+        }
+        const auto object = PyObject_New(TableObject, table_type());
+        if (!object) {
+          throw py::error_already_set();
+        }
+        // Complete before anything else can throw, so dealloc always sees a valid object.
+        object->views = nullptr;
+        new (&object->table) std::shared_ptr<const DataTableBase>(table);
+        auto owned = py::reinterpret_steal<py::object>(reinterpret_cast<PyObject*>(object));
+        object->views = new PyObject*[table->size()]();
+        tables_[table->name()] = std::move(owned);
+      }
+
+      /// <summary>
+      /// The published table with a name. Throws a KeyError when there is none.
+      /// </summary>
+      py::object get(const std::string& name) const {
+        const auto found = tables_.find(name);
+        if (found == tables_.end()) {
+          throw py::key_error("no table named " + name);
+        }
+        return found->second;
+      }
+
+      bool contains(const std::string& name) const { return tables_.count(name) > 0; }
+
+      py::list names() const {
+        py::list names;
+        for (const auto& table : tables_) {
+          names.append(table.first);
+        }
+        return names;
+      }
+
+      /// <summary>
+      /// Drop every table. Must be called with the GIL held, before the interpreter is finalized.
+      /// </summary>
+      void clear() {
+        tables_.clear();
+      }
+
+    private:
+      std::unordered_map<std::string, py::object> tables_;
+    };
+  }
+}
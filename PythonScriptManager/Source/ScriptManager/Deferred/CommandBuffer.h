@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "..\Dispatch\DispatchScope.h"
+
+namespace scripting {
+  namespace deferred {
+    /// <summary>
+    /// A side effect requested by a script, recorded during dispatch and applied once the GIL is released.
+    /// Text is stored in the owning buffer's arena so commands stay small and trivially copyable.
+    /// </summary>
+    struct DeferredCommand {
+      std::uint16_t opcode = 0;
+      std::uint32_t text_offset = 0;
+      std::uint32_t text_length = 0;
+      std::int64_t values[2] = { 0, 0 };
+
+      std::string_view text(const char* arena) const {
+        return std::string_view(arena + text_offset, text_length);
+      }
+    };
+
+    /// <summary>
+    /// Applies every queued command with one opcode. Called without the GIL.
+    /// </summary>
+    /// <param name="commands">The commands in the order scripts queued them</param>
+    /// <param name="count">Number of commands</param>
+    /// <param name="arena">Text arena the commands' text points in to</param>
+    /// <param name="user_data">The pointer given when the opcode was registered</param>
+    using ApplyFunction = void(*)(const DeferredCommand* commands, std::size_t count, const char* arena, void* user_data);
+
+    /// <summary>
+    /// Takes a whole batch instead of applying it, used by worker processes to send their side effects to the game.
+    /// </summary>
+    using ForwardFunction = void(*)(const std::vector<DeferredCommand>& commands, const std::string& arena, void* user_data);
+
+    /// <summary>
+    /// The C++ functions that apply each kind of deferred command.
+    /// </summary>
+    class CommandTable {
+    public:
+      static CommandTable& instance() {
+        static CommandTable instance;
+        return instance;
+      }
+
+      /// <summary>
+      /// Register an applier. Opcodes are applied in the order they were registered.
+      /// </summary>
+      /// <returns>The opcode scripts queue the command with.</returns>
+      std::uint16_t register_command(std::string name, const ApplyFunction apply, void* user_data = nullptr) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        entries_.push_back({ std::move(name), apply, user_data });
+        return static_cast<std::uint16_t>(entries_.size() - 1);
+      }
+
+      /// <summary>
+      /// Hand every batch to a forwarder rather than applying it. Pass nullptr to apply batches again.
+      /// </summary>
+      void set_forwarder(const ForwardFunction forward, void* user_data = nullptr) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        forward_ = forward;
+        forward_user_data_ = user_data;
+      }
+
+      /// <summary>
+      /// Apply a batch of commands grouped by opcode. Commands with the same opcode keep their queued order.
+      /// </summary>
+      void apply(std::vector<DeferredCommand>& commands, const std::string& arena) const {
+        {
+          std::shared_lock<std::shared_mutex> lock(mutex_);
+          if (forward_) {
+            forward_(commands, arena, forward_user_data_);
+            return;
+          }
+        }
+
+        const auto by_opcode = [](const DeferredCommand& lhs, const DeferredCommand& rhs) { return lhs.opcode < rhs.opcode; };
+        if (!std::is_sorted(commands.begin(), commands.end(), by_opcode)) {
+          std::stable_sort(commands.begin(), commands.end(), by_opcode);
+        }
+
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (std::size_t begin = 0; begin < commands.size();) {
+          auto end = begin + 1;
+          while (end < commands.size() && commands[end].opcode == commands[begin].opcode) {
+            ++end;
+          }
+
+          const auto& entry = entries_.at(commands[begin].opcode);
+          entry.apply(commands.data() + begin, end - begin, arena.data(), entry.user_data);
+          begin = end;
+        }
+      }
+
+    private:
+      struct Entry {
+        std::string name;
+        ApplyFunction apply;
+        void* user_data;
+      };
+
+      mutable std::shared_mutex mutex_;
+      std::deque<Entry> entries_;
+      ForwardFunction forward_ = nullptr;
+      void* forward_user_data_ = nullptr;
+    };
+
+    /// <summary>
+    /// Commands queued by scripts on the current thread during its outermost dispatch.
+    /// Scripts append while holding the GIL and the dispatching thread flushes after releasing it, so the buffer
+    /// being thread local means neither side needs a lock.
+    /// </summary>
+    class CommandBuffer {
+    public:
+      static CommandBuffer& current() {
+        thread_local CommandBuffer buffer;
+        return buffer;
+      }
+
+      /// <summary>
+      /// Queue a command. Outside of a dispatch nothing would flush it so it is applied straight away.
+      /// </summary>
+      void append(const std::uint16_t opcode, const std::string_view text, const std::int64_t first = 0, const std::int64_t second = 0) {
+        DeferredCommand command;
+        command.opcode = opcode;
+        command.text_offset = static_cast<std::uint32_t>(arena_.size());
+        command.text_length = static_cast<std::uint32_t>(text.size());
+        command.values[0] = first;
+        command.values[1] = second;
+
+        arena_.append(text);
+        commands_.push_back(command);
+
+        if (!dispatch::DispatchScope::active()) {
+          flush();
+        }
+      }
+
+      /// <summary>
+      /// Apply and clear every queued command. Should be called without the GIL.
+      /// </summary>
+      void flush() {
+        if (commands_.empty()) {
+          return;
+        }
+
+        // An applier may dispatch another event which flushes again, so apply from a detached batch.
+        std::vector<DeferredCommand> commands;
+        std::string arena;
+        commands.swap(commands_);
+        arena.swap(arena_);
+
+        CommandTable::instance().apply(commands, arena);
+
+        // Hand the storage back so steady state dispatching does not allocate.
+        if (commands_.empty()) {
+          commands.clear();
+          arena.clear();
+          commands_.swap(commands);
+          arena_.swap(arena);
+        }
+      }
+
+      std::size_t size() const { return commands_.size(); }
+
+    private:
+      std::vector<DeferredCommand> commands_;
+      std::string arena_;
+    };
+  }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "..\ScriptManager.h"
+
+namespace scripting {
+  namespace definitions {
+
+    /// <summary>
+    /// Send an event to the other processes on the bridge without dispatching it locally.
+    /// </summary>
+    inline bool broadcast(const std::string& event_key_name, const py::args& arguments) {
+      return ScriptManager::instance().event_bridge().publish_python(event_key_name, arguments);
+    }
+
+    namespace event_bridge {
+      inline void apply_definitions(py::module& module) {
+        module.def("broadcast", &broadcast, py::arg("event_name"));
+      }
+    }
+  }
+}
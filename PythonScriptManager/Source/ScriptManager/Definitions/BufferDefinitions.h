@@ -0,0 +1,19 @@
+#pragma once
+#include "..\ScriptManager.h"
+#include "..\Buffers\EntitySnapshot.h"
+#include "..\Buffers\PacketBuffer.h"
+
+namespace scripting {
+  namespace definitions {
+    namespace packet_buffers {
+      /// <summary>
+      /// Packet buffers reach scripts as memoryviews, valid until the game recycles the buffer. Entity snapshots
+      /// reach them as columns of numbers read through typed memoryviews.
+      /// </summary>
+      inline void apply_definitions(py::module& module) {
+        module.attr("PacketBuffer") = scripting::buffers::make_exporter_type();
+        scripting::buffers::EntitySnapshot::apply_class_definitions(module);
+      }
+    }
+  }
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "..\ScriptManager.h"
+
+namespace scripting {
+  namespace definitions {
+    namespace message_bus {
+      inline void apply_definitions(py::module& module) {
+        scripting::bus::MessageBus::apply_class_definitions(module);
+
+        // The bus lives as long as the manager, python only ever borrows it.
+        module.attr("bus") = py::cast(&ScriptManager::instance().message_bus(), py::return_value_policy::reference);
+      }
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "..\ScriptManager.h"
+
+namespace scripting {
+  namespace definitions {
+
+    /// <summary>
+    /// Register a chat command handler. The handler is called with the dispatch context followed by the parsed arguments.
+    /// </summary>
+    /// <param name="name">Command name without the chat prefix</param>
+    /// <param name="handler">The python callable that owns the command</param>
+    /// <param name="argument_specs">Argument types: "str", "int", "float" or "rest", suffixed with "?" when optional</param>
+    inline void register_command(const std::string& name, const py::function& handler, const py::iterable& argument_specs) {
+      commands::Command command;
+      command.name = name;
+      command.handler = handler;
+      if (py::hasattr(handler, "__module__") && py::isinstance<py::str>(handler.attr("__module__"))) {
+        command.owner_module = handler.attr("__module__").cast<std::string>();
+      }
+
+      for (const auto& spec : argument_specs) {
+        commands::ArgumentSpec argument;
+        if (!commands::CommandRouter::parse_spec(spec.cast<std::string>(), argument)) {
+          throw py::value_error("Unknown command argument type: " + spec.cast<std::string>());
+        }
+        command.arguments.push_back(argument);
+      }
+
+      std::string error;
+      if (!ScriptManager::instance().command_router().register_command(std::move(command), error)) {
+        throw py::value_error(error);
+      }
+    }
+
+    inline bool unregister_command(const std::string& name) {
+      return ScriptManager::instance().command_router().unregister_command(name);
+    }
+
+    namespace chat_commands {
+      inline void apply_definitions(py::module& module) {
+        module.def("register_command", &register_command, py::arg("name"), py::arg("handler"), py::arg("arguments") = py::list());
+        module.def("unregister_command", &unregister_command, py::arg("name"));
+      }
+    }
+  }
+}
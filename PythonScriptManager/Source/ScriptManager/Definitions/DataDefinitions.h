@@ -0,0 +1,28 @@
+#pragma once
+#include "..\ScriptManager.h"
+#include "..\Data\DataTable.h"
+
+namespace scripting {
+  namespace definitions {
+    namespace game_data {
+      /// <summary>
+      /// Tables published with publish_table are read through example_module.table(name), a mapping of id to row.
+      /// </summary>
+      inline void apply_definitions(py::module& module) {
+        scripting::data::apply_type_definitions(module);
+
+        module.def("table", [](const std::string& name) {
+          return scripting::ScriptManager::instance().data_tables().get(name);
+        }, py::arg("name"));
+
+        module.def("tables", []() {
+          return scripting::ScriptManager::instance().data_tables().names();
+        });
+
+        module.def("has_table", [](const std::string& name) {
+          return scripting::ScriptManager::instance().data_tables().contains(name);
+        }, py::arg("name"));
+      }
+    }
+  }
+}
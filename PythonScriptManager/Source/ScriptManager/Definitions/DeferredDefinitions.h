@@ -0,0 +1,45 @@
+#pragma once
+#include "..\ScriptManager.h"
+#include "ExampleDefinitions.h"
+
+namespace scripting {
+  namespace definitions {
+    namespace deferred_commands {
+      /// <summary>
+      /// Print a batch of queued messages with a single write.
+      /// </summary>
+      inline void apply_output_text(const scripting::deferred::DeferredCommand* commands, const std::size_t count, const char* arena, void*) {
+        std::string output;
+        for (std::size_t i = 0; i < count; ++i) {
+          output.append(commands[i].text(arena));
+          output += '\n';
+        }
+        std::cout << output << std::flush;
+      }
+
+      inline std::uint16_t send_message_opcode = 0;
+      inline std::uint16_t event_handled_opcode = 0;
+
+      inline void send_message(const std::string_view text) {
+        scripting::deferred::CommandBuffer::current().append(send_message_opcode, text);
+      }
+
+      inline void event_handled(const std::string_view text) {
+        scripting::deferred::CommandBuffer::current().append(event_handled_opcode, text);
+      }
+
+      /// <summary>
+      /// Queued versions of the module's side effect functions, applied once the dispatch has released the GIL.
+      /// </summary>
+      inline void apply_definitions(py::module& module) {
+        auto& table = scripting::deferred::CommandTable::instance();
+        send_message_opcode = table.register_command("send_message", &apply_output_text);
+        event_handled_opcode = table.register_command("event_handled", &apply_output_text);
+
+        auto deferred = module.def_submodule("deferred", "Side effects applied after the current dispatch releases the GIL");
+        deferred.def("send_message", &send_message, py::arg("text"));
+        deferred.def("event_handled", &event_handled, py::arg("text"));
+      }
+    }
+  }
+}
@@ -1,7 +1,18 @@
 #include <pybind11\embed.h>
 #include "..\..\User.h"
+#include "BridgeDefinitions.h"
+#include "BufferDefinitions.h"
+#include "BusDefinitions.h"
+#include "CommandDefinitions.h"
+#include "DataDefinitions.h"
+#include "DeferredDefinitions.h"
+#include "DispatchDefinitions.h"
 #include "ExampleDefinitions.h"
+#include "FormulaDefinitions.h"
+#include "HandleDefinitions.h"
+#include "JobDefinitions.h"
 #include "LoadTestDefinitions.h"
+#include "ProxyDefinitions.h"
 using namespace scripting::definitions;
 
 PYBIND11_EMBEDDED_MODULE(example_module, module)
@@ -9,5 +20,16 @@ PYBIND11_EMBEDDED_MODULE(example_module, module)
   module.doc() = "Example Module";
   example::apply_definitions(module);
   loadtest::apply_definitions(module);
+  formulas::apply_definitions(module);
+  chat_commands::apply_definitions(module);
+  message_bus::apply_definitions(module);
+  deferred_commands::apply_definitions(module);
+  event_bridge::apply_definitions(module);
+  native_jobs::apply_definitions(module);
+  entity_handles::apply_definitions(module);
+  packet_buffers::apply_definitions(module);
+  batch_events::apply_definitions(module);
+  lazy_proxies::apply_definitions(module);
+  game_data::apply_definitions(module);
   User::apply_class_definitions(module);
 }
\ No newline at end of file
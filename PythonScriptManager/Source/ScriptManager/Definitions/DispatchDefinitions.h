@@ -0,0 +1,22 @@
+#pragma once
+#include "..\ScriptManager.h"
+#include "..\Dispatch\BatchDispatch.h"
+
+namespace scripting {
+  namespace definitions {
+    namespace batch_events {
+      /// <summary>
+      /// Decorator marking an event handler as taking a whole batch event in one call: the list of entities, then one
+      /// list per argument column.
+      /// </summary>
+      inline py::function batch_handler(const py::function& function) {
+        function.attr(dispatch::kBatchHandlerAttribute) = true;
+        return function;
+      }
+
+      inline void apply_definitions(py::module& module) {
+        module.def("batch_handler", &batch_handler, py::arg("function"));
+      }
+    }
+  }
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "..\ScriptManager.h"
+#include "..\Wrappers\FastCall.h"
 
 namespace scripting {
   namespace definitions {
@@ -16,10 +17,18 @@ namespace scripting {
       output_text(text);
     }
 
+    /// <summary>
+    /// Dispatch an event from a script. Handled according to the nested dispatch policy when called from a handler.
+    /// </summary>
+    inline void dispatch_event(const std::string& event_key_name, const py::args& arguments) {
+      ScriptManager::instance().dispatch_event_arguments(event_key_name, arguments);
+    }
+
     namespace example {
       inline void apply_definitions(py::module& module) {
         module.def("reload_script", &reload_script);
-        module.def("send_message", &handle_message);
+        scripting::wrappers::def_fastcall<&handle_message>(module, "send_message");
+        module.def("dispatch_event", &dispatch_event);
       }
     }
   }
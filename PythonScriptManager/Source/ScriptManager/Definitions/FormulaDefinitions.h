@@ -0,0 +1,27 @@
+#pragma once
+#include "..\ScriptManager.h"
+
+namespace scripting {
+  namespace definitions {
+
+    /// <summary>
+    /// Decorator marking a script function for native compilation when its module loads.
+    /// </summary>
+    inline py::function native_formula(const py::function& function) {
+      function.attr(formula::kNativeFormulaAttribute) = true;
+      return function;
+    }
+
+    inline double level_scale(const long long level) {
+      return 1.0 + static_cast<double>(level) * 0.05;
+    }
+
+    namespace formulas {
+      inline void apply_definitions(py::module& module) {
+        module.def("native_formula", &native_formula);
+        formula::native_formula_decorator() = module.attr("native_formula").ptr();
+        formula::def_formula_accessor(module, "level_scale", &level_scale);
+      }
+    }
+  }
+}
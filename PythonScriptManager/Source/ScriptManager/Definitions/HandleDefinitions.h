@@ -0,0 +1,25 @@
+#pragma once
+#include "..\ScriptManager.h"
+#include "..\Handles\EntityHandle.h"
+
+namespace scripting {
+  namespace definitions {
+    namespace entity_handles {
+      /// <summary>
+      /// The entity behind a handle, or None once it is gone.
+      /// </summary>
+      inline py::object resolve(const scripting::handles::EntityHandle handle) {
+        return scripting::handles::HandleRegistry::instance().resolve(handle);
+      }
+
+      /// <summary>
+      /// Handles let scripts keep references to game entities across ticks: store user.handle in a global and call
+      /// resolve(handle) when it is needed again.
+      /// </summary>
+      inline void apply_definitions(py::module& module) {
+        module.attr("EntityHandle") = scripting::handles::make_handle_type();
+        module.def("resolve", &resolve, py::arg("handle"));
+      }
+    }
+  }
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+#include "..\ScriptManager.h"
+
+namespace scripting {
+  namespace definitions {
+    namespace native_jobs {
+      /// <summary>
+      /// Breadth first search across a size by size grid with a repeating pattern of obstacles, from the top left
+      /// corner to the bottom right. The same search path_search.py runs in python.
+      /// </summary>
+      /// <returns>Steps to the goal, or -1 if it cannot be reached, and the number of cells visited.</returns>
+      inline std::pair<int, int> search_path(const long long seed, const int size) {
+        if (size <= 0) {
+          return { -1, 0 };
+        }
+
+        // Python's % floors, so the seed's remainder is never negative, and taking it first keeps the sum from overflowing.
+        const auto offset = (seed % 5 + 5) % 5;
+        const auto blocked = [offset](const int x, const int y) {
+          return (static_cast<long long>(x) * 7 + static_cast<long long>(y) * 13 + offset) % 5 == 0 && x != y;
+        };
+        std::vector<int> distances(static_cast<std::size_t>(size) * size, -1);
+        std::deque<std::pair<int, int>> frontier = { { 0, 0 } };
+        distances[0] = 0;
+        auto visited = 1;
+        while (!frontier.empty()) {
+          const auto [x, y] = frontier.front();
+          frontier.pop_front();
+          if (x == size - 1 && y == size - 1) {
+            break;
+          }
+          const std::pair<int, int> neighbours[] = { { x + 1, y }, { x - 1, y }, { x, y + 1 }, { x, y - 1 } };
+          for (const auto& [next_x, next_y] : neighbours) {
+            if (next_x < 0 || next_x >= size || next_y < 0 || next_y >= size || blocked(next_x, next_y)) {
+              continue;
+            }
+            auto& distance = distances[static_cast<std::size_t>(next_y) * size + next_x];
+            if (distance < 0) {
+              distance = distances[static_cast<std::size_t>(y) * size + x] + 1;
+              frontier.emplace_back(next_x, next_y);
+              ++visited;
+            }
+          }
+        }
+        return { distances.back(), visited };
+      }
+
+      /// <summary>
+      /// Job: find_path(seed, size) -> (steps, visited)
+      /// </summary>
+      inline void find_path_job(scripting::jobs::JobContext& context) {
+        const auto [steps, visited] = search_path(context.argument<long long>(0), context.argument<int>(1));
+        context.set_result(steps, visited);
+      }
+
+      /// <summary>
+      /// Job: sort_numbers(count, seed) -> (smallest, median, largest) of count random numbers, sorted natively.
+      /// </summary>
+      inline void sort_numbers_job(scripting::jobs::JobContext& context) {
+        const auto count = context.argument<long long>(0);
+        if (count <= 0 || count > 100000000) {
+          context.fail("count must be between 1 and 100000000");
+          return;
+        }
+
+        std::mt19937_64 generator(context.argument<unsigned long long>(1));
+        std::vector<double> numbers(static_cast<std::size_t>(count));
+        std::uniform_real_distribution<double> distribution(0.0, 1.0);
+        for (auto& number : numbers) {
+          number = distribution(generator);
+        }
+        std::sort(numbers.begin(), numbers.end());
+        context.set_result(numbers.front(), numbers[numbers.size() / 2], numbers.back());
+      }
+
+      /// <summary>
+      /// Run the search straight away on the calling thread. The GIL is released while it runs.
+      /// </summary>
+      inline std::pair<int, int> find_path_now(const long long seed, const int size) {
+        return search_path(seed, size);
+      }
+
+      inline std::shared_ptr<scripting::jobs::JobFuture> submit(const std::string& job_name, const py::object& arguments, const std::string& event) {
+        const auto values = py::isinstance<py::tuple>(arguments) || py::isinstance<py::list>(arguments) ? py::tuple(arguments) : py::make_tuple(arguments);
+        return ScriptManager::instance().script_jobs().submit(job_name, values, event);
+      }
+
+      /// <summary>
+      /// Native work scripts hand to the job pool. submit returns a JobFuture at once; the job runs without the GIL
+      /// and the future is filled in, and the event dispatched with it, once the game calls pump_jobs.
+      /// </summary>
+      inline void apply_definitions(py::module& module) {
+        auto& pool = ScriptManager::instance().script_jobs().pool();
+        pool.register_job("find_path", &find_path_job);
+        pool.register_job("sort_numbers", &sort_numbers_job);
+
+        scripting::jobs::JobFuture::apply_class_definitions(module);
+        module.def("submit", &submit, py::arg("job_name"), py::arg("args") = py::tuple(), py::arg("event") = std::string());
+
+        auto jobs = module.def_submodule("jobs", "Native work run without holding the GIL");
+        jobs.def("find_path", &find_path_now, py::arg("seed"), py::arg("size"), py::call_guard<scripting::gil::GilRelease>());
+      }
+    }
+  }
+}
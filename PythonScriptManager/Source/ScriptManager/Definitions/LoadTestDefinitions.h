@@ -1,5 +1,6 @@
 #pragma once
 #include "..\ScriptManager.h"
+#include "..\Wrappers\FastCall.h"
 
 namespace scripting {
   namespace definitions {
@@ -10,7 +11,8 @@ namespace scripting {
 
       namespace loadtest {
         inline void apply_definitions(py::module& module) {
-          module.def("event_handled", &event_handled);
+          // Called by every loadtest handler.
+          scripting::wrappers::def_fastcall<&event_handled>(module, "event_handled");
         }
       }
   }
@@ -0,0 +1,16 @@
+#pragma once
+#include "..\ScriptManager.h"
+#include "..\Wrappers\LazyProxy.h"
+
+namespace scripting {
+  namespace definitions {
+    namespace lazy_proxies {
+      /// <summary>
+      /// Objects passed with wrappers::lazy reach scripts as LazyProxy objects, whose fields are read as attributes.
+      /// </summary>
+      inline void apply_definitions(py::module& module) {
+        module.attr("LazyProxy") = scripting::wrappers::make_lazy_proxy_type();
+      }
+    }
+  }
+}
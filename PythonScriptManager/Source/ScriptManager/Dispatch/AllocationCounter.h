@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+namespace scripting {
+  namespace dispatch {
+    /// <summary>
+    /// Counts the allocations python makes for objects, by wrapping the object allocator while started. Used to check
+    /// how much a dispatch allocates in steady state; the counting costs little but is meant for measuring, not to be
+    /// left running.
+    /// </summary>
+    class AllocationCounter {
+    public:
+      static AllocationCounter& instance() {
+        static AllocationCounter counter;
+        return counter;
+      }
+
+      /// <summary>
+      /// Start counting. Must be called with the GIL held.
+      /// </summary>
+      void start() {
+        if (running_) {
+          return;
+        }
+        PyMem_GetAllocator(PYMEM_DOMAIN_OBJ, &original_);
+        PyMemAllocatorEx hook = { this, &hook_malloc, &hook_calloc, &hook_realloc, &hook_free };
+        PyMem_SetAllocator(PYMEM_DOMAIN_OBJ, &hook);
+        running_ = true;
+      }
+
+      /// <summary>
+      /// Stop counting. Memory allocated while counting is freed through the same allocator as before.
+      /// Must be called with the GIL held.
+      /// </summary>
+      void stop() {
+        if (!running_) {
+          return;
+        }
+        PyMem_SetAllocator(PYMEM_DOMAIN_OBJ, &original_);
+        running_ = false;
+      }
+
+      bool running() const { return running_; }
+
+      /// <summary>
+      /// Allocations, including reallocations that had to move, since start up or the last reset.
+      /// </summary>
+      std::uint64_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+
+      void reset() { allocations_.store(0, std::memory_order_relaxed); }
+
+    private:
+      AllocationCounter() = default;
+
+      static void* hook_malloc(void* context, const std::size_t size) {
+        const auto self = static_cast<AllocationCounter*>(context);
+        self->allocations_.fetch_add(1, std::memory_order_relaxed);
+        return self->original_.malloc(self->original_.ctx, size);
+      }
+
+      static void* hook_calloc(void* context, const std::size_t count, const std::size_t size) {
+        const auto self = static_cast<AllocationCounter*>(context);
+        self->allocations_.fetch_add(1, std::memory_order_relaxed);
+        return self->original_.calloc(self->original_.ctx, count, size);
+      }
+
+      static void* hook_realloc(void* context, void* pointer, const std::size_t size) {
+        const auto self = static_cast<AllocationCounter*>(context);
+        const auto result = self->original_.realloc(self->original_.ctx, pointer, size);
+        if (result != pointer) {
+          self->allocations_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return result;
+      }
+
+      static void hook_free(void* context, void* pointer) {
+        const auto self = static_cast<AllocationCounter*>(context);
+        self->original_.free(self->original_.ctx, pointer);
+      }
+
+      PyMemAllocatorEx original_{};
+      bool running_ = false;
+      std::atomic<std::uint64_t> allocations_{ 0 };
+    };
+  }
+}
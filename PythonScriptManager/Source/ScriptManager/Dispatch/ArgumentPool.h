@@ -0,0 +1,357 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Strings\StringTable.h"
+
+namespace scripting {
+  namespace dispatch {
+    /// <summary>
+    /// Convert an event argument to a new reference, throwing if it cannot be converted.
+    /// </summary>
+    template <typename T>
+    PyObject* argument_reference(T&& value) {
+      auto object = strings::to_python(std::forward<T>(value));
+      if (!object) {
+        if (PyErr_Occurred()) {
+          throw py::error_already_set();
+        }
+        throw py::cast_error("Unable to convert an event argument to a Python object");
+      }
+      return object.release().ptr();
+    }
+
+    /// <summary>
+    /// Argument tuples kept for reuse, one freelist per arity. A tuple is only taken back when the dispatch held the
+    /// last reference to it; tuples a script kept, or a queued nested event still holds, are left alone.
+    /// Only used with the GIL held.
+    /// </summary>
+    class ArgumentPool {
+    public:
+      static constexpr std::size_t kMaxArity = 8;
+      static constexpr std::size_t kMaxPooled = 64;
+
+      /// <summary>
+      /// Convert the arguments in to a tuple from the pool, or a new one when the pool is empty or disabled.
+      /// </summary>
+      template <typename... Args>
+      py::tuple pack(Args&&... args) {
+        auto tuple = acquire(sizeof...(Args));
+        Py_ssize_t index = 0;
+        // Left to right, so the tuple never holds an item after an empty slot.
+        ((PyTuple_SET_ITEM(tuple.ptr(), index++, argument_reference(std::forward<Args>(args)))), ...);
+        return tuple;
+      }
+
+      /// <summary>
+      /// Hand a tuple back once its dispatch is over. Its items are released straight away either way.
+      /// </summary>
+      void release(py::tuple&& arguments) {
+        const auto tuple = arguments.release().ptr();
+        const auto size = static_cast<std::size_t>(PyTuple_GET_SIZE(tuple));
+        if (!enabled_ || size == 0 || size > kMaxArity) {
+          Py_DECREF(tuple);
+          return;
+        }
+        if (Py_REFCNT(tuple) != 1) {
+          ++retained_;
+          Py_DECREF(tuple);
+          return;
+        }
+
+        auto& free = free_[size];
+        if (free.size() >= kMaxPooled) {
+          Py_DECREF(tuple);
+          return;
+        }
+        for (std::size_t i = 0; i < size; ++i) {
+          const auto item = PyTuple_GET_ITEM(tuple, i);
+          PyTuple_SET_ITEM(tuple, i, nullptr);
+          Py_XDECREF(item);
+        }
+        // A tuple with empty slots must not be reachable through gc.get_objects() while it waits in the pool.
+        if (PyObject_GC_IsTracked(tuple)) {
+          PyObject_GC_UnTrack(tuple);
+        }
+        free.push_back(tuple);
+      }
+
+      /// <summary>
+      /// Turn pooling on or off, for comparing the two. Turning it off drops the pooled tuples.
+      /// </summary>
+      void set_enabled(const bool enabled) {
+        enabled_ = enabled;
+        if (!enabled_) {
+          clear();
+        }
+      }
+
+      bool enabled() const { return enabled_; }
+
+      /// <summary>
+      /// Drop every pooled tuple. Must be called with the GIL held, before the interpreter is finalized.
+      /// </summary>
+      void clear() {
+        for (auto& free : free_) {
+          for (const auto tuple : free) {
+            Py_DECREF(tuple);
+          }
+          free.clear();
+        }
+      }
+
+      // Tuples created because the freelist was empty, taken from it, and not taken back because something kept them.
+      std::uint64_t allocated() const { return allocated_; }
+      std::uint64_t reused() const { return reused_; }
+      std::uint64_t retained() const { return retained_; }
+
+    private:
+      py::tuple acquire(const std::size_t size) {
+        if (enabled_ && size > 0 && size <= kMaxArity && !free_[size].empty()) {
+          const auto tuple = free_[size].back();
+          free_[size].pop_back();
+          ++reused_;
+          // Untracked while pooled.
+          if (!PyObject_GC_IsTracked(tuple)) {
+            PyObject_GC_Track(tuple);
+          }
+          return py::reinterpret_steal<py::tuple>(tuple);
+        }
+
+        ++allocated_;
+        const auto tuple = PyTuple_New(static_cast<Py_ssize_t>(size));
+        if (!tuple) {
+          throw py::error_already_set();
+        }
+        return py::reinterpret_steal<py::tuple>(tuple);
+      }
+
+      bool enabled_ = true;
+      std::array<std::vector<PyObject*>, kMaxArity + 1> free_;
+      std::uint64_t allocated_ = 0;
+      std::uint64_t reused_ = 0;
+      std::uint64_t retained_ = 0;
+    };
+
+    class PayloadShape;
+
+    /// <summary>
+    /// The dict payloads the current thread handed out and has not taken back, with the shape each came from.
+    /// Only touched with the GIL held.
+    /// </summary>
+    inline std::vector<std::pair<PayloadShape*, PyObject*>>& lent_payloads() {
+      thread_local std::vector<std::pair<PayloadShape*, PyObject*>> payloads;
+      return payloads;
+    }
+
+    template <typename... Values>
+    struct ShapedPayload;
+
+    /// <summary>
+    /// The keys of a dict payload an event always sends, such as a trade's item, count and price. Keeps the dicts it
+    /// builds for reuse: their keys stay in place and only the values are replaced, so a steady stream of events
+    /// stops allocating a dict and its key table each time. Declare one per event shape, for the life of the program:
+    /// static PayloadShape trade({ "item_id", "count", "price" });
+    /// dispatch_event("on_trade", cached(user), trade.with(item_id, count, price));
+    /// Only used with the GIL held.
+    /// </summary>
+    class PayloadShape {
+    public:
+      static constexpr std::size_t kMaxPooled = 16;
+
+      PayloadShape(const std::initializer_list<const char*> keys) : key_names_(keys) {
+        shapes().push_back(this);
+      }
+      PayloadShape(const PayloadShape&) = delete;
+      PayloadShape& operator=(const PayloadShape&) = delete;
+
+      // Dicts still pooled once the interpreter is gone went with it.
+      ~PayloadShape() {
+        auto& all = shapes();
+        all.erase(std::remove(all.begin(), all.end(), this), all.end());
+      }
+
+      /// <summary>
+      /// Every shape declared, for dropping their pooled dicts at shutdown.
+      /// </summary>
+      static std::vector<PayloadShape*>& shapes() {
+        static std::vector<PayloadShape*> all;
+        return all;
+      }
+
+      /// <summary>
+      /// A payload argument with a value for each key, in the order the keys were given.
+      /// </summary>
+      template <typename... Values>
+      ShapedPayload<Values...> with(Values&&... values) {
+        return { this, { std::forward<Values>(values)... } };
+      }
+
+      std::size_t size() const { return key_names_.size(); }
+
+      /// <summary>
+      /// Fill a dict from the pool, or a new one, with the values. Returns a new reference.
+      /// </summary>
+      template <typename... Values>
+      PyObject* fill(const std::tuple<Values...>& values) {
+        if (sizeof...(Values) != key_names_.size()) {
+          throw py::value_error("a payload needs one value per key");
+        }
+        if (keys_.empty()) {
+          for (const auto name : key_names_) {
+            keys_.push_back(PyUnicode_InternFromString(name));
+          }
+        }
+
+        PyObject* dict;
+        if (!free_.empty()) {
+          dict = free_.back();
+          free_.pop_back();
+          ++reused_;
+        }
+        else {
+          dict = PyDict_New();
+          if (!dict) {
+            throw py::error_already_set();
+          }
+          ++allocated_;
+        }
+        auto owned = py::reinterpret_steal<py::object>(dict);
+
+        std::apply([this, dict](const auto&... value) {
+          std::size_t index = 0;
+          (set_item(dict, index++, value), ...);
+        }, values);
+
+        Py_INCREF(dict);
+        lent_payloads().emplace_back(this, dict);
+        return owned.release().ptr();
+      }
+
+      // Dicts created because none were free, taken from the pool, and not taken back because something kept them.
+      std::uint64_t allocated() const { return allocated_; }
+      std::uint64_t reused() const { return reused_; }
+      std::uint64_t retained() const { return retained_; }
+
+      /// <summary>
+      /// Take back a lent dict. Its values are replaced with None so nothing stays alive through the pool, and it is
+      /// dropped instead if a script kept it or changed its keys.
+      /// </summary>
+      void recycle(PyObject* dict) {
+        if (Py_REFCNT(dict) != 1) {
+          ++retained_;
+          Py_DECREF(dict);
+          return;
+        }
+        if (free_.size() >= kMaxPooled) {
+          Py_DECREF(dict);
+          return;
+        }
+        for (const auto key : keys_) {
+          if (PyDict_SetItem(dict, key, Py_None) < 0) {
+            PyErr_Clear();
+            Py_DECREF(dict);
+            return;
+          }
+        }
+        if (PyDict_GET_SIZE(dict) != static_cast<Py_ssize_t>(keys_.size())) {
+          Py_DECREF(dict);
+          return;
+        }
+        free_.push_back(dict);
+      }
+
+      /// <summary>
+      /// Drop every pooled dict. Must be called with the GIL held, before the interpreter is finalized.
+      /// </summary>
+      void clear() {
+        for (const auto dict : free_) {
+          Py_DECREF(dict);
+        }
+        free_.clear();
+      }
+
+    private:
+      template <typename V>
+      void set_item(PyObject* dict, const std::size_t index, const V& value) {
+        const auto item = py::reinterpret_steal<py::object>(argument_reference(value));
+        if (PyDict_SetItem(dict, keys_[index], item.ptr()) < 0) {
+          throw py::error_already_set();
+        }
+      }
+
+      std::vector<const char*> key_names_;
+      std::vector<PyObject*> keys_;
+      std::vector<PyObject*> free_;
+      std::uint64_t allocated_ = 0;
+      std::uint64_t reused_ = 0;
+      std::uint64_t retained_ = 0;
+    };
+
+    /// <summary>
+    /// Take back every payload the current thread lent since the last call, once the dispatches that used them are
+    /// over. Must be called with the GIL held.
+    /// </summary>
+    /// <param name="pool">Keep the dicts for reuse, or just release them</param>
+    inline void recycle_payloads(const bool pool) {
+      auto& payloads = lent_payloads();
+      // Recycling may release objects whose finalizers dispatch events and lend more payloads.
+      std::vector<std::pair<PayloadShape*, PyObject*>> lent;
+      lent.swap(payloads);
+      for (const auto& [shape, dict] : lent) {
+        if (pool) {
+          shape->recycle(dict);
+        }
+        else {
+          Py_DECREF(dict);
+        }
+      }
+    }
+
+    /// <summary>
+    /// Drop every payload shape's pooled dicts. Must be called with the GIL held, before the interpreter is finalized.
+    /// </summary>
+    inline void clear_payloads() {
+      recycle_payloads(false);
+      for (const auto shape : PayloadShape::shapes()) {
+        shape->clear();
+      }
+    }
+
+    /// <summary>
+    /// A payload argument, converted to a dict from its shape's pool. Holds its values, text as strings of its own,
+    /// so it can be posted to the executor as well.
+    /// </summary>
+    template <typename... Values>
+    struct ShapedPayload {
+      PayloadShape* shape;
+      std::tuple<strings::owned_t<Values>...> values;
+    };
+  }
+}
+
+namespace pybind11 {
+  namespace detail {
+    /// <summary>
+    /// Converts payload arguments to a dict of their values.
+    /// </summary>
+    template <typename... Values>
+    struct type_caster<scripting::dispatch::ShapedPayload<Values...>> {
+      PYBIND11_TYPE_CASTER(scripting::dispatch::ShapedPayload<Values...>, const_name("dict"));
+
+      // Only ever passed from C++ to python.
+      bool load(handle, bool) { return false; }
+
+      static handle cast(const scripting::dispatch::ShapedPayload<Values...>& value, return_value_policy, handle) {
+        return value.shape->fill(value.values);
+      }
+    };
+  }
+}
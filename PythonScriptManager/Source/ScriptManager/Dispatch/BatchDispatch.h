@@ -0,0 +1,85 @@
+#pragma once
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Strings\StringTable.h"
+
+namespace scripting {
+  namespace dispatch {
+    // Set by example_module.batch_handler on handlers that take every entity of a batch event in one call.
+    constexpr const char* kBatchHandlerAttribute = "__batch_handler__";
+
+    /// <summary>
+    /// How a batch event reaches modules whose handler takes one entity at a time.
+    /// </summary>
+    enum class BatchFallback {
+      // Call the handler once per entity, in a loop under the batch's GIL hold.
+      PER_ENTITY = 0,
+      // Only batch handlers see the event.
+      SKIP
+    };
+
+    /// <summary>
+    /// Convert every value of a range to python, text through the string table and objects by reference.
+    /// Must be called with the GIL held.
+    /// </summary>
+    template <typename Range>
+    py::list to_list(const Range& values) {
+      py::list list(static_cast<std::size_t>(std::distance(std::begin(values), std::end(values))));
+      Py_ssize_t index = 0;
+      for (const auto& value : values) {
+        py::object object;
+        if constexpr (strings::is_text_v<decltype(value)>) {
+          object = strings::to_python(value);
+        }
+        else {
+          object = py::cast(value, py::return_value_policy::reference);
+        }
+        PyList_SET_ITEM(list.ptr(), index++, object.release().ptr());
+      }
+      return list;
+    }
+
+    /// <summary>
+    /// Pack a batch event's arguments: a list of the entities, then one list per argument column.
+    /// Must be called with the GIL held.
+    /// </summary>
+    /// <param name="entities">The entities the event is for</param>
+    /// <param name="...columns">One value per entity for each further handler argument</param>
+    template <typename Range, typename... Columns>
+    py::tuple make_batch(const Range& entities, const Columns&... columns) {
+      auto batch = py::make_tuple(to_list(entities), to_list(columns)...);
+      const auto count = PyList_GET_SIZE(PyTuple_GET_ITEM(batch.ptr(), 0));
+      for (Py_ssize_t column = 1; column < PyTuple_GET_SIZE(batch.ptr()); ++column) {
+        if (PyList_GET_SIZE(PyTuple_GET_ITEM(batch.ptr(), column)) != count) {
+          throw std::invalid_argument("argument column " + std::to_string(column) + " does not have one value per entity");
+        }
+      }
+      return batch;
+    }
+
+    /// <summary>
+    /// Number of entities in a packed batch.
+    /// </summary>
+    inline Py_ssize_t batch_size(const py::tuple& batch) {
+      return PyList_GET_SIZE(PyTuple_GET_ITEM(batch.ptr(), 0));
+    }
+
+    /// <summary>
+    /// The arguments a per entity handler takes for one entity of a batch: the entity and its value from each column.
+    /// </summary>
+    inline py::tuple batch_row(const py::tuple& batch, const Py_ssize_t index) {
+      const auto columns = PyTuple_GET_SIZE(batch.ptr());
+      py::tuple row(columns);
+      for (Py_ssize_t column = 0; column < columns; ++column) {
+        const auto value = PyList_GET_ITEM(PyTuple_GET_ITEM(batch.ptr(), column), index);
+        Py_INCREF(value);
+        PyTuple_SET_ITEM(row.ptr(), column, value);
+      }
+      return row;
+    }
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include <string>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Models\ScriptModule.h"
+
+namespace scripting {
+  namespace dispatch {
+    /// <summary>
+    /// How an event dispatched from inside a script handler is handled.
+    /// </summary>
+    enum class NestedDispatchPolicy {
+      // Dispatch straight away, queueing once the nesting depth limit is reached.
+      INLINE = 0,
+      // Queue every nested event until the outermost dispatch has finished.
+      QUEUE
+    };
+
+    /// <summary>
+    /// An event waiting for the outermost dispatch to finish.
+    /// </summary>
+    struct QueuedDispatch {
+      // The single module to send to, or nullptr to dispatch to every module.
+      std::shared_ptr<models::ScriptModule> target;
+      std::string event_name;
+      py::tuple arguments;
+      // Whether the arguments are a batch packed by make_batch.
+      bool batch = false;
+    };
+
+    /// <summary>
+    /// The current thread's nested events, drained in FIFO order at the end of its outermost dispatch.
+    /// Only touched with the GIL held, and always empty once the outermost dispatch returns.
+    /// </summary>
+    class DispatchQueue {
+    public:
+      // Events drained for one outermost dispatch before the rest are dropped, guards against events queueing each other forever.
+      static constexpr std::size_t kMaxQueuedPerDispatch = 10000;
+
+      static DispatchQueue& current() {
+        thread_local DispatchQueue queue;
+        return queue;
+      }
+
+      void push(QueuedDispatch dispatch) {
+        queue_.push_back(std::move(dispatch));
+      }
+
+      /// <summary>
+      /// Take the oldest queued event.
+      /// </summary>
+      /// <returns>false when the queue is empty.</returns>
+      bool pop(QueuedDispatch& dispatch) {
+        if (queue_.empty()) {
+          return false;
+        }
+        dispatch = std::move(queue_.front());
+        queue_.pop_front();
+        return true;
+      }
+
+      bool empty() const { return queue_.empty(); }
+
+      void clear() { queue_.clear(); }
+
+    private:
+      std::deque<QueuedDispatch> queue_;
+    };
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+namespace scripting {
+  namespace dispatch {
+    /// <summary>
+    /// Tracks how deeply event dispatches are nested on the current thread.
+    /// A dispatch is nested when a handler calls back in to C++ which dispatches another event.
+    /// </summary>
+    class DispatchScope {
+    public:
+      DispatchScope() : outermost_(depth()++ == 0) {}
+      ~DispatchScope() { --depth(); }
+
+      DispatchScope(const DispatchScope&) = delete;
+      DispatchScope& operator=(const DispatchScope&) = delete;
+
+      /// <summary>
+      /// Whether this is the first dispatch on the thread's stack.
+      /// </summary>
+      bool outermost() const { return outermost_; }
+
+      /// <summary>
+      /// Whether the current thread is inside any dispatch.
+      /// </summary>
+      static bool active() { return depth() > 0; }
+
+      /// <summary>
+      /// The current thread's dispatch nesting depth.
+      /// </summary>
+      static int& depth() {
+        thread_local int depth = 0;
+        return depth;
+      }
+
+    private:
+      bool outermost_;
+    };
+  }
+}
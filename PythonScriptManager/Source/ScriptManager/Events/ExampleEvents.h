@@ -1,13 +1,13 @@
 #pragma once
 #include "..\ScriptManager.h"
 #include <random>
-#include <string>
+#include <string_view>
 
 namespace scripting {
   namespace events {
 
-    inline void send_message(User* user, const std::string& message) {
-      dispatch_event("on_message", user, message);
+    inline void send_message(User* user, const std::string_view message) {
+      dispatch_event("on_message", wrappers::cached(user), message);
     }
 
   }
@@ -0,0 +1,204 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ThreadPlacement.h"
+
+namespace scripting {
+  namespace executor {
+    /// <summary>
+    /// How many executor threads to run and where to place them.
+    /// </summary>
+    struct ExecutorSettings {
+      std::size_t threads = 2;
+      // Thread i uses placements[i % placements.size()]. Empty leaves every thread to the scheduler.
+      std::vector<ThreadPlacement> placements;
+      // Jobs each thread's queue holds before submit turns work away.
+      std::size_t queue_capacity = 4096;
+    };
+
+    /// <summary>
+    /// Dedicated threads that run script work handed over by game threads, so those threads never wait on the GIL.
+    /// Each thread has its own bounded queue, which it allocates itself after its placement is applied so the memory
+    /// comes from its own NUMA node under the kernel's first touch policy.
+    /// </summary>
+    class ScriptExecutor {
+    public:
+      using Job = std::function<void()>;
+
+      ScriptExecutor() = default;
+      ScriptExecutor(const ScriptExecutor&) = delete;
+      ScriptExecutor& operator=(const ScriptExecutor&) = delete;
+      ~ScriptExecutor() { stop(); }
+
+      /// <summary>
+      /// Start the threads and wait until each has applied its placement and allocated its queue.
+      /// A placement that cannot be applied is reported but the thread still runs.
+      /// </summary>
+      /// <param name="settings">Thread count, placements and queue size</param>
+      /// <param name="on_thread_start">Run on each thread before its first job</param>
+      /// <param name="on_thread_exit">Run on each thread after its last job</param>
+      /// <param name="errors">One line per thread whose placement failed</param>
+      /// <returns>false if the executor was already running or the settings ask for no threads.</returns>
+      bool start(const ExecutorSettings& settings, Job on_thread_start, Job on_thread_exit, std::vector<std::string>& errors) {
+        errors.clear();
+        if (running() || settings.threads == 0 || settings.queue_capacity == 0) {
+          return false;
+        }
+
+        queues_.assign(settings.threads, nullptr);
+        std::mutex ready_mutex;
+        std::condition_variable ready_condition;
+        std::size_t ready = 0;
+
+        for (std::size_t i = 0; i < settings.threads; ++i) {
+          const auto placement = settings.placements.empty() ? ThreadPlacement() : settings.placements[i % settings.placements.size()];
+          threads_.emplace_back([&, i, placement, capacity = settings.queue_capacity, on_thread_start, on_thread_exit]() {
+            std::string error;
+            const auto placed = apply_placement(placement, error);
+            auto queue = std::make_shared<Queue>(capacity);
+            if (on_thread_start) {
+              on_thread_start();
+            }
+            {
+              std::lock_guard<std::mutex> lock(ready_mutex);
+              queues_[i] = queue;
+              if (!placed) {
+                errors.push_back("executor thread " + std::to_string(i) + ": could not set " + error);
+              }
+              ++ready;
+              // Notified under the lock, as start returns and destroys the condition once it sees every thread ready.
+              ready_condition.notify_one();
+            }
+
+            // Nothing from start's frame may be touched past this point.
+            run(*queue);
+            if (on_thread_exit) {
+              on_thread_exit();
+            }
+          });
+        }
+
+        std::unique_lock<std::mutex> lock(ready_mutex);
+        ready_condition.wait(lock, [&] { return ready == settings.threads; });
+        running_.store(true, std::memory_order_release);
+        return true;
+      }
+
+      /// <summary>
+      /// Run every job already submitted, then stop the threads. Must not race with submit.
+      /// </summary>
+      void stop() {
+        if (!running_.exchange(false, std::memory_order_acq_rel)) {
+          return;
+        }
+
+        for (const auto& queue : queues_) {
+          {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->stopping = true;
+          }
+          queue->condition.notify_one();
+        }
+        for (auto& thread : threads_) {
+          thread.join();
+        }
+        threads_.clear();
+        queues_.clear();
+      }
+
+      bool running() const { return running_.load(std::memory_order_acquire); }
+
+      /// <summary>
+      /// Queue a job on the next thread with room, taking threads in turn.
+      /// </summary>
+      /// <returns>false if the executor is stopped or every queue is full.</returns>
+      bool submit(Job job) {
+        if (!running()) {
+          return false;
+        }
+
+        const auto count = queues_.size();
+        const auto first = next_.fetch_add(1, std::memory_order_relaxed);
+        for (std::size_t i = 0; i < count; ++i) {
+          auto& queue = *queues_[(first + i) % count];
+          std::unique_lock<std::mutex> lock(queue.mutex);
+          if (queue.size == queue.jobs.size()) {
+            continue;
+          }
+          queue.jobs[(queue.head + queue.size) % queue.jobs.size()] = std::move(job);
+          // The thread only sleeps on an empty queue.
+          const auto wake = queue.size++ == 0;
+          lock.unlock();
+          if (wake) {
+            queue.condition.notify_one();
+          }
+          submitted_.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      std::size_t size() const { return queues_.size(); }
+      std::uint64_t submitted() const { return submitted_.load(std::memory_order_relaxed); }
+      std::uint64_t completed() const { return completed_.load(std::memory_order_relaxed); }
+      std::uint64_t rejected() const { return rejected_.load(std::memory_order_relaxed); }
+      std::uint64_t failed() const { return failed_.load(std::memory_order_relaxed); }
+
+    private:
+      struct Queue {
+        explicit Queue(const std::size_t capacity) : jobs(capacity) {}
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::vector<Job> jobs;
+        std::size_t head = 0;
+        std::size_t size = 0;
+        bool stopping = false;
+      };
+
+      void run(Queue& queue) {
+        while (true) {
+          Job job;
+          {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.condition.wait(lock, [&] { return queue.size > 0 || queue.stopping; });
+            if (queue.size == 0) {
+              return;
+            }
+            job = std::move(queue.jobs[queue.head]);
+            queue.jobs[queue.head] = nullptr;
+            queue.head = (queue.head + 1) % queue.jobs.size();
+            --queue.size;
+          }
+
+          try {
+            job();
+          }
+          catch (...) {
+            failed_.fetch_add(1, std::memory_order_relaxed);
+          }
+          completed_.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+
+      std::atomic<bool> running_{ false };
+      std::vector<std::thread> threads_;
+      std::vector<std::shared_ptr<Queue>> queues_;
+      std::atomic<std::size_t> next_{ 0 };
+      std::atomic<std::uint64_t> submitted_{ 0 };
+      std::atomic<std::uint64_t> completed_{ 0 };
+      std::atomic<std::uint64_t> rejected_{ 0 };
+      std::atomic<std::uint64_t> failed_{ 0 };
+    };
+  }
+}
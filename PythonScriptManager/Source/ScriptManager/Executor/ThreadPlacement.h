@@ -0,0 +1,129 @@
+#pragma once
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace scripting {
+  namespace executor {
+    /// <summary>
+    /// Where and how urgently an executor thread is scheduled.
+    /// </summary>
+    struct ThreadPlacement {
+      // CPUs the thread may run on, empty to let the scheduler choose.
+      std::vector<int> cpus;
+      // Run under SCHED_FIFO at this priority (1-99). Needs CAP_SYS_NICE on Linux.
+      std::optional<int> fifo_priority;
+      // Nice value for the thread (-20 to 19). Ignored when fifo_priority is set.
+      std::optional<int> nice;
+    };
+
+    /// <summary>
+    /// Parse a CPU list in the kernel's format, such as "2-3,6".
+    /// </summary>
+    /// <returns>false if the list is malformed.</returns>
+    inline bool parse_cpu_list(const std::string& text, std::vector<int>& cpus) {
+      cpus.clear();
+      std::size_t position = 0;
+      while (position < text.size()) {
+        auto next = text.find(',', position);
+        if (next == std::string::npos) {
+          next = text.size();
+        }
+        const auto range = text.substr(position, next - position);
+        const auto dash = range.find('-');
+        try {
+          const auto first = std::stoi(range.substr(0, dash));
+          const auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+          if (first < 0 || last < first) {
+            return false;
+          }
+          for (auto cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+          }
+        }
+        catch (const std::exception&) {
+          return false;
+        }
+        position = next + 1;
+      }
+      return !cpus.empty();
+    }
+
+    /// <summary>
+    /// Apply a placement to the calling thread. Every part is attempted even if an earlier one fails.
+    /// </summary>
+    /// <param name="placement">CPUs and scheduling to apply</param>
+    /// <param name="error">Set to what could not be applied</param>
+    /// <returns>false if any part could not be applied.</returns>
+    inline bool apply_placement(const ThreadPlacement& placement, std::string& error) {
+      error.clear();
+#ifdef _WIN32
+      if (!placement.cpus.empty()) {
+        DWORD_PTR mask = 0;
+        for (const auto cpu : placement.cpus) {
+          if (cpu < static_cast<int>(sizeof(DWORD_PTR) * 8)) {
+            mask |= DWORD_PTR(1) << cpu;
+          }
+        }
+        if (!mask || !SetThreadAffinityMask(GetCurrentThread(), mask)) {
+          error += "affinity ";
+        }
+      }
+
+      // Windows has no per-thread nice value or FIFO class, the nearest are thread priorities.
+      auto priority = THREAD_PRIORITY_NORMAL;
+      if (placement.fifo_priority) {
+        priority = THREAD_PRIORITY_TIME_CRITICAL;
+      }
+      else if (placement.nice) {
+        priority = *placement.nice < 0 ? THREAD_PRIORITY_ABOVE_NORMAL : *placement.nice > 0 ? THREAD_PRIORITY_BELOW_NORMAL : THREAD_PRIORITY_NORMAL;
+      }
+      if (priority != THREAD_PRIORITY_NORMAL && !SetThreadPriority(GetCurrentThread(), priority)) {
+        error += "priority ";
+      }
+#else
+      if (!placement.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const auto cpu : placement.cpus) {
+          if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+          }
+        }
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+          error += "affinity ";
+        }
+      }
+
+      if (placement.fifo_priority) {
+        sched_param parameters{};
+        parameters.sched_priority = *placement.fifo_priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters) != 0) {
+          error += "SCHED_FIFO ";
+        }
+      }
+      else if (placement.nice) {
+        // Linux applies a thread id passed to setpriority to that thread alone.
+        if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), *placement.nice) != 0) {
+          error += "nice ";
+        }
+      }
+#endif
+      return error.empty();
+    }
+  }
+}
@@ -0,0 +1,466 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "FormulaValue.h"
+
+namespace scripting {
+  namespace formula {
+    /// <summary>
+    /// A C++ accessor that native formulas may call. Accessors are invoked without the GIL so they must be thread safe.
+    /// </summary>
+    struct FormulaAccessor {
+      using AccessorFunction = std::function<std::optional<FormulaValue>(const FormulaValue*)>;
+
+      std::string name;
+      std::size_t arity = 0;
+      AccessorFunction function;
+
+      // The python callable bound under the same name, used by the compiler to resolve call sites.
+      const void* python_function = nullptr;
+    };
+
+    /// <summary>
+    /// Registry of every accessor formulas can call.
+    /// Entries are never removed so compiled formulas can hold raw pointers to them.
+    /// </summary>
+    class FormulaAccessorRegistry {
+    public:
+      static FormulaAccessorRegistry& instance() {
+        static FormulaAccessorRegistry instance;
+        return instance;
+      }
+
+      const FormulaAccessor* add(FormulaAccessor accessor) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        accessors_.push_back(std::move(accessor));
+        return &accessors_.back();
+      }
+
+      /// <summary>
+      /// Find the accessor bound to a python callable.
+      /// </summary>
+      /// <param name="python_function">The PyObject pointer of the bound python function</param>
+      /// <returns>The accessor or nullptr if the callable is not a formula accessor.</returns>
+      const FormulaAccessor* find(const void* python_function) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& accessor : accessors_) {
+          if (accessor.python_function == python_function) {
+            return &accessor;
+          }
+        }
+        return nullptr;
+      }
+
+    private:
+      std::mutex mutex_;
+      std::deque<FormulaAccessor> accessors_;
+    };
+
+    enum class OpCode : unsigned char {
+      // Expressions
+      CONSTANT = 0,
+      LOAD_LOCAL,
+      ADD,
+      SUB,
+      MUL,
+      TRUE_DIV,
+      FLOOR_DIV,
+      MOD,
+      NEGATE,
+      POSITIVE,
+      NOT,
+      AND,
+      OR,
+      COMPARE,
+      IF_EXPR,
+      CALL_ACCESSOR,
+      ABS,
+      MIN,
+      MAX,
+
+      // Statements
+      BLOCK,
+      ASSIGN,
+      RETURN,
+      IF
+    };
+
+    enum class CompareOp : std::int32_t {
+      LT = 0,
+      LE,
+      GT,
+      GE,
+      EQ,
+      NE
+    };
+
+    /// <summary>
+    /// A node in the flattened expression tree.
+    /// Child lists (call arguments, block statements, comparison chains) live in the formula's operand pool.
+    /// </summary>
+    struct FormulaNode {
+      OpCode op = OpCode::CONSTANT;
+      std::int32_t a = -1;
+      std::int32_t b = -1;
+      std::int32_t c = -1;
+      std::int32_t first = 0;
+      std::int32_t count = 0;
+      FormulaValue value;
+      const FormulaAccessor* accessor = nullptr;
+    };
+
+    /// <summary>
+    /// A python function compiled to a native expression tree.
+    /// Evaluation never touches the python interpreter so it can run without the GIL.
+    /// </summary>
+    class CompiledFormula {
+    public:
+      static constexpr std::size_t kMaxLocals = 64;
+      static constexpr std::size_t kMaxCallArgs = 8;
+
+      CompiledFormula(std::string name, const std::size_t arity)
+        : name_(std::move(name)), arity_(arity) {}
+
+      const std::string& name() const { return name_; }
+      std::size_t arity() const { return arity_; }
+
+      /// <summary>
+      /// Evaluate the formula.
+      /// </summary>
+      /// <param name="args">Positional arguments</param>
+      /// <param name="arg_count">Number of positional arguments</param>
+      /// <returns>The result, or std::nullopt when the python function must be called instead.</returns>
+      std::optional<FormulaValue> evaluate(const FormulaValue* args, const std::size_t arg_count) const {
+        if (arg_count != arity_) {
+          return std::nullopt;
+        }
+
+        Frame frame;
+        for (std::size_t i = 0; i < arg_count; ++i) {
+          frame.locals[i] = args[i];
+          frame.bound |= (std::uint64_t(1) << i);
+        }
+
+        FormulaValue result;
+        if (execute(body_, frame, result) != Flow::RETURNED) {
+          return std::nullopt;
+        }
+        return result;
+      }
+
+      // Construction API used by the compiler.
+      std::int32_t add_node(const FormulaNode& node) {
+        nodes_.push_back(node);
+        return static_cast<std::int32_t>(nodes_.size() - 1);
+      }
+
+      std::int32_t add_operands(const std::vector<std::int32_t>& operands) {
+        const auto first = static_cast<std::int32_t>(operands_.size());
+        operands_.insert(operands_.end(), operands.begin(), operands.end());
+        return first;
+      }
+
+      void set_body(const std::int32_t body, const std::size_t local_count) {
+        body_ = body;
+        local_count_ = local_count;
+      }
+
+    private:
+      struct Frame {
+        FormulaValue locals[kMaxLocals];
+        std::uint64_t bound = 0;
+      };
+
+      enum class Flow {
+        NEXT,
+        RETURNED,
+        FALLBACK
+      };
+
+      Flow execute(const std::int32_t index, Frame& frame, FormulaValue& result) const {
+        const auto& node = nodes_[index];
+        switch (node.op) {
+        case OpCode::BLOCK:
+          for (std::int32_t i = 0; i < node.count; ++i) {
+            const auto flow = execute(operands_[node.first + i], frame, result);
+            if (flow != Flow::NEXT) {
+              return flow;
+            }
+          }
+          return Flow::NEXT;
+
+        case OpCode::ASSIGN: {
+          const auto value = evaluate(node.b, frame);
+          if (!value) {
+            return Flow::FALLBACK;
+          }
+          frame.locals[node.a] = *value;
+          frame.bound |= (std::uint64_t(1) << node.a);
+          return Flow::NEXT;
+        }
+
+        case OpCode::RETURN: {
+          const auto value = evaluate(node.a, frame);
+          if (!value) {
+            return Flow::FALLBACK;
+          }
+          result = *value;
+          return Flow::RETURNED;
+        }
+
+        case OpCode::IF: {
+          const auto condition = evaluate(node.a, frame);
+          if (!condition) {
+            return Flow::FALLBACK;
+          }
+          if (condition->truthy()) {
+            return execute(node.b, frame, result);
+          }
+          return node.c >= 0 ? execute(node.c, frame, result) : Flow::NEXT;
+        }
+
+        default:
+          return Flow::FALLBACK;
+        }
+      }
+
+      std::optional<FormulaValue> evaluate(const std::int32_t index, Frame& frame) const {
+        const auto& node = nodes_[index];
+        switch (node.op) {
+        case OpCode::CONSTANT:
+          return node.value;
+
+        case OpCode::LOAD_LOCAL:
+          // Reading an unassigned local raises UnboundLocalError in python.
+          if (!(frame.bound & (std::uint64_t(1) << node.a))) {
+            return std::nullopt;
+          }
+          return frame.locals[node.a];
+
+        case OpCode::ADD:
+        case OpCode::SUB:
+        case OpCode::MUL:
+        case OpCode::TRUE_DIV:
+        case OpCode::FLOOR_DIV:
+        case OpCode::MOD: {
+          const auto lhs = evaluate(node.a, frame);
+          if (!lhs) {
+            return std::nullopt;
+          }
+          const auto rhs = evaluate(node.b, frame);
+          if (!rhs) {
+            return std::nullopt;
+          }
+          switch (node.op) {
+          case OpCode::ADD: return ops::add(*lhs, *rhs);
+          case OpCode::SUB: return ops::sub(*lhs, *rhs);
+          case OpCode::MUL: return ops::mul(*lhs, *rhs);
+          case OpCode::TRUE_DIV: return ops::true_div(*lhs, *rhs);
+          case OpCode::FLOOR_DIV: return ops::floor_div(*lhs, *rhs);
+          default: return ops::modulo(*lhs, *rhs);
+          }
+        }
+
+        case OpCode::NEGATE:
+        case OpCode::POSITIVE:
+        case OpCode::NOT:
+        case OpCode::ABS: {
+          const auto operand = evaluate(node.a, frame);
+          if (!operand) {
+            return std::nullopt;
+          }
+          switch (node.op) {
+          case OpCode::NEGATE: return ops::negate(*operand);
+          case OpCode::POSITIVE: return ops::positive(*operand);
+          case OpCode::NOT: return FormulaValue::from_bool(!operand->truthy());
+          default: return ops::absolute(*operand);
+          }
+        }
+
+        case OpCode::AND:
+        case OpCode::OR: {
+          // Python returns the deciding operand, not a bool.
+          std::optional<FormulaValue> value;
+          for (std::int32_t i = 0; i < node.count; ++i) {
+            value = evaluate(operands_[node.first + i], frame);
+            if (!value) {
+              return std::nullopt;
+            }
+            if (value->truthy() == (node.op == OpCode::OR)) {
+              return value;
+            }
+          }
+          return value;
+        }
+
+        case OpCode::COMPARE: {
+          // Operands are laid out as [left, op, right, op, right, ...] to support chained comparisons.
+          auto lhs = evaluate(operands_[node.first], frame);
+          if (!lhs) {
+            return std::nullopt;
+          }
+          for (std::int32_t i = 1; i + 1 < node.count; i += 2) {
+            const auto rhs = evaluate(operands_[node.first + i + 1], frame);
+            if (!rhs) {
+              return std::nullopt;
+            }
+            const auto passed = compare(static_cast<CompareOp>(operands_[node.first + i]), *lhs, *rhs);
+            if (!passed) {
+              return std::nullopt;
+            }
+            if (!*passed) {
+              return FormulaValue::from_bool(false);
+            }
+            lhs = rhs;
+          }
+          return FormulaValue::from_bool(true);
+        }
+
+        case OpCode::IF_EXPR: {
+          const auto condition = evaluate(node.a, frame);
+          if (!condition) {
+            return std::nullopt;
+          }
+          return evaluate(condition->truthy() ? node.b : node.c, frame);
+        }
+
+        case OpCode::MIN:
+        case OpCode::MAX: {
+          // min() keeps the first item unless a later one is strictly smaller (max: strictly greater).
+          auto best = evaluate(operands_[node.first], frame);
+          if (!best) {
+            return std::nullopt;
+          }
+          for (std::int32_t i = 1; i < node.count; ++i) {
+            const auto item = evaluate(operands_[node.first + i], frame);
+            if (!item) {
+              return std::nullopt;
+            }
+            const auto better = compare(node.op == OpCode::MIN ? CompareOp::LT : CompareOp::GT, *item, *best);
+            if (!better) {
+              return std::nullopt;
+            }
+            if (*better) {
+              best = item;
+            }
+          }
+          return best;
+        }
+
+        case OpCode::CALL_ACCESSOR: {
+          FormulaValue args[kMaxCallArgs];
+          for (std::int32_t i = 0; i < node.count; ++i) {
+            const auto arg = evaluate(operands_[node.first + i], frame);
+            if (!arg) {
+              return std::nullopt;
+            }
+            args[i] = *arg;
+          }
+          return node.accessor->function(args);
+        }
+
+        default:
+          return std::nullopt;
+        }
+      }
+
+      static std::optional<bool> compare(const CompareOp op, const FormulaValue& lhs, const FormulaValue& rhs) {
+        const auto ordering = ops::compare(lhs, rhs);
+        if (!ordering) {
+          return std::nullopt;
+        }
+
+        switch (op) {
+        case CompareOp::LT: return *ordering == ops::Ordering::LESS;
+        case CompareOp::LE: return *ordering == ops::Ordering::LESS || *ordering == ops::Ordering::EQUAL;
+        case CompareOp::GT: return *ordering == ops::Ordering::GREATER;
+        case CompareOp::GE: return *ordering == ops::Ordering::GREATER || *ordering == ops::Ordering::EQUAL;
+        case CompareOp::EQ: return *ordering == ops::Ordering::EQUAL;
+        default: return *ordering != ops::Ordering::EQUAL;
+        }
+      }
+
+      std::string name_;
+      std::size_t arity_ = 0;
+      std::size_t local_count_ = 0;
+      std::int32_t body_ = -1;
+      std::vector<FormulaNode> nodes_;
+      std::vector<std::int32_t> operands_;
+    };
+
+    /// <summary>
+    /// Whether native formulas can take or return a C++ type: bool, integral and floating point types. Calls with any
+    /// other argument or result type always go through python.
+    /// </summary>
+    template <typename T>
+    constexpr bool is_formula_type_v = std::is_arithmetic_v<std::decay_t<T>>;
+
+    /// <summary>
+    /// Convert a C++ argument to a formula value using the same rules pybind11 applies when casting it to python.
+    /// </summary>
+    /// <returns>The value, or std::nullopt when it has no formula value and the call must go through python.</returns>
+    template <typename T>
+    std::optional<FormulaValue> to_formula_value(const T& value) {
+      using Type = std::decay_t<T>;
+      if constexpr (std::is_same_v<Type, bool>) {
+        return FormulaValue::from_bool(value);
+      }
+      else if constexpr (std::is_integral_v<Type>) {
+        if constexpr (std::is_unsigned_v<Type> && sizeof(Type) >= sizeof(std::int64_t)) {
+          if (value > static_cast<Type>(std::numeric_limits<std::int64_t>::max())) {
+            return std::nullopt;
+          }
+        }
+        return FormulaValue::from_int(static_cast<std::int64_t>(value));
+      }
+      else if constexpr (std::is_floating_point_v<Type>) {
+        return FormulaValue::from_float(static_cast<double>(value));
+      }
+      else {
+        return std::nullopt;
+      }
+    }
+
+    /// <summary>
+    /// Convert a formula result to a C++ type using the same rules pybind11 applies when casting the python result.
+    /// </summary>
+    /// <returns>The result, or std::nullopt when it does not convert and the call must go through python.</returns>
+    template <typename T>
+    std::optional<T> from_formula_value(const FormulaValue& value) {
+      if constexpr (std::is_same_v<T, bool>) {
+        return value.truthy();
+      }
+      else if constexpr (std::is_integral_v<T>) {
+        if (value.is_float()) {
+          return std::nullopt; // pybind11 refuses float -> int conversion
+        }
+        const auto v = value.as_int();
+        if constexpr (std::is_unsigned_v<T>) {
+          if (v < 0 || static_cast<std::uint64_t>(v) > static_cast<std::uint64_t>(std::numeric_limits<T>::max())) {
+            return std::nullopt;
+          }
+        }
+        else {
+          if (v < static_cast<std::int64_t>(std::numeric_limits<T>::min()) || v > static_cast<std::int64_t>(std::numeric_limits<T>::max())) {
+            return std::nullopt;
+          }
+        }
+        return static_cast<T>(v);
+      }
+      else if constexpr (std::is_floating_point_v<T>) {
+        return static_cast<T>(value.as_float());
+      }
+      else {
+        return std::nullopt;
+      }
+    }
+  }
+}
@@ -0,0 +1,453 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "Formula.h"
+
+namespace scripting {
+  namespace formula {
+    // Attribute set on a python function by the native_formula decorator.
+    constexpr const char* kNativeFormulaAttribute = "__native_formula__";
+
+    /// <summary>
+    /// The bound native_formula decorator, the only decorator a compiled function may use.
+    /// </summary>
+    inline const void*& native_formula_decorator() {
+      static const void* decorator = nullptr;
+      return decorator;
+    }
+
+    /// <summary>
+    /// Convert a python object to a formula value. Requires the GIL.
+    /// </summary>
+    /// <returns>The value, or std::nullopt when the object is outside the supported numeric subset.</returns>
+    inline std::optional<FormulaValue> formula_value_from_python(const py::handle& object) {
+      if (PyBool_Check(object.ptr())) {
+        return FormulaValue::from_bool(object.ptr() == Py_True);
+      }
+
+      if (PyLong_CheckExact(object.ptr())) {
+        int overflow = 0;
+        const auto value = PyLong_AsLongLongAndOverflow(object.ptr(), &overflow);
+        if (overflow != 0) {
+          return std::nullopt;
+        }
+        return FormulaValue::from_int(value);
+      }
+
+      if (PyFloat_CheckExact(object.ptr())) {
+        return FormulaValue::from_float(PyFloat_AS_DOUBLE(object.ptr()));
+      }
+
+      return std::nullopt;
+    }
+
+    /// <summary>
+    /// Convert a formula value to the equivalent python object. Requires the GIL.
+    /// </summary>
+    inline py::object formula_value_to_python(const FormulaValue& value) {
+      switch (value.type) {
+      case FormulaValue::Type::BOOL: return py::bool_(value.b);
+      case FormulaValue::Type::INT: return py::int_(value.i);
+      default: return py::float_(value.f);
+      }
+    }
+
+    /// <summary>
+    /// Convert formula arguments to the accessor's parameter types and call it.
+    /// </summary>
+    template <typename R, typename... A, std::size_t... I>
+    std::optional<FormulaValue> invoke_accessor(R(*function)(A...), const FormulaValue* args, std::index_sequence<I...>) {
+      std::tuple<std::optional<std::decay_t<A>>...> converted{ from_formula_value<std::decay_t<A>>(args[I])... };
+      if (!(std::get<I>(converted).has_value() && ...)) {
+        return std::nullopt;
+      }
+      return to_formula_value<R>(function(*std::get<I>(converted)...));
+    }
+
+    /// <summary>
+    /// Bind a C++ accessor to python and register it so native formulas can call it without the GIL.
+    /// The accessor must be thread safe and only take and return bool, integral or floating point values.
+    /// </summary>
+    /// <param name="module">The module to bind the accessor in to</param>
+    /// <param name="name">Name of the accessor in python</param>
+    /// <param name="function">The accessor function</param>
+    template <typename R, typename... A>
+    void def_formula_accessor(py::module& module, const char* name, R(*function)(A...)) {
+      static_assert(sizeof...(A) <= CompiledFormula::kMaxCallArgs, "Too many formula accessor arguments.");
+
+      module.def(name, function);
+
+      FormulaAccessor accessor;
+      accessor.name = name;
+      accessor.arity = sizeof...(A);
+      accessor.python_function = module.attr(name).ptr();
+      accessor.function = [function](const FormulaValue* args) -> std::optional<FormulaValue> {
+        return invoke_accessor(function, args, std::index_sequence_for<A...>{});
+      };
+      FormulaAccessorRegistry::instance().add(std::move(accessor));
+    }
+
+    /// <summary>
+    /// Compiles functions decorated with native_formula to native expression trees.
+    /// Only a restricted subset of python is accepted: numeric constants, arguments and locals, arithmetic,
+    /// comparisons, boolean logic, if/else, abs/min/max and calls to registered formula accessors.
+    /// Anything else leaves the function as a plain python function.
+    /// </summary>
+    class FormulaCompiler {
+    public:
+      /// <summary>
+      /// Compile a python function. Requires the GIL.
+      /// </summary>
+      /// <param name="module">The module the function was defined in, used to resolve global names</param>
+      /// <param name="function">The python function</param>
+      /// <param name="error">Set to the reason the function could not be compiled</param>
+      /// <returns>The compiled formula or nullptr when the function is outside the supported subset.</returns>
+      static std::shared_ptr<CompiledFormula> compile(const py::module_& module, const py::object& function, std::string& error) {
+        try {
+          const auto source = py::module::import("inspect").attr("getsource")(function);
+          const auto dedented = py::module::import("textwrap").attr("dedent")(source);
+          const auto ast = py::module::import("ast");
+          const auto tree = ast.attr("parse")(dedented);
+          ast.attr("increment_lineno")(tree, function.attr("__code__").attr("co_firstlineno").cast<int>() - 1);
+          const auto definition = tree.attr("body")[py::int_(0)];
+
+          FormulaCompiler compiler(module);
+          return compiler.compile_function(definition);
+        }
+        catch (const CompileError& e) {
+          error = e.what();
+        }
+        catch (const py::error_already_set& e) {
+          error = e.what();
+        }
+        return nullptr;
+      }
+
+    private:
+      class CompileError : public std::runtime_error {
+      public:
+        explicit CompileError(const std::string& message) : std::runtime_error(message) {}
+      };
+
+      explicit FormulaCompiler(const py::module_& module) : module_(module) {}
+
+      static std::string node_type(const py::handle& node) {
+        return py::str(py::type::handle_of(node).attr("__name__"));
+      }
+
+      static std::string line_of(const py::handle& node) {
+        return py::hasattr(node, "lineno") ? " (line " + std::string(py::str(node.attr("lineno"))) + ")" : std::string();
+      }
+
+      [[noreturn]] static void unsupported(const py::handle& node, const std::string& what) {
+        throw CompileError("unsupported " + what + " '" + node_type(node) + "'" + line_of(node));
+      }
+
+      std::shared_ptr<CompiledFormula> compile_function(const py::handle& definition) {
+        if (node_type(definition) != "FunctionDef") {
+          unsupported(definition, "definition");
+        }
+
+        // Any decorator other than native_formula could change what the function does, or mark a wrapper whose
+        // source inspect reports as that of the function it wraps.
+        const auto decorators = definition.attr("decorator_list");
+        if (py::len(decorators) != 1) {
+          throw CompileError("native formulas may only use the native_formula decorator");
+        }
+        const auto decorator = resolve_global(decorators[py::int_(0)]);
+        if (!decorator || decorator.ptr() != native_formula_decorator()) {
+          throw CompileError("native formulas may only use the native_formula decorator" + line_of(decorators[py::int_(0)]));
+        }
+
+        const auto arguments = definition.attr("args");
+        if (!arguments.attr("vararg").is_none() || !arguments.attr("kwarg").is_none() ||
+          py::len(arguments.attr("kwonlyargs")) != 0 || py::len(arguments.attr("defaults")) != 0) {
+          throw CompileError("native formulas only support plain positional arguments");
+        }
+
+        for (const auto& argument : arguments.attr("posonlyargs")) {
+          declare_local(py::str(argument.attr("arg")));
+        }
+        for (const auto& argument : arguments.attr("args")) {
+          declare_local(py::str(argument.attr("arg")));
+        }
+        const auto arity = locals_.size();
+
+        // Python scoping: any name assigned anywhere in the function is local everywhere in it.
+        const auto body = definition.attr("body");
+        collect_assigned_names(body);
+
+        formula_ = std::make_shared<CompiledFormula>(py::str(definition.attr("name")), arity);
+        formula_->set_body(compile_block(body, true), locals_.size());
+        return formula_;
+      }
+
+      void declare_local(const std::string& name) {
+        if (locals_.find(name) != locals_.end()) {
+          return;
+        }
+        if (locals_.size() >= CompiledFormula::kMaxLocals) {
+          throw CompileError("too many locals");
+        }
+        locals_.emplace(name, static_cast<std::int32_t>(locals_.size()));
+      }
+
+      void collect_assigned_names(const py::handle& statements) {
+        for (const auto& statement : statements) {
+          const auto type = node_type(statement);
+          if (type == "Assign") {
+            for (const auto& target : statement.attr("targets")) {
+              if (node_type(target) != "Name") {
+                unsupported(target, "assignment target");
+              }
+              declare_local(py::str(target.attr("id")));
+            }
+          }
+          else if (type == "If") {
+            collect_assigned_names(statement.attr("body"));
+            collect_assigned_names(statement.attr("orelse"));
+          }
+        }
+      }
+
+      std::int32_t compile_block(const py::handle& statements, const bool allow_docstring) {
+        std::vector<std::int32_t> compiled;
+        auto first = true;
+        for (const auto& statement : statements) {
+          const auto type = node_type(statement);
+          const auto is_docstring = allow_docstring && first && type == "Expr" &&
+            node_type(statement.attr("value")) == "Constant" && py::isinstance<py::str>(statement.attr("value").attr("value"));
+          first = false;
+
+          if (is_docstring || type == "Pass") {
+            continue;
+          }
+          compiled.push_back(compile_statement(statement));
+        }
+
+        FormulaNode node;
+        node.op = OpCode::BLOCK;
+        node.first = formula_->add_operands(compiled);
+        node.count = static_cast<std::int32_t>(compiled.size());
+        return formula_->add_node(node);
+      }
+
+      std::int32_t compile_statement(const py::handle& statement) {
+        const auto type = node_type(statement);
+        FormulaNode node;
+
+        if (type == "Return") {
+          if (statement.attr("value").is_none()) {
+            throw CompileError("native formulas must return a value" + line_of(statement));
+          }
+          node.op = OpCode::RETURN;
+          node.a = compile_expression(statement.attr("value"));
+        }
+        else if (type == "Assign") {
+          const auto value = compile_expression(statement.attr("value"));
+          // a = b = expr assigns the same value to every target.
+          std::vector<std::int32_t> assignments;
+          for (const auto& target : statement.attr("targets")) {
+            FormulaNode assign;
+            assign.op = OpCode::ASSIGN;
+            assign.a = locals_.at(py::str(target.attr("id")));
+            assign.b = value;
+            assignments.push_back(formula_->add_node(assign));
+          }
+          node.op = OpCode::BLOCK;
+          node.first = formula_->add_operands(assignments);
+          node.count = static_cast<std::int32_t>(assignments.size());
+        }
+        else if (type == "If") {
+          node.op = OpCode::IF;
+          node.a = compile_expression(statement.attr("test"));
+          node.b = compile_block(statement.attr("body"), false);
+          node.c = py::len(statement.attr("orelse")) > 0 ? compile_block(statement.attr("orelse"), false) : -1;
+        }
+        else {
+          unsupported(statement, "statement");
+        }
+
+        return formula_->add_node(node);
+      }
+
+      std::int32_t compile_expression(const py::handle& expression) {
+        const auto type = node_type(expression);
+        FormulaNode node;
+
+        if (type == "Constant") {
+          const auto value = formula_value_from_python(expression.attr("value"));
+          if (!value) {
+            unsupported(expression, "constant");
+          }
+          node.op = OpCode::CONSTANT;
+          node.value = *value;
+        }
+        else if (type == "Name") {
+          const auto name = std::string(py::str(expression.attr("id")));
+          const auto it = locals_.find(name);
+          if (it == locals_.end()) {
+            throw CompileError("global name '" + name + "' can not be used in a native formula" + line_of(expression));
+          }
+          node.op = OpCode::LOAD_LOCAL;
+          node.a = it->second;
+        }
+        else if (type == "BinOp") {
+          static const std::unordered_map<std::string, OpCode> binary_ops = {
+            { "Add", OpCode::ADD }, { "Sub", OpCode::SUB }, { "Mult", OpCode::MUL },
+            { "Div", OpCode::TRUE_DIV }, { "FloorDiv", OpCode::FLOOR_DIV }, { "Mod", OpCode::MOD }
+          };
+          const auto op = binary_ops.find(node_type(expression.attr("op")));
+          if (op == binary_ops.end()) {
+            unsupported(expression.attr("op"), "operator");
+          }
+          node.op = op->second;
+          node.a = compile_expression(expression.attr("left"));
+          node.b = compile_expression(expression.attr("right"));
+        }
+        else if (type == "UnaryOp") {
+          static const std::unordered_map<std::string, OpCode> unary_ops = {
+            { "USub", OpCode::NEGATE }, { "UAdd", OpCode::POSITIVE }, { "Not", OpCode::NOT }
+          };
+          const auto op = unary_ops.find(node_type(expression.attr("op")));
+          if (op == unary_ops.end()) {
+            unsupported(expression.attr("op"), "operator");
+          }
+          node.op = op->second;
+          node.a = compile_expression(expression.attr("operand"));
+        }
+        else if (type == "BoolOp") {
+          node.op = node_type(expression.attr("op")) == "And" ? OpCode::AND : OpCode::OR;
+          compile_operands(expression.attr("values"), node);
+        }
+        else if (type == "Compare") {
+          static const std::unordered_map<std::string, CompareOp> compare_ops = {
+            { "Lt", CompareOp::LT }, { "LtE", CompareOp::LE }, { "Gt", CompareOp::GT },
+            { "GtE", CompareOp::GE }, { "Eq", CompareOp::EQ }, { "NotEq", CompareOp::NE }
+          };
+
+          std::vector<std::int32_t> operands = { compile_expression(expression.attr("left")) };
+          const auto ops = expression.attr("ops");
+          const auto comparators = expression.attr("comparators");
+          for (std::size_t i = 0; i < py::len(ops); ++i) {
+            const auto op = compare_ops.find(node_type(ops[py::int_(i)]));
+            if (op == compare_ops.end()) {
+              unsupported(ops[py::int_(i)], "comparison");
+            }
+            operands.push_back(static_cast<std::int32_t>(op->second));
+            operands.push_back(compile_expression(comparators[py::int_(i)]));
+          }
+
+          node.op = OpCode::COMPARE;
+          node.first = formula_->add_operands(operands);
+          node.count = static_cast<std::int32_t>(operands.size());
+        }
+        else if (type == "IfExp") {
+          node.op = OpCode::IF_EXPR;
+          node.a = compile_expression(expression.attr("test"));
+          node.b = compile_expression(expression.attr("body"));
+          node.c = compile_expression(expression.attr("orelse"));
+        }
+        else if (type == "Call") {
+          compile_call(expression, node);
+        }
+        else {
+          unsupported(expression, "expression");
+        }
+
+        return formula_->add_node(node);
+      }
+
+      void compile_operands(const py::handle& expressions, FormulaNode& node) {
+        std::vector<std::int32_t> operands;
+        for (const auto& expression : expressions) {
+          operands.push_back(compile_expression(expression));
+        }
+        node.first = formula_->add_operands(operands);
+        node.count = static_cast<std::int32_t>(operands.size());
+      }
+
+      void compile_call(const py::handle& call, FormulaNode& node) {
+        if (py::len(call.attr("keywords")) != 0) {
+          throw CompileError("keyword arguments are not supported" + line_of(call));
+        }
+
+        const auto function = call.attr("func");
+        const auto arguments = call.attr("args");
+        for (const auto& argument : arguments) {
+          if (node_type(argument) == "Starred") {
+            unsupported(argument, "argument");
+          }
+        }
+        const auto arg_count = py::len(arguments);
+
+        // Builtins are only used when the module does not shadow them.
+        if (node_type(function) == "Name") {
+          const auto name = std::string(py::str(function.attr("id")));
+          if (locals_.find(name) != locals_.end()) {
+            throw CompileError("calling a local is not supported" + line_of(call));
+          }
+
+          if (!py::hasattr(module_, name.c_str())) {
+            if (name == "abs" && arg_count == 1) {
+              node.op = OpCode::ABS;
+              node.a = compile_expression(arguments[py::int_(0)]);
+              return;
+            }
+            if ((name == "min" || name == "max") && arg_count >= 2) {
+              node.op = name == "min" ? OpCode::MIN : OpCode::MAX;
+              compile_operands(arguments, node);
+              return;
+            }
+          }
+        }
+
+        // Otherwise the callee must resolve to a registered accessor, either imported directly or as module.accessor.
+        const auto callee = resolve_global(function);
+        const auto accessor = callee ? FormulaAccessorRegistry::instance().find(callee.ptr()) : nullptr;
+        if (!accessor) {
+          throw CompileError("only formula accessors can be called from a native formula" + line_of(call));
+        }
+        if (accessor->arity != arg_count) {
+          throw CompileError("wrong number of arguments for accessor '" + accessor->name + "'" + line_of(call));
+        }
+
+        node.op = OpCode::CALL_ACCESSOR;
+        node.accessor = accessor;
+        compile_operands(arguments, node);
+      }
+
+      py::object resolve_global(const py::handle& expression) {
+        const auto type = node_type(expression);
+        if (type == "Name") {
+          const auto name = std::string(py::str(expression.attr("id")));
+          if (locals_.find(name) != locals_.end() || !py::hasattr(module_, name.c_str())) {
+            return py::object();
+          }
+          return module_.attr(name.c_str());
+        }
+
+        if (type == "Attribute") {
+          const auto owner = resolve_global(expression.attr("value"));
+          const auto attribute = std::string(py::str(expression.attr("attr")));
+          if (!owner || !py::hasattr(owner, attribute.c_str())) {
+            return py::object();
+          }
+          return owner.attr(attribute.c_str());
+        }
+
+        return py::object();
+      }
+
+      const py::module_& module_;
+      std::shared_ptr<CompiledFormula> formula_;
+      std::unordered_map<std::string, std::int32_t> locals_;
+    };
+  }
+}
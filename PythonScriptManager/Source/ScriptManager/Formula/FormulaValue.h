@@ -0,0 +1,318 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+
+namespace scripting {
+  namespace formula {
+    /// <summary>
+    /// A scalar value produced by a native formula.
+    /// Mirrors the subset of python's numeric tower we support: bool, int (64-bit) and float.
+    /// </summary>
+    struct FormulaValue {
+      enum class Type : unsigned char {
+        BOOL = 0,
+        INT,
+        FLOAT
+      };
+
+      Type type = Type::INT;
+      union {
+        bool b;
+        std::int64_t i;
+        double f;
+      };
+
+      FormulaValue() : i(0) {}
+
+      static FormulaValue from_bool(const bool value) {
+        FormulaValue result;
+        result.type = Type::BOOL;
+        result.i = 0;
+        result.b = value;
+        return result;
+      }
+
+      static FormulaValue from_int(const std::int64_t value) {
+        FormulaValue result;
+        result.type = Type::INT;
+        result.i = value;
+        return result;
+      }
+
+      static FormulaValue from_float(const double value) {
+        FormulaValue result;
+        result.type = Type::FLOAT;
+        result.f = value;
+        return result;
+      }
+
+      bool is_float() const { return type == Type::FLOAT; }
+
+      /// <summary>
+      /// Integer view of a bool or int value (python treats bool as an int subclass).
+      /// </summary>
+      std::int64_t as_int() const { return type == Type::BOOL ? (b ? 1 : 0) : i; }
+
+      /// <summary>
+      /// Float view of any value. int -> float conversion rounds to nearest-even exactly as PyLong_AsDouble does.
+      /// </summary>
+      double as_float() const { return type == Type::FLOAT ? f : static_cast<double>(as_int()); }
+
+      /// <summary>
+      /// Python truthiness.
+      /// </summary>
+      bool truthy() const {
+        switch (type) {
+        case Type::BOOL: return b;
+        case Type::INT: return i != 0;
+        default: return f != 0.0;
+        }
+      }
+
+      /// <summary>
+      /// Compare type and bit pattern. Used by the conformance check so -0.0 and NaN payloads are not glossed over.
+      /// </summary>
+      bool identical(const FormulaValue& other) const {
+        if (type != other.type) {
+          return false;
+        }
+
+        switch (type) {
+        case Type::BOOL: return b == other.b;
+        case Type::INT: return i == other.i;
+        default: {
+          std::uint64_t lhs, rhs;
+          static_assert(sizeof(lhs) == sizeof(double));
+          std::memcpy(&lhs, &f, sizeof(lhs));
+          std::memcpy(&rhs, &other.f, sizeof(rhs));
+          return lhs == rhs;
+        }
+        }
+      }
+    };
+
+    /// <summary>
+    /// Python-exact arithmetic on FormulaValues.
+    /// Every operation returns std::nullopt when the result would differ from CPython (overflow beyond 64 bits,
+    /// inexact int/float mixing, or an operation that would raise). The caller then falls back to the python function.
+    /// </summary>
+    namespace ops {
+      // Integers up to 2^53 convert to double without rounding.
+      constexpr std::int64_t kExactFloatIntLimit = std::int64_t(1) << 53;
+
+      inline bool exact_as_float(const FormulaValue& value) {
+        if (value.is_float()) {
+          return true;
+        }
+        const auto v = value.as_int();
+        return v >= -kExactFloatIntLimit && v <= kExactFloatIntLimit;
+      }
+
+      inline std::optional<std::int64_t> checked_add(const std::int64_t a, const std::int64_t b) {
+        if ((b > 0 && a > std::numeric_limits<std::int64_t>::max() - b) ||
+          (b < 0 && a < std::numeric_limits<std::int64_t>::min() - b)) {
+          return std::nullopt;
+        }
+        return a + b;
+      }
+
+      inline std::optional<std::int64_t> checked_sub(const std::int64_t a, const std::int64_t b) {
+        if ((b < 0 && a > std::numeric_limits<std::int64_t>::max() + b) ||
+          (b > 0 && a < std::numeric_limits<std::int64_t>::min() + b)) {
+          return std::nullopt;
+        }
+        return a - b;
+      }
+
+      inline std::optional<std::int64_t> checked_mul(const std::int64_t a, const std::int64_t b) {
+        if (a == 0 || b == 0) {
+          return std::int64_t(0);
+        }
+        const auto result = static_cast<std::int64_t>(static_cast<std::uint64_t>(a) * static_cast<std::uint64_t>(b));
+        if ((a == -1 && b == std::numeric_limits<std::int64_t>::min()) ||
+          (b == -1 && a == std::numeric_limits<std::int64_t>::min()) ||
+          result / b != a) {
+          return std::nullopt;
+        }
+        return result;
+      }
+
+      inline std::optional<FormulaValue> add(const FormulaValue& a, const FormulaValue& b) {
+        if (!a.is_float() && !b.is_float()) {
+          const auto result = checked_add(a.as_int(), b.as_int());
+          return result ? std::optional<FormulaValue>(FormulaValue::from_int(*result)) : std::nullopt;
+        }
+        return FormulaValue::from_float(a.as_float() + b.as_float());
+      }
+
+      inline std::optional<FormulaValue> sub(const FormulaValue& a, const FormulaValue& b) {
+        if (!a.is_float() && !b.is_float()) {
+          const auto result = checked_sub(a.as_int(), b.as_int());
+          return result ? std::optional<FormulaValue>(FormulaValue::from_int(*result)) : std::nullopt;
+        }
+        return FormulaValue::from_float(a.as_float() - b.as_float());
+      }
+
+      inline std::optional<FormulaValue> mul(const FormulaValue& a, const FormulaValue& b) {
+        if (!a.is_float() && !b.is_float()) {
+          const auto result = checked_mul(a.as_int(), b.as_int());
+          return result ? std::optional<FormulaValue>(FormulaValue::from_int(*result)) : std::nullopt;
+        }
+        return FormulaValue::from_float(a.as_float() * b.as_float());
+      }
+
+      inline std::optional<FormulaValue> true_div(const FormulaValue& a, const FormulaValue& b) {
+        // int / int is correctly rounded by CPython; IEEE division matches only when both operands are exact doubles.
+        if (!a.is_float() && !b.is_float() && (!exact_as_float(a) || !exact_as_float(b))) {
+          return std::nullopt;
+        }
+        const auto divisor = b.as_float();
+        if (divisor == 0.0) {
+          return std::nullopt; // ZeroDivisionError
+        }
+        return FormulaValue::from_float(a.as_float() / divisor);
+      }
+
+      /// <summary>
+      /// CPython's float divmod (Objects/floatobject.c: _float_div_mod).
+      /// </summary>
+      inline void float_div_mod(const double vx, const double wx, double& floordiv, double& mod) {
+        mod = std::fmod(vx, wx);
+        auto div = (vx - mod) / wx;
+        if (mod != 0.0) {
+          if ((wx < 0) != (mod < 0)) {
+            mod += wx;
+            div -= 1.0;
+          }
+        }
+        else {
+          mod = std::copysign(0.0, wx);
+        }
+
+        if (div != 0.0) {
+          floordiv = std::floor(div);
+          if (div - floordiv > 0.5) {
+            floordiv += 1.0;
+          }
+        }
+        else {
+          floordiv = std::copysign(0.0, vx / wx);
+        }
+      }
+
+      inline std::optional<FormulaValue> floor_div(const FormulaValue& a, const FormulaValue& b) {
+        if (!a.is_float() && !b.is_float()) {
+          const auto x = a.as_int();
+          const auto y = b.as_int();
+          if (y == 0 || (x == std::numeric_limits<std::int64_t>::min() && y == -1)) {
+            return std::nullopt;
+          }
+          auto q = x / y;
+          if ((x % y != 0) && ((x < 0) != (y < 0))) {
+            --q;
+          }
+          return FormulaValue::from_int(q);
+        }
+
+        const auto wx = b.as_float();
+        if (wx == 0.0) {
+          return std::nullopt;
+        }
+        double floordiv, mod;
+        float_div_mod(a.as_float(), wx, floordiv, mod);
+        return FormulaValue::from_float(floordiv);
+      }
+
+      inline std::optional<FormulaValue> modulo(const FormulaValue& a, const FormulaValue& b) {
+        if (!a.is_float() && !b.is_float()) {
+          const auto x = a.as_int();
+          const auto y = b.as_int();
+          if (y == 0) {
+            return std::nullopt;
+          }
+          if (y == -1) {
+            return FormulaValue::from_int(0);
+          }
+          auto r = x % y;
+          if (r != 0 && ((r < 0) != (y < 0))) {
+            r += y;
+          }
+          return FormulaValue::from_int(r);
+        }
+
+        // Objects/floatobject.c: float_rem
+        const auto vx = a.as_float();
+        const auto wx = b.as_float();
+        if (wx == 0.0) {
+          return std::nullopt;
+        }
+        auto result = std::fmod(vx, wx);
+        if (result != 0.0) {
+          if ((wx < 0) != (result < 0)) {
+            result += wx;
+          }
+        }
+        else {
+          result = std::copysign(0.0, wx);
+        }
+        return FormulaValue::from_float(result);
+      }
+
+      inline std::optional<FormulaValue> negate(const FormulaValue& a) {
+        if (a.is_float()) {
+          return FormulaValue::from_float(-a.f);
+        }
+        const auto v = a.as_int();
+        if (v == std::numeric_limits<std::int64_t>::min()) {
+          return std::nullopt;
+        }
+        return FormulaValue::from_int(-v);
+      }
+
+      inline std::optional<FormulaValue> positive(const FormulaValue& a) {
+        return a.is_float() ? a : FormulaValue::from_int(a.as_int());
+      }
+
+      inline std::optional<FormulaValue> absolute(const FormulaValue& a) {
+        if (a.is_float()) {
+          return FormulaValue::from_float(std::fabs(a.f));
+        }
+        const auto v = a.as_int();
+        return v < 0 ? negate(FormulaValue::from_int(v)) : FormulaValue::from_int(v);
+      }
+
+      /// <summary>
+      /// Three-way comparison result. Unordered means at least one NaN was involved.
+      /// </summary>
+      enum class Ordering {
+        LESS,
+        EQUAL,
+        GREATER,
+        UNORDERED
+      };
+
+      inline std::optional<Ordering> compare(const FormulaValue& a, const FormulaValue& b) {
+        if (!a.is_float() && !b.is_float()) {
+          const auto x = a.as_int();
+          const auto y = b.as_int();
+          return x < y ? Ordering::LESS : (x > y ? Ordering::GREATER : Ordering::EQUAL);
+        }
+
+        // Python compares int and float exactly, converting to double is only safe for exact integers.
+        if (!exact_as_float(a) || !exact_as_float(b)) {
+          return std::nullopt;
+        }
+
+        const auto x = a.as_float();
+        const auto y = b.as_float();
+        if (std::isnan(x) || std::isnan(y)) {
+          return Ordering::UNORDERED;
+        }
+        return x < y ? Ordering::LESS : (x > y ? Ordering::GREATER : Ordering::EQUAL);
+      }
+    }
+  }
+}
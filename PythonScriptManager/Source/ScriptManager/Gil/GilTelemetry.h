@@ -0,0 +1,242 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace scripting {
+  namespace gil {
+    /// <summary>
+    /// Durations in nanoseconds bucketed by power of two, with each power split in four, so any value is within 25%
+    /// of its bucket's bound.
+    /// </summary>
+    class DurationHistogram {
+    public:
+      static constexpr std::size_t kBuckets = 64 * 4;
+
+      static std::size_t bucket_of(const std::uint64_t nanoseconds) {
+        if (nanoseconds < 4) {
+          return static_cast<std::size_t>(nanoseconds);
+        }
+        const auto exponent = log2_floor(nanoseconds);
+        return exponent * 4 + ((nanoseconds >> (exponent - 2)) & 3);
+      }
+
+      /// <summary>
+      /// The largest duration that falls in a bucket.
+      /// </summary>
+      static std::uint64_t upper_bound(const std::size_t bucket) {
+        if (bucket < 4) {
+          return bucket;
+        }
+        const auto exponent = bucket / 4;
+        return ((4 + bucket % 4 + 1) << (exponent - 2)) - 1;
+      }
+
+      void add(const std::uint64_t nanoseconds) {
+        ++counts_[bucket_of(nanoseconds)];
+        ++count_;
+        total_ += nanoseconds;
+      }
+
+      void merge(const DurationHistogram& other) {
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+          counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        total_ += other.total_;
+      }
+
+      /// <summary>
+      /// What has been recorded since an earlier copy of this histogram was taken.
+      /// </summary>
+      DurationHistogram since(const DurationHistogram& earlier) const {
+        DurationHistogram window;
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+          window.counts_[i] = counts_[i] - earlier.counts_[i];
+        }
+        window.count_ = count_ - earlier.count_;
+        window.total_ = total_ - earlier.total_;
+        return window;
+      }
+
+      /// <summary>
+      /// The duration below which a fraction of the recorded durations fall, in nanoseconds.
+      /// </summary>
+      std::uint64_t percentile(const double fraction) const {
+        if (count_ == 0) {
+          return 0;
+        }
+        const auto rank = static_cast<std::uint64_t>(fraction * static_cast<double>(count_ - 1)) + 1;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+          seen += counts_[i];
+          if (seen >= rank) {
+            return upper_bound(i);
+          }
+        }
+        return upper_bound(kBuckets - 1);
+      }
+
+      std::uint64_t count() const { return count_; }
+      std::uint64_t total() const { return total_; }
+
+    private:
+      static std::size_t log2_floor(std::uint64_t value) {
+        std::size_t result = 0;
+        for (auto shift : { 32, 16, 8, 4, 2, 1 }) {
+          if (value >> shift) {
+            value >>= shift;
+            result += shift;
+          }
+        }
+        return result;
+      }
+
+      std::array<std::uint64_t, kBuckets> counts_{};
+      std::uint64_t count_ = 0;
+      std::uint64_t total_ = 0;
+    };
+
+    /// <summary>
+    /// How long one thread waited for and held the GIL. Hold time runs until the acquisition is released, so it includes
+    /// any time python code let the GIL go in between.
+    /// </summary>
+    struct GilThreadStats {
+      std::size_t thread_id = 0;
+      DurationHistogram wait;
+      DurationHistogram hold;
+    };
+
+    /// <summary>
+    /// Records how long each thread waits for the GIL and then holds it, for every acquisition the script manager
+    /// makes. A thread only ever writes to its own histograms, under a lock no other thread takes except while a
+    /// report is being copied, so recording costs two clock reads and an uncontended lock.
+    /// </summary>
+    class GilTelemetry {
+    public:
+      static GilTelemetry& instance() {
+        static GilTelemetry instance;
+        return instance;
+      }
+
+      bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+      void set_enabled(const bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+
+      static std::uint64_t now() {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+      }
+
+      /// <summary>
+      /// Record one acquisition made by the calling thread.
+      /// </summary>
+      void record(const std::uint64_t wait_nanoseconds, const std::uint64_t hold_nanoseconds) {
+        auto& recorder = thread_recorder();
+        std::lock_guard<std::mutex> lock(recorder.mutex);
+        recorder.stats.wait.add(wait_nanoseconds);
+        recorder.stats.hold.add(hold_nanoseconds);
+      }
+
+      /// <summary>
+      /// Copy every live thread's statistics. Threads that have exited are merged in to one entry with thread id 0.
+      /// </summary>
+      /// <param name="epoch">Set to the number of resets before the copy, when given</param>
+      std::vector<GilThreadStats> threads(std::uint64_t* epoch = nullptr) const {
+        std::vector<GilThreadStats> threads;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (epoch) {
+          *epoch = epoch_;
+        }
+        for (const auto& recorder : recorders_) {
+          std::lock_guard<std::mutex> recorder_lock(recorder->mutex);
+          threads.push_back(recorder->stats);
+        }
+        if (retired_.wait.count() > 0) {
+          threads.push_back(retired_);
+        }
+        return threads;
+      }
+
+      /// <summary>
+      /// Every thread's statistics added together. Two totals can only be compared with since when their epochs match.
+      /// </summary>
+      /// <param name="epoch">Set to the number of resets before the copy, when given</param>
+      GilThreadStats total(std::uint64_t* epoch = nullptr) const {
+        GilThreadStats total;
+        for (const auto& thread : threads(epoch)) {
+          total.wait.merge(thread.wait);
+          total.hold.merge(thread.hold);
+        }
+        return total;
+      }
+
+      /// <summary>
+      /// Forget everything recorded so far.
+      /// </summary>
+      void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& recorder : recorders_) {
+          std::lock_guard<std::mutex> recorder_lock(recorder->mutex);
+          recorder->stats.wait = DurationHistogram();
+          recorder->stats.hold = DurationHistogram();
+        }
+        retired_ = GilThreadStats();
+        ++epoch_;
+      }
+
+    private:
+      struct Recorder {
+        std::mutex mutex;
+        GilThreadStats stats;
+      };
+
+      /// <summary>
+      /// Registers the thread's recorder on first use and retires it when the thread exits.
+      /// </summary>
+      struct RecorderHandle {
+        std::shared_ptr<Recorder> recorder = std::make_shared<Recorder>();
+
+        RecorderHandle() {
+          recorder->stats.thread_id = std::hash<std::thread::id>()(std::this_thread::get_id());
+          GilTelemetry::instance().add(recorder);
+        }
+
+        ~RecorderHandle() {
+          GilTelemetry::instance().retire(recorder);
+        }
+      };
+
+      static Recorder& thread_recorder() {
+        thread_local RecorderHandle handle;
+        return *handle.recorder;
+      }
+
+      void add(const std::shared_ptr<Recorder>& recorder) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        recorders_.push_back(recorder);
+      }
+
+      void retire(const std::shared_ptr<Recorder>& recorder) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        {
+          std::lock_guard<std::mutex> recorder_lock(recorder->mutex);
+          retired_.wait.merge(recorder->stats.wait);
+          retired_.hold.merge(recorder->stats.hold);
+        }
+        recorders_.erase(std::remove(recorders_.begin(), recorders_.end(), recorder), recorders_.end());
+      }
+
+      std::atomic<bool> enabled_{ true };
+      mutable std::mutex mutex_;
+      std::vector<std::shared_ptr<Recorder>> recorders_;
+      GilThreadStats retired_;
+      std::uint64_t epoch_ = 0;
+    };
+  }
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "GilTelemetry.h"
+#include "ThreadState.h"
+
+namespace scripting {
+  namespace gil {
+    /// <summary>
+    /// Limits for the switch interval controller.
+    /// </summary>
+    struct SwitchIntervalSettings {
+      // Time the game has for one tick, and the share of it a dispatch may spend waiting for the GIL.
+      std::chrono::microseconds tick_budget{ 50000 };
+      double wait_share = 0.02;
+      // Bounds for sys.setswitchinterval, in seconds. Python's default is 0.005.
+      double min_interval = 0.0002;
+      double max_interval = 0.005;
+      // How often contention is measured and the interval adjusted.
+      std::chrono::milliseconds period{ 200 };
+    };
+
+    /// <summary>
+    /// Tunes sys.setswitchinterval from GilTelemetry. When the 99th percentile GIL wait over the last period goes past
+    /// the share of the tick budget allowed for it, a thread running python is made to give up the GIL sooner by
+    /// halving the interval. Once waits are well inside the budget the interval is raised again, so switching only
+    /// costs throughput while there is contention.
+    /// </summary>
+    class SwitchIntervalController {
+    public:
+      SwitchIntervalController() = default;
+      SwitchIntervalController(const SwitchIntervalController&) = delete;
+      SwitchIntervalController& operator=(const SwitchIntervalController&) = delete;
+      ~SwitchIntervalController() { stop(); }
+
+      /// <summary>
+      /// Start adjusting the interval. Call without the GIL, the interpreter must be running.
+      /// </summary>
+      void start(const SwitchIntervalSettings& settings) {
+        stop();
+
+        {
+          GilAcquire acquire;
+          original_interval_ = py::module::import("sys").attr("getswitchinterval")().cast<double>();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        settings_ = settings;
+        interval_.store(std::clamp(original_interval_, settings.min_interval, settings.max_interval), std::memory_order_relaxed);
+        adjustments_ = 0;
+        stopping_ = false;
+        worker_ = std::thread(&SwitchIntervalController::control_loop, this);
+        running_.store(true, std::memory_order_release);
+      }
+
+      /// <summary>
+      /// Stop adjusting and put back the interval python had before start. Call without the GIL.
+      /// </summary>
+      void stop() {
+        if (!running_.exchange(false, std::memory_order_acq_rel)) {
+          return;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          stopping_ = true;
+        }
+        condition_.notify_one();
+        worker_.join();
+
+        if (Py_IsInitialized()) {
+          apply(original_interval_);
+        }
+      }
+
+      bool running() const { return running_.load(std::memory_order_acquire); }
+
+      /// <summary>
+      /// The switch interval last set, in seconds.
+      /// </summary>
+      double interval() const { return interval_.load(std::memory_order_relaxed); }
+
+      /// <summary>
+      /// The 99th percentile GIL wait over the last period, in nanoseconds.
+      /// </summary>
+      std::uint64_t window_wait() const { return window_wait_.load(std::memory_order_relaxed); }
+
+      std::uint64_t adjustments() const { return adjustments_.load(std::memory_order_relaxed); }
+
+    private:
+      static void apply(const double interval) {
+        GilAcquire acquire;
+        py::module::import("sys").attr("setswitchinterval")(interval);
+      }
+
+      void control_loop() {
+        auto& telemetry = GilTelemetry::instance();
+        std::uint64_t epoch = 0;
+        auto previous = telemetry.total(&epoch).wait;
+        apply(interval_.load(std::memory_order_relaxed));
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!condition_.wait_for(lock, settings_.period, [this] { return stopping_; })) {
+          std::uint64_t current_epoch = 0;
+          const auto current = telemetry.total(&current_epoch).wait;
+          // After a reset the counts start again from zero, so everything recorded since is the window.
+          const auto window = current_epoch == epoch ? current.since(previous) : current;
+          previous = current;
+          epoch = current_epoch;
+          if (window.count() == 0) {
+            continue;
+          }
+
+          const auto wait = window.percentile(0.99);
+          window_wait_.store(wait, std::memory_order_relaxed);
+
+          const auto target = std::chrono::duration_cast<std::chrono::nanoseconds>(settings_.tick_budget).count() * settings_.wait_share;
+          const auto interval = interval_.load(std::memory_order_relaxed);
+          auto next = interval;
+          if (wait > target) {
+            next = std::max(settings_.min_interval, interval / 2);
+          }
+          else if (wait < target / 4) {
+            next = std::min(settings_.max_interval, interval * 1.25);
+          }
+          if (next == interval) {
+            continue;
+          }
+
+          interval_.store(next, std::memory_order_relaxed);
+          ++adjustments_;
+          // Setting the interval takes the GIL, which must not wait on the lock stop holds.
+          lock.unlock();
+          apply(next);
+          lock.lock();
+        }
+      }
+
+      std::atomic<bool> running_{ false };
+      std::atomic<double> interval_{ 0.005 };
+      std::atomic<std::uint64_t> window_wait_{ 0 };
+      std::atomic<std::uint64_t> adjustments_{ 0 };
+      double original_interval_ = 0.005;
+
+      SwitchIntervalSettings settings_;
+      std::mutex mutex_;
+      std::condition_variable condition_;
+      std::thread worker_;
+      bool stopping_ = false;
+    };
+  }
+}
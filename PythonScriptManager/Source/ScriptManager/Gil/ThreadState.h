@@ -0,0 +1,162 @@
+#pragma once
+#include <cstdint>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "GilTelemetry.h"
+
+namespace scripting {
+  namespace gil {
+    /// <summary>
+    /// A native thread's python thread state, kept for the life of the thread once it attaches.
+    /// Without one every GIL acquisition on a thread that python did not create allocates a thread state and frees it
+    /// again on release.
+    /// </summary>
+    class ThreadState {
+    public:
+      static ThreadState& current() {
+        thread_local ThreadState state;
+        return state;
+      }
+
+      ThreadState(const ThreadState&) = delete;
+      ThreadState& operator=(const ThreadState&) = delete;
+
+      ~ThreadState() {
+        // A thread exiting without detaching still frees its state, unless the interpreter has already gone.
+        if (owned_ && Py_IsInitialized()) {
+          detach();
+        }
+      }
+
+      /// <summary>
+      /// Create this thread's state. Call without holding the GIL, before the thread first dispatches.
+      /// A thread that already has a state, such as the one that started the interpreter, keeps using it.
+      /// </summary>
+      void attach() {
+        if (state_) {
+          return;
+        }
+
+        state_ = PyGILState_GetThisThreadState();
+        owned_ = state_ == nullptr;
+        if (owned_) {
+          // Also becomes the state PyGILState and pybind11 find for this thread.
+          state_ = PyThreadState_New(PyInterpreterState_Main());
+        }
+      }
+
+      /// <summary>
+      /// Free this thread's state. Call without holding the GIL, before the thread exits.
+      /// </summary>
+      void detach() {
+        if (!state_) {
+          return;
+        }
+
+        if (owned_) {
+          PyEval_RestoreThread(state_);
+          PyThreadState_Clear(state_);
+          PyThreadState_DeleteCurrent();
+        }
+        state_ = nullptr;
+        owned_ = false;
+      }
+
+      bool attached() const { return state_ != nullptr; }
+
+      PyThreadState* state() const { return state_; }
+
+    private:
+      ThreadState() = default;
+
+      PyThreadState* state_ = nullptr;
+      // Whether attach created the state, and so detach must delete it.
+      bool owned_ = false;
+    };
+
+    /// <summary>
+    /// Holds the GIL for its scope, in place of py::gil_scoped_acquire.
+    /// Does nothing when the caller already holds the GIL, swaps in the thread's state on attached threads and falls
+    /// back to PyGILState on any other thread. Each acquisition that has to take the GIL is timed for GilTelemetry.
+    /// </summary>
+    class GilAcquire {
+    public:
+      GilAcquire() {
+        if (PyGILState_Check()) {
+          return;
+        }
+
+        auto& telemetry = GilTelemetry::instance();
+        const auto timed = telemetry.enabled();
+        const auto requested = timed ? GilTelemetry::now() : 0;
+
+        const auto state = ThreadState::current().state();
+        if (state) {
+          PyEval_RestoreThread(state);
+          mode_ = Mode::RESTORED;
+        }
+        else {
+          gil_state_ = PyGILState_Ensure();
+          mode_ = Mode::ENSURED;
+        }
+
+        if (timed) {
+          acquired_ = GilTelemetry::now();
+          wait_ = acquired_ - requested;
+        }
+      }
+
+      GilAcquire(const GilAcquire&) = delete;
+      GilAcquire& operator=(const GilAcquire&) = delete;
+
+      ~GilAcquire() {
+        if (acquired_) {
+          GilTelemetry::instance().record(wait_, GilTelemetry::now() - acquired_);
+        }
+
+        if (mode_ == Mode::RESTORED) {
+          PyEval_SaveThread();
+        }
+        else if (mode_ == Mode::ENSURED) {
+          PyGILState_Release(gil_state_);
+        }
+      }
+
+    private:
+      enum class Mode { ALREADY_HELD, RESTORED, ENSURED };
+
+      Mode mode_ = Mode::ALREADY_HELD;
+      PyGILState_STATE gil_state_ = PyGILState_UNLOCKED;
+      // When the GIL was taken and how long that took, in nanoseconds. Zero when not timed.
+      std::uint64_t acquired_ = 0;
+      std::uint64_t wait_ = 0;
+    };
+
+    /// <summary>
+    /// Releases the GIL for its scope, and does nothing when the caller does not hold it.
+    /// Bound functions that run long native code declare it at registration with py::call_guard&lt;gil::GilRelease&gt;(),
+    /// after their arguments have been converted, so other threads can run python while they work.
+    /// </summary>
+    class GilRelease {
+    public:
+      GilRelease() {
+        if (PyGILState_Check()) {
+          state_ = PyEval_SaveThread();
+        }
+      }
+
+      GilRelease(const GilRelease&) = delete;
+      GilRelease& operator=(const GilRelease&) = delete;
+
+      ~GilRelease() {
+        if (state_) {
+          PyEval_RestoreThread(state_);
+        }
+      }
+
+    private:
+      PyThreadState* state_ = nullptr;
+    };
+  }
+}
@@ -0,0 +1,243 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+namespace scripting {
+  namespace handles {
+    /// <summary>
+    /// A reference to a game entity that stays safe to hold after the entity is gone.
+    /// Packs the entity's slot in its HandleTable, the slot's generation when the handle was made and the table's kind.
+    /// Zero is the null handle.
+    /// </summary>
+    struct EntityHandle {
+      static constexpr std::uint32_t kGenerationMask = 0xFFFFFF;
+
+      std::uint64_t value = 0;
+
+      static EntityHandle make(const std::uint8_t kind, const std::uint32_t generation, const std::uint32_t index) {
+        return { (static_cast<std::uint64_t>(kind) << 56) | (static_cast<std::uint64_t>(generation & kGenerationMask) << 32) | index };
+      }
+
+      std::uint32_t index() const { return static_cast<std::uint32_t>(value); }
+      std::uint32_t generation() const { return static_cast<std::uint32_t>(value >> 32) & kGenerationMask; }
+      std::uint8_t kind() const { return static_cast<std::uint8_t>(value >> 56); }
+
+      explicit operator bool() const { return value != 0; }
+      bool operator==(const EntityHandle& other) const { return value == other.value; }
+      bool operator!=(const EntityHandle& other) const { return value != other.value; }
+    };
+
+    /// <summary>
+    /// The python side of EntityHandle: an immutable object holding only the packed value, so passing one to python
+    /// costs one small allocation, like an int, rather than a pybind11 instance registration.
+    /// </summary>
+    struct HandleObject {
+      PyObject_HEAD
+      std::uint64_t value;
+    };
+
+    /// <summary>
+    /// Finds the table behind a handle's kind, so a handle can be checked and resolved without knowing its type.
+    /// Tables register when they are created, normally at startup, and unregister when destroyed.
+    /// </summary>
+    class HandleRegistry {
+    public:
+      using ValidFunction = bool(*)(const void* table, EntityHandle handle);
+      using ResolveFunction = py::object(*)(const void* table, EntityHandle handle);
+
+      static HandleRegistry& instance() {
+        static HandleRegistry registry;
+        return registry;
+      }
+
+      /// <summary>
+      /// Register a table.
+      /// </summary>
+      /// <returns>The table's kind, or 0 if every kind is taken.</returns>
+      std::uint8_t add(const void* table, const ValidFunction valid, const ResolveFunction resolve) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::size_t kind = 1; kind < entries_.size(); ++kind) {
+          if (!entries_[kind].table) {
+            entries_[kind] = { table, valid, resolve };
+            return static_cast<std::uint8_t>(kind);
+          }
+        }
+        return 0;
+      }
+
+      void remove(const std::uint8_t kind) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_[kind] = Entry();
+      }
+
+      bool valid(const EntityHandle handle) const {
+        const auto& entry = entries_[handle.kind()];
+        return entry.table && entry.valid(entry.table, handle);
+      }
+
+      /// <summary>
+      /// The handle's entity as a python object, or None if it no longer exists. Must be called with the GIL held.
+      /// </summary>
+      py::object resolve(const EntityHandle handle) const {
+        const auto& entry = entries_[handle.kind()];
+        return entry.table ? entry.resolve(entry.table, handle) : py::none();
+      }
+
+    private:
+      struct Entry {
+        const void* table = nullptr;
+        ValidFunction valid = nullptr;
+        ResolveFunction resolve = nullptr;
+      };
+
+      HandleRegistry() = default;
+
+      std::mutex mutex_;
+      std::array<Entry, 256> entries_{};
+    };
+
+    /// <summary>
+    /// The python type for handles, created when example_module is imported.
+    /// </summary>
+    inline PyTypeObject*& handle_type() {
+      static PyTypeObject* type = nullptr;
+      return type;
+    }
+
+    inline EntityHandle handle_of(PyObject* object) {
+      return { reinterpret_cast<HandleObject*>(object)->value };
+    }
+
+    /// <summary>
+    /// Make a python handle. Must be called with the GIL held, after handle_type is created.
+    /// </summary>
+    inline PyObject* new_handle_object(const EntityHandle handle) {
+      const auto object = PyObject_New(HandleObject, handle_type());
+      if (object) {
+        object->value = handle.value;
+      }
+      return reinterpret_cast<PyObject*>(object);
+    }
+
+    namespace handle_slots {
+      inline void dealloc(PyObject* self) {
+        const auto type = Py_TYPE(self);
+        PyObject_Free(self);
+        Py_DECREF(type);
+      }
+
+      inline PyObject* repr(PyObject* self) {
+        const auto handle = handle_of(self);
+        return PyUnicode_FromFormat("EntityHandle(kind=%u, index=%u, generation=%u)", static_cast<unsigned>(handle.kind()),
+          static_cast<unsigned>(handle.index()), static_cast<unsigned>(handle.generation()));
+      }
+
+      inline Py_hash_t hash(PyObject* self) {
+        const auto hash = static_cast<Py_hash_t>(handle_of(self).value ^ (handle_of(self).value >> 32));
+        // -1 signals an error to python.
+        return hash == -1 ? -2 : hash;
+      }
+
+      inline PyObject* compare(PyObject* self, PyObject* other, const int operation) {
+        if (Py_TYPE(other) != handle_type() || (operation != Py_EQ && operation != Py_NE)) {
+          Py_RETURN_NOTIMPLEMENTED;
+        }
+        const auto equal = handle_of(self) == handle_of(other);
+        return PyBool_FromLong(operation == Py_EQ ? equal : !equal);
+      }
+
+      inline int is_set(PyObject* self) {
+        return handle_of(self) ? 1 : 0;
+      }
+
+      inline PyObject* valid(PyObject* self, PyObject*) {
+        return PyBool_FromLong(HandleRegistry::instance().valid(handle_of(self)));
+      }
+
+      inline PyObject* index(PyObject* self, void*) {
+        return PyLong_FromUnsignedLong(handle_of(self).index());
+      }
+
+      inline PyObject* generation(PyObject* self, void*) {
+        return PyLong_FromUnsignedLong(handle_of(self).generation());
+      }
+
+      inline PyObject* kind(PyObject* self, void*) {
+        return PyLong_FromUnsignedLong(handle_of(self).kind());
+      }
+
+      inline PyObject* value(PyObject* self, void*) {
+        return PyLong_FromUnsignedLongLong(handle_of(self).value);
+      }
+    }
+
+    /// <summary>
+    /// Create the python handle type. Scripts cannot construct or change handles, only receive them from the game.
+    /// </summary>
+    inline py::object make_handle_type() {
+      static PyMethodDef methods[] = {
+        { "valid", &handle_slots::valid, METH_NOARGS, "Whether the entity is still alive" },
+        { nullptr, nullptr, 0, nullptr }
+      };
+      static PyGetSetDef properties[] = {
+        { "index", &handle_slots::index, nullptr, nullptr, nullptr },
+        { "generation", &handle_slots::generation, nullptr, nullptr, nullptr },
+        { "kind", &handle_slots::kind, nullptr, nullptr, nullptr },
+        { "value", &handle_slots::value, nullptr, "The packed 64 bit handle", nullptr },
+        { nullptr, nullptr, nullptr, nullptr, nullptr }
+      };
+      static PyType_Slot slots[] = {
+        { Py_tp_dealloc, reinterpret_cast<void*>(&handle_slots::dealloc) },
+        { Py_tp_repr, reinterpret_cast<void*>(&handle_slots::repr) },
+        { Py_tp_hash, reinterpret_cast<void*>(&handle_slots::hash) },
+        { Py_tp_richcompare, reinterpret_cast<void*>(&handle_slots::compare) },
+        { Py_nb_bool, reinterpret_cast<void*>(&handle_slots::is_set) },
+        { Py_tp_methods, methods },
+        { Py_tp_getset, properties },
+        { 0, nullptr }
+      };
+      static PyType_Spec spec = {
+        "example_module.EntityHandle", static_cast<int>(sizeof(HandleObject)), 0,
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION, slots
+      };
+
+      const auto type = PyType_FromSpec(&spec);
+      if (!type) {
+        throw py::error_already_set();
+      }
+      handle_type() = reinterpret_cast<PyTypeObject*>(type);
+      return py::reinterpret_steal<py::object>(type);
+    }
+  }
+}
+
+namespace pybind11 {
+  namespace detail {
+    /// <summary>
+    /// Converts EntityHandle to and from the python handle type. None converts to the null handle.
+    /// </summary>
+    template <>
+    struct type_caster<scripting::handles::EntityHandle> {
+      PYBIND11_TYPE_CASTER(scripting::handles::EntityHandle, const_name("EntityHandle"));
+
+      bool load(handle source, bool) {
+        if (source.is_none()) {
+          value = scripting::handles::EntityHandle();
+          return true;
+        }
+        if (Py_TYPE(source.ptr()) != scripting::handles::handle_type()) {
+          return false;
+        }
+        value = scripting::handles::handle_of(source.ptr());
+        return true;
+      }
+
+      static handle cast(const scripting::handles::EntityHandle& source, return_value_policy, handle) {
+        return scripting::handles::new_handle_object(source);
+      }
+    };
+  }
+}
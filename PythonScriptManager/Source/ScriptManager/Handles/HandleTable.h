@@ -0,0 +1,174 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "EntityHandle.h"
+#include "..\Wrappers\CachedWrapper.h"
+
+namespace scripting {
+  namespace handles {
+    /// <summary>
+    /// Gives each live entity of one type a handle scripts can keep across ticks.
+    /// Entities sit in slots of a slab that only grows, so resolving a handle is an index and a generation check with
+    /// no lock and no hashing. Removing an entity bumps its slot's generation, so handles made before it fail to
+    /// resolve even once the slot is reused.
+    /// Adding and removing take a lock and may happen on any thread. Removing and using an entity must not race:
+    /// remove it on the thread that owns it before destroying it.
+    /// </summary>
+    /// <typeparam name="T">The entity type, bound with py::class_ to resolve handles from python</typeparam>
+    template <typename T>
+    class HandleTable {
+    public:
+      static constexpr std::uint32_t kChunkSize = 4096;
+      static constexpr std::uint32_t kMaxChunks = 1024;
+
+      HandleTable() {
+        kind_ = HandleRegistry::instance().add(this, &valid_entry, &resolve_entry);
+      }
+
+      HandleTable(const HandleTable&) = delete;
+      HandleTable& operator=(const HandleTable&) = delete;
+
+      ~HandleTable() {
+        if (kind_ != 0) {
+          HandleRegistry::instance().remove(kind_);
+        }
+        for (auto& chunk : chunks_) {
+          delete[] chunk.load(std::memory_order_relaxed);
+        }
+      }
+
+      /// <summary>
+      /// Give an entity a handle.
+      /// </summary>
+      /// <returns>The handle, or the null handle if the table is full or has no kind.</returns>
+      EntityHandle add(T* object) {
+        if (!object || kind_ == 0) {
+          return EntityHandle();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::uint32_t index;
+        if (free_head_ != kNoSlot) {
+          index = free_head_;
+          free_head_ = slot(index).next_free;
+        }
+        else {
+          index = used_.load(std::memory_order_relaxed);
+          if (index == kChunkSize * kMaxChunks) {
+            return EntityHandle();
+          }
+          if (index % kChunkSize == 0) {
+            chunks_[index / kChunkSize].store(new Slot[kChunkSize], std::memory_order_release);
+          }
+        }
+
+        auto& entry = slot(index);
+        entry.object.store(object, std::memory_order_release);
+        if (index == used_.load(std::memory_order_relaxed)) {
+          used_.store(index + 1, std::memory_order_release);
+        }
+        ++live_;
+        return EntityHandle::make(kind_, entry.generation.load(std::memory_order_relaxed), index);
+      }
+
+      /// <summary>
+      /// Remove an entity, invalidating every handle to it.
+      /// </summary>
+      /// <returns>False if the handle was already stale.</returns>
+      bool remove(const EntityHandle handle) {
+        if (handle.kind() != kind_ || handle.index() >= used()) {
+          return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entry = slot(handle.index());
+        const auto generation = entry.generation.load(std::memory_order_relaxed);
+        if (generation != handle.generation()) {
+          return false;
+        }
+        entry.object.store(nullptr, std::memory_order_release);
+        entry.generation.store((generation + 1) & EntityHandle::kGenerationMask, std::memory_order_release);
+        entry.next_free = free_head_;
+        free_head_ = handle.index();
+        --live_;
+        return true;
+      }
+
+      /// <summary>
+      /// The entity behind a handle, or nullptr if it has been removed or the handle belongs to another table.
+      /// </summary>
+      T* resolve(const EntityHandle handle) const {
+        if (handle.kind() != kind_ || handle.index() >= used()) {
+          return nullptr;
+        }
+        const auto& entry = slot(handle.index());
+        // Reading the generation on both sides of the object means a slot removed and reused in between is not missed.
+        if (entry.generation.load(std::memory_order_acquire) != handle.generation()) {
+          return nullptr;
+        }
+        const auto object = entry.object.load(std::memory_order_acquire);
+        if (entry.generation.load(std::memory_order_acquire) != handle.generation()) {
+          return nullptr;
+        }
+        return object;
+      }
+
+      bool valid(const EntityHandle handle) const { return resolve(handle) != nullptr; }
+
+      std::uint8_t kind() const { return kind_; }
+
+      /// <summary>
+      /// Number of entities with a handle.
+      /// </summary>
+      std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return live_;
+      }
+
+    private:
+      static constexpr std::uint32_t kNoSlot = 0xFFFFFFFF;
+
+      struct Slot {
+        std::atomic<T*> object{ nullptr };
+        std::atomic<std::uint32_t> generation{ 0 };
+        std::uint32_t next_free = kNoSlot;
+      };
+
+      std::uint32_t used() const { return used_.load(std::memory_order_acquire); }
+
+      Slot& slot(const std::uint32_t index) const {
+        return chunks_[index / kChunkSize].load(std::memory_order_acquire)[index % kChunkSize];
+      }
+
+      static bool valid_entry(const void* table, const EntityHandle handle) {
+        return static_cast<const HandleTable*>(table)->valid(handle);
+      }
+
+      static py::object resolve_entry(const void* table, const EntityHandle handle) {
+        const auto object = static_cast<const HandleTable*>(table)->resolve(handle);
+        if (!object) {
+          return py::none();
+        }
+        if constexpr (std::is_base_of_v<wrappers::CachedWrapper<T>, T>) {
+          return object->python_wrapper();
+        }
+        else {
+          return py::cast(object, py::return_value_policy::reference);
+        }
+      }
+
+      mutable std::mutex mutex_;
+      std::uint8_t kind_ = 0;
+      std::array<std::atomic<Slot*>, kMaxChunks> chunks_{};
+      std::atomic<std::uint32_t> used_{ 0 };
+      std::uint32_t free_head_ = kNoSlot;
+      std::size_t live_ = 0;
+    };
+  }
+}
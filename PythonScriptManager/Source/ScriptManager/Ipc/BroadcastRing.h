@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace scripting {
+  namespace ipc {
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "ring positions must be lock free to live in shared memory");
+
+    /// <summary>
+    /// Control block of a ring, placed in shared memory ahead of its data.
+    /// Positions only ever grow, the byte offset of a position is position % capacity.
+    /// </summary>
+    struct alignas(64) RingHeader {
+      // Process id of the writer, zero while the ring is unclaimed.
+      std::atomic<std::uint32_t> owner;
+      // End of the record currently being written. Readers use it to detect records overwritten while they copied them.
+      alignas(64) std::atomic<std::uint64_t> write_begin;
+      // End of the last complete record.
+      alignas(64) std::atomic<std::uint64_t> write_end;
+    };
+
+    /// <summary>
+    /// A single writer, many reader broadcast ring over shared memory.
+    /// The writer never waits for readers: a reader that falls a full ring behind loses the overwritten records and is
+    /// told so, rather than stalling the writing process. Records are [u32 size][payload] padded to 8 bytes.
+    /// </summary>
+    class BroadcastRing {
+    public:
+      enum class ReadResult {
+        EMPTY = 0,
+        READ,
+        // The reader fell behind and skipped to the newest data.
+        LOST
+      };
+
+      BroadcastRing() = default;
+      BroadcastRing(RingHeader* header, char* data, const std::uint32_t capacity) : header_(header), data_(data), capacity_(capacity) {}
+
+      /// <summary>
+      /// Largest payload a single record can hold.
+      /// </summary>
+      std::uint32_t max_payload() const { return capacity_ / 4; }
+
+      /// <summary>
+      /// Append a record. Only the process that owns the ring may write, one thread at a time.
+      /// </summary>
+      /// <returns>false if the payload is larger than max_payload.</returns>
+      bool write(const char* payload, const std::uint32_t size) {
+        if (size > max_payload()) {
+          return false;
+        }
+
+        const auto record = record_size(size);
+        auto position = header_->write_end.load(std::memory_order_relaxed);
+        auto offset = offset_of(position);
+
+        // Records never wrap, fill the end of the ring with padding and start again at the beginning.
+        const auto padding = offset + record > capacity_ ? capacity_ - offset : 0;
+        header_->write_begin.store(position + padding + record, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        if (padding > 0) {
+          std::memcpy(data_ + offset, &kPadding, sizeof(kPadding));
+          position += padding;
+          offset = 0;
+        }
+
+        std::memcpy(data_ + offset, &size, sizeof(size));
+        std::memcpy(data_ + offset + sizeof(size), payload, size);
+        header_->write_end.store(position + record, std::memory_order_release);
+        return true;
+      }
+
+      /// <summary>
+      /// Position new readers start from so they only see records written after they joined.
+      /// </summary>
+      std::uint64_t end_position() const {
+        return header_->write_end.load(std::memory_order_acquire);
+      }
+
+      /// <summary>
+      /// Read the record at a reader's cursor.
+      /// </summary>
+      /// <param name="cursor">The reader's position, advanced past the record</param>
+      /// <param name="payload">Set to a copy of the record's payload</param>
+      ReadResult read(std::uint64_t& cursor, std::string& payload) const {
+        while (true) {
+          const auto end = header_->write_end.load(std::memory_order_acquire);
+          if (cursor == end) {
+            return ReadResult::EMPTY;
+          }
+          if (end - cursor > capacity_) {
+            cursor = end;
+            return ReadResult::LOST;
+          }
+
+          const auto offset = offset_of(cursor);
+          std::uint32_t size;
+          std::memcpy(&size, data_ + offset, sizeof(size));
+
+          const auto padding = size == kPadding;
+          if (!padding && size <= max_payload()) {
+            payload.assign(data_ + offset + sizeof(size), size);
+          }
+
+          // Anything the writer started after we loaded end may have overwritten what we just copied.
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (header_->write_begin.load(std::memory_order_relaxed) - cursor > capacity_ || (!padding && size > max_payload())) {
+            cursor = header_->write_end.load(std::memory_order_acquire);
+            return ReadResult::LOST;
+          }
+
+          if (padding) {
+            cursor += capacity_ - offset;
+            continue;
+          }
+          cursor += record_size(size);
+          return ReadResult::READ;
+        }
+      }
+
+    private:
+      static constexpr std::uint32_t kPadding = 0xFFFFFFFF;
+
+      static std::uint32_t record_size(const std::uint32_t size) {
+        return (static_cast<std::uint32_t>(sizeof(std::uint32_t)) + size + 7) & ~7u;
+      }
+
+      std::uint32_t offset_of(const std::uint64_t position) const {
+        return static_cast<std::uint32_t>(position & (capacity_ - 1));
+      }
+
+      RingHeader* header_ = nullptr;
+      char* data_ = nullptr;
+      // A power of two.
+      std::uint32_t capacity_ = 0;
+    };
+  }
+}
@@ -0,0 +1,317 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "BroadcastRing.h"
+#include "SharedMemory.h"
+#include "..\Serialization\EventCodec.h"
+
+namespace scripting {
+  namespace ipc {
+    /// <summary>
+    /// An event received from another process. The arguments are still encoded.
+    /// </summary>
+    struct BridgeEvent {
+      std::string event_name;
+      std::string arguments;
+    };
+
+    /// <summary>
+    /// Carries selected events between the processes on a host.
+    /// The shared region holds one broadcast ring per process: each process writes only to the ring it claimed and
+    /// reads every other ring, so no lock is ever shared between processes. Records are an event name followed by
+    /// EventCodec arguments, encoded and decoded without the GIL.
+    /// </summary>
+    class EventBridge {
+    public:
+      static constexpr std::uint32_t kMaxProcesses = 16;
+      static constexpr std::uint32_t kDefaultRingCapacity = 1 << 20;
+      // Event names are sent with 16 bit lengths.
+      static constexpr std::size_t kMaxEventNameSize = std::numeric_limits<std::uint16_t>::max();
+
+      EventBridge() = default;
+      EventBridge(const EventBridge&) = delete;
+      EventBridge& operator=(const EventBridge&) = delete;
+      ~EventBridge() { close(); }
+
+      /// <summary>
+      /// Join the bridge, creating the shared region if this is the first process.
+      /// </summary>
+      /// <param name="name">Name of the shared region, the same for every process on the bridge</param>
+      /// <param name="ring_capacity">Bytes per process ring, a power of two. Must match the other processes</param>
+      /// <param name="error">Set to the reason the bridge could not be joined</param>
+      bool open(const std::string& name, const std::uint32_t ring_capacity, std::string& error) {
+        close();
+
+        if (ring_capacity < 4096 || (ring_capacity & (ring_capacity - 1)) != 0) {
+          error = "ring capacity must be a power of two of at least 4096 bytes";
+          return false;
+        }
+
+        const auto ring_stride = sizeof(RingHeader) + ring_capacity;
+        if (!memory_.open(name, sizeof(RegionHeader) + kMaxProcesses * ring_stride)) {
+          error = "could not map shared memory '" + name + "'";
+          return false;
+        }
+
+        // The first process to arrive lays the region out, everyone else waits for it to finish.
+        const auto region = reinterpret_cast<RegionHeader*>(memory_.data());
+        std::uint32_t state = kUninitialized;
+        if (region->state.compare_exchange_strong(state, kInitializing)) {
+          region->ring_capacity = ring_capacity;
+          region->state.store(kReady, std::memory_order_release);
+        }
+        else {
+          const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+          while (region->state.load(std::memory_order_acquire) != kReady) {
+            if (std::chrono::steady_clock::now() > deadline) {
+              error = "shared memory '" + name + "' was left half initialized";
+              memory_.close();
+              return false;
+            }
+            std::this_thread::yield();
+          }
+        }
+
+        if (region->ring_capacity != ring_capacity) {
+          error = "ring capacity does not match the other processes on the bridge";
+          memory_.close();
+          return false;
+        }
+
+        for (std::uint32_t i = 0; i < kMaxProcesses; ++i) {
+          const auto base = memory_.data() + sizeof(RegionHeader) + i * ring_stride;
+          headers_[i] = reinterpret_cast<RingHeader*>(base);
+          rings_[i] = BroadcastRing(headers_[i], base + sizeof(RingHeader), ring_capacity);
+        }
+
+        slot_ = claim_slot();
+        if (slot_ < 0) {
+          error = "every bridge slot is in use";
+          memory_.close();
+          return false;
+        }
+
+        // Only deliver what other processes publish from now on.
+        for (std::uint32_t i = 0; i < kMaxProcesses; ++i) {
+          cursors_[i] = rings_[i].end_position();
+        }
+
+        open_.store(true, std::memory_order_release);
+        return true;
+      }
+
+      /// <summary>
+      /// Leave the bridge, freeing this process's ring for another process.
+      /// </summary>
+      void close() {
+        if (!open_.exchange(false, std::memory_order_acq_rel)) {
+          return;
+        }
+
+        std::scoped_lock lock(write_mutex_, read_mutex_);
+        headers_[slot_]->owner.store(0, std::memory_order_release);
+        slot_ = -1;
+        memory_.close();
+      }
+
+      bool is_open() const { return open_.load(std::memory_order_acquire); }
+
+      /// <summary>
+      /// Forward an event to the other processes whenever it is dispatched locally.
+      /// </summary>
+      /// <returns>false if the event name is too long to be sent.</returns>
+      bool forward_event(const std::string& event_name) {
+        if (event_name.size() > kMaxEventNameSize) {
+          return false;
+        }
+        std::unique_lock<std::shared_mutex> lock(forward_mutex_);
+        forwarded_.insert(event_name);
+        forward_count_.store(forwarded_.size(), std::memory_order_release);
+        return true;
+      }
+
+      void stop_forwarding(const std::string& event_name) {
+        std::unique_lock<std::shared_mutex> lock(forward_mutex_);
+        forwarded_.erase(event_name);
+        forward_count_.store(forwarded_.size(), std::memory_order_release);
+      }
+
+      /// <summary>
+      /// Whether an event is forwarded. Free when nothing is forwarded.
+      /// </summary>
+      bool forwards(const std::string& event_name) const {
+        if (forward_count_.load(std::memory_order_acquire) == 0 || !is_open()) {
+          return false;
+        }
+        std::shared_lock<std::shared_mutex> lock(forward_mutex_);
+        return forwarded_.count(event_name) != 0;
+      }
+
+      /// <summary>
+      /// Publish an event from its C++ arguments. Does not require the GIL.
+      /// </summary>
+      /// <returns>false if the bridge is closed, the event name is too long or the event is too large for a ring record.</returns>
+      template <typename... Args>
+      bool publish(const std::string_view event_name, const Args&... args) {
+        if (event_name.size() > kMaxEventNameSize) {
+          return false;
+        }
+        auto& record = scratch();
+        begin_record(record, event_name);
+        serialization::EventCodec::encode(record, args...);
+        return write(record);
+      }
+
+      /// <summary>
+      /// Publish an event whose arguments are python objects. Must be called with the GIL held.
+      /// </summary>
+      /// <returns>false under the same conditions as publish.</returns>
+      bool publish_python(const std::string_view event_name, const py::tuple& arguments) {
+        if (event_name.size() > kMaxEventNameSize) {
+          return false;
+        }
+        auto& record = scratch();
+        begin_record(record, event_name);
+        serialization::EventCodec::encode(record, arguments);
+        return write(record);
+      }
+
+      /// <summary>
+      /// Read events published by the other processes. Does not require the GIL.
+      /// </summary>
+      /// <param name="events">Received events are appended here</param>
+      /// <param name="max_events">Stop after this many events</param>
+      /// <returns>The number of events received.</returns>
+      std::size_t poll(std::vector<BridgeEvent>& events, const std::size_t max_events) {
+        std::lock_guard<std::mutex> lock(read_mutex_);
+        if (!is_open()) {
+          return 0;
+        }
+
+        std::size_t received = 0;
+        for (std::uint32_t i = 0; i < kMaxProcesses && received < max_events; ++i) {
+          if (static_cast<int>(i) == slot_) {
+            continue;
+          }
+
+          while (received < max_events) {
+            const auto result = rings_[i].read(cursors_[i], record_);
+            if (result == BroadcastRing::ReadResult::EMPTY) {
+              break;
+            }
+            if (result == BroadcastRing::ReadResult::LOST) {
+              lost_.fetch_add(1, std::memory_order_relaxed);
+              continue;
+            }
+
+            BridgeEvent event;
+            if (!split_record(record_, event)) {
+              continue;
+            }
+            events.push_back(std::move(event));
+            ++received;
+          }
+        }
+        return received;
+      }
+
+      std::uint64_t published() const { return published_.load(std::memory_order_relaxed); }
+      std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+      // Number of times this process fell a full ring behind a writer and skipped ahead.
+      std::uint64_t overruns() const { return lost_.load(std::memory_order_relaxed); }
+
+    private:
+      static constexpr std::uint32_t kUninitialized = 0;
+      static constexpr std::uint32_t kInitializing = 1;
+      static constexpr std::uint32_t kReady = 2;
+
+      struct alignas(64) RegionHeader {
+        std::atomic<std::uint32_t> state;
+        std::uint32_t ring_capacity;
+      };
+
+      static std::string& scratch() {
+        thread_local std::string record;
+        return record;
+      }
+
+      static void begin_record(std::string& record, const std::string_view event_name) {
+        record.clear();
+        serialization::EventCodec::write(record, static_cast<std::uint16_t>(event_name.size()));
+        record.append(event_name);
+      }
+
+      static bool split_record(const std::string& record, BridgeEvent& event) {
+        const char* data = record.data();
+        const auto end = data + record.size();
+        std::uint16_t length;
+        if (!serialization::EventCodec::read(data, end, length) || static_cast<std::size_t>(end - data) < length) {
+          return false;
+        }
+        event.event_name.assign(data, length);
+        event.arguments.assign(data + length, end);
+        return true;
+      }
+
+      bool write(const std::string& record) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        if (!is_open() || !rings_[slot_].write(record.data(), static_cast<std::uint32_t>(record.size()))) {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+        published_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+
+      /// <summary>
+      /// Claim a free ring, or one left behind by a process that is no longer running.
+      /// </summary>
+      int claim_slot() {
+        const auto process_id = SharedMemory::current_process_id();
+        for (auto pass = 0; pass < 2; ++pass) {
+          for (std::uint32_t i = 0; i < kMaxProcesses; ++i) {
+            auto owner = headers_[i]->owner.load(std::memory_order_acquire);
+            if (owner != 0 && (pass == 0 || SharedMemory::process_alive(owner))) {
+              continue;
+            }
+            if (headers_[i]->owner.compare_exchange_strong(owner, process_id, std::memory_order_acq_rel)) {
+              return static_cast<int>(i);
+            }
+          }
+        }
+        return -1;
+      }
+
+      SharedMemory memory_;
+      std::atomic<bool> open_{ false };
+      int slot_ = -1;
+      std::array<RingHeader*, kMaxProcesses> headers_{};
+      std::array<BroadcastRing, kMaxProcesses> rings_{};
+
+      std::mutex write_mutex_;
+
+      std::mutex read_mutex_;
+      std::array<std::uint64_t, kMaxProcesses> cursors_{};
+      std::string record_;
+
+      mutable std::shared_mutex forward_mutex_;
+      std::unordered_set<std::string> forwarded_;
+      std::atomic<std::size_t> forward_count_{ 0 };
+
+      std::atomic<std::uint64_t> published_{ 0 };
+      std::atomic<std::uint64_t> dropped_{ 0 };
+      std::atomic<std::uint64_t> lost_{ 0 };
+    };
+  }
+}
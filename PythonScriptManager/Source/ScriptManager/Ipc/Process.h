@@ -0,0 +1,175 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <climits>
+extern char** environ;
+#endif
+
+namespace scripting {
+  namespace ipc {
+    /// <summary>
+    /// A child process started by the script manager.
+    /// </summary>
+    class Process {
+    public:
+      Process() = default;
+      Process(const Process&) = delete;
+      Process& operator=(const Process&) = delete;
+      ~Process() { release(); }
+
+      /// <summary>
+      /// Path of the running executable, used to start copies of it in another mode.
+      /// </summary>
+      static std::string executable_path() {
+#ifdef _WIN32
+        char path[MAX_PATH];
+        const auto length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+        return std::string(path, length);
+#else
+        char path[PATH_MAX];
+        const auto length = readlink("/proc/self/exe", path, sizeof(path));
+        return length > 0 ? std::string(path, static_cast<std::size_t>(length)) : std::string();
+#endif
+      }
+
+      /// <summary>
+      /// Start a process. It shares the parent's console.
+      /// </summary>
+      /// <returns>false if the process could not be started.</returns>
+      bool start(const std::string& executable, const std::vector<std::string>& arguments) {
+        release();
+
+#ifdef _WIN32
+        std::string command_line = quote(executable);
+        for (const auto& argument : arguments) {
+          command_line += ' ';
+          command_line += quote(argument);
+        }
+
+        STARTUPINFOA startup_info = { sizeof(startup_info) };
+        PROCESS_INFORMATION process_info;
+        if (!CreateProcessA(executable.c_str(), command_line.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup_info, &process_info)) {
+          return false;
+        }
+        CloseHandle(process_info.hThread);
+        handle_ = process_info.hProcess;
+        id_ = process_info.dwProcessId;
+#else
+        owned_ = true;
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(executable.c_str()));
+        for (const auto& argument : arguments) {
+          argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        pid_t pid;
+        if (posix_spawn(&pid, executable.c_str(), nullptr, nullptr, argv.data(), environ) != 0) {
+          return false;
+        }
+        id_ = static_cast<std::uint32_t>(pid);
+#endif
+        return true;
+      }
+
+#ifndef _WIN32
+      /// <summary>
+      /// Track a process started by another process, such as a worker forked by the fork server.
+      /// Its parent reaps it, so it is watched by id alone.
+      /// </summary>
+      void adopt(const std::uint32_t process_id) {
+        release();
+        id_ = process_id;
+        owned_ = false;
+      }
+#endif
+
+      /// <summary>
+      /// Wait for the process to exit, killing it if it has not exited in time.
+      /// </summary>
+      void stop(const std::chrono::milliseconds timeout) {
+        if (id_ == 0) {
+          return;
+        }
+
+#ifdef _WIN32
+        if (WaitForSingleObject(handle_, static_cast<DWORD>(timeout.count())) == WAIT_TIMEOUT) {
+          TerminateProcess(handle_, 1);
+          WaitForSingleObject(handle_, INFINITE);
+        }
+#else
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (running()) {
+          if (std::chrono::steady_clock::now() > deadline) {
+            kill(static_cast<pid_t>(id_), SIGKILL);
+            if (owned_) {
+              waitpid(static_cast<pid_t>(id_), nullptr, 0);
+            }
+            break;
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+#endif
+        id_ = 0;
+        release();
+      }
+
+      /// <summary>
+      /// Whether the process is still running.
+      /// </summary>
+      bool running() const {
+        if (id_ == 0) {
+          return false;
+        }
+#ifdef _WIN32
+        return WaitForSingleObject(handle_, 0) == WAIT_TIMEOUT;
+#else
+        if (!owned_) {
+          return kill(static_cast<pid_t>(id_), 0) == 0;
+        }
+        return waitpid(static_cast<pid_t>(id_), nullptr, WNOHANG) == 0;
+#endif
+      }
+
+      std::uint32_t id() const { return id_; }
+
+    private:
+#ifdef _WIN32
+      static std::string quote(const std::string& argument) {
+        return "\"" + argument + "\"";
+      }
+#endif
+
+      void release() {
+#ifdef _WIN32
+        if (handle_) {
+          CloseHandle(handle_);
+          handle_ = nullptr;
+        }
+#endif
+      }
+
+#ifdef _WIN32
+      HANDLE handle_ = nullptr;
+#else
+      // Whether this process is the parent, and so must reap it.
+      bool owned_ = true;
+#endif
+      std::uint32_t id_ = 0;
+    };
+  }
+}
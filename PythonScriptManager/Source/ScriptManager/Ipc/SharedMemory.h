@@ -0,0 +1,139 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace scripting {
+  namespace ipc {
+    /// <summary>
+    /// A named shared memory region visible to every process on the host. New regions are zero filled.
+    /// </summary>
+    class SharedMemory {
+    public:
+      SharedMemory() = default;
+      SharedMemory(const SharedMemory&) = delete;
+      SharedMemory& operator=(const SharedMemory&) = delete;
+      ~SharedMemory() { close(); }
+
+      /// <summary>
+      /// Create the region or open it if another process already created it.
+      /// </summary>
+      /// <param name="name">Name shared by every process using the region</param>
+      /// <param name="size">Size of the region in bytes</param>
+      /// <returns>false if the region could not be mapped.</returns>
+      bool open(const std::string& name, const std::size_t size) {
+        close();
+
+#ifdef _WIN32
+        const auto object_name = "Local\\" + name;
+        mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+          static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size), object_name.c_str());
+        if (!mapping_) {
+          return false;
+        }
+        data_ = static_cast<char*>(MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size));
+#else
+        const auto object_name = "/" + name;
+        const auto file = shm_open(object_name.c_str(), O_RDWR | O_CREAT, 0600);
+        if (file < 0) {
+          return false;
+        }
+
+        // Only grow the region, a process that created it larger must not have it cut from under it.
+        struct stat status;
+        if (fstat(file, &status) != 0 || (static_cast<std::size_t>(status.st_size) < size && ftruncate(file, static_cast<off_t>(size)) != 0)) {
+          ::close(file);
+          return false;
+        }
+
+        const auto mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        ::close(file);
+        data_ = mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+#endif
+
+        if (!data_) {
+          close();
+          return false;
+        }
+        size_ = size;
+        return true;
+      }
+
+      void close() {
+#ifdef _WIN32
+        if (data_) {
+          UnmapViewOfFile(data_);
+        }
+        if (mapping_) {
+          CloseHandle(mapping_);
+        }
+        mapping_ = nullptr;
+#else
+        if (data_) {
+          munmap(data_, size_);
+        }
+#endif
+        data_ = nullptr;
+        size_ = 0;
+      }
+
+      /// <summary>
+      /// Delete a named region once every process has unmapped it. Regions are reference counted on Windows.
+      /// </summary>
+      static void remove(const std::string& name) {
+#ifndef _WIN32
+        shm_unlink(("/" + name).c_str());
+#endif
+      }
+
+      char* data() const { return data_; }
+      std::size_t size() const { return size_; }
+
+      static std::uint32_t current_process_id() {
+#ifdef _WIN32
+        return static_cast<std::uint32_t>(GetCurrentProcessId());
+#else
+        return static_cast<std::uint32_t>(getpid());
+#endif
+      }
+
+      /// <summary>
+      /// Whether a process is still running, used to reclaim resources left behind by a crashed process.
+      /// </summary>
+      static bool process_alive(const std::uint32_t process_id) {
+#ifdef _WIN32
+        const auto process = OpenProcess(SYNCHRONIZE, FALSE, process_id);
+        if (!process) {
+          return GetLastError() == ERROR_ACCESS_DENIED;
+        }
+        const auto alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+        CloseHandle(process);
+        return alive;
+#else
+        return kill(static_cast<pid_t>(process_id), 0) == 0 || errno == EPERM;
+#endif
+      }
+
+    private:
+#ifdef _WIN32
+      HANDLE mapping_ = nullptr;
+#endif
+      char* data_ = nullptr;
+      std::size_t size_ = 0;
+    };
+  }
+}
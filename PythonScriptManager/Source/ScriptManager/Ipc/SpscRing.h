@@ -0,0 +1,141 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+namespace scripting {
+  namespace ipc {
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "ring positions must be lock free to live in shared memory");
+
+    /// <summary>
+    /// Control block of a single producer, single consumer ring, placed in shared memory ahead of its data.
+    /// </summary>
+    struct alignas(64) SpscHeader {
+      // Written by the producer only.
+      std::atomic<std::uint64_t> head;
+      // Written by the consumer only.
+      alignas(64) std::atomic<std::uint64_t> tail;
+    };
+
+    /// <summary>
+    /// A lossless ring between exactly one producer and one consumer, which may be in different processes.
+    /// Records are [u32 size][payload] padded to 8 bytes and never wrap. A producer that knows a payload's size can
+    /// reserve it and build the payload in place, and the consumer reads records where they lie; write copies a payload
+    /// built elsewhere.
+    /// </summary>
+    class SpscRing {
+    public:
+      SpscRing() = default;
+      SpscRing(SpscHeader* header, char* data, const std::uint32_t capacity) : header_(header), data_(data), capacity_(capacity) {}
+
+      /// <summary>
+      /// Largest payload a single record can hold.
+      /// </summary>
+      std::uint32_t max_payload() const { return capacity_ / 4; }
+
+      /// <summary>
+      /// Reserve space for a record. Fill it and then commit it.
+      /// </summary>
+      /// <returns>Where to write the payload, or nullptr while the consumer has not freed enough space.</returns>
+      char* reserve(const std::uint32_t size) {
+        if (size > max_payload()) {
+          return nullptr;
+        }
+
+        const auto record = record_size(size);
+        auto head = header_->head.load(std::memory_order_relaxed);
+        const auto offset = offset_of(head);
+        const auto padding = offset + record > capacity_ ? capacity_ - offset : 0;
+
+        if (head + padding + record - header_->tail.load(std::memory_order_acquire) > capacity_) {
+          return nullptr;
+        }
+
+        if (padding > 0) {
+          std::memcpy(data_ + offset, &kPadding, sizeof(kPadding));
+          head += padding;
+        }
+
+        reserved_head_ = head;
+        reserved_size_ = size;
+        std::memcpy(data_ + offset_of(head), &size, sizeof(size));
+        return data_ + offset_of(head) + sizeof(size);
+      }
+
+      /// <summary>
+      /// Publish the record filled after reserve.
+      /// </summary>
+      void commit() {
+        header_->head.store(reserved_head_ + record_size(reserved_size_), std::memory_order_release);
+      }
+
+      /// <summary>
+      /// Copy a payload in to the ring.
+      /// </summary>
+      /// <returns>false while the ring is too full.</returns>
+      bool write(const char* payload, const std::uint32_t size) {
+        const auto data = reserve(size);
+        if (!data) {
+          return false;
+        }
+        std::memcpy(data, payload, size);
+        commit();
+        return true;
+      }
+
+      /// <summary>
+      /// Look at the oldest record without consuming it. The payload stays valid until pop.
+      /// </summary>
+      /// <returns>false when the ring is empty.</returns>
+      bool peek(const char*& payload, std::uint32_t& size) {
+        const auto head = header_->head.load(std::memory_order_acquire);
+        auto tail = header_->tail.load(std::memory_order_relaxed);
+        if (tail == head) {
+          return false;
+        }
+
+        std::memcpy(&size, data_ + offset_of(tail), sizeof(size));
+        if (size == kPadding) {
+          tail += capacity_ - offset_of(tail);
+          header_->tail.store(tail, std::memory_order_release);
+          if (tail == head) {
+            return false;
+          }
+          std::memcpy(&size, data_ + offset_of(tail), sizeof(size));
+        }
+
+        payload = data_ + offset_of(tail) + sizeof(size);
+        peeked_size_ = size;
+        return true;
+      }
+
+      /// <summary>
+      /// Release the record returned by peek so the producer can reuse its space.
+      /// </summary>
+      void pop() {
+        const auto tail = header_->tail.load(std::memory_order_relaxed);
+        header_->tail.store(tail + record_size(peeked_size_), std::memory_order_release);
+      }
+
+    private:
+      static constexpr std::uint32_t kPadding = 0xFFFFFFFF;
+
+      static std::uint32_t record_size(const std::uint32_t size) {
+        return (static_cast<std::uint32_t>(sizeof(std::uint32_t)) + size + 7) & ~7u;
+      }
+
+      std::uint32_t offset_of(const std::uint64_t position) const {
+        return static_cast<std::uint32_t>(position & (capacity_ - 1));
+      }
+
+      SpscHeader* header_ = nullptr;
+      char* data_ = nullptr;
+      // A power of two.
+      std::uint32_t capacity_ = 0;
+
+      std::uint64_t reserved_head_ = 0;
+      std::uint32_t reserved_size_ = 0;
+      std::uint32_t peeked_size_ = 0;
+    };
+  }
+}
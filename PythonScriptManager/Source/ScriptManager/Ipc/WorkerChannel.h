@@ -0,0 +1,313 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "SharedMemory.h"
+#include "SpscRing.h"
+#include "..\Deferred\CommandBuffer.h"
+#include "..\Serialization\EventCodec.h"
+
+namespace scripting {
+  namespace ipc {
+    /// <summary>
+    /// The kinds of message sent between the game and a worker process.
+    /// </summary>
+    enum class WorkerMessage : std::uint8_t {
+      // Game to worker: [target module][event name][EventCodec arguments].
+      EVENT = 1,
+      // Game to worker: exit once every earlier event is handled.
+      SHUTDOWN,
+      // Worker to game: [module names][handler names] the worker hosts, sent once its modules are loaded.
+      READY,
+      // Worker to game: [u32 count][DeferredCommand x count][text arena] side effects queued by the worker's scripts.
+      COMMANDS,
+      // Worker to game: [u32 count] events handled since the last DONE.
+      DONE,
+      // Game to fork server: [channel name] fork a worker attached to this channel.
+      SPAWN,
+      // Fork server to game: [u32 process id] the worker forked for the last SPAWN, 0 if fork failed.
+      FORKED
+    };
+
+    /// <summary>
+    /// A pair of lossless rings in shared memory between the game and one worker process.
+    /// Each direction has exactly one writing and one reading process. Writes from several game threads are
+    /// serialized by a lock local to the writing process.
+    /// </summary>
+    class WorkerChannel {
+    public:
+      static constexpr std::uint32_t kDefaultRingCapacity = 1 << 20;
+
+      enum class Side { HOST, WORKER };
+
+      WorkerChannel() = default;
+      WorkerChannel(const WorkerChannel&) = delete;
+      WorkerChannel& operator=(const WorkerChannel&) = delete;
+      ~WorkerChannel() { close(); }
+
+      /// <summary>
+      /// Create the channel for a new worker, replacing any region left under the same name.
+      /// </summary>
+      bool create(const std::string& name, const std::uint32_t ring_capacity) {
+        SharedMemory::remove(name);
+        if (!map(name, ring_capacity, Side::HOST)) {
+          return false;
+        }
+        header_->host_process = SharedMemory::current_process_id();
+        return true;
+      }
+
+      /// <summary>
+      /// Attach to the channel the game created for this worker.
+      /// </summary>
+      bool attach(const std::string& name, const std::uint32_t ring_capacity) {
+        return map(name, ring_capacity, Side::WORKER);
+      }
+
+      void close() {
+        if (side_ == Side::HOST && memory_.data()) {
+          SharedMemory::remove(name_);
+        }
+        memory_.close();
+      }
+
+      /// <summary>
+      /// Id of the game process, so a worker can exit when the game has gone.
+      /// </summary>
+      std::uint32_t host_process() const { return header_->host_process; }
+
+      /// <summary>
+      /// Send a message. Retries for a short while if the reader is behind.
+      /// </summary>
+      /// <returns>false if the message is too large or the ring stayed full.</returns>
+      bool send(const std::string& message) {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        auto& ring = side_ == Side::HOST ? to_worker_ : from_worker_;
+        const auto size = static_cast<std::uint32_t>(message.size());
+        for (auto attempt = 0; attempt < kSendAttempts; ++attempt) {
+          if (ring.write(message.data(), size)) {
+            return true;
+          }
+          if (size > ring.max_payload()) {
+            return false;
+          }
+          std::this_thread::yield();
+        }
+        return false;
+      }
+
+      /// <summary>
+      /// Send an EVENT message, encoding it straight in to the ring rather than through a buffer. Retries for a short
+      /// while if the reader is behind.
+      /// </summary>
+      /// <param name="arguments_size">Bytes encode_arguments writes</param>
+      /// <param name="encode_arguments">Writes the EventCodec arguments to the char* it is given</param>
+      /// <returns>false if a name is too long, the message is too large or the ring stayed full.</returns>
+      template <typename Encode>
+      bool send_event(const std::string_view target_module, const std::string_view event_name, const std::size_t arguments_size, const Encode& encode_arguments) {
+        if (target_module.size() > kMaxText || event_name.size() > kMaxText) {
+          return false;
+        }
+        const auto size = 1 + 2 * sizeof(std::uint16_t) + target_module.size() + event_name.size() + arguments_size;
+
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        auto& ring = side_ == Side::HOST ? to_worker_ : from_worker_;
+        if (size > ring.max_payload()) {
+          return false;
+        }
+        for (auto attempt = 0; attempt < kSendAttempts; ++attempt) {
+          auto data = ring.reserve(static_cast<std::uint32_t>(size));
+          if (!data) {
+            std::this_thread::yield();
+            continue;
+          }
+          *data++ = static_cast<char>(WorkerMessage::EVENT);
+          data = write_text_to(data, target_module);
+          data = write_text_to(data, event_name);
+          encode_arguments(data);
+          ring.commit();
+          return true;
+        }
+        return false;
+      }
+
+      /// <summary>
+      /// Look at the oldest received message. Its payload stays valid until release.
+      /// </summary>
+      bool receive(WorkerMessage& kind, const char*& data, const char*& end) {
+        auto& ring = side_ == Side::HOST ? from_worker_ : to_worker_;
+        const char* payload;
+        std::uint32_t size;
+        if (!ring.peek(payload, size)) {
+          return false;
+        }
+
+        kind = static_cast<WorkerMessage>(size > 0 ? payload[0] : 0);
+        data = payload + 1;
+        end = payload + size;
+        return true;
+      }
+
+      /// <summary>
+      /// Consume the message returned by receive.
+      /// </summary>
+      void release() {
+        (side_ == Side::HOST ? from_worker_ : to_worker_).pop();
+      }
+
+      std::uint32_t max_message() const { return to_worker_.max_payload(); }
+
+      static void begin_message(std::string& message, const WorkerMessage kind) {
+        message.clear();
+        message.push_back(static_cast<char>(kind));
+      }
+
+      /// <summary>
+      /// Append a length prefixed string.
+      /// </summary>
+      /// <returns>false, leaving the message unchanged, if the text is too long for its 16 bit length.</returns>
+      static bool write_text(std::string& message, const std::string_view text) {
+        if (text.size() > kMaxText) {
+          return false;
+        }
+        serialization::EventCodec::write(message, static_cast<std::uint16_t>(text.size()));
+        message.append(text.data(), text.size());
+        return true;
+      }
+
+      /// <summary>
+      /// Read a length prefixed string. The view points in to the message.
+      /// </summary>
+      static bool read_text(const char*& data, const char* end, std::string_view& text) {
+        std::uint16_t length;
+        if (!serialization::EventCodec::read(data, end, length) || static_cast<std::size_t>(end - data) < length) {
+          return false;
+        }
+        text = std::string_view(data, length);
+        data += length;
+        return true;
+      }
+
+      /// <summary>
+      /// Decode an EVENT message. String arguments and the target point in to the message.
+      /// </summary>
+      static bool read_event(const char* data, const char* end, serialization::DecodedEvent& event) {
+        std::string_view event_name;
+        if (!read_text(data, end, event.target_module) || !read_text(data, end, event_name)) {
+          return false;
+        }
+        event.event_name.assign(event_name.data(), event_name.size());
+        return serialization::EventCodec::decode(data, end, event.arguments);
+      }
+
+      /// <summary>
+      /// Append a count prefixed list of strings.
+      /// </summary>
+      /// <returns>false, leaving the message unchanged, if there are too many names or one is too long.</returns>
+      static bool write_names(std::string& message, const std::vector<std::string>& names) {
+        if (names.size() > kMaxNames) {
+          return false;
+        }
+        for (const auto& name : names) {
+          if (name.size() > kMaxText) {
+            return false;
+          }
+        }
+        serialization::EventCodec::write(message, static_cast<std::uint16_t>(names.size()));
+        for (const auto& name : names) {
+          write_text(message, name);
+        }
+        return true;
+      }
+
+      static bool read_names(const char*& data, const char* end, std::vector<std::string>& names) {
+        std::uint16_t count;
+        if (!serialization::EventCodec::read(data, end, count)) {
+          return false;
+        }
+        names.clear();
+        for (std::uint16_t i = 0; i < count; ++i) {
+          std::string_view name;
+          if (!read_text(data, end, name)) {
+            return false;
+          }
+          names.emplace_back(name);
+        }
+        return true;
+      }
+
+      static void write_commands(std::string& message, const std::vector<deferred::DeferredCommand>& commands, const std::string& arena) {
+        begin_message(message, WorkerMessage::COMMANDS);
+        serialization::EventCodec::write(message, static_cast<std::uint32_t>(commands.size()));
+        message.append(reinterpret_cast<const char*>(commands.data()), commands.size() * sizeof(deferred::DeferredCommand));
+        message.append(arena);
+      }
+
+      static bool read_commands(const char* data, const char* end, std::vector<deferred::DeferredCommand>& commands, std::string& arena) {
+        std::uint32_t count;
+        if (!serialization::EventCodec::read(data, end, count) || static_cast<std::size_t>(end - data) / sizeof(deferred::DeferredCommand) < count) {
+          return false;
+        }
+        // The ring only aligns records to 8 bytes, so copy the commands out rather than pointing at them.
+        commands.resize(count);
+        std::memcpy(commands.data(), data, count * sizeof(deferred::DeferredCommand));
+        data += count * sizeof(deferred::DeferredCommand);
+        arena.assign(data, end);
+        return true;
+      }
+
+    private:
+      static constexpr int kSendAttempts = 10000;
+      // Strings and string lists are sent with 16 bit lengths and counts.
+      static constexpr std::size_t kMaxText = std::numeric_limits<std::uint16_t>::max();
+      static constexpr std::size_t kMaxNames = std::numeric_limits<std::uint16_t>::max();
+
+      static char* write_text_to(char* data, const std::string_view text) {
+        const auto length = static_cast<std::uint16_t>(text.size());
+        std::memcpy(data, &length, sizeof(length));
+        std::memcpy(data + sizeof(length), text.data(), text.size());
+        return data + sizeof(length) + text.size();
+      }
+
+      struct alignas(64) ChannelHeader {
+        std::uint32_t host_process;
+      };
+
+      bool map(const std::string& name, const std::uint32_t ring_capacity, const Side side) {
+        close();
+        if (ring_capacity < 4096 || (ring_capacity & (ring_capacity - 1)) != 0) {
+          return false;
+        }
+
+        const auto ring_stride = sizeof(SpscHeader) + ring_capacity;
+        if (!memory_.open(name, sizeof(ChannelHeader) + 2 * ring_stride)) {
+          return false;
+        }
+
+        name_ = name;
+        side_ = side;
+        header_ = reinterpret_cast<ChannelHeader*>(memory_.data());
+        const auto to_worker = memory_.data() + sizeof(ChannelHeader);
+        const auto from_worker = to_worker + ring_stride;
+        to_worker_ = SpscRing(reinterpret_cast<SpscHeader*>(to_worker), to_worker + sizeof(SpscHeader), ring_capacity);
+        from_worker_ = SpscRing(reinterpret_cast<SpscHeader*>(from_worker), from_worker + sizeof(SpscHeader), ring_capacity);
+        return true;
+      }
+
+      SharedMemory memory_;
+      std::string name_;
+      Side side_ = Side::HOST;
+      ChannelHeader* header_ = nullptr;
+      SpscRing to_worker_;
+      SpscRing from_worker_;
+      std::mutex send_mutex_;
+    };
+  }
+}
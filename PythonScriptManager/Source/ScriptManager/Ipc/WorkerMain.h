@@ -0,0 +1,271 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+#include "SharedMemory.h"
+#include "WorkerChannel.h"
+#include "..\ScriptManager.h"
+
+namespace scripting {
+  namespace ipc {
+    /// <summary>
+    /// Send a worker's deferred command batch to the game instead of applying it in the worker.
+    /// </summary>
+    inline void forward_worker_commands(const std::vector<deferred::DeferredCommand>& commands, const std::string& arena, void* user_data) {
+      thread_local std::string message;
+      WorkerChannel::write_commands(message, commands, arena);
+      if (!static_cast<WorkerChannel*>(user_data)->send(message)) {
+        get_logger()->log_message(LogType::LOG_ERROR, "run_worker - Could not send commands to the game, dropped: ", commands.size());
+      }
+    }
+
+    /// <summary>
+    /// Wait a little for the next message, spinning briefly for low latency under load and then backing off so an idle
+    /// process does not burn a core.
+    /// </summary>
+    /// <returns>false once the game process has exited.</returns>
+    inline bool wait_for_message(const WorkerChannel& channel, std::uint32_t& idle) {
+      if (++idle % 4096 == 0 && !SharedMemory::process_alive(channel.host_process())) {
+        get_logger()->log_message(LogType::LOG_WARNING, "wait_for_message - The game process has exited.");
+        return false;
+      }
+      if (idle < 256) {
+        std::this_thread::yield();
+      }
+      else {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      return true;
+    }
+
+    /// <summary>
+    /// Tell the game which modules and handlers this process hosts so it only sends the events they handle.
+    /// </summary>
+    inline void report_modules(WorkerChannel& channel) {
+      std::vector<std::string> modules;
+      std::set<std::string> handlers;
+      {
+        gil::GilAcquire acquire;
+        for (const auto& loaded : ScriptManager::instance().loaded_modules()) {
+          modules.push_back(loaded.first);
+          for (const auto& item : py::reinterpret_borrow<py::dict>(loaded.second->script_module()->attr("__dict__"))) {
+            auto name = item.first.cast<std::string>();
+            if (!name.empty() && name[0] != '_' && PyCallable_Check(item.second.ptr())) {
+              handlers.insert(std::move(name));
+            }
+          }
+        }
+      }
+
+      std::string message;
+      WorkerChannel::begin_message(message, WorkerMessage::READY);
+      if (!WorkerChannel::write_names(message, modules)
+        || !WorkerChannel::write_names(message, std::vector<std::string>(handlers.begin(), handlers.end()))) {
+        get_logger()->log_message(LogType::LOG_ERROR, "report_modules - Too many modules or handlers, or names too long, to report to the game.");
+        return;
+      }
+      if (!channel.send(message)) {
+        get_logger()->log_message(LogType::LOG_ERROR, "report_modules - Could not report handlers to the game.");
+      }
+    }
+
+    /// <summary>
+    /// Handle events from the game with the modules already loaded, until it asks the worker to exit or goes away.
+    /// </summary>
+    inline void serve_worker(WorkerChannel& channel) {
+      auto& manager = ScriptManager::instance();
+      deferred::CommandTable::instance().set_forwarder(&forward_worker_commands, &channel);
+      report_modules(channel);
+
+      serialization::DecodedEvent event;
+      std::string done;
+      std::uint32_t handled = 0;
+      std::uint32_t idle = 0;
+      const auto report = [&]() {
+        if (handled > 0) {
+          WorkerChannel::begin_message(done, WorkerMessage::DONE);
+          serialization::EventCodec::write(done, handled);
+          channel.send(done);
+          handled = 0;
+        }
+      };
+
+      while (true) {
+        WorkerMessage kind;
+        const char* data;
+        const char* end;
+        if (!channel.receive(kind, data, end)) {
+          report();
+          if (!wait_for_message(channel, idle)) {
+            break;
+          }
+          continue;
+        }
+        idle = 0;
+
+        if (kind == WorkerMessage::SHUTDOWN) {
+          channel.release();
+          break;
+        }
+
+        // Arguments are decoded where they lie in the ring, which is only released once the handlers have run.
+        if (kind == WorkerMessage::EVENT && WorkerChannel::read_event(data, end, event)) {
+          manager.dispatch_decoded(event);
+          ++handled;
+        }
+        channel.release();
+
+        if (handled >= 64) {
+          report();
+        }
+      }
+
+      report();
+      deferred::CommandTable::instance().set_forwarder(nullptr);
+    }
+
+    /// <summary>
+    /// Run this process as a worker started by WorkerPool: load the modules, then handle events from the game until
+    /// it asks the worker to exit or goes away.
+    /// </summary>
+    /// <param name="channel_name">Name of the channel the game created for this worker</param>
+    /// <param name="ring_capacity">Bytes per channel ring</param>
+    /// <param name="module_paths">Python files to load</param>
+    /// <returns>The process exit code.</returns>
+    inline int run_worker(const std::string& channel_name, const std::uint32_t ring_capacity, const std::vector<std::string>& module_paths) {
+      auto& manager = ScriptManager::instance();
+
+      WorkerChannel channel;
+      if (!channel.attach(channel_name, ring_capacity)) {
+        manager.get_logger()->log_message(LogType::LOG_ERROR, "run_worker - Could not attach to channel: ", channel_name);
+        return 1;
+      }
+
+      py::scoped_interpreter guard{};
+      py::gil_scoped_release release;
+
+      for (const auto& path : module_paths) {
+        manager.load_script(path);
+      }
+      serve_worker(channel);
+      manager.shutdown();
+      return 0;
+    }
+
+#ifndef _WIN32
+    /// <summary>
+    /// Run this process as the fork server started by WorkerPool: load the modules once, move everything they
+    /// allocated in to the garbage collector's permanent generation, then fork a worker for every SPAWN request.
+    /// Freezing keeps collections in the workers from writing to, and so copying, the pages they share.
+    /// </summary>
+    /// <param name="channel_name">Name of the channel the game created for the server</param>
+    /// <param name="ring_capacity">Bytes per channel ring</param>
+    /// <param name="module_paths">Python files every worker hosts</param>
+    /// <returns>The process exit code.</returns>
+    inline int run_fork_server(const std::string& channel_name, const std::uint32_t ring_capacity, const std::vector<std::string>& module_paths) {
+      auto& manager = ScriptManager::instance();
+      const auto logger = manager.get_logger();
+
+      WorkerChannel control;
+      if (!control.attach(channel_name, ring_capacity)) {
+        logger->log_message(LogType::LOG_ERROR, "run_fork_server - Could not attach to channel: ", channel_name);
+        return 1;
+      }
+
+      // Workers are reaped by the system as soon as they exit, the game watches them by process id.
+      signal(SIGCHLD, SIG_IGN);
+
+      py::scoped_interpreter guard{};
+      py::gil_scoped_release release;
+
+      for (const auto& path : module_paths) {
+        manager.load_script(path);
+      }
+      {
+        gil::GilAcquire acquire;
+        const auto gc = py::module::import("gc");
+        gc.attr("collect")();
+        gc.attr("freeze")();
+      }
+      report_modules(control);
+
+      // Set in a forked worker, which leaves the server loop to serve this channel instead.
+      std::string worker_channel;
+      std::string answer;
+      std::uint32_t idle = 0;
+      while (worker_channel.empty()) {
+        WorkerMessage kind;
+        const char* data;
+        const char* end;
+        if (!control.receive(kind, data, end)) {
+          if (!wait_for_message(control, idle)) {
+            break;
+          }
+          continue;
+        }
+        idle = 0;
+
+        if (kind == WorkerMessage::SHUTDOWN) {
+          control.release();
+          break;
+        }
+
+        std::string_view requested;
+        const auto spawn = kind == WorkerMessage::SPAWN && WorkerChannel::read_text(data, end, requested);
+        const auto name = std::string(requested);
+        control.release();
+        if (!spawn) {
+          continue;
+        }
+
+        pid_t process_id;
+        {
+          gil::GilAcquire acquire;
+          PyOS_BeforeFork();
+          process_id = ::fork();
+          if (process_id == 0) {
+            PyOS_AfterFork_Child();
+          }
+          else {
+            PyOS_AfterFork_Parent();
+          }
+        }
+
+        if (process_id == 0) {
+          worker_channel = name;
+          break;
+        }
+
+        WorkerChannel::begin_message(answer, WorkerMessage::FORKED);
+        serialization::EventCodec::write(answer, static_cast<std::uint32_t>(process_id > 0 ? process_id : 0));
+        control.send(answer);
+      }
+
+      if (!worker_channel.empty()) {
+        signal(SIGCHLD, SIG_DFL);
+        WorkerChannel channel;
+        if (channel.attach(worker_channel, ring_capacity)) {
+          serve_worker(channel);
+        }
+        else {
+          logger->log_message(LogType::LOG_ERROR, "run_fork_server - Forked worker could not attach to channel: ", worker_channel);
+        }
+      }
+
+      manager.shutdown();
+      return 0;
+    }
+#endif
+  }
+}
@@ -0,0 +1,474 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "Process.h"
+#include "SharedMemory.h"
+#include "WorkerChannel.h"
+#include "..\Deferred\CommandBuffer.h"
+#include "..\Serialization\EventCodec.h"
+
+namespace scripting {
+  namespace ipc {
+    /// <summary>
+    /// Script modules hosted in separate worker processes, each running its own interpreter.
+    /// Events whose handler a worker defines are encoded without the GIL and written to the worker's channel, and
+    /// the side effects its scripts queue come back as deferred command batches applied by pump.
+    /// </summary>
+    class WorkerPool {
+    public:
+      // Command line switch that starts the executable as a worker.
+      static constexpr const char* kWorkerSwitch = "--worker";
+      // Command line switch that starts the executable as a fork server.
+      static constexpr const char* kForkServerSwitch = "--fork-server";
+
+      WorkerPool() = default;
+      WorkerPool(const WorkerPool&) = delete;
+      WorkerPool& operator=(const WorkerPool&) = delete;
+      ~WorkerPool() { stop(); }
+
+      /// <summary>
+      /// Start a worker process hosting the given modules and wait for it to load them.
+      /// </summary>
+      /// <param name="module_paths">Python files the worker loads</param>
+      /// <param name="error">Set to the reason the worker could not be started</param>
+      /// <returns>The worker's process id, or 0 if it could not be started.</returns>
+      std::uint32_t spawn(const std::vector<std::string>& module_paths, std::string& error) {
+        auto worker = start_process(kWorkerSwitch, module_paths, error);
+        if (!worker) {
+          return 0;
+        }
+        worker->group = next_group_.fetch_add(1);
+        return add(std::move(worker));
+      }
+
+      /// <summary>
+      /// Start a fork server: a process that loads the modules once, freezes its heap out of the garbage collector's
+      /// reach and then forks workers from it on demand. Forked workers share the warmed heap copy-on-write and are
+      /// ready as soon as they are forked, rather than after importing every module again.
+      /// Only available where processes can fork.
+      /// </summary>
+      /// <param name="module_paths">Python files every forked worker hosts</param>
+      /// <param name="error">Set to the reason the server could not be started</param>
+      bool start_fork_server(const std::vector<std::string>& module_paths, std::string& error) {
+#ifdef _WIN32
+        error = "processes can not be forked on this platform";
+        return false;
+#else
+        std::lock_guard<std::mutex> lock(fork_mutex_);
+        if (fork_server_) {
+          error = "the fork server is already running";
+          return false;
+        }
+
+        fork_server_ = start_process(kForkServerSwitch, module_paths, error);
+        if (!fork_server_) {
+          return false;
+        }
+        fork_server_->group = next_group_.fetch_add(1);
+        return true;
+#endif
+      }
+
+      /// <summary>
+      /// Fork a worker from the fork server. Events are spread between the workers forked from the same server, which
+      /// share no state once forked.
+      /// </summary>
+      /// <param name="error">Set to the reason the worker could not be forked</param>
+      /// <returns>The worker's process id, or 0 if it could not be forked.</returns>
+      std::uint32_t fork_worker(std::string& error) {
+#ifdef _WIN32
+        error = "processes can not be forked on this platform";
+        return 0;
+#else
+        std::lock_guard<std::mutex> lock(fork_mutex_);
+        if (!fork_server_ || !fork_server_->process.running()) {
+          error = "the fork server is not running";
+          return 0;
+        }
+
+        auto worker = std::make_unique<Worker>();
+        const auto channel_name = create_channel(*worker, error);
+        if (channel_name.empty()) {
+          return 0;
+        }
+
+        std::string message;
+        WorkerChannel::begin_message(message, WorkerMessage::SPAWN);
+        if (!WorkerChannel::write_text(message, channel_name)) {
+          error = "the channel name is too long";
+          return 0;
+        }
+        fork_server_->forked.reset();
+        if (!fork_server_->channel.send(message)) {
+          error = "the fork server is not reading requests";
+          return 0;
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!fork_server_->forked) {
+          if (!fork_server_->process.running() || std::chrono::steady_clock::now() > deadline) {
+            error = "the fork server did not answer";
+            return 0;
+          }
+          if (pump_worker(*fork_server_, 1) == 0) {
+            std::this_thread::yield();
+          }
+        }
+        if (*fork_server_->forked == 0) {
+          error = "the fork server could not fork";
+          return 0;
+        }
+
+        worker->process.adopt(*fork_server_->forked);
+        worker->group = fork_server_->group;
+        if (!wait_until_ready(*worker, error)) {
+          return 0;
+        }
+        return add(std::move(worker));
+#endif
+      }
+
+      /// <summary>
+      /// Ask every worker and the fork server to exit and wait for them.
+      /// </summary>
+      void stop() {
+        std::string message;
+        WorkerChannel::begin_message(message, WorkerMessage::SHUTDOWN);
+        {
+          std::unique_lock<std::shared_mutex> lock(mutex_);
+          for (const auto& worker : workers_) {
+            worker->channel.send(message);
+          }
+          for (const auto& worker : workers_) {
+            worker->process.stop(std::chrono::seconds(5));
+          }
+          // A pump or send still using a worker keeps it, and its channel, until it is done.
+          workers_.clear();
+          worker_count_.store(0, std::memory_order_release);
+        }
+
+        std::lock_guard<std::mutex> lock(fork_mutex_);
+        if (fork_server_) {
+          fork_server_->channel.send(message);
+          fork_server_->process.stop(std::chrono::seconds(5));
+          fork_server_.reset();
+        }
+      }
+
+      /// <summary>
+      /// Whether a worker defines a handler for an event. Free when there are no workers.
+      /// </summary>
+      bool handles(const std::string& event_name) const {
+        if (worker_count_.load(std::memory_order_acquire) == 0) {
+          return false;
+        }
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& worker : workers_) {
+          if (worker->handlers.count(event_name) != 0) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      /// <summary>
+      /// Whether a worker hosts a module.
+      /// </summary>
+      bool hosts(const std::string& module_name) const {
+        if (worker_count_.load(std::memory_order_acquire) == 0) {
+          return false;
+        }
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& worker : workers_) {
+          if (worker->modules.count(module_name) != 0) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      /// <summary>
+      /// Send an event to the workers handling it. Does not require the GIL.
+      /// </summary>
+      /// <param name="target_module">The module to send to, or empty for every module defining the handler</param>
+      template <typename... Args>
+      void send(const std::string& target_module, const std::string& event_name, const Args&... args) {
+        route(target_module, event_name, serialization::EventCodec::encoded_size(args...), [&](char* data) {
+          serialization::EventCodec::encode_to(data, args...);
+        });
+      }
+
+      /// <summary>
+      /// Send an event whose arguments are python objects. Must be called with the GIL held.
+      /// </summary>
+      void send_python(const std::string& target_module, const std::string& event_name, const py::tuple& arguments) {
+        route(target_module, event_name, serialization::EventCodec::encoded_size(arguments), [&](char* data) {
+          serialization::EventCodec::encode_to(data, arguments);
+        });
+      }
+
+      /// <summary>
+      /// Apply the command batches workers sent back and collect their progress. Call it regularly from one thread,
+      /// without the GIL.
+      /// </summary>
+      /// <param name="max_messages">Most messages to read from each worker</param>
+      /// <returns>The number of messages read.</returns>
+      std::size_t pump(const std::size_t max_messages = 256) {
+        // Applied commands may dispatch events that are sent to workers, so do not hold the pool's lock while applying.
+        // The snapshot shares ownership, so stop or remove_exited on another thread can not free a worker mid pump.
+        thread_local std::vector<std::shared_ptr<Worker>> workers;
+        {
+          std::shared_lock<std::shared_mutex> lock(mutex_);
+          workers.assign(workers_.begin(), workers_.end());
+        }
+
+        std::size_t messages = 0;
+        for (const auto& worker : workers) {
+          messages += pump_worker(*worker, max_messages);
+        }
+        workers.clear();
+        return messages;
+      }
+
+      /// <summary>
+      /// Forget workers whose process has exited, for example after a script crashed it, so nothing more is sent to them.
+      /// </summary>
+      /// <returns>Process ids of the workers removed.</returns>
+      std::vector<std::uint32_t> remove_exited() {
+        std::vector<std::uint32_t> process_ids;
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        for (auto it = workers_.begin(); it != workers_.end();) {
+          if ((*it)->process.running()) {
+            ++it;
+            continue;
+          }
+          process_ids.push_back((*it)->process.id());
+          (*it)->process.stop(std::chrono::milliseconds(0));
+          it = workers_.erase(it);
+        }
+        worker_count_.store(workers_.size(), std::memory_order_release);
+        return process_ids;
+      }
+
+      /// <summary>
+      /// Process ids of the running workers.
+      /// </summary>
+      std::vector<std::uint32_t> process_ids() const {
+        std::vector<std::uint32_t> process_ids;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (const auto& worker : workers_) {
+          process_ids.push_back(worker->process.id());
+        }
+        return process_ids;
+      }
+
+      std::size_t size() const { return worker_count_.load(std::memory_order_acquire); }
+      std::uint64_t sent() const { return sent_.load(std::memory_order_relaxed); }
+      std::uint64_t completed() const { return completed_.load(std::memory_order_relaxed); }
+      // Events not sent because a worker's ring stayed full, or the event or its names were too large.
+      std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+      struct Worker {
+        WorkerChannel channel;
+        Process process;
+        bool ready = false;
+        std::unordered_set<std::string> modules;
+        std::unordered_set<std::string> handlers;
+        // Workers hosting the same modules, each event goes to only one of them.
+        std::uint32_t group = 0;
+        // The fork server's answer to the last SPAWN.
+        std::optional<std::uint32_t> forked;
+
+        // Only one thread reads a channel at a time.
+        std::mutex receive_mutex;
+        std::vector<deferred::DeferredCommand> commands;
+        std::string arena;
+      };
+
+      /// <summary>
+      /// Create a worker's channel under a name unique to this process.
+      /// </summary>
+      /// <returns>The channel's name, or empty if it could not be created.</returns>
+      std::string create_channel(Worker& worker, std::string& error) {
+        const auto channel_name = "psm_worker_" + std::to_string(SharedMemory::current_process_id()) + "_" + std::to_string(next_channel_.fetch_add(1));
+        if (!worker.channel.create(channel_name, WorkerChannel::kDefaultRingCapacity)) {
+          error = "could not map shared memory '" + channel_name + "'";
+          return std::string();
+        }
+        return channel_name;
+      }
+
+      /// <summary>
+      /// Start the executable in worker or fork server mode and wait for it to load its modules.
+      /// </summary>
+      std::unique_ptr<Worker> start_process(const char* mode, const std::vector<std::string>& module_paths, std::string& error) {
+        auto worker = std::make_unique<Worker>();
+        const auto channel_name = create_channel(*worker, error);
+        if (channel_name.empty()) {
+          return nullptr;
+        }
+
+        std::vector<std::string> arguments = { mode, channel_name, std::to_string(WorkerChannel::kDefaultRingCapacity) };
+        for (const auto& path : module_paths) {
+          arguments.push_back(std::filesystem::absolute(path).string());
+        }
+        if (!worker->process.start(Process::executable_path(), arguments)) {
+          error = "could not start the process";
+          return nullptr;
+        }
+        if (!wait_until_ready(*worker, error)) {
+          return nullptr;
+        }
+        return worker;
+      }
+
+      /// <summary>
+      /// Nothing is routed to a worker until it reports the handlers its modules define.
+      /// </summary>
+      bool wait_until_ready(Worker& worker, std::string& error) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (!worker.ready) {
+          if (!worker.process.running() || std::chrono::steady_clock::now() > deadline) {
+            error = "the process exited before loading its modules";
+            worker.process.stop(std::chrono::milliseconds(0));
+            return false;
+          }
+          if (pump_worker(worker, 1) == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+          }
+        }
+        return true;
+      }
+
+      std::uint32_t add(std::unique_ptr<Worker> worker) {
+        const auto process_id = worker->process.id();
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        workers_.push_back(std::move(worker));
+        worker_count_.store(workers_.size(), std::memory_order_release);
+        return process_id;
+      }
+
+      /// <summary>
+      /// Send an event to one worker of every group hosting the target module or event handler, starting from a
+      /// different worker each time to spread events across a group. The arguments are encoded straight in to each
+      /// chosen worker's ring.
+      /// </summary>
+      template <typename Encode>
+      void route(const std::string& target_module, const std::string& event_name, const std::size_t arguments_size, const Encode& encode_arguments) {
+        thread_local std::vector<std::shared_ptr<Worker>> targets;
+        thread_local std::vector<std::uint32_t> wanted, sent;
+        wanted.clear();
+        sent.clear();
+
+        // Sending can spin on a full ring, so only the targets are collected under the lock.
+        {
+          std::shared_lock<std::shared_mutex> lock(mutex_);
+          const auto& key = target_module.empty() ? event_name : target_module;
+          const auto count = workers_.size();
+          const auto first = next_worker_.fetch_add(1, std::memory_order_relaxed);
+          for (std::size_t i = 0; i < count; ++i) {
+            const auto& worker = workers_[(first + i) % count];
+            const auto& names = target_module.empty() ? worker->handlers : worker->modules;
+            if (names.count(key) != 0) {
+              targets.push_back(worker);
+            }
+          }
+        }
+
+        for (const auto& worker : targets) {
+          if (std::find(sent.begin(), sent.end(), worker->group) != sent.end()) {
+            continue;
+          }
+          if (std::find(wanted.begin(), wanted.end(), worker->group) == wanted.end()) {
+            wanted.push_back(worker->group);
+          }
+          // A full ring moves the event on to the group's next worker.
+          if (worker->channel.send_event(target_module, event_name, arguments_size, encode_arguments)) {
+            sent.push_back(worker->group);
+            sent_.fetch_add(1, std::memory_order_relaxed);
+          }
+        }
+        targets.clear();
+        dropped_.fetch_add(wanted.size() - sent.size(), std::memory_order_relaxed);
+      }
+
+      std::size_t pump_worker(Worker& worker, const std::size_t max_messages) {
+        std::lock_guard<std::mutex> lock(worker.receive_mutex);
+        std::size_t messages = 0;
+        WorkerMessage kind;
+        const char* data;
+        const char* end;
+        while (messages < max_messages && worker.channel.receive(kind, data, end)) {
+          switch (kind) {
+          case WorkerMessage::READY:
+          {
+            std::vector<std::string> modules, handlers;
+            if (WorkerChannel::read_names(data, end, modules) && WorkerChannel::read_names(data, end, handlers)) {
+              worker.modules.insert(modules.begin(), modules.end());
+              worker.handlers.insert(handlers.begin(), handlers.end());
+              worker.ready = true;
+            }
+            break;
+          }
+          case WorkerMessage::COMMANDS:
+            if (WorkerChannel::read_commands(data, end, worker.commands, worker.arena)) {
+              worker.channel.release();
+              ++messages;
+              // Applying may dispatch events that send to this worker, so the message is released first.
+              deferred::CommandTable::instance().apply(worker.commands, worker.arena);
+              continue;
+            }
+            break;
+          case WorkerMessage::FORKED:
+          {
+            std::uint32_t process_id;
+            worker.forked = serialization::EventCodec::read(data, end, process_id) ? process_id : 0;
+            break;
+          }
+          case WorkerMessage::DONE:
+          {
+            std::uint32_t count;
+            if (serialization::EventCodec::read(data, end, count)) {
+              completed_.fetch_add(count, std::memory_order_relaxed);
+            }
+            break;
+          }
+          default:
+            break;
+          }
+          worker.channel.release();
+          ++messages;
+        }
+        return messages;
+      }
+
+      mutable std::shared_mutex mutex_;
+      std::vector<std::shared_ptr<Worker>> workers_;
+      std::atomic<std::size_t> worker_count_{ 0 };
+      std::atomic<std::uint32_t> next_channel_{ 0 };
+      std::atomic<std::uint32_t> next_group_{ 0 };
+      std::atomic<std::size_t> next_worker_{ 0 };
+
+      std::mutex fork_mutex_;
+      std::unique_ptr<Worker> fork_server_;
+
+      std::atomic<std::uint64_t> sent_{ 0 };
+      std::atomic<std::uint64_t> completed_{ 0 };
+      std::atomic<std::uint64_t> dropped_{ 0 };
+    };
+  }
+}
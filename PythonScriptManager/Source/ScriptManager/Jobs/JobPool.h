@@ -0,0 +1,319 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include "..\Serialization\EventCodec.h"
+
+namespace scripting {
+  namespace jobs {
+    /// <summary>
+    /// What a native job is given and where it writes its result. Runs without the GIL.
+    /// </summary>
+    class JobContext {
+    public:
+      JobContext(const std::uint64_t id, const std::vector<serialization::EventValue>& arguments, std::string& result)
+        : id_(id), arguments_(arguments), result_(result) {}
+
+      std::uint64_t id() const { return id_; }
+
+      /// <summary>
+      /// The arguments the script submitted. Strings point in to the job and are valid until it returns.
+      /// </summary>
+      const std::vector<serialization::EventValue>& arguments() const { return arguments_; }
+
+      /// <summary>
+      /// A numeric argument, or a fallback when it is missing or not a number.
+      /// </summary>
+      template <typename T>
+      T argument(const std::size_t index, const T fallback = T()) const {
+        if (index >= arguments_.size()) {
+          return fallback;
+        }
+        return std::visit([fallback](const auto& value) -> T {
+          using V = std::decay_t<decltype(value)>;
+          if constexpr (std::is_arithmetic_v<V>) {
+            return static_cast<T>(value);
+          }
+          else {
+            return fallback;
+          }
+        }, arguments_[index]);
+      }
+
+      /// <summary>
+      /// Set the values the script receives. One value is returned as is, several as a tuple.
+      /// </summary>
+      template <typename... Args>
+      void set_result(const Args&... values) {
+        result_.clear();
+        serialization::EventCodec::encode(result_, values...);
+      }
+
+      /// <summary>
+      /// Fail the job. The script's result() raises with this message.
+      /// </summary>
+      void fail(const std::string& message) {
+        failed_ = true;
+        result_ = message;
+      }
+
+      bool failed() const { return failed_; }
+
+    private:
+      std::uint64_t id_;
+      const std::vector<serialization::EventValue>& arguments_;
+      std::string& result_;
+      bool failed_ = false;
+    };
+
+    using JobFunction = void(*)(JobContext& context);
+
+    /// <summary>
+    /// A finished job waiting to be handed back to the scripts.
+    /// </summary>
+    struct CompletedJob {
+      std::uint64_t id = 0;
+      bool failed = false;
+      // EventCodec encoded result values, or the error message when failed.
+      std::string result;
+    };
+
+    /// <summary>
+    /// Threads that run named native jobs without the GIL. Each thread takes jobs from its own queue first and steals
+    /// from the others once it runs dry, so a few long jobs landing on one thread do not hold up the rest.
+    /// Finished jobs are collected by the game thread, which hands them back to the scripts on a later tick.
+    /// </summary>
+    class JobPool {
+    public:
+      JobPool() = default;
+      JobPool(const JobPool&) = delete;
+      JobPool& operator=(const JobPool&) = delete;
+      ~JobPool() { stop(); }
+
+      /// <summary>
+      /// Register a job scripts can submit by name. Registering a name again replaces its function.
+      /// </summary>
+      void register_job(const std::string& name, const JobFunction function) {
+        std::unique_lock<std::shared_mutex> lock(registry_mutex_);
+        registry_[name] = function;
+      }
+
+      bool has_job(const std::string& name) const {
+        std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+        return registry_.count(name) > 0;
+      }
+
+      /// <summary>
+      /// Start the threads. Does nothing if already running.
+      /// </summary>
+      /// <param name="threads">Number of threads, the hardware concurrency less one when 0</param>
+      void start(std::size_t threads = 0) {
+        if (running()) {
+          return;
+        }
+        if (threads == 0) {
+          threads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        }
+
+        stopping_ = false;
+        queues_.clear();
+        for (std::size_t i = 0; i < threads; ++i) {
+          queues_.push_back(std::make_unique<WorkQueue>());
+        }
+        for (std::size_t i = 0; i < threads; ++i) {
+          threads_.emplace_back(&JobPool::run, this, i);
+        }
+        running_.store(true, std::memory_order_release);
+      }
+
+      /// <summary>
+      /// Finish every queued job, then stop the threads. Results not yet collected stay collectable.
+      /// Must not race with submit.
+      /// </summary>
+      void stop() {
+        if (!running_.exchange(false, std::memory_order_acq_rel)) {
+          return;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(sleep_mutex_);
+          stopping_ = true;
+        }
+        sleep_condition_.notify_all();
+        for (auto& thread : threads_) {
+          thread.join();
+        }
+        threads_.clear();
+        queues_.clear();
+      }
+
+      bool running() const { return running_.load(std::memory_order_acquire); }
+
+      /// <summary>
+      /// Queue a job. Does not require the GIL.
+      /// </summary>
+      /// <param name="name">Registered job name</param>
+      /// <param name="arguments">EventCodec encoded arguments, kept by the job until it finishes</param>
+      /// <returns>The job's id, or 0 if the pool is stopped or no job has this name.</returns>
+      std::uint64_t submit(const std::string& name, std::string arguments) {
+        if (!running()) {
+          return 0;
+        }
+
+        Job job;
+        {
+          std::shared_lock<std::shared_mutex> lock(registry_mutex_);
+          const auto it = registry_.find(name);
+          if (it == registry_.end()) {
+            return 0;
+          }
+          job.function = it->second;
+        }
+        const auto id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        job.id = id;
+        job.arguments = std::move(arguments);
+
+        auto& queue = *queues_[next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size()];
+        {
+          std::lock_guard<std::mutex> lock(queue.mutex);
+          queue.jobs.push_back(std::move(job));
+        }
+        {
+          // Counted under the sleep lock so a thread about to sleep cannot miss the wake up.
+          std::lock_guard<std::mutex> lock(sleep_mutex_);
+          ++pending_;
+        }
+        sleep_condition_.notify_one();
+        return id;
+      }
+
+      /// <summary>
+      /// Take finished jobs, oldest first. Does not require the GIL.
+      /// </summary>
+      /// <returns>The number of jobs added to completed.</returns>
+      std::size_t collect(std::vector<CompletedJob>& completed, const std::size_t max_jobs) {
+        std::lock_guard<std::mutex> lock(completed_mutex_);
+        const auto count = std::min(max_jobs, completed_.size());
+        for (std::size_t i = 0; i < count; ++i) {
+          completed.push_back(std::move(completed_.front()));
+          completed_.pop_front();
+        }
+        return count;
+      }
+
+      std::size_t size() const { return queues_.size(); }
+      std::uint64_t stolen() const { return stolen_.load(std::memory_order_relaxed); }
+
+    private:
+      struct Job {
+        std::uint64_t id = 0;
+        JobFunction function = nullptr;
+        std::string arguments;
+      };
+
+      struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+      };
+
+      /// <summary>
+      /// Take the oldest job from this thread's queue, or steal the newest from another's.
+      /// </summary>
+      bool take(const std::size_t index, Job& job) {
+        {
+          auto& own = *queues_[index];
+          std::lock_guard<std::mutex> lock(own.mutex);
+          if (!own.jobs.empty()) {
+            job = std::move(own.jobs.front());
+            own.jobs.pop_front();
+            return true;
+          }
+        }
+
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+          auto& victim = *queues_[(index + i) % queues_.size()];
+          std::lock_guard<std::mutex> lock(victim.mutex);
+          if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.back());
+            victim.jobs.pop_back();
+            stolen_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          }
+        }
+        return false;
+      }
+
+      void run(const std::size_t index) {
+        std::vector<serialization::EventValue> arguments;
+        while (true) {
+          {
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            sleep_condition_.wait(lock, [this] { return pending_ > 0 || stopping_; });
+            if (pending_ == 0) {
+              return;
+            }
+            --pending_;
+          }
+
+          // A pending count means some queue holds a job no other thread has claimed.
+          Job job;
+          while (!take(index, job)) {
+            std::this_thread::yield();
+          }
+
+          CompletedJob completed;
+          completed.id = job.id;
+          const char* data = job.arguments.data();
+          if (!serialization::EventCodec::decode(data, data + job.arguments.size(), arguments)) {
+            arguments.clear();
+          }
+          JobContext context(job.id, arguments, completed.result);
+          try {
+            job.function(context);
+          }
+          catch (const std::exception& exception) {
+            context.fail(exception.what());
+          }
+          // Anything else thrown would otherwise end the thread and lose the job.
+          catch (...) {
+            context.fail("job threw an unknown exception");
+          }
+          completed.failed = context.failed();
+
+          std::lock_guard<std::mutex> lock(completed_mutex_);
+          completed_.push_back(std::move(completed));
+        }
+      }
+
+      mutable std::shared_mutex registry_mutex_;
+      std::unordered_map<std::string, JobFunction> registry_;
+
+      std::atomic<bool> running_{ false };
+      std::vector<std::unique_ptr<WorkQueue>> queues_;
+      std::vector<std::thread> threads_;
+      std::atomic<std::size_t> next_queue_{ 0 };
+      std::atomic<std::uint64_t> next_id_{ 1 };
+      std::atomic<std::uint64_t> stolen_{ 0 };
+
+      std::mutex sleep_mutex_;
+      std::condition_variable sleep_condition_;
+      std::size_t pending_ = 0;
+      bool stopping_ = false;
+
+      std::mutex completed_mutex_;
+      std::deque<CompletedJob> completed_;
+    };
+  }
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "JobPool.h"
+#include "..\Serialization\EventCodec.h"
+
+namespace scripting {
+  namespace jobs {
+    /// <summary>
+    /// A script's handle on a submitted job, filled in when the game hands the job back on a later tick.
+    /// Only touched with the GIL held.
+    /// </summary>
+    class JobFuture {
+    public:
+      JobFuture(const std::uint64_t id, std::string event) : id_(id), event_(std::move(event)) {}
+
+      std::uint64_t id() const { return id_; }
+      bool done() const { return done_; }
+      bool failed() const { return failed_; }
+
+      /// <summary>
+      /// The event dispatched with this future when the job finishes, empty for none.
+      /// </summary>
+      const std::string& event() const { return event_; }
+
+      /// <summary>
+      /// The job's result. Raises if the job has not finished or failed.
+      /// </summary>
+      py::object result() const {
+        if (!done_) {
+          throw std::runtime_error("job " + std::to_string(id_) + " has not finished");
+        }
+        if (failed_) {
+          throw std::runtime_error("job " + std::to_string(id_) + " failed: " + error_);
+        }
+        return value_;
+      }
+
+      /// <summary>
+      /// Fill in the future from a finished job. Must be called with the GIL held.
+      /// </summary>
+      void complete(const CompletedJob& job) {
+        done_ = true;
+        failed_ = job.failed;
+        if (failed_) {
+          error_ = job.result;
+          return;
+        }
+
+        thread_local std::vector<serialization::EventValue> values;
+        const char* data = job.result.data();
+        if (job.result.empty() || !serialization::EventCodec::decode(data, data + job.result.size(), values)) {
+          values.clear();
+        }
+        const auto result = serialization::EventCodec::to_python(values);
+        value_ = result.size() == 0 ? py::none() : result.size() == 1 ? py::object(result[0]) : py::object(result);
+      }
+
+      static void apply_class_definitions(const py::module& module) {
+        py::class_<JobFuture, std::shared_ptr<JobFuture>>(module, "JobFuture")
+          .def_property_readonly("id", &JobFuture::id)
+          .def("done", &JobFuture::done)
+          .def("failed", &JobFuture::failed)
+          .def("result", &JobFuture::result);
+      }
+
+    private:
+      std::uint64_t id_;
+      std::string event_;
+      bool done_ = false;
+      bool failed_ = false;
+      std::string error_;
+      py::object value_ = py::none();
+    };
+
+    /// <summary>
+    /// Connects scripts to the job pool: converts submitted arguments under the GIL, keeps each job's future until
+    /// it finishes and fills it in when the game collects the job.
+    /// </summary>
+    class ScriptJobs {
+    public:
+      JobPool& pool() { return pool_; }
+
+      /// <summary>
+      /// Submit a job from a script, starting the pool on first use. Must be called with the GIL held.
+      /// Arguments are converted like event arguments: numbers, strings, booleans and None.
+      /// </summary>
+      /// <param name="name">Registered job name</param>
+      /// <param name="arguments">Values passed to the job</param>
+      /// <param name="event">Event dispatched with the future once the job finishes, empty for none</param>
+      std::shared_ptr<JobFuture> submit(const std::string& name, const py::tuple& arguments, const std::string& event) {
+        if (!pool_.has_job(name)) {
+          throw py::value_error("no native job named " + name);
+        }
+        pool_.start(threads_);
+
+        std::string encoded;
+        serialization::EventCodec::encode(encoded, arguments);
+        const auto id = pool_.submit(name, std::move(encoded));
+        if (id == 0) {
+          throw std::runtime_error("could not submit job " + name);
+        }
+
+        auto future = std::make_shared<JobFuture>(id, event);
+        pending_.emplace(id, future);
+        return future;
+      }
+
+      /// <summary>
+      /// Threads to start the pool with, 0 for the hardware concurrency less one.
+      /// </summary>
+      void set_threads(const std::size_t threads) { threads_ = threads; }
+
+      /// <summary>
+      /// Take finished jobs. Does not require the GIL.
+      /// </summary>
+      std::size_t collect(std::vector<CompletedJob>& completed, const std::size_t max_jobs) {
+        return pool_.collect(completed, max_jobs);
+      }
+
+      /// <summary>
+      /// Fill in a finished job's future and stop tracking it. Must be called with the GIL held.
+      /// </summary>
+      /// <returns>The future, or nullptr if the job is unknown.</returns>
+      std::shared_ptr<JobFuture> finish(const CompletedJob& job) {
+        const auto it = pending_.find(job.id);
+        if (it == pending_.end()) {
+          return nullptr;
+        }
+        auto future = std::move(it->second);
+        pending_.erase(it);
+        future->complete(job);
+        return future;
+      }
+
+      std::size_t pending() const { return pending_.size(); }
+
+      /// <summary>
+      /// Drop every future. Must be called with the GIL held, after the pool is stopped.
+      /// </summary>
+      void clear() {
+        pending_.clear();
+      }
+
+    private:
+      JobPool pool_;
+      std::size_t threads_ = 0;
+      std::unordered_map<std::uint64_t, std::shared_ptr<JobFuture>> pending_;
+    };
+  }
+}
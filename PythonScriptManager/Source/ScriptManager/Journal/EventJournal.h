@@ -0,0 +1,475 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedSegment.h"
+#include "..\Serialization\EventCodec.h"
+
+namespace scripting {
+  namespace journal {
+    // "PSMJ" in little endian.
+    constexpr std::uint32_t kJournalMagic = 0x4A4D5350;
+    constexpr std::uint32_t kJournalVersion = 1;
+
+    enum class RecordType : std::uint8_t {
+      // Maps an event id to its name. Written before the first use of the id in every segment.
+      EVENT_NAME = 1,
+      EVENT
+    };
+
+    /// <summary>
+    /// Written at the start of every segment file.
+    /// </summary>
+    struct SegmentHeader {
+      std::uint32_t magic;
+      std::uint32_t version;
+      std::uint32_t segment_index;
+      std::uint32_t reserved;
+    };
+
+    /// <summary>
+    /// Records every top level event dispatch in to a directory of memory mapped segment files.
+    /// Each record is [u32 body size][u8 type][body]. Event records hold the nanoseconds since recording started,
+    /// an event id, the target module (empty for every module) and the arguments in EventCodec format.
+    /// Dispatching threads only copy in to the mapping, a background thread flushes written ranges in groups.
+    /// </summary>
+    class EventJournal {
+    public:
+      EventJournal() = default;
+      EventJournal(const EventJournal&) = delete;
+      EventJournal& operator=(const EventJournal&) = delete;
+      ~EventJournal() { stop(); }
+
+      /// <summary>
+      /// Start recording in to a directory, replacing any journal already in it.
+      /// </summary>
+      /// <param name="directory">Directory for the segment files</param>
+      /// <param name="segment_size">Bytes per segment file</param>
+      /// <param name="flush_interval">How often written records are flushed to the file</param>
+      /// <returns>false if the directory or first segment could not be created.</returns>
+      bool start(const std::filesystem::path& directory, const std::size_t segment_size = 64 * 1024 * 1024,
+        const std::chrono::milliseconds flush_interval = std::chrono::milliseconds(50)) {
+        stop();
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        for (const auto& file : std::filesystem::directory_iterator(directory, error)) {
+          if (file.path().extension() == ".psmj") {
+            std::filesystem::remove(file.path(), error);
+          }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        directory_ = directory;
+        segment_size_ = segment_size;
+        flush_interval_ = flush_interval;
+        segment_index_ = 0;
+        event_ids_.clear();
+        records_ = 0;
+        dropped_ = 0;
+        if (!open_segment()) {
+          return false;
+        }
+
+        start_time_ = std::chrono::steady_clock::now();
+        stopping_ = false;
+        flusher_ = std::thread(&EventJournal::flush_loop, this);
+        recording_.store(true, std::memory_order_release);
+        return true;
+      }
+
+      /// <summary>
+      /// Stop recording, flushing and trimming the last segment.
+      /// </summary>
+      void stop() {
+        if (!recording_.exchange(false, std::memory_order_acq_rel)) {
+          return;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          stopping_ = true;
+          if (segment_) {
+            retired_.push_back({ std::move(segment_), flushed_, written_ });
+          }
+        }
+        flush_condition_.notify_one();
+        flusher_.join();
+      }
+
+      bool recording() const { return recording_.load(std::memory_order_acquire); }
+
+      /// <summary>
+      /// Record an event from its C++ arguments. Does not require the GIL.
+      /// </summary>
+      /// <param name="event_name">The dispatched event</param>
+      /// <param name="target_module">The module it was sent to, empty when sent to every module</param>
+      template <typename... Args>
+      void record(const std::string& event_name, const std::string_view target_module, const Args&... args) {
+        const auto timestamp = elapsed();
+        auto& arguments = scratch();
+        arguments.clear();
+        serialization::EventCodec::encode(arguments, args...);
+        append(timestamp, event_name, target_module, arguments);
+      }
+
+      /// <summary>
+      /// Record an event whose arguments are already python objects. Must be called with the GIL held.
+      /// </summary>
+      void record_python(const std::string& event_name, const std::string_view target_module, const py::tuple& arguments) {
+        const auto timestamp = elapsed();
+        auto& encoded = scratch();
+        encoded.clear();
+        serialization::EventCodec::encode(encoded, arguments);
+        append(timestamp, event_name, target_module, encoded);
+      }
+
+      /// <summary>
+      /// Record an event whose arguments are already in EventCodec format, such as one received from another process.
+      /// </summary>
+      void record_encoded(const std::string& event_name, const std::string_view target_module, const std::string& arguments) {
+        append(elapsed(), event_name, target_module, arguments);
+      }
+
+      std::uint64_t records() const { return records_; }
+      std::uint64_t dropped() const { return dropped_; }
+
+    private:
+      struct RetiredSegment {
+        std::shared_ptr<MappedSegment> segment;
+        std::size_t flushed;
+        std::size_t written;
+      };
+
+      static std::string& scratch() {
+        thread_local std::string buffer;
+        return buffer;
+      }
+
+      std::uint64_t elapsed() const {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time_).count());
+      }
+
+      static std::filesystem::path segment_path(const std::filesystem::path& directory, const std::uint32_t index) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "journal_%06u.psmj", index);
+        return directory / name;
+      }
+
+      bool open_segment() {
+        auto segment = std::make_shared<MappedSegment>();
+        if (!segment->open(segment_path(directory_, segment_index_), segment_size_, true)) {
+          return false;
+        }
+
+        const SegmentHeader header = { kJournalMagic, kJournalVersion, segment_index_, 0 };
+        std::memcpy(segment->data(), &header, sizeof(header));
+        segment_ = std::move(segment);
+        written_ = sizeof(header);
+        flushed_ = 0;
+        defined_.assign(event_ids_.size(), false);
+        ++segment_index_;
+        return true;
+      }
+
+      void append(const std::uint64_t timestamp, const std::string& event_name, const std::string_view target_module, const std::string& arguments) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!segment_) {
+          return;
+        }
+        // Names are written with 16 bit lengths.
+        if (event_name.size() > kMaxTextSize || target_module.size() > kMaxTextSize) {
+          ++dropped_;
+          return;
+        }
+
+        const auto event_id = event_ids_.try_emplace(event_name, static_cast<std::uint32_t>(event_ids_.size())).first->second;
+        const auto name_size = sizeof(RecordType) + sizeof(event_id) + sizeof(std::uint16_t) + event_name.size();
+        const auto event_size = sizeof(RecordType) + sizeof(timestamp) + sizeof(event_id) + sizeof(std::uint16_t) + target_module.size() + arguments.size();
+        const auto required = [&]() {
+          const auto defined = event_id < defined_.size() && defined_[event_id];
+          return (defined ? 0 : sizeof(std::uint32_t) + name_size) + sizeof(std::uint32_t) + event_size;
+        };
+
+        if (written_ + required() > segment_->size()) {
+          retired_.push_back({ std::move(segment_), flushed_, written_ });
+          flush_condition_.notify_one();
+          if (!open_segment()) {
+            ++dropped_;
+            return;
+          }
+        }
+        if (written_ + required() > segment_->size()) {
+          // Larger than a whole segment.
+          ++dropped_;
+          return;
+        }
+
+        auto data = segment_->data() + written_;
+        written_ += required();
+
+        if (event_id >= defined_.size()) {
+          defined_.resize(event_id + 1, false);
+        }
+        if (!defined_[event_id]) {
+          data = write_header(data, name_size, RecordType::EVENT_NAME);
+          data = write_value(data, event_id);
+          data = write_string(data, event_name);
+          defined_[event_id] = true;
+        }
+
+        data = write_header(data, event_size, RecordType::EVENT);
+        data = write_value(data, timestamp);
+        data = write_value(data, event_id);
+        data = write_string(data, target_module);
+        std::memcpy(data, arguments.data(), arguments.size());
+        ++records_;
+      }
+
+      static char* write_header(char* data, const std::size_t size, const RecordType type) {
+        data = write_value(data, static_cast<std::uint32_t>(size));
+        return write_value(data, type);
+      }
+
+      template <typename T>
+      static char* write_value(char* data, const T& value) {
+        std::memcpy(data, &value, sizeof(T));
+        return data + sizeof(T);
+      }
+
+      static constexpr std::size_t kMaxTextSize = std::numeric_limits<std::uint16_t>::max();
+
+      static char* write_string(char* data, const std::string_view text) {
+        data = write_value(data, static_cast<std::uint16_t>(text.size()));
+        std::memcpy(data, text.data(), text.size());
+        return data + text.size();
+      }
+
+      /// <summary>
+      /// Flush everything written since the last pass in one go, and close segments that filled up.
+      /// </summary>
+      void flush_loop() {
+        auto stopping = false;
+        while (!stopping) {
+          std::shared_ptr<MappedSegment> segment;
+          std::size_t from = 0, to = 0;
+          std::vector<RetiredSegment> retired;
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            flush_condition_.wait_for(lock, flush_interval_, [this] { return stopping_ || !retired_.empty(); });
+            stopping = stopping_;
+            retired.swap(retired_);
+            if (segment_) {
+              segment = segment_;
+              from = flushed_;
+              to = written_;
+              flushed_ = written_;
+            }
+          }
+
+          if (segment) {
+            segment->flush(from, to - from);
+          }
+          for (const auto& entry : retired) {
+            entry.segment->flush(entry.flushed, entry.written - entry.flushed);
+            entry.segment->close(entry.written);
+          }
+        }
+      }
+
+      std::atomic<bool> recording_{ false };
+      std::chrono::steady_clock::time_point start_time_;
+
+      std::mutex mutex_;
+      std::condition_variable flush_condition_;
+      std::thread flusher_;
+      bool stopping_ = false;
+
+      std::filesystem::path directory_;
+      std::size_t segment_size_ = 0;
+      std::chrono::milliseconds flush_interval_{ 50 };
+      std::uint32_t segment_index_ = 0;
+      std::shared_ptr<MappedSegment> segment_;
+      std::size_t written_ = 0;
+      std::size_t flushed_ = 0;
+      std::vector<RetiredSegment> retired_;
+
+      std::unordered_map<std::string, std::uint32_t> event_ids_;
+      std::vector<bool> defined_;
+      std::atomic<std::uint64_t> records_{ 0 };
+      std::atomic<std::uint64_t> dropped_{ 0 };
+    };
+
+    /// <summary>
+    /// A recorded event read back from a journal.
+    /// </summary>
+    struct JournalEvent {
+      std::uint64_t timestamp = 0;
+      const std::string* event_name = nullptr;
+      std::string_view target_module;
+      // Strings point in to the mapped segment and stay valid until the next call to next().
+      std::vector<serialization::EventValue> arguments;
+    };
+
+    /// <summary>
+    /// Reads the events in a journal directory back in the order they were recorded.
+    /// </summary>
+    class JournalReader {
+    public:
+      /// <summary>
+      /// Find the segments in a journal directory.
+      /// </summary>
+      /// <returns>false if the directory holds no segments.</returns>
+      bool open(const std::filesystem::path& directory) {
+        segments_.clear();
+        std::error_code error;
+        for (const auto& file : std::filesystem::directory_iterator(directory, error)) {
+          if (file.path().extension() == ".psmj") {
+            segments_.push_back(file.path());
+          }
+        }
+        std::sort(segments_.begin(), segments_.end());
+        next_segment_ = 0;
+        cursor_ = end_ = nullptr;
+        return !segments_.empty();
+      }
+
+      /// <summary>
+      /// Read the next event.
+      /// </summary>
+      /// <returns>false at the end of the journal.</returns>
+      bool next(JournalEvent& event) {
+        while (true) {
+          if (cursor_ == end_ && !next_segment()) {
+            return false;
+          }
+
+          std::uint32_t size = 0;
+          RecordType type;
+          if (!serialization::EventCodec::read(cursor_, end_, size) || size == 0 || static_cast<std::size_t>(end_ - cursor_) < size ||
+            !serialization::EventCodec::read(cursor_, end_, type)) {
+            // Zero filled space after the last record, or a record cut short by a crash.
+            cursor_ = end_;
+            continue;
+          }
+
+          const auto record_end = cursor_ + size - sizeof(RecordType);
+          if (read_record(type, record_end, event)) {
+            cursor_ = record_end;
+            return true;
+          }
+          cursor_ = record_end;
+        }
+      }
+
+    private:
+      bool next_segment() {
+        while (next_segment_ < segments_.size()) {
+          segment_.close(0);
+          if (!segment_.open(segments_[next_segment_++], 0, false) || segment_.size() < sizeof(SegmentHeader)) {
+            continue;
+          }
+
+          SegmentHeader header;
+          std::memcpy(&header, segment_.data(), sizeof(header));
+          if (header.magic != kJournalMagic || header.version != kJournalVersion) {
+            continue;
+          }
+
+          // Event ids are only defined per segment.
+          names_.clear();
+          cursor_ = segment_.data() + sizeof(header);
+          end_ = segment_.data() + segment_.size();
+          return true;
+        }
+        return false;
+      }
+
+      bool read_record(const RecordType type, const char* record_end, JournalEvent& event) {
+        if (type == RecordType::EVENT_NAME) {
+          std::uint32_t event_id;
+          std::string_view name;
+          if (serialization::EventCodec::read(cursor_, record_end, event_id) && read_string(record_end, name)) {
+            names_[event_id] = std::string(name);
+          }
+          return false;
+        }
+
+        if (type != RecordType::EVENT) {
+          return false;
+        }
+
+        std::uint32_t event_id;
+        if (!serialization::EventCodec::read(cursor_, record_end, event.timestamp) || !serialization::EventCodec::read(cursor_, record_end, event_id) ||
+          !read_string(record_end, event.target_module)) {
+          return false;
+        }
+
+        const auto name = names_.find(event_id);
+        if (name == names_.end()) {
+          return false;
+        }
+        event.event_name = &name->second;
+        return serialization::EventCodec::decode(cursor_, record_end, event.arguments);
+      }
+
+      bool read_string(const char* record_end, std::string_view& text) {
+        std::uint16_t length;
+        if (!serialization::EventCodec::read(cursor_, record_end, length) || static_cast<std::size_t>(record_end - cursor_) < length) {
+          return false;
+        }
+        text = std::string_view(cursor_, length);
+        cursor_ += length;
+        return true;
+      }
+
+      std::vector<std::filesystem::path> segments_;
+      std::size_t next_segment_ = 0;
+      MappedSegment segment_;
+      const char* cursor_ = nullptr;
+      const char* end_ = nullptr;
+      std::unordered_map<std::uint32_t, std::string> names_;
+    };
+
+    /// <summary>
+    /// Latencies measured while replaying a journal, in microseconds.
+    /// </summary>
+    struct ReplayStats {
+      std::size_t events = 0;
+      std::size_t skipped = 0;
+      double seconds = 0.0;
+      double p50 = 0.0;
+      double p99 = 0.0;
+      double p999 = 0.0;
+      double max = 0.0;
+
+      void summarize(std::vector<double>& latencies) {
+        if (latencies.empty()) {
+          return;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        const auto at = [&latencies](const double percentile) {
+          return latencies[std::min(latencies.size() - 1, static_cast<std::size_t>(percentile * latencies.size()))];
+        };
+        p50 = at(0.50);
+        p99 = at(0.99);
+        p999 = at(0.999);
+        max = latencies.back();
+      }
+    };
+  }
+}
@@ -0,0 +1,167 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace scripting {
+  namespace journal {
+    /// <summary>
+    /// A fixed size file mapped in to memory, written by copying straight in to the mapping.
+    /// </summary>
+    class MappedSegment {
+    public:
+      MappedSegment() = default;
+      MappedSegment(const MappedSegment&) = delete;
+      MappedSegment& operator=(const MappedSegment&) = delete;
+      ~MappedSegment() { close(0); }
+
+      /// <summary>
+      /// Create or open a file and map it.
+      /// </summary>
+      /// <param name="path">File to map</param>
+      /// <param name="size">Size to map. A new or shorter file is extended to this size, zero maps the file as it is</param>
+      /// <param name="writable">Map for writing</param>
+      /// <returns>false if the file could not be mapped.</returns>
+      bool open(const std::filesystem::path& path, std::size_t size, const bool writable) {
+        close(0);
+
+#ifdef _WIN32
+        file_ = CreateFileW(path.wstring().c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr,
+          writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) {
+          return false;
+        }
+
+        if (size == 0) {
+          LARGE_INTEGER file_size;
+          GetFileSizeEx(file_, &file_size);
+          size = static_cast<std::size_t>(file_size.QuadPart);
+        }
+        if (size == 0) {
+          return true;
+        }
+
+        mapping_ = CreateFileMappingW(file_, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+          static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32), static_cast<DWORD>(size), nullptr);
+        if (!mapping_) {
+          close(0);
+          return false;
+        }
+
+        data_ = static_cast<char*>(MapViewOfFile(mapping_, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size));
+#else
+        file_ = ::open(path.string().c_str(), writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+        if (file_ < 0) {
+          return false;
+        }
+
+        if (size == 0) {
+          size = static_cast<std::size_t>(lseek(file_, 0, SEEK_END));
+        }
+        if (size == 0) {
+          return true;
+        }
+
+        if (writable && ftruncate(file_, static_cast<off_t>(size)) != 0) {
+          close(0);
+          return false;
+        }
+
+        const auto mapped = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file_, 0);
+        data_ = mapped == MAP_FAILED ? nullptr : static_cast<char*>(mapped);
+#endif
+
+        if (!data_) {
+          close(0);
+          return false;
+        }
+        size_ = size;
+        writable_ = writable;
+        return true;
+      }
+
+      /// <summary>
+      /// Write a dirty range back to the file.
+      /// </summary>
+      void flush(const std::size_t offset, const std::size_t length) const {
+        if (!data_ || length == 0) {
+          return;
+        }
+
+#ifdef _WIN32
+        FlushViewOfFile(data_ + offset, length);
+#else
+        // msync needs a page aligned start address.
+        const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const auto aligned = offset - offset % page;
+        msync(data_ + aligned, length + (offset - aligned), MS_ASYNC);
+#endif
+      }
+
+      /// <summary>
+      /// Unmap and close the file.
+      /// </summary>
+      /// <param name="truncate_to">Cut a writable file down to this many bytes, zero keeps its mapped size</param>
+      void close(const std::size_t truncate_to) {
+#ifdef _WIN32
+        if (data_) {
+          UnmapViewOfFile(data_);
+        }
+        if (mapping_) {
+          CloseHandle(mapping_);
+        }
+        if (file_ != INVALID_HANDLE_VALUE) {
+          if (writable_ && truncate_to > 0) {
+            LARGE_INTEGER end;
+            end.QuadPart = static_cast<LONGLONG>(truncate_to);
+            SetFilePointerEx(file_, end, nullptr, FILE_BEGIN);
+            SetEndOfFile(file_);
+          }
+          CloseHandle(file_);
+        }
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) {
+          munmap(data_, size_);
+        }
+        if (file_ >= 0) {
+          if (writable_ && truncate_to > 0) {
+            [[maybe_unused]] const auto result = ftruncate(file_, static_cast<off_t>(truncate_to));
+          }
+          ::close(file_);
+        }
+        file_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+        writable_ = false;
+      }
+
+      char* data() const { return data_; }
+      std::size_t size() const { return size_; }
+
+    private:
+#ifdef _WIN32
+      HANDLE file_ = INVALID_HANDLE_VALUE;
+      HANDLE mapping_ = nullptr;
+#else
+      int file_ = -1;
+#endif
+      char* data_ = nullptr;
+      std::size_t size_ = 0;
+      bool writable_ = false;
+    };
+  }
+}
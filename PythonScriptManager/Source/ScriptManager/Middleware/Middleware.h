@@ -0,0 +1,255 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+namespace scripting {
+  namespace middleware {
+    /// <summary>
+    /// State shared by the middleware stages around a single handler invocation. Stages run with the GIL held.
+    /// </summary>
+    struct DispatchContext {
+      DispatchContext(const std::string& event_name, const std::string& module_name, py::tuple arguments)
+        : event_name(event_name), module_name(module_name), arguments(std::move(arguments)) {}
+
+      const std::string& event_name;
+      const std::string& module_name;
+
+      // Arguments passed to the handler. Before stages may replace them.
+      py::tuple arguments;
+
+      // The handler's return value, available to after stages.
+      py::object result;
+
+      // Set by a stage to stop the event reaching any further modules.
+      bool cancelled = false;
+    };
+
+    enum class StageResult {
+      // Run the next stage and then the handler.
+      CONTINUE = 0,
+      // Skip the remaining before stages and the handler for this module. After stages still run.
+      SKIP_HANDLER
+    };
+
+    using BeforeFunction = StageResult(*)(DispatchContext& context, void* user_data);
+    using AfterFunction = void(*)(DispatchContext& context, void* user_data);
+
+    /// <summary>
+    /// A middleware stage. Either function may be null.
+    /// </summary>
+    struct Stage {
+      std::string name;
+
+      // Stages run in ascending order before the handler and in descending order after it.
+      int order = 0;
+
+      // Only apply to these events. Empty applies the stage to every event.
+      std::vector<std::string> events;
+
+      BeforeFunction before = nullptr;
+      AfterFunction after = nullptr;
+      void* user_data = nullptr;
+    };
+
+    /// <summary>
+    /// The stages that apply to one event, flattened in to plain function pointer arrays.
+    /// </summary>
+    class ComposedChain {
+    public:
+      struct BeforeEntry {
+        BeforeFunction function;
+        void* user_data;
+      };
+
+      struct AfterEntry {
+        AfterFunction function;
+        void* user_data;
+      };
+
+      StageResult run_before(DispatchContext& context) const {
+        for (const auto& entry : before_) {
+          if (entry.function(context, entry.user_data) != StageResult::CONTINUE) {
+            return StageResult::SKIP_HANDLER;
+          }
+        }
+        return StageResult::CONTINUE;
+      }
+
+      void run_after(DispatchContext& context) const {
+        for (const auto& entry : after_) {
+          entry.function(context, entry.user_data);
+        }
+      }
+
+      bool empty() const { return before_.empty() && after_.empty(); }
+
+    private:
+      friend class Pipeline;
+
+      std::vector<BeforeEntry> before_;
+      std::vector<AfterEntry> after_;
+    };
+
+    /// <summary>
+    /// An ordered chain of C++ stages run around every script handler invocation.
+    /// Every event's chain is composed when stages are added or removed and published as one immutable snapshot, so
+    /// looking a chain up takes no lock, and events without stages get no chain at all.
+    /// </summary>
+    class Pipeline {
+    public:
+      /// <summary>
+      /// Keeps the chains chain_for returns valid while it lives. Snapshots replaced in the meantime are freed once no
+      /// reader is left on any thread.
+      /// </summary>
+      class Reader {
+      public:
+        explicit Reader(const Pipeline& pipeline) : pipeline_(pipeline) {
+          pipeline_.readers_.fetch_add(1);
+        }
+        ~Reader() {
+          if (pipeline_.readers_.fetch_sub(1) == 1 && pipeline_.has_retired_.load()) {
+            pipeline_.reclaim();
+          }
+        }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+      private:
+        const Pipeline& pipeline_;
+      };
+
+      /// <summary>
+      /// Add a stage, replacing any existing stage with the same name.
+      /// </summary>
+      void add_stage(Stage stage) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto name = stage.name;
+        remove_stage_locked(name);
+        stages_.push_back(std::move(stage));
+        std::stable_sort(stages_.begin(), stages_.end(), [](const Stage& lhs, const Stage& rhs) { return lhs.order < rhs.order; });
+        publish_locked();
+      }
+
+      /// <summary>
+      /// Remove a stage by name.
+      /// </summary>
+      /// <returns>true if the stage existed.</returns>
+      bool remove_stage(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const auto removed = remove_stage_locked(name);
+        publish_locked();
+        return removed;
+      }
+
+      /// <summary>
+      /// Get the composed chain for an event. Takes no lock. Only call it while a Reader is alive.
+      /// </summary>
+      /// <returns>The chain, or nullptr when no stage applies to the event. Valid until the last Reader is gone.</returns>
+      const ComposedChain* chain_for(const std::string& event_name) const {
+        const auto snapshot = snapshot_.load();
+        if (!snapshot) {
+          return nullptr;
+        }
+        if (!snapshot->by_event.empty()) {
+          const auto it = snapshot->by_event.find(event_name);
+          if (it != snapshot->by_event.end()) {
+            return &it->second;
+          }
+        }
+        return snapshot->every_event.empty() ? nullptr : &snapshot->every_event;
+      }
+
+    private:
+      /// <summary>
+      /// The chains for one set of stages: one per event a stage names, each with the stages applying to every
+      /// event merged in order, and the chain for every other event.
+      /// </summary>
+      struct Snapshot {
+        std::unordered_map<std::string, ComposedChain> by_event;
+        ComposedChain every_event;
+      };
+
+      static ComposedChain compose(const std::vector<Stage>& stages, const std::string* event_name) {
+        ComposedChain chain;
+        for (const auto& stage : stages) {
+          if (!stage.events.empty() && (!event_name || std::find(stage.events.begin(), stage.events.end(), *event_name) == stage.events.end())) {
+            continue;
+          }
+          if (stage.before) {
+            chain.before_.push_back({ stage.before, stage.user_data });
+          }
+          if (stage.after) {
+            chain.after_.push_back({ stage.after, stage.user_data });
+          }
+        }
+        std::reverse(chain.after_.begin(), chain.after_.end());
+        return chain;
+      }
+
+      bool remove_stage_locked(const std::string& name) {
+        const auto it = std::remove_if(stages_.begin(), stages_.end(), [&name](const Stage& stage) { return stage.name == name; });
+        const auto removed = it != stages_.end();
+        stages_.erase(it, stages_.end());
+        return removed;
+      }
+
+      void publish_locked() {
+        std::unique_ptr<Snapshot> snapshot;
+        if (!stages_.empty()) {
+          snapshot = std::make_unique<Snapshot>();
+          for (const auto& stage : stages_) {
+            for (const auto& event_name : stage.events) {
+              if (snapshot->by_event.count(event_name) == 0) {
+                snapshot->by_event.emplace(event_name, compose(stages_, &event_name));
+              }
+            }
+          }
+          snapshot->every_event = compose(stages_, nullptr);
+        }
+
+        // A dispatch on another thread may still be running the old snapshot's chains, so it is freed once no
+        // reader is left.
+        snapshot_.store(snapshot.get());
+        if (current_) {
+          retired_.push_back(std::move(current_));
+          has_retired_.store(true);
+        }
+        current_ = std::move(snapshot);
+        reclaim_locked();
+      }
+
+      void reclaim() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        reclaim_locked();
+      }
+
+      /// <summary>
+      /// Free the retired snapshots if nothing can be reading them. A reader arriving after the check loads the current
+      /// snapshot, which can not be retired while the lock is held. Sequentially consistent on both sides.
+      /// </summary>
+      void reclaim_locked() const {
+        if (readers_.load() == 0) {
+          retired_.clear();
+          has_retired_.store(false);
+        }
+      }
+
+      mutable std::mutex mutex_;
+      std::vector<Stage> stages_;
+      std::unique_ptr<const Snapshot> current_;
+      mutable std::vector<std::unique_ptr<const Snapshot>> retired_;
+      mutable std::atomic<bool> has_retired_{ false };
+      mutable std::atomic<std::size_t> readers_{ 0 };
+      std::atomic<const Snapshot*> snapshot_{ nullptr };
+    };
+  }
+}
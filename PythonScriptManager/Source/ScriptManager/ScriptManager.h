@@ -1,12 +1,38 @@
 #pragma once
+#include <array>
+#include <chrono>
 #include <filesystem>
+#include <optional>
+#include <shared_mutex>
+#include <thread>
+#include <tuple>
 #include <pybind11\embed.h>
 #include <pybind11\functional.h>
 #include <pybind11\gil.h>
 namespace py = pybind11;
 
 #include "Logger.h"
+#include "Bus\MessageBus.h"
+#include "Commands\CommandRouter.h"
+#include "Data\DataTable.h"
+#include "Deferred\CommandBuffer.h"
+#include "Dispatch\ArgumentPool.h"
+#include "Dispatch\BatchDispatch.h"
+#include "Dispatch\DispatchQueue.h"
+#include "Dispatch\DispatchScope.h"
+#include "Executor\ScriptExecutor.h"
+#include "Formula\FormulaCompiler.h"
+#include "Gil\GilTelemetry.h"
+#include "Gil\SwitchIntervalController.h"
+#include "Gil\ThreadState.h"
+#include "Ipc\EventBridge.h"
+#include "Ipc\WorkerPool.h"
+#include "Jobs\ScriptJobs.h"
+#include "Journal\EventJournal.h"
+#include "Middleware\Middleware.h"
 #include "Models\ScriptModule.h"
+#include "Strings\StringTable.h"
+#include "Wrappers\LazyProxy.h"
 
 namespace scripting {
   /// <summary>
@@ -60,6 +86,56 @@ namespace scripting {
       return logger_ptr_;
     }
 
+    /// <summary>
+    /// Give the calling thread a python thread state that lives until detach_thread, rather than one created and freed
+    /// around every dispatch. Call it once from each long lived game thread that dispatches events, without the GIL.
+    /// </summary>
+    void attach_thread() {
+      gil::ThreadState::current().attach();
+    }
+
+    /// <summary>
+    /// Free the calling thread's python thread state. Call it without the GIL before an attached thread exits.
+    /// </summary>
+    void detach_thread() {
+      gil::ThreadState::current().detach();
+    }
+
+    /// <summary>
+    /// How long each thread has waited for and held the GIL since start up or the last reset.
+    /// Threads that have exited are merged in to one entry with thread id 0.
+    /// </summary>
+    std::vector<gil::GilThreadStats> gil_stats() const {
+      return gil::GilTelemetry::instance().threads();
+    }
+
+    void reset_gil_stats() {
+      gil::GilTelemetry::instance().reset();
+    }
+
+    /// <summary>
+    /// Start tuning python's switch interval to keep GIL waits inside a share of the tick budget.
+    /// </summary>
+    /// <param name="settings">Tick budget and interval bounds</param>
+    void start_gil_controller(const gil::SwitchIntervalSettings& settings = gil::SwitchIntervalSettings()) {
+      gil_controller_.start(settings);
+      logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::start_gil_controller - Tuning the switch interval, starting at: ", gil_controller_.interval());
+    }
+
+    /// <summary>
+    /// Stop tuning the switch interval and restore the one python had before.
+    /// </summary>
+    void stop_gil_controller() {
+      gil_controller_.stop();
+    }
+
+    /// <summary>
+    /// Accessor for the switch interval controller.
+    /// </summary>
+    const gil::SwitchIntervalController& gil_controller() const {
+      return gil_controller_;
+    }
+
     /// <summary>
     /// Set the path for modules to be loaded from.
     /// </summary>
@@ -74,7 +150,7 @@ namespace scripting {
     /// <param name="module_path">Module path of the python script.</param>
     /// <param name="callback_on_load">Callback function that will be called when the script successfully loads</param>
     void load_script(const std::filesystem::path& module_path, const std::function<void(const std::string&, const std::shared_ptr<models::ScriptModule>&)>& callback_on_load = nullptr) {
-      py::gil_scoped_acquire acquire;
+      gil::GilAcquire acquire;
 
       // Use an absolute path to ensure consistency
       const auto absolute_path = std::filesystem::absolute(module_path);
@@ -94,6 +170,8 @@ namespace scripting {
         const auto script = std::make_shared<models::ScriptModule>(module_name, std::make_shared<py::module_>(module), absolute_path, relative_path);
         loaded_modules_[module_name] = script;
 
+        compile_formulas(module_name, module);
+
         if (callback_on_load) {
           callback_on_load(module_name, script);
         }
@@ -122,7 +200,7 @@ namespace scripting {
     /// </summary>
     /// <param name="module_name">The name of a module to reload</param>
     void reload_script(const std::string& module_name) {
-      py::gil_scoped_acquire acquire;
+      gil::GilAcquire acquire;
 
       // Check if the script is already loaded.
       const auto it = loaded_modules_.find(module_name);
@@ -135,8 +213,16 @@ namespace scripting {
       // Reload the module.
       const auto script = it->second;
 
+      // The module registers its commands and subscriptions again as it is re-imported. The old ones are kept until it
+      // has, so a reload that fails leaves the module working as before.
+      const auto previous_commands = command_router_.module_commands(module_name);
+      const auto previous_subscriptions = message_bus_.module_subscriptions(module_name);
+
       try {
         script->script_module()->reload();
+        command_router_.unregister_commands(previous_commands);
+        message_bus_.unsubscribe_all(previous_subscriptions);
+        compile_formulas(module_name, *script->script_module());
         logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::reload_script - Reloaded Module: ", module_name);
       }
       catch (const py::error_already_set& e) {
@@ -184,6 +270,35 @@ namespace scripting {
       }
     }
 
+    /// <summary>
+    /// Release every python object held by the manager.
+    /// Must be called before the interpreter is finalized as the manager outlives it.
+    /// </summary>
+    void shutdown() {
+      gil_controller_.stop();
+      executor_.stop();
+      jobs_.pool().stop();
+      workers_.stop();
+      journal_.stop();
+      bridge_.close();
+
+      gil::GilAcquire acquire;
+
+      command_router_.clear();
+      message_bus_.clear();
+      jobs_.clear();
+      strings::StringTable::instance().clear();
+      wrappers::release_lazy_proxies();
+      dispatch::clear_payloads();
+      arguments_.clear();
+      tables_.clear();
+      {
+        std::unique_lock<std::shared_mutex> lock(formula_mutex_);
+        formulas_.clear();
+      }
+      loaded_modules_.clear();
+    }
+
     /// <summary>
     /// Sends an event to a single loaded script for them to handle
     /// </summary>
@@ -195,11 +310,15 @@ namespace scripting {
       const auto it = loaded_modules_.find(module_name);
       if (it == loaded_modules_.end())
       {
-        logger_ptr_->log_message(LogType::LOG_ERROR, __FUNCTION__" Could not find module: ", module_name);
+        if (workers_.hosts(module_name)) {
+          workers_.send(module_name, event_key_name, args...);
+          return;
+        }
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::send_event_to_single_module - Could not find module: ", module_name);
         return;
       }
 
-      send_event_to_single_module(*it, event_key_name, args);
+      send_event_to_single_module(it->second, event_key_name, std::forward<Args>(args)...);
     }
 
     /// <summary>
@@ -210,155 +329,1390 @@ namespace scripting {
     /// <param name="...args">Argument list to pass to the python handlers</param>
     template <typename... Args>
     void send_event_to_single_module(std::shared_ptr<models::ScriptModule> script_module, const std::string& event_key_name, Args&&... args) {
-      py::gil_scoped_acquire acquire;
-      const auto module_ = script_module->script_module().get();
+      if (journal_.recording() && !dispatch::DispatchScope::active()) {
+        journal_.record(event_key_name, script_module->name(), args...);
+      }
 
-      try {
-        if (py::hasattr(*script_module->script_module(), event_key_name.c_str())) {
-          logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::dispatch_event - Dispatching cached event: ", event_key_name);
+      {
+        gil::GilAcquire acquire;
+        wrappers::ProxyLease lease;
+        auto arguments = arguments_.pack(std::forward<Args>(args)...);
+        dispatch_arguments(script_module, event_key_name, arguments);
+        release_arguments(std::move(arguments));
+      }
+      flush_deferred_commands();
+    }
 
-          // Call the specified Python function variadically
-          py::object result = module_->attr(event_key_name.c_str())(
-            std::forward<Args>(args)...);
-        }
+    /// <summary>
+    /// Dispatch an event to any loaded scripts for them to handle
+    /// </summary>
+    /// <param name="event_key_name">name of the event function we want python to handle</param>
+    /// <param name="...args">Argument list to pass to the python handlers</param>
+    template <typename... Args>
+    void dispatch_event(const std::string& event_key_name, Args&&... args) {
+      // Encode for the journal from the C++ arguments, before taking the GIL.
+      if (journal_.recording() && !dispatch::DispatchScope::active()) {
+        journal_.record(event_key_name, std::string_view(), args...);
+      }
+      if (bridge_.forwards(event_key_name)) {
+        bridge_.publish(event_key_name, args...);
+      }
+      if (workers_.handles(event_key_name)) {
+        workers_.send(std::string(), event_key_name, args...);
       }
-      catch (const py::error_already_set& e) {
-        // An exception occurred, print the error message and traceback
-        PyErr_Print();
-        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::send_event_to_single_module - Script Error.\n",
-          e.what());
 
-        // Access the Python traceback
-        PyObject* type, * value, * traceback;
-        PyErr_Fetch(&type, &value, &traceback);
+      {
+        gil::GilAcquire acquire;
+        wrappers::ProxyLease lease;
 
-        // Print the traceback
-        if (traceback) {
-          py::object print_tb = py::module::import("traceback").attr("print_tb");
-          logger_ptr_->log_message(LogType::LOG_ERROR, "Trace:\n", traceback);
+        // Convert the arguments once and share them between every module's handler.
+        auto arguments = arguments_.pack(std::forward<Args>(args)...);
+        dispatch_arguments(nullptr, event_key_name, arguments);
+        release_arguments(std::move(arguments));
+      }
+      flush_deferred_commands();
+    }
+
+    /// <summary>
+    /// Dispatch an event whose arguments are already python objects. Must be called with the GIL held.
+    /// </summary>
+    /// <param name="event_key_name">name of the event function we want python to handle</param>
+    /// <param name="arguments">Argument tuple to pass to the python handlers</param>
+    void dispatch_event_arguments(const std::string& event_key_name, const py::tuple& arguments) {
+      if (journal_.recording() && !dispatch::DispatchScope::active()) {
+        journal_.record_python(event_key_name, std::string_view(), arguments);
+      }
+      if (bridge_.forwards(event_key_name)) {
+        bridge_.publish_python(event_key_name, arguments);
+      }
+      if (workers_.handles(event_key_name)) {
+        workers_.send_python(std::string(), event_key_name, arguments);
+      }
+      dispatch_arguments(nullptr, event_key_name, arguments);
+    }
+
+    /// <summary>
+    /// Dispatch one event for many entities, such as a tick for every user, converting everything and taking the GIL
+    /// once. Handlers marked with example_module.batch_handler are called once with a list of the entities followed by
+    /// one list per argument column. Other handlers are called once per entity, unless the batch fallback skips them.
+    /// Batch events are not recorded, bridged or sent to workers.
+    /// </summary>
+    /// <param name="event_key_name">name of the event function we want python to handle</param>
+    /// <param name="entities">The entities the event is for</param>
+    /// <param name="...columns">One value per entity for each further handler argument</param>
+    template <typename Range, typename... Columns>
+    void dispatch_batch(const std::string& event_key_name, const Range& entities, const Columns&... columns) {
+      {
+        gil::GilAcquire acquire;
+        wrappers::ProxyLease lease;
+        py::tuple batch;
+        try {
+          batch = dispatch::make_batch(entities, columns...);
+        }
+        catch (const std::invalid_argument& e) {
+          logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::dispatch_batch - ", event_key_name, ": ", e.what());
+          return;
         }
+        dispatch_batch_arguments(event_key_name, batch);
       }
+      flush_deferred_commands();
     }
 
     /// <summary>
-    /// Dispatch an event to any loaded scripts for them to handle
+    /// Dispatch a batch event already packed by dispatch::make_batch. Must be called with the GIL held.
+    /// </summary>
+    /// <param name="event_key_name">name of the event function we want python to handle</param>
+    /// <param name="batch">The entities' list followed by one list per argument column</param>
+    void dispatch_batch_arguments(const std::string& event_key_name, const py::tuple& batch) {
+      const auto depth = dispatch::DispatchScope::depth();
+      if (depth > 0 && (nested_dispatch_policy_ == dispatch::NestedDispatchPolicy::QUEUE || depth >= max_dispatch_depth_)) {
+        dispatch::DispatchQueue::current().push({ nullptr, event_key_name, batch, true });
+        return;
+      }
+
+      dispatch::DispatchScope scope;
+      run_batch_handlers(event_key_name, batch);
+      end_dispatch(scope);
+    }
+
+    /// <summary>
+    /// Choose whether batch events reach handlers that take one entity at a time.
+    /// </summary>
+    /// <param name="fallback">Call them once per entity, or skip them</param>
+    void set_batch_fallback(const dispatch::BatchFallback fallback) {
+      batch_fallback_ = fallback;
+    }
+
+    /// <summary>
+    /// Hand an event to the executor threads to dispatch, returning without waiting for the GIL.
+    /// The arguments are copied, text in to strings of its own, so anything else referenced must outlive the dispatch.
     /// </summary>
     /// <param name="event_key_name">name of the event function we want python to handle</param>
     /// <param name="...args">Argument list to pass to the python handlers</param>
+    /// <returns>false if the executor is not running or its queues are full.</returns>
     template <typename... Args>
-    void dispatch_event(const std::string& event_key_name, Args&&... args) {
-      py::gil_scoped_acquire acquire;
+    bool post_event(const std::string& event_key_name, Args&&... args) {
+      return executor_.submit([this, event_key_name, arguments = std::tuple<strings::owned_t<Args>...>(std::forward<Args>(args)...)]() {
+        std::apply([this, &event_key_name](const auto&... values) { dispatch_event(event_key_name, values...); }, arguments);
+      });
+    }
+
+    /// <summary>
+    /// Join the event bridge shared by the processes on this host.
+    /// </summary>
+    /// <param name="name">Name of the shared memory region, the same for every process</param>
+    /// <param name="ring_capacity">Bytes per process ring, a power of two matching the other processes</param>
+    /// <returns>false if the bridge could not be joined.</returns>
+    bool start_bridge(const std::string& name = "psm_event_bridge", const std::uint32_t ring_capacity = ipc::EventBridge::kDefaultRingCapacity) {
+      std::string error;
+      if (!bridge_.open(name, ring_capacity, error)) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::start_bridge - Could not join the event bridge: ", error);
+        return false;
+      }
+      logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::start_bridge - Joined the event bridge: ", name);
+      return true;
+    }
 
-      // The function was not found in cache so we will iterate over all loaded modules and if the event is active in any module we will add it to cache.
-      std::vector<std::shared_ptr<models::ScriptModule>> valid_modules;
+    /// <summary>
+    /// Leave the event bridge.
+    /// </summary>
+    void stop_bridge() {
+      bridge_.close();
+    }
 
-      // Iterate over all loaded scripts
-      for (const auto& loaded_script : loaded_modules_) {
-        const auto script = loaded_script.second;
-        const auto module = script->script_module().get();
+    /// <summary>
+    /// Forward an event to the other processes on the bridge every time it is dispatched here.
+    /// </summary>
+    /// <param name="event_key_name">name of the event to forward</param>
+    /// <returns>false if the event name is too long to be sent.</returns>
+    bool bridge_event(const std::string& event_key_name) {
+      if (!bridge_.forward_event(event_key_name)) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::bridge_event - Event name longer than the bridge allows: ", event_key_name.size());
+        return false;
+      }
+      return true;
+    }
 
-        // Check if the function exists in the script
-        try {
-          if (py::hasattr(*module, event_key_name.c_str())) {
-            logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::dispatch_event - Dispatching event: ", event_key_name);
+    /// <summary>
+    /// Accessor for the cross-process event bridge.
+    /// </summary>
+    /// <returns>The event bridge</returns>
+    ipc::EventBridge& event_bridge() {
+      return bridge_;
+    }
+
+    /// <summary>
+    /// Dispatch events the other processes forwarded over the bridge. Call it regularly, for example once per tick.
+    /// Reading and decoding happen before the GIL is taken, which is then held once for the whole batch.
+    /// </summary>
+    /// <param name="max_events">Most events to dispatch in one call</param>
+    /// <returns>The number of events dispatched.</returns>
+    std::size_t pump_bridge(const std::size_t max_events = 256) {
+      thread_local std::vector<ipc::BridgeEvent> batch;
+      thread_local std::vector<std::vector<serialization::EventValue>> values;
+
+      batch.clear();
+      if (bridge_.poll(batch, max_events) == 0) {
+        return 0;
+      }
+
+      if (values.size() < batch.size()) {
+        values.resize(batch.size());
+      }
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        const char* data = batch[i].arguments.data();
+        if (!serialization::EventCodec::decode(data, data + batch[i].arguments.size(), values[i])) {
+          values[i].clear();
+        }
+        if (journal_.recording() && !dispatch::DispatchScope::active()) {
+          journal_.record_encoded(batch[i].event_name, std::string_view(), batch[i].arguments);
+        }
+      }
+
+      {
+        gil::GilAcquire acquire;
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+          dispatch_arguments(nullptr, batch[i].event_name, serialization::EventCodec::to_python(values[i]));
+        }
+      }
+      flush_deferred_commands();
+      return batch.size();
+    }
 
-            // Call the specified Python function variadically
-            py::object result = module->attr(event_key_name.c_str())(
-              std::forward<Args>(args)...);
+    /// <summary>
+    /// Dispatch an event received from outside the interpreter, such as by a worker process from the game.
+    /// </summary>
+    /// <param name="event">The event, sent to every module when it has no target module</param>
+    void dispatch_decoded(const serialization::DecodedEvent& event) {
+      {
+        gil::GilAcquire acquire;
 
-            // Add the module so it gets added to the function cache.
-            valid_modules.push_back(script);
+        std::shared_ptr<models::ScriptModule> target;
+        if (!event.target_module.empty()) {
+          const auto it = loaded_modules_.find(std::string(event.target_module));
+          if (it == loaded_modules_.end()) {
+            logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::dispatch_decoded - Could not find module: ", event.target_module);
+            return;
           }
+          target = it->second;
         }
-        catch (const py::error_already_set& e) {
-          // An exception occurred, print the error message and traceback
-          PyErr_Print();
-          logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::dispatch_event - Script Error.\n",
-            e.what());
+        dispatch_arguments(target, event.event_name, serialization::EventCodec::to_python(event.arguments));
+      }
+      flush_deferred_commands();
+    }
+
+    /// <summary>
+    /// Host script modules in a separate worker process with its own interpreter, so their CPU work runs in parallel
+    /// with the game and a crash takes down only the worker. Events the modules handle are sent to the worker.
+    /// </summary>
+    /// <param name="module_paths">Python files for the worker to load. Do not also load them in this process</param>
+    /// <returns>false if the worker could not be started.</returns>
+    bool spawn_worker(const std::vector<std::string>& module_paths) {
+      std::string error;
+      const auto process_id = workers_.spawn(module_paths, error);
+      if (process_id == 0) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::spawn_worker - Could not start worker: ", error);
+        return false;
+      }
+      logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::spawn_worker - Started worker process: ", process_id);
+      return true;
+    }
+
+    /// <summary>
+    /// Start a fork server that loads the modules once and forks pre-warmed workers from them, see fork_worker.
+    /// </summary>
+    /// <param name="module_paths">Python files every forked worker hosts. Do not also load them in this process</param>
+    /// <returns>false if the server could not be started, or processes can not be forked on this platform.</returns>
+    bool start_fork_server(const std::vector<std::string>& module_paths) {
+      std::string error;
+      if (!workers_.start_fork_server(module_paths, error)) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::start_fork_server - Could not start the fork server: ", error);
+        return false;
+      }
+      logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::start_fork_server - Fork server ready.");
+      return true;
+    }
+
+    /// <summary>
+    /// Fork a worker from the fork server. It is ready for events straight away, as it shares the server's already
+    /// imported modules, and events are spread between every worker forked from the server.
+    /// </summary>
+    /// <returns>false if the worker could not be forked.</returns>
+    bool fork_worker() {
+      std::string error;
+      const auto process_id = workers_.fork_worker(error);
+      if (process_id == 0) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::fork_worker - Could not fork worker: ", error);
+        return false;
+      }
+      logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::fork_worker - Forked worker process: ", process_id);
+      return true;
+    }
+
+    /// <summary>
+    /// Apply the side effects worker processes sent back. Call it regularly, for example once per tick.
+    /// </summary>
+    /// <param name="max_messages">Most messages to read from each worker</param>
+    /// <returns>The number of messages read.</returns>
+    std::size_t pump_workers(const std::size_t max_messages = 256) {
+      for (const auto process_id : workers_.remove_exited()) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::pump_workers - Worker process exited: ", process_id);
+      }
+      return workers_.pump(max_messages);
+    }
+
+    /// <summary>
+    /// Hand finished native jobs back to the scripts that submitted them: fill in each job's future and dispatch its
+    /// completion event, if it asked for one. Call once per tick from the game thread.
+    /// </summary>
+    /// <param name="max_jobs">Most jobs to hand back in one call</param>
+    /// <returns>The number of jobs handed back.</returns>
+    std::size_t pump_jobs(const std::size_t max_jobs = 256) {
+      thread_local std::vector<jobs::CompletedJob> completed;
 
-          // Access the Python traceback
-          PyObject* type, * value, * traceback;
-          PyErr_Fetch(&type, &value, &traceback);
+      completed.clear();
+      if (jobs_.collect(completed, max_jobs) == 0) {
+        return 0;
+      }
 
-          // Print the traceback
-          if (traceback) {
-            py::object print_tb = py::module::import("traceback").attr("print_tb");
-            logger_ptr_->log_message(LogType::LOG_ERROR, "Trace:\n", traceback);
+      {
+        gil::GilAcquire acquire;
+        for (const auto& job : completed) {
+          const auto future = jobs_.finish(job);
+          if (future && !future->event().empty()) {
+            dispatch_arguments(nullptr, future->event(), py::make_tuple(future));
           }
         }
       }
+      flush_deferred_commands();
+      return completed.size();
     }
 
-  private:
-    // Logger to provide custom logging context.
-    std::shared_ptr<Logger> logger_ptr_;
+    /// <summary>
+    /// Accessor for the native jobs scripts submit. Register jobs on its pool before scripts submit them.
+    /// </summary>
+    jobs::ScriptJobs& script_jobs() {
+      return jobs_;
+    }
 
-    // Directory housing the python scripts
-    std::string module_path_;
+    /// <summary>
+    /// Start the threads post_event dispatches on. Each attaches a python thread state for its lifetime.
+    /// Placements that cannot be applied, such as SCHED_FIFO without the privilege, are logged and the thread runs unplaced.
+    /// </summary>
+    /// <param name="settings">Thread count, CPU sets and scheduling</param>
+    /// <returns>false if the executor is already running or the settings ask for no threads.</returns>
+    bool start_executor(const executor::ExecutorSettings& settings) {
+      std::vector<std::string> errors;
+      const auto started = executor_.start(settings, [this]() { attach_thread(); }, [this]() { detach_thread(); }, errors);
+      for (const auto& error : errors) {
+        logger_ptr_->log_message(LogType::LOG_WARNING, "ScriptManager::start_executor - ", error);
+      }
+      if (!started) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::start_executor - Could not start the executor.");
+      }
+      return started;
+    }
 
-    // List of all the loaded python script modules
-    std::unordered_map<std::string, std::shared_ptr<models::ScriptModule>> loaded_modules_;
-  };
+    /// <summary>
+    /// Dispatch every event already posted, then stop the executor threads.
+    /// </summary>
+    void stop_executor() {
+      executor_.stop();
+    }
 
-  /// <summary>
-  /// A wrapper function to get the Script Manager's Logger.
-  /// </summary>
-  inline std::shared_ptr<Logger> get_logger() {
-    return ScriptManager::instance().get_logger();
-  }
+    /// <summary>
+    /// Accessor for the executor threads.
+    /// </summary>
+    executor::ScriptExecutor& script_executor() {
+      return executor_;
+    }
 
-  /// <summary>
-  /// A wrapper function to dispatch events without having to call for the instance each time.
-  /// </summary>
-  /// <typeparam name="...Args">Args list type</typeparam>
-  /// <param name="event_key_name">Name of the python function</param>
-  /// <param name="args">Variadic arguments to pass to the python function</param>
-  template <typename... Args>
-  void dispatch_event(const std::string& event_key_name, Args&&... args) {
-    ScriptManager::instance().dispatch_event(event_key_name, std::forward<Args>(args)...);
-  }
+    /// <summary>
+    /// Accessor for the worker processes hosting script modules.
+    /// </summary>
+    /// <returns>The worker pool</returns>
+    ipc::WorkerPool& worker_pool() {
+      return workers_;
+    }
 
-  /// <summary>
-  /// A wrapper function to send events to single modules without having to call for the instance each time.
-  /// </summary>
-  /// <typeparam name="...Args">Args list type</typeparam>
-  /// <param name="module_name">Name of the python module</param>
-  /// <param name="event_key_name">Name of the python function</param>
-  /// <param name="args">Variadic arguments to pass to the python function</param>
-  template <typename... Args>
-  void send_event_to_single_module(const std::string& module_name, const std::string& event_key_name, Args&&... args) {
-    ScriptManager::instance().send_event_to_single_module(module_name, event_key_name, std::forward<Args>(args)...);
-  }
+    /// <summary>
+    /// Accessor for the loaded script modules. Must be used with the GIL held.
+    /// </summary>
+    /// <returns>The loaded modules by name</returns>
+    const std::unordered_map<std::string, std::shared_ptr<models::ScriptModule>>& loaded_modules() const {
+      return loaded_modules_;
+    }
 
-  /// <summary>
-  /// A wrapper function to send events to single modules without having to call for the instance each time.
-  /// </summary>
-  /// <typeparam name="...Args">Args list type</typeparam>
-  /// <param name="module">The python module</param>
-  /// <param name="script_module">The script module we are calling in to</param>
-  /// <param name="event_key_name">Name of the python function</param>
-  /// <param name="args">Variadic arguments to pass to the python function</param>
-  template <typename... Args>
-  void send_event_to_single_module(std::shared_ptr<models::ScriptModule> script_module, const std::string& event_key_name, Args&&... args) {
-    ScriptManager::instance().send_event_to_single_module(script_module, event_key_name, std::forward<Args>(args)...);
-  }
+    /// <summary>
+    /// Start recording every top level event dispatch in to a binary journal.
+    /// Events raised from inside handlers are not recorded as replaying their parent raises them again.
+    /// </summary>
+    /// <param name="directory">Directory for the journal's segment files, any previous journal in it is replaced</param>
+    /// <returns>false if the journal could not be created.</returns>
+    bool start_journal(const std::filesystem::path& directory) {
+      if (!journal_.start(directory)) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::start_journal - Could not create journal in: ", directory);
+        return false;
+      }
+      logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::start_journal - Recording events to: ", directory);
+      return true;
+    }
 
-  /// <summary>
-  /// A wrapper function to load scripts without having to call for the instance each time.
-  /// </summary>
-  /// <param name="path">Path name housing the python modules</param>
-  /// <param name="callback_on_load">Callback function that will be called when each script successfully loads</param>
-  inline void load_scripts(const std::filesystem::path& path = std::filesystem::path(), const std::function<void(const std::string&, const std::shared_ptr<models::ScriptModule>&)>& callback_on_load = nullptr) {
-    ScriptManager::instance().load_scripts(path, callback_on_load);
-  }
+    /// <summary>
+    /// Stop recording events, flushing the journal to disk.
+    /// </summary>
+    /// <returns>The number of events recorded.</returns>
+    std::uint64_t stop_journal() {
+      journal_.stop();
+      if (journal_.dropped() > 0) {
+        logger_ptr_->log_message(LogType::LOG_WARNING, "ScriptManager::stop_journal - Events too large to record: ", journal_.dropped());
+      }
+      return journal_.records();
+    }
 
-  /// <summary>
-  /// A wrapper function to load a single script without having to call for the instance each time.
-  /// </summary>
-  /// <param name="module_path">Path name housing the python module</param>
-  /// <param name="callback_on_load">Callback function that will be called when the script successfully loads</param>
-  inline void load_script(const std::filesystem::path& module_path, const std::function<void(const std::string&, const std::shared_ptr<models::ScriptModule>&)>& callback_on_load = nullptr) {
-    ScriptManager::instance().load_script(module_path, callback_on_load);
+    /// <summary>
+    /// Dispatch a recorded journal against the loaded scripts and measure each dispatch's latency.
+    /// Arguments that could not be recorded, such as pointers to game objects, are replayed as None.
+    /// </summary>
+    /// <param name="directory">Directory holding the journal</param>
+    /// <param name="speed">Multiple of the recorded pace to replay at, zero replays as fast as possible</param>
+    /// <returns>Latency statistics for the replay.</returns>
+    journal::ReplayStats replay_journal(const std::filesystem::path& directory, const double speed = 1.0) {
+      journal::ReplayStats stats;
+      if (journal_.recording()) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::replay_journal - Stop recording before replaying a journal.");
+        return stats;
+      }
+
+      journal::JournalReader reader;
+      if (!reader.open(directory)) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::replay_journal - No journal found in: ", directory);
+        return stats;
+      }
+
+      std::vector<double> latencies;
+      journal::JournalEvent event;
+      const auto start = std::chrono::steady_clock::now();
+      while (reader.next(event)) {
+        if (speed > 0.0) {
+          std::this_thread::sleep_until(start + std::chrono::nanoseconds(static_cast<long long>(event.timestamp / speed)));
+        }
+
+        const auto dispatch_start = std::chrono::steady_clock::now();
+        {
+          gil::GilAcquire acquire;
+
+          std::shared_ptr<models::ScriptModule> target;
+          if (!event.target_module.empty()) {
+            const auto it = loaded_modules_.find(std::string(event.target_module));
+            if (it == loaded_modules_.end()) {
+              ++stats.skipped;
+              continue;
+            }
+            target = it->second;
+          }
+          dispatch_arguments(target, *event.event_name, serialization::EventCodec::to_python(event.arguments));
+        }
+        flush_deferred_commands();
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - dispatch_start).count());
+      }
+
+      stats.events = latencies.size();
+      stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      stats.summarize(latencies);
+      return stats;
+    }
+
+    /// <summary>
+    /// Choose how events dispatched from inside a script handler are handled. Set before dispatching any events.
+    /// </summary>
+    /// <param name="policy">Run nested events inline or queue them until the outermost dispatch finishes</param>
+    /// <param name="max_depth">Nesting depth at which inline events are queued instead</param>
+    void set_nested_dispatch_policy(const dispatch::NestedDispatchPolicy policy, const int max_depth = 8) {
+      nested_dispatch_policy_ = policy;
+      max_dispatch_depth_ = max_depth;
+    }
+
+    /// <summary>
+    /// Accessor for the middleware pipeline run around every handler invocation.
+    /// </summary>
+    /// <returns>The middleware pipeline</returns>
+    middleware::Pipeline& middleware() {
+      return middleware_;
+    }
+
+    /// <summary>
+    /// Accessor for the pool of argument tuples events are dispatched with.
+    /// </summary>
+    /// <returns>The argument pool</returns>
+    dispatch::ArgumentPool& argument_pool() {
+      return arguments_;
+    }
+
+    /// <summary>
+    /// Publish a read only table of game data, such as item or monster definitions, for every script to read through
+    /// example_module.table. Replaces the table published before under the same name. Takes the GIL.
+    /// </summary>
+    /// <param name="table">The table, shared with scripts for as long as they hold it</param>
+    void publish_table(std::shared_ptr<const data::DataTableBase> table) {
+      gil::GilAcquire acquire;
+      const auto name = table->name();
+      const auto rows = table->size();
+      tables_.publish(std::move(table));
+      logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::publish_table - Published table: ", name, " (", rows, " rows)");
+    }
+
+    /// <summary>
+    /// Accessor for the game data tables published to scripts.
+    /// </summary>
+    /// <returns>The published tables</returns>
+    data::DataTables& data_tables() {
+      return tables_;
+    }
+
+    /// <summary>
+    /// Accessor for the chat command router.
+    /// </summary>
+    /// <returns>The router scripts register their commands with</returns>
+    commands::CommandRouter& command_router() {
+      return command_router_;
+    }
+
+    /// <summary>
+    /// Accessor for the script-to-script message bus.
+    /// </summary>
+    /// <returns>The bus scripts publish and subscribe through</returns>
+    bus::MessageBus& message_bus() {
+      return message_bus_;
+    }
+
+    /// <summary>
+    /// Route a prefixed chat line to the script handler that registered the command.
+    /// Unknown commands and malformed arguments are rejected without acquiring the GIL.
+    /// </summary>
+    /// <param name="line">The chat line, including the command prefix</param>
+    /// <param name="...context">Arguments passed to the handler ahead of the parsed command arguments</param>
+    /// <returns>true if a handler was invoked.</returns>
+    template <typename... Context>
+    bool dispatch_command(const std::string_view line, Context&&... context) {
+      std::shared_ptr<const commands::Command> command;
+      std::vector<commands::CommandArgument> arguments;
+
+      const auto result = command_router_.route(line, command, arguments);
+      if (result != commands::RouteResult::ROUTED) {
+        if (result != commands::RouteResult::NOT_A_COMMAND) {
+          logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::dispatch_command - Rejected command: ", line);
+        }
+        // Resolved but with bad arguments. If it was unregistered meanwhile ours is the last reference to its handler.
+        if (command) {
+          gil::GilAcquire acquire;
+          command.reset();
+        }
+        return false;
+      }
+
+      {
+        gil::GilAcquire acquire;
+        dispatch::DispatchScope scope;
+
+        // Release our reference to the command while the GIL is still held, it may be the last one.
+        const auto handled_command = std::move(command);
+
+        try {
+          py::tuple call_arguments(sizeof...(Context) + arguments.size());
+          std::size_t index = 0;
+          ((call_arguments[index++] = strings::to_python(std::forward<Context>(context))), ...);
+          for (auto& argument : arguments) {
+            call_arguments[index++] = std::visit([](auto& value) { return strings::to_python(std::move(value)); }, argument);
+          }
+
+          logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::dispatch_command - Dispatching command: ", handled_command->name);
+          handled_command->handler(*call_arguments);
+        }
+        catch (const py::error_already_set& e) {
+          PyErr_Print();
+          logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::dispatch_command - Script Error.\n", e.what());
+        }
+        end_dispatch(scope);
+      }
+      flush_deferred_commands();
+      return true;
+    }
+
+    /// <summary>
+    /// Evaluate a script function that returns a value.
+    /// Functions decorated with native_formula are evaluated natively without acquiring the GIL, anything else
+    /// (or a formula hitting a case the native evaluator can not reproduce exactly) is called through python.
+    /// Calls passing or returning anything but bool, integral and floating point values always go through python.
+    /// </summary>
+    /// <typeparam name="R">The C++ type of the result</typeparam>
+    /// <param name="module_name">name of the module housing the function</param>
+    /// <param name="function_name">name of the function to evaluate</param>
+    /// <param name="...args">Argument list to pass to the function</param>
+    /// <returns>The result, or std::nullopt if the function could not be called.</returns>
+    template <typename R, typename... Args>
+    std::optional<R> evaluate_formula(const std::string& module_name, const std::string& function_name, const Args&... args) {
+      std::shared_ptr<const formula::CompiledFormula> compiled;
+      if constexpr (formula::is_formula_type_v<R> && (formula::is_formula_type_v<Args> && ...)) {
+        std::shared_lock<std::shared_mutex> lock(formula_mutex_);
+        const auto module_it = formulas_.find(module_name);
+        if (module_it != formulas_.end()) {
+          const auto it = module_it->second.find(function_name);
+          if (it != module_it->second.end()) {
+            compiled = it->second;
+          }
+        }
+      }
+
+      if (compiled) {
+        const std::array<std::optional<formula::FormulaValue>, sizeof...(Args)> converted = { formula::to_formula_value(args)... };
+        std::array<formula::FormulaValue, sizeof...(Args)> values;
+        auto convertible = true;
+        for (std::size_t i = 0; i < converted.size(); ++i) {
+          convertible = convertible && converted[i].has_value();
+          if (convertible) {
+            values[i] = *converted[i];
+          }
+        }
+
+        if (convertible) {
+          const auto result = compiled->evaluate(values.data(), values.size());
+          if (result) {
+            const auto typed_result = formula::from_formula_value<R>(*result);
+            if (typed_result) {
+              return typed_result;
+            }
+          }
+        }
+      }
+
+      gil::GilAcquire acquire;
+      const auto it = loaded_modules_.find(module_name);
+      if (it == loaded_modules_.end()) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::evaluate_formula - Could not find module: ", module_name);
+        return std::nullopt;
+      }
+
+      try {
+        return it->second->script_module()->attr(function_name.c_str())(args...).template cast<R>();
+      }
+      catch (const py::error_already_set& e) {
+        PyErr_Print();
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::evaluate_formula - Script Error.\n", e.what());
+      }
+      catch (const py::cast_error& e) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::evaluate_formula - Result could not be converted.\n", e.what());
+      }
+      return std::nullopt;
+    }
+
+    /// <summary>
+    /// Check that native formulas in a module return exactly what their python versions return.
+    /// The module provides FORMULA_CONFORMANCE_CASES, a list of (function name, argument tuple) pairs, and may provide
+    /// FORMULA_PYTHON_ONLY, names of marked functions the compiler must leave as python.
+    /// </summary>
+    /// <param name="module_name">name of the module housing the formulas and cases</param>
+    /// <returns>true if every case matched bit for bit and no python only function was compiled.</returns>
+    bool check_formula_conformance(const std::string& module_name) {
+      gil::GilAcquire acquire;
+
+      const auto it = loaded_modules_.find(module_name);
+      if (it == loaded_modules_.end()) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::check_formula_conformance - Could not find module: ", module_name);
+        return false;
+      }
+
+      const auto& module = *it->second->script_module();
+      if (!py::hasattr(module, "FORMULA_CONFORMANCE_CASES")) {
+        logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::check_formula_conformance - Module has no FORMULA_CONFORMANCE_CASES: ", module_name);
+        return false;
+      }
+
+      std::unordered_map<std::string, std::shared_ptr<const formula::CompiledFormula>> compiled;
+      {
+        std::shared_lock<std::shared_mutex> lock(formula_mutex_);
+        const auto formulas_it = formulas_.find(module_name);
+        if (formulas_it != formulas_.end()) {
+          compiled = formulas_it->second;
+        }
+      }
+
+      std::size_t checked = 0, native = 0, mismatches = 0;
+      if (py::hasattr(module, "FORMULA_PYTHON_ONLY")) {
+        for (const auto& name : module.attr("FORMULA_PYTHON_ONLY")) {
+          const auto function_name = name.cast<std::string>();
+          ++checked;
+          if (compiled.count(function_name) != 0) {
+            ++mismatches;
+            logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::check_formula_conformance - Compiled a python only function: ", function_name);
+          }
+        }
+      }
+      for (const auto& test_case : module.attr("FORMULA_CONFORMANCE_CASES")) {
+        const auto function_name = test_case[py::int_(0)].cast<std::string>();
+        const auto arguments = py::tuple(test_case[py::int_(1)]);
+        ++checked;
+
+        const auto formula_it = compiled.find(function_name);
+        if (formula_it == compiled.end()) {
+          continue;
+        }
+
+        std::vector<formula::FormulaValue> values;
+        for (const auto& argument : arguments) {
+          const auto value = formula::formula_value_from_python(argument);
+          if (!value) {
+            break;
+          }
+          values.push_back(*value);
+        }
+        if (values.size() != arguments.size()) {
+          continue;
+        }
+
+        const auto native_result = formula_it->second->evaluate(values.data(), values.size());
+        if (!native_result) {
+          continue;
+        }
+        ++native;
+
+        std::optional<formula::FormulaValue> python_result;
+        std::string python_repr = "<exception>";
+        try {
+          const auto result = module.attr(function_name.c_str())(*arguments);
+          python_result = formula::formula_value_from_python(result);
+          python_repr = py::repr(result).cast<std::string>();
+        }
+        catch (const py::error_already_set&) {
+          PyErr_Clear();
+        }
+
+        if (!python_result || !python_result->identical(*native_result)) {
+          ++mismatches;
+          logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::check_formula_conformance - Mismatch: ", function_name,
+            std::string(py::repr(arguments)), " native=", std::string(py::repr(formula::formula_value_to_python(*native_result))),
+            " python=", python_repr);
+        }
+      }
+
+      logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::check_formula_conformance - ", module_name, ": ", checked,
+        " cases, ", native, " evaluated natively, ", checked - native, " fell back to python, ", mismatches, " mismatches.");
+      return mismatches == 0;
+    }
+
+  private:
+    /// <summary>
+    /// Dispatch an event to one module or every module, or queue it if it is nested and the policy says so.
+    /// Must be called with the GIL held.
+    /// </summary>
+    /// <param name="target">The module to send to, or nullptr for every module</param>
+    /// <param name="event_key_name">name of the event function</param>
+    /// <param name="arguments">Arguments for the handlers</param>
+    void dispatch_arguments(const std::shared_ptr<models::ScriptModule>& target, const std::string& event_key_name, const py::tuple& arguments) {
+      const auto depth = dispatch::DispatchScope::depth();
+      if (depth > 0 && (nested_dispatch_policy_ == dispatch::NestedDispatchPolicy::QUEUE || depth >= max_dispatch_depth_)) {
+        dispatch::DispatchQueue::current().push({ target, event_key_name, arguments });
+        return;
+      }
+
+      dispatch::DispatchScope scope;
+      run_handlers(target, event_key_name, arguments);
+      end_dispatch(scope);
+    }
+
+    /// <summary>
+    /// Call the event's handlers. Must be called with the GIL held.
+    /// </summary>
+    void run_handlers(const std::shared_ptr<models::ScriptModule>& target, const std::string& event_key_name, const py::tuple& arguments) {
+      const middleware::Pipeline::Reader reader(middleware_);
+      const auto chain = middleware_.chain_for(event_key_name);
+      const auto handler_name = strings::StringTable::instance().get(event_key_name);
+      if (target) {
+        invoke_handler(target, event_key_name, handler_name, arguments, chain);
+        return;
+      }
+
+      // Iterate over all loaded scripts
+      for (const auto& loaded_script : loaded_modules_) {
+        if (!invoke_handler(loaded_script.second, event_key_name, handler_name, arguments, chain)) {
+          break;
+        }
+      }
+    }
+
+    /// <summary>
+    /// Call every module's handler for a batch event. Must be called with the GIL held.
+    /// </summary>
+    void run_batch_handlers(const std::string& event_key_name, const py::tuple& batch) {
+      const middleware::Pipeline::Reader reader(middleware_);
+      const auto chain = middleware_.chain_for(event_key_name);
+      const auto handler_name = strings::StringTable::instance().get(event_key_name);
+      std::size_t per_entity = 0;
+      for (const auto& loaded_script : loaded_modules_) {
+        if (!invoke_batch_handler(loaded_script.second, event_key_name, handler_name, batch, chain, per_entity)) {
+          break;
+        }
+      }
+      // Once per batch, however many modules fell back.
+      if (per_entity > 0) {
+        logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::dispatch_batch - Dispatched event per entity: ", event_key_name,
+          " x", dispatch::batch_size(batch), " in ", per_entity, " modules");
+      }
+    }
+
+    /// <summary>
+    /// Call a module's handler for a batch event: once with the whole batch if it is a batch handler, otherwise once
+    /// per entity with the middleware chain run around each call. Must be called with the GIL held.
+    /// </summary>
+    /// <param name="per_entity">Incremented when the handler is called per entity</param>
+    /// <returns>false if a middleware stage cancelled the event for any entity.</returns>
+    bool invoke_batch_handler(const std::shared_ptr<models::ScriptModule>& script, const std::string& event_key_name, const py::str& handler_name, const py::tuple& batch, const middleware::ComposedChain* chain, std::size_t& per_entity) {
+      const auto module = script->script_module().get();
+      py::object handler;
+      try {
+        handler = find_handler(*module, handler_name);
+        if (!handler) {
+          return true;
+        }
+        if (py::hasattr(handler, dispatch::kBatchHandlerAttribute)) {
+          return invoke_handler(script, event_key_name, handler_name, batch, chain);
+        }
+      }
+      catch (const py::error_already_set& e) {
+        report_script_error(e);
+        return true;
+      }
+      if (batch_fallback_ == dispatch::BatchFallback::SKIP) {
+        return true;
+      }
+
+      const auto count = dispatch::batch_size(batch);
+      ++per_entity;
+      const auto module_name = script->name();
+      const auto columns = PyTuple_GET_SIZE(batch.ptr());
+      std::vector<PyObject*> arguments(static_cast<std::size_t>(columns));
+      auto cancelled = false;
+      for (Py_ssize_t index = 0; index < count; ++index) {
+        try {
+          if (!chain) {
+            // Borrowed straight from the batch's lists, without packing a tuple per entity.
+            for (Py_ssize_t column = 0; column < columns; ++column) {
+              arguments[column] = PyList_GET_ITEM(PyTuple_GET_ITEM(batch.ptr(), column), index);
+            }
+            const auto result = PyObject_Vectorcall(handler.ptr(), arguments.data(), static_cast<std::size_t>(columns), nullptr);
+            if (!result) {
+              throw py::error_already_set();
+            }
+            Py_DECREF(result);
+            continue;
+          }
+
+          middleware::DispatchContext context{ event_key_name, module_name, dispatch::batch_row(batch, index) };
+          if (chain->run_before(context) == middleware::StageResult::CONTINUE) {
+            context.result = call_handler(handler, context.arguments);
+          }
+          chain->run_after(context);
+          cancelled = cancelled || context.cancelled;
+        }
+        catch (const py::error_already_set& e) {
+          // One entity's error does not stop the rest of the batch.
+          report_script_error(e);
+        }
+      }
+      return !cancelled;
+    }
+
+    /// <summary>
+    /// Finish a dispatch. Once the outermost dispatch completes, queued nested events and messages scripts deferred on
+    /// the bus are delivered in the same GIL hold, until neither produces any more, and lazy proxies are released.
+    /// Must be called with the GIL held.
+    /// </summary>
+    void end_dispatch(const dispatch::DispatchScope& scope) {
+      if (!scope.outermost()) {
+        return;
+      }
+
+      auto& queue = dispatch::DispatchQueue::current();
+      std::size_t drained = 0;
+      do {
+        dispatch::QueuedDispatch next;
+        while (queue.pop(next)) {
+          if (++drained > dispatch::DispatchQueue::kMaxQueuedPerDispatch) {
+            logger_ptr_->log_message(LogType::LOG_WARNING, "ScriptManager::end_dispatch - Too many nested events in one dispatch, dropping the rest.");
+            queue.clear();
+            break;
+          }
+          if (next.batch) {
+            run_batch_handlers(next.event_name, next.arguments);
+          }
+          else {
+            run_handlers(next.target, next.event_name, next.arguments);
+          }
+        }
+        try {
+          message_bus_.drain_deferred();
+        }
+        catch (const py::error_already_set& e) {
+          report_script_error(e);
+        }
+      } while (!queue.empty());
+
+      // Objects passed as lazy proxies are only guaranteed to live for the dispatch.
+      wrappers::release_lazy_proxies();
+    }
+
+    /// <summary>
+    /// Apply the side effects scripts deferred during the dispatch that just finished.
+    /// Called after the GIL is released, nested dispatches leave them for the outermost one.
+    /// </summary>
+    static void flush_deferred_commands() {
+      if (!dispatch::DispatchScope::active()) {
+        deferred::CommandBuffer::current().flush();
+      }
+    }
+
+    /// <summary>
+    /// Call a module's handler for an event, running the middleware chain around it.
+    /// Must be called with the GIL held.
+    /// </summary>
+    /// <param name="script">The module to call in to</param>
+    /// <param name="event_key_name">name of the event function</param>
+    /// <param name="handler_name">The same name as a python string</param>
+    /// <param name="arguments">Arguments for the handler</param>
+    /// <param name="chain">The event's middleware chain, or nullptr when there is none</param>
+    /// <returns>false if a middleware stage cancelled the event.</returns>
+    bool invoke_handler(const std::shared_ptr<models::ScriptModule>& script, const std::string& event_key_name, const py::str& handler_name, const py::tuple& arguments, const middleware::ComposedChain* chain) {
+      const auto module = script->script_module().get();
+
+      // Check if the function exists in the script
+      try {
+        const auto handler = find_handler(*module, handler_name);
+        if (!handler) {
+          return true;
+        }
+
+        logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::dispatch_event - Dispatching event: ", event_key_name);
+
+        if (!chain) {
+          call_handler(handler, arguments);
+          return true;
+        }
+
+        const auto module_name = script->name();
+        middleware::DispatchContext context{ event_key_name, module_name, arguments };
+        if (chain->run_before(context) == middleware::StageResult::CONTINUE) {
+          context.result = call_handler(handler, context.arguments);
+        }
+        chain->run_after(context);
+        return !context.cancelled;
+      }
+      catch (const py::error_already_set& e) {
+        report_script_error(e);
+      }
+      return true;
+    }
+
+    /// <summary>
+    /// A module's handler for an event, or a null object when it has none. Reads the module's dict directly, since a
+    /// failed attribute lookup on a module raises, and allocates, an AttributeError for every module without the
+    /// handler. Modules defining __getattr__ still go through it. Must be called with the GIL held.
+    /// </summary>
+    static py::object find_handler(const py::module_& module, const py::str& handler_name) {
+      const auto dict = PyModule_GetDict(module.ptr());
+      if (const auto handler = PyDict_GetItemWithError(dict, handler_name.ptr())) {
+        return py::reinterpret_borrow<py::object>(handler);
+      }
+      if (PyErr_Occurred()) {
+        throw py::error_already_set();
+      }
+
+      static const auto getattr_name = PyUnicode_InternFromString("__getattr__");
+      if (!PyDict_GetItemWithError(dict, getattr_name)) {
+        if (PyErr_Occurred()) {
+          throw py::error_already_set();
+        }
+        return py::object();
+      }
+      const auto handler = PyObject_GetAttr(module.ptr(), handler_name.ptr());
+      if (!handler) {
+        if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+          throw py::error_already_set();
+        }
+        PyErr_Clear();
+      }
+      return py::reinterpret_steal<py::object>(handler);
+    }
+
+    /// <summary>
+    /// Hand a dispatch's argument tuple back to the pool and, once the outermost dispatch is over, the payloads it
+    /// lent. Must be called with the GIL held.
+    /// </summary>
+    void release_arguments(py::tuple&& arguments) {
+      arguments_.release(std::move(arguments));
+      if (!dispatch::DispatchScope::active()) {
+        dispatch::recycle_payloads(arguments_.enabled());
+      }
+    }
+
+    /// <summary>
+    /// Log an exception raised by a handler along with its traceback.
+    /// </summary>
+    void report_script_error(const py::error_already_set& e) {
+      // An exception occurred, print the error message and traceback
+      PyErr_Print();
+      logger_ptr_->log_message(LogType::LOG_ERROR, "ScriptManager::dispatch_event - Script Error.\n",
+        e.what());
+
+      // Access the Python traceback
+      PyObject* type, * value, * traceback;
+      PyErr_Fetch(&type, &value, &traceback);
+
+      // Print the traceback
+      if (traceback) {
+        py::object print_tb = py::module::import("traceback").attr("print_tb");
+        logger_ptr_->log_message(LogType::LOG_ERROR, "Trace:\n", traceback);
+      }
+    }
+
+    /// <summary>
+    /// Call a handler with an already packed argument tuple, avoiding pybind11 re-packing it for every call.
+    /// </summary>
+    static py::object call_handler(const py::handle& handler, const py::tuple& arguments) {
+      const auto result = PyObject_Call(handler.ptr(), arguments.ptr(), nullptr);
+      if (!result) {
+        throw py::error_already_set();
+      }
+      return py::reinterpret_steal<py::object>(result);
+    }
+
+    /// <summary>
+    /// Compile every native_formula function in a module, replacing any formulas from a previous load.
+    /// Must be called with the GIL held.
+    /// </summary>
+    /// <param name="module_name">The name the module is stored under</param>
+    /// <param name="module">The loaded python module</param>
+    void compile_formulas(const std::string& module_name, const py::module_& module) {
+      std::unordered_map<std::string, std::shared_ptr<const formula::CompiledFormula>> compiled;
+
+      for (const auto& item : py::reinterpret_borrow<py::dict>(module.attr("__dict__"))) {
+        const auto function = py::reinterpret_borrow<py::object>(item.second);
+        if (!PyFunction_Check(function.ptr()) || !py::hasattr(function, formula::kNativeFormulaAttribute)) {
+          continue;
+        }
+
+        const auto function_name = item.first.cast<std::string>();
+        std::string error;
+        const auto formula = formula::FormulaCompiler::compile(module, function, error);
+        if (formula) {
+          compiled[function_name] = formula;
+          logger_ptr_->log_message(LogType::LOG_INFO, "ScriptManager::compile_formulas - Native formula compiled: ", module_name, ".", function_name);
+        }
+        else {
+          logger_ptr_->log_message(LogType::LOG_WARNING, "ScriptManager::compile_formulas - ", module_name, ".", function_name,
+            " will run as python: ", error);
+        }
+      }
+
+      std::unique_lock<std::shared_mutex> lock(formula_mutex_);
+      formulas_[module_name] = std::move(compiled);
+    }
+
+    // Logger to provide custom logging context.
+    std::shared_ptr<Logger> logger_ptr_;
+
+    // Directory housing the python scripts
+    std::string module_path_;
+
+    // List of all the loaded python script modules
+    std::unordered_map<std::string, std::shared_ptr<models::ScriptModule>> loaded_modules_;
+
+    // C++ stages run around every handler invocation.
+    middleware::Pipeline middleware_;
+
+    // Argument tuples reused between dispatches.
+    dispatch::ArgumentPool arguments_;
+
+    // Chat commands registered by scripts.
+    commands::CommandRouter command_router_;
+
+    // Game data shared by every script, kept across reloads.
+    data::DataTables tables_;
+
+    // Topics scripts publish to each other on.
+    bus::MessageBus message_bus_;
+
+    // Records top level dispatches for replay.
+    journal::EventJournal journal_;
+
+    // Carries selected events to and from the other processes on the host.
+    ipc::EventBridge bridge_;
+
+    // Worker processes hosting script modules out of process.
+    ipc::WorkerPool workers_;
+
+    // Threads that dispatch events posted by game threads.
+    executor::ScriptExecutor executor_;
+
+    // Native jobs submitted by scripts and run without the GIL.
+    jobs::ScriptJobs jobs_;
+
+    // Adjusts the switch interval from GIL telemetry while started.
+    gil::SwitchIntervalController gil_controller_;
+
+    // How events dispatched from inside a handler are handled.
+    dispatch::NestedDispatchPolicy nested_dispatch_policy_ = dispatch::NestedDispatchPolicy::INLINE;
+    int max_dispatch_depth_ = 8;
+
+    // Whether batch events reach handlers that take one entity at a time.
+    dispatch::BatchFallback batch_fallback_ = dispatch::BatchFallback::PER_ENTITY;
+
+    // Native formulas per module. Guarded by formula_mutex_ as they are evaluated without the GIL.
+    std::shared_mutex formula_mutex_;
+    std::unordered_map<std::string, std::unordered_map<std::string, std::shared_ptr<const formula::CompiledFormula>>> formulas_;
+  };
+
+  /// <summary>
+  /// A wrapper function to get the Script Manager's Logger.
+  /// </summary>
+  inline std::shared_ptr<Logger> get_logger() {
+    return ScriptManager::instance().get_logger();
+  }
+
+  /// <summary>
+  /// A wrapper function to attach the calling thread without having to call for the instance each time.
+  /// </summary>
+  inline void attach_thread() {
+    ScriptManager::instance().attach_thread();
+  }
+
+  /// <summary>
+  /// A wrapper function to detach the calling thread without having to call for the instance each time.
+  /// </summary>
+  inline void detach_thread() {
+    ScriptManager::instance().detach_thread();
+  }
+
+  /// <summary>
+  /// A wrapper function to read GIL wait and hold times without having to call for the instance each time.
+  /// </summary>
+  inline std::vector<gil::GilThreadStats> gil_stats() {
+    return ScriptManager::instance().gil_stats();
+  }
+
+  /// <summary>
+  /// A wrapper function to start the switch interval controller without having to call for the instance each time.
+  /// </summary>
+  /// <param name="settings">Tick budget and interval bounds</param>
+  inline void start_gil_controller(const gil::SwitchIntervalSettings& settings = gil::SwitchIntervalSettings()) {
+    ScriptManager::instance().start_gil_controller(settings);
+  }
+
+  /// <summary>
+  /// A wrapper function to stop the switch interval controller without having to call for the instance each time.
+  /// </summary>
+  inline void stop_gil_controller() {
+    ScriptManager::instance().stop_gil_controller();
+  }
+
+  /// <summary>
+  /// A wrapper function to dispatch events without having to call for the instance each time.
+  /// </summary>
+  /// <typeparam name="...Args">Args list type</typeparam>
+  /// <param name="event_key_name">Name of the python function</param>
+  /// <param name="args">Variadic arguments to pass to the python function</param>
+  template <typename... Args>
+  void dispatch_event(const std::string& event_key_name, Args&&... args) {
+    ScriptManager::instance().dispatch_event(event_key_name, std::forward<Args>(args)...);
+  }
+
+  /// <summary>
+  /// A wrapper function to post events to the executor without having to call for the instance each time.
+  /// </summary>
+  /// <typeparam name="...Args">Args list type</typeparam>
+  /// <param name="event_key_name">Name of the python function</param>
+  /// <param name="args">Variadic arguments to pass to the python function</param>
+  template <typename... Args>
+  bool post_event(const std::string& event_key_name, Args&&... args) {
+    return ScriptManager::instance().post_event(event_key_name, std::forward<Args>(args)...);
+  }
+
+  /// <summary>
+  /// A wrapper function to hand finished native jobs back to the scripts without having to call for the instance each time.
+  /// </summary>
+  /// <param name="max_jobs">Most jobs to hand back in one call</param>
+  inline std::size_t pump_jobs(const std::size_t max_jobs = 256) {
+    return ScriptManager::instance().pump_jobs(max_jobs);
+  }
+
+  /// <summary>
+  /// A wrapper function to start the executor threads without having to call for the instance each time.
+  /// </summary>
+  /// <param name="settings">Thread count, CPU sets and scheduling</param>
+  inline bool start_executor(const executor::ExecutorSettings& settings) {
+    return ScriptManager::instance().start_executor(settings);
+  }
+
+  /// <summary>
+  /// A wrapper function to stop the executor threads without having to call for the instance each time.
+  /// </summary>
+  inline void stop_executor() {
+    ScriptManager::instance().stop_executor();
+  }
+
+  /// <summary>
+  /// A wrapper function to send events to single modules without having to call for the instance each time.
+  /// </summary>
+  /// <typeparam name="...Args">Args list type</typeparam>
+  /// <param name="module_name">Name of the python module</param>
+  /// <param name="event_key_name">Name of the python function</param>
+  /// <param name="args">Variadic arguments to pass to the python function</param>
+  template <typename... Args>
+  void send_event_to_single_module(const std::string& module_name, const std::string& event_key_name, Args&&... args) {
+    ScriptManager::instance().send_event_to_single_module(module_name, event_key_name, std::forward<Args>(args)...);
+  }
+
+  /// <summary>
+  /// A wrapper function to send events to single modules without having to call for the instance each time.
+  /// </summary>
+  /// <typeparam name="...Args">Args list type</typeparam>
+  /// <param name="module">The python module</param>
+  /// <param name="script_module">The script module we are calling in to</param>
+  /// <param name="event_key_name">Name of the python function</param>
+  /// <param name="args">Variadic arguments to pass to the python function</param>
+  template <typename... Args>
+  void send_event_to_single_module(std::shared_ptr<models::ScriptModule> script_module, const std::string& event_key_name, Args&&... args) {
+    ScriptManager::instance().send_event_to_single_module(script_module, event_key_name, std::forward<Args>(args)...);
+  }
+
+  /// <summary>
+  /// A wrapper function to dispatch a batch event without having to call for the instance each time.
+  /// </summary>
+  /// <param name="event_key_name">name of the event function we want python to handle</param>
+  /// <param name="entities">The entities the event is for</param>
+  /// <param name="...columns">One value per entity for each further handler argument</param>
+  template <typename Range, typename... Columns>
+  void dispatch_batch(const std::string& event_key_name, const Range& entities, const Columns&... columns) {
+    ScriptManager::instance().dispatch_batch(event_key_name, entities, columns...);
+  }
+
+  /// <summary>
+  /// A wrapper function to set the batch fallback without having to call for the instance each time.
+  /// </summary>
+  /// <param name="fallback">Call per entity handlers once per entity, or skip them</param>
+  inline void set_batch_fallback(const dispatch::BatchFallback fallback) {
+    ScriptManager::instance().set_batch_fallback(fallback);
+  }
+
+  /// <summary>
+  /// A wrapper function to set the nested dispatch policy without having to call for the instance each time.
+  /// </summary>
+  /// <param name="policy">Run nested events inline or queue them until the outermost dispatch finishes</param>
+  /// <param name="max_depth">Nesting depth at which inline events are queued instead</param>
+  inline void set_nested_dispatch_policy(const dispatch::NestedDispatchPolicy policy, const int max_depth = 8) {
+    ScriptManager::instance().set_nested_dispatch_policy(policy, max_depth);
+  }
+
+  /// <summary>
+  /// A wrapper function to start recording events without having to call for the instance each time.
+  /// </summary>
+  /// <param name="directory">Directory for the journal's segment files</param>
+  inline bool start_journal(const std::filesystem::path& directory) {
+    return ScriptManager::instance().start_journal(directory);
+  }
+
+  /// <summary>
+  /// A wrapper function to stop recording events without having to call for the instance each time.
+  /// </summary>
+  inline std::uint64_t stop_journal() {
+    return ScriptManager::instance().stop_journal();
+  }
+
+  /// <summary>
+  /// A wrapper function to replay a journal without having to call for the instance each time.
+  /// </summary>
+  /// <param name="directory">Directory holding the journal</param>
+  /// <param name="speed">Multiple of the recorded pace to replay at, zero replays as fast as possible</param>
+  inline journal::ReplayStats replay_journal(const std::filesystem::path& directory, const double speed = 1.0) {
+    return ScriptManager::instance().replay_journal(directory, speed);
+  }
+
+  /// <summary>
+  /// A wrapper function to join the event bridge without having to call for the instance each time.
+  /// </summary>
+  /// <param name="name">Name of the shared memory region, the same for every process</param>
+  inline bool start_bridge(const std::string& name = "psm_event_bridge") {
+    return ScriptManager::instance().start_bridge(name);
+  }
+
+  /// <summary>
+  /// A wrapper function to forward an event over the bridge without having to call for the instance each time.
+  /// </summary>
+  /// <param name="event_key_name">Name of the event to forward</param>
+  inline bool bridge_event(const std::string& event_key_name) {
+    return ScriptManager::instance().bridge_event(event_key_name);
+  }
+
+  /// <summary>
+  /// A wrapper function to dispatch events received over the bridge without having to call for the instance each time.
+  /// </summary>
+  /// <param name="max_events">Most events to dispatch in one call</param>
+  inline std::size_t pump_bridge(const std::size_t max_events = 256) {
+    return ScriptManager::instance().pump_bridge(max_events);
+  }
+
+  /// <summary>
+  /// A wrapper function to start a worker process without having to call for the instance each time.
+  /// </summary>
+  /// <param name="module_paths">Python files for the worker to load</param>
+  inline bool spawn_worker(const std::vector<std::string>& module_paths) {
+    return ScriptManager::instance().spawn_worker(module_paths);
+  }
+
+  /// <summary>
+  /// A wrapper function to start the fork server without having to call for the instance each time.
+  /// </summary>
+  /// <param name="module_paths">Python files every forked worker hosts</param>
+  inline bool start_fork_server(const std::vector<std::string>& module_paths) {
+    return ScriptManager::instance().start_fork_server(module_paths);
+  }
+
+  /// <summary>
+  /// A wrapper function to fork a pre-warmed worker without having to call for the instance each time.
+  /// </summary>
+  inline bool fork_worker() {
+    return ScriptManager::instance().fork_worker();
+  }
+
+  /// <summary>
+  /// A wrapper function to apply side effects sent back by worker processes without having to call for the instance each time.
+  /// </summary>
+  /// <param name="max_messages">Most messages to read from each worker</param>
+  inline std::size_t pump_workers(const std::size_t max_messages = 256) {
+    return ScriptManager::instance().pump_workers(max_messages);
+  }
+
+  /// <summary>
+  /// A wrapper function to route chat commands without having to call for the instance each time.
+  /// </summary>
+  /// <typeparam name="...Context">Context argument types</typeparam>
+  /// <param name="line">The chat line, including the command prefix</param>
+  /// <param name="context">Arguments passed to the handler ahead of the parsed command arguments</param>
+  template <typename... Context>
+  bool dispatch_command(const std::string_view line, Context&&... context) {
+    return ScriptManager::instance().dispatch_command(line, std::forward<Context>(context)...);
+  }
+
+  /// <summary>
+  /// A wrapper function to evaluate a script function without having to call for the instance each time.
+  /// </summary>
+  /// <typeparam name="R">The C++ type of the result</typeparam>
+  /// <param name="module_name">Name of the python module</param>
+  /// <param name="function_name">Name of the python function</param>
+  /// <param name="args">Arguments to pass to the function</param>
+  template <typename R, typename... Args>
+  std::optional<R> evaluate_formula(const std::string& module_name, const std::string& function_name, const Args&... args) {
+    return ScriptManager::instance().evaluate_formula<R>(module_name, function_name, args...);
+  }
+
+  /// <summary>
+  /// A wrapper function to check native formula conformance without having to call for the instance each time.
+  /// </summary>
+  /// <param name="module_name">Name of the python module housing FORMULA_CONFORMANCE_CASES</param>
+  inline bool check_formula_conformance(const std::string& module_name) {
+    return ScriptManager::instance().check_formula_conformance(module_name);
+  }
+
+  /// <summary>
+  /// A wrapper function to load scripts without having to call for the instance each time.
+  /// </summary>
+  /// <param name="path">Path name housing the python modules</param>
+  /// <param name="callback_on_load">Callback function that will be called when each script successfully loads</param>
+  inline void load_scripts(const std::filesystem::path& path = std::filesystem::path(), const std::function<void(const std::string&, const std::shared_ptr<models::ScriptModule>&)>& callback_on_load = nullptr) {
+    ScriptManager::instance().load_scripts(path, callback_on_load);
+  }
+
+  /// <summary>
+  /// A wrapper function to load a single script without having to call for the instance each time.
+  /// </summary>
+  /// <param name="module_path">Path name housing the python module</param>
+  /// <param name="callback_on_load">Callback function that will be called when the script successfully loads</param>
+  inline void load_script(const std::filesystem::path& module_path, const std::function<void(const std::string&, const std::shared_ptr<models::ScriptModule>&)>& callback_on_load = nullptr) {
+    ScriptManager::instance().load_script(module_path, callback_on_load);
+  }
+
+  /// <summary>
+  /// A wrapper function to publish a game data table without having to call for the instance each time.
+  /// </summary>
+  /// <param name="table">The table, shared with scripts for as long as they hold it</param>
+  inline void publish_table(std::shared_ptr<const data::DataTableBase> table) {
+    ScriptManager::instance().publish_table(std::move(table));
+  }
+
+  /// <summary>
+  /// A wrapper function to release the manager's python objects before the interpreter shuts down.
+  /// </summary>
+  inline void shutdown() {
+    ScriptManager::instance().shutdown();
   }
 
   /// <summary>
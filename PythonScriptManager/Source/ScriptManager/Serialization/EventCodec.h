@@ -0,0 +1,342 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Strings\StringTable.h"
+
+namespace scripting {
+  namespace serialization {
+    /// <summary>
+    /// Type tag written ahead of every encoded argument.
+    /// </summary>
+    enum class ValueTag : std::uint8_t {
+      NONE = 0,
+      FALSE_VALUE,
+      TRUE_VALUE,
+      INT,
+      UINT,
+      FLOAT,
+      STRING,
+      // A value with no portable encoding, such as a pointer to a game object. Decodes as None.
+      UNSUPPORTED
+    };
+
+    /// <summary>
+    /// A decoded argument. Strings point in to the encoded buffer so decoding never allocates per argument.
+    /// </summary>
+    using EventValue = std::variant<std::monostate, bool, long long, unsigned long long, double, std::string_view>;
+
+    /// <summary>
+    /// An event received from outside the interpreter with its arguments decoded.
+    /// </summary>
+    struct DecodedEvent {
+      std::string event_name;
+      // The module to send the event to, empty for every module.
+      std::string_view target_module;
+      std::vector<EventValue> arguments;
+    };
+
+    /// <summary>
+    /// Compact binary encoding of event arguments, shared by the event journal and the cross-process bridge.
+    /// Layout is a one byte argument count followed by each tagged value, in host byte order.
+    /// Arguments can be encoded from C++ values without the GIL or from a python tuple with it.
+    /// </summary>
+    class EventCodec {
+    public:
+      static constexpr std::size_t kMaxArguments = 255;
+
+      /// <summary>
+      /// Encode C++ arguments. Does not require the GIL.
+      /// </summary>
+      template <typename... Args>
+      static void encode(std::string& out, const Args&... args) {
+        StringWriter writer{ out };
+        encode_arguments(writer, args...);
+      }
+
+      /// <summary>
+      /// Encode a python argument tuple. Must be called with the GIL held.
+      /// </summary>
+      static void encode(std::string& out, const py::tuple& arguments) {
+        StringWriter writer{ out };
+        encode_arguments(writer, arguments);
+      }
+
+      /// <summary>
+      /// Bytes encode_to writes for the same arguments. Requires the GIL for a python tuple.
+      /// </summary>
+      template <typename... Args>
+      static std::size_t encoded_size(const Args&... args) {
+        SizeWriter writer;
+        encode_arguments(writer, args...);
+        return writer.size;
+      }
+
+      /// <summary>
+      /// Encode arguments straight in to memory reserved for them, encoded_size bytes long, such as a ring record.
+      /// Requires the GIL for a python tuple.
+      /// </summary>
+      /// <returns>The end of the encoded arguments.</returns>
+      template <typename... Args>
+      static char* encode_to(char* data, const Args&... args) {
+        BufferWriter writer{ data };
+        encode_arguments(writer, args...);
+        return writer.data;
+      }
+
+      /// <summary>
+      /// Decode arguments. Does not require the GIL.
+      /// </summary>
+      /// <param name="data">Start of the encoded arguments, advanced past them</param>
+      /// <param name="end">End of the readable buffer</param>
+      /// <param name="values">Set to the decoded values</param>
+      /// <returns>false if the buffer is truncated or malformed.</returns>
+      static bool decode(const char*& data, const char* end, std::vector<EventValue>& values) {
+        values.clear();
+        if (data >= end) {
+          return false;
+        }
+        const auto count = static_cast<std::uint8_t>(*data++);
+
+        for (std::size_t i = 0; i < count; ++i) {
+          if (data >= end) {
+            return false;
+          }
+
+          switch (static_cast<ValueTag>(*data++)) {
+          case ValueTag::NONE:
+          case ValueTag::UNSUPPORTED:
+            values.emplace_back(std::monostate());
+            break;
+          case ValueTag::FALSE_VALUE:
+            values.emplace_back(false);
+            break;
+          case ValueTag::TRUE_VALUE:
+            values.emplace_back(true);
+            break;
+          case ValueTag::INT: {
+            long long value;
+            if (!read(data, end, value)) {
+              return false;
+            }
+            values.emplace_back(value);
+            break;
+          }
+          case ValueTag::UINT: {
+            unsigned long long value;
+            if (!read(data, end, value)) {
+              return false;
+            }
+            values.emplace_back(value);
+            break;
+          }
+          case ValueTag::FLOAT: {
+            double value;
+            if (!read(data, end, value)) {
+              return false;
+            }
+            values.emplace_back(value);
+            break;
+          }
+          case ValueTag::STRING: {
+            std::uint32_t length;
+            if (!read(data, end, length) || static_cast<std::size_t>(end - data) < length) {
+              return false;
+            }
+            values.emplace_back(std::string_view(data, length));
+            data += length;
+            break;
+          }
+          default:
+            return false;
+          }
+        }
+        return true;
+      }
+
+      /// <summary>
+      /// Convert decoded values to a handler argument tuple. Must be called with the GIL held.
+      /// </summary>
+      static py::tuple to_python(const std::vector<EventValue>& values) {
+        py::tuple arguments(values.size());
+        for (std::size_t i = 0; i < values.size(); ++i) {
+          arguments[i] = std::visit([](const auto& value) -> py::object {
+            using T = std::decay_t<decltype(value)>;
+            if constexpr (std::is_same_v<T, std::monostate>) {
+              return py::none();
+            }
+            else if constexpr (std::is_same_v<T, std::string_view>) {
+              return strings::StringTable::instance().get(value);
+            }
+            else {
+              return py::cast(value);
+            }
+          }, values[i]);
+        }
+        return arguments;
+      }
+
+      template <typename T>
+      static void write(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+      }
+
+      template <typename T>
+      static bool read(const char*& data, const char* end, T& value) {
+        if (static_cast<std::size_t>(end - data) < sizeof(T)) {
+          return false;
+        }
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        return true;
+      }
+
+    private:
+      // Where encoded bytes go: appended to a string, copied in to reserved memory, or only counted.
+      struct StringWriter {
+        std::string& out;
+        void append(const void* bytes, const std::size_t size) { out.append(static_cast<const char*>(bytes), size); }
+      };
+
+      struct BufferWriter {
+        char* data;
+        void append(const void* bytes, const std::size_t size) {
+          std::memcpy(data, bytes, size);
+          data += size;
+        }
+      };
+
+      struct SizeWriter {
+        std::size_t size = 0;
+        void append(const void*, const std::size_t bytes) { size += bytes; }
+      };
+
+      template <typename Writer, typename... Args>
+      static void encode_arguments(Writer& out, const Args&... args) {
+        static_assert(sizeof...(Args) <= kMaxArguments, "too many event arguments");
+        write_value(out, static_cast<std::uint8_t>(sizeof...(Args)));
+        (encode_value(out, args), ...);
+      }
+
+      template <typename Writer>
+      static void encode_arguments(Writer& out, const py::tuple& arguments) {
+        const auto count = std::min(arguments.size(), kMaxArguments);
+        write_value(out, static_cast<std::uint8_t>(count));
+        for (std::size_t i = 0; i < count; ++i) {
+          encode_python(out, arguments[i]);
+        }
+      }
+
+      template <typename Writer, typename T>
+      static void write_value(Writer& out, const T& value) {
+        out.append(&value, sizeof(T));
+      }
+
+      template <typename Writer>
+      static void write_tag(Writer& out, const ValueTag tag) {
+        write_value(out, tag);
+      }
+
+      template <typename Writer>
+      static void write_string(Writer& out, const std::string_view text) {
+        write_tag(out, ValueTag::STRING);
+        write_value(out, static_cast<std::uint32_t>(text.size()));
+        out.append(text.data(), text.size());
+      }
+
+      template <typename Writer, typename T>
+      static void encode_value(Writer& out, const T& value) {
+        using U = std::decay_t<T>;
+        if constexpr (std::is_same_v<U, bool>) {
+          write_tag(out, value ? ValueTag::TRUE_VALUE : ValueTag::FALSE_VALUE);
+        }
+        else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+          write_tag(out, ValueTag::INT);
+          write_value(out, static_cast<long long>(value));
+        }
+        else if constexpr (std::is_integral_v<U>) {
+          write_tag(out, ValueTag::UINT);
+          write_value(out, static_cast<unsigned long long>(value));
+        }
+        else if constexpr (std::is_floating_point_v<U>) {
+          write_tag(out, ValueTag::FLOAT);
+          write_value(out, static_cast<double>(value));
+        }
+        else if constexpr (std::is_enum_v<U>) {
+          write_tag(out, ValueTag::INT);
+          write_value(out, static_cast<long long>(value));
+        }
+        else if constexpr (std::is_same_v<U, std::nullptr_t>) {
+          write_tag(out, ValueTag::NONE);
+        }
+        else if constexpr (std::is_same_v<U, const char*> || std::is_same_v<U, char*>) {
+          if (value) {
+            write_string(out, std::string_view(value));
+          }
+          else {
+            write_tag(out, ValueTag::NONE);
+          }
+        }
+        else if constexpr (std::is_convertible_v<const U&, std::string_view>) {
+          write_string(out, std::string_view(value));
+        }
+        else {
+          write_tag(out, ValueTag::UNSUPPORTED);
+        }
+      }
+
+      template <typename Writer>
+      static void encode_python(Writer& out, const py::handle& value) {
+        if (value.is_none()) {
+          write_tag(out, ValueTag::NONE);
+        }
+        else if (PyBool_Check(value.ptr())) {
+          write_tag(out, value.ptr() == Py_True ? ValueTag::TRUE_VALUE : ValueTag::FALSE_VALUE);
+        }
+        else if (PyLong_Check(value.ptr())) {
+          auto overflow = 0;
+          const auto signed_value = PyLong_AsLongLongAndOverflow(value.ptr(), &overflow);
+          if (overflow == 0) {
+            write_tag(out, ValueTag::INT);
+            write_value(out, signed_value);
+            return;
+          }
+
+          const auto unsigned_value = PyLong_AsUnsignedLongLong(value.ptr());
+          if (unsigned_value == static_cast<unsigned long long>(-1) && PyErr_Occurred()) {
+            PyErr_Clear();
+            write_tag(out, ValueTag::UNSUPPORTED);
+            return;
+          }
+          write_tag(out, ValueTag::UINT);
+          write_value(out, unsigned_value);
+        }
+        else if (PyFloat_Check(value.ptr())) {
+          write_tag(out, ValueTag::FLOAT);
+          write_value(out, PyFloat_AS_DOUBLE(value.ptr()));
+        }
+        else if (PyUnicode_Check(value.ptr())) {
+          Py_ssize_t length = 0;
+          const auto text = PyUnicode_AsUTF8AndSize(value.ptr(), &length);
+          if (!text) {
+            PyErr_Clear();
+            write_tag(out, ValueTag::UNSUPPORTED);
+            return;
+          }
+          write_string(out, std::string_view(text, static_cast<std::size_t>(length)));
+        }
+        else {
+          write_tag(out, ValueTag::UNSUPPORTED);
+        }
+      }
+    };
+  }
+}
@@ -0,0 +1,211 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+namespace scripting {
+  namespace strings {
+    /// <summary>
+    /// Whether every byte is below 0x80, checked eight bytes at a time.
+    /// </summary>
+    inline bool is_ascii(const std::string_view text) {
+      const auto data = text.data();
+      const auto size = text.size();
+      std::size_t i = 0;
+      for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        if (word & 0x8080808080808080ull) {
+          return false;
+        }
+      }
+      for (; i < size; ++i) {
+        if (static_cast<unsigned char>(data[i]) & 0x80) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    /// <summary>
+    /// Make a python string from UTF-8. ASCII text is copied straight in to a compact string without decoding.
+    /// Must be called with the GIL held.
+    /// </summary>
+    inline py::str new_string(const std::string_view text) {
+      PyObject* object;
+      if (is_ascii(text)) {
+        object = PyUnicode_New(static_cast<Py_ssize_t>(text.size()), 127);
+        if (object) {
+          std::memcpy(PyUnicode_1BYTE_DATA(object), text.data(), text.size());
+        }
+      }
+      else {
+        object = PyUnicode_DecodeUTF8(text.data(), static_cast<Py_ssize_t>(text.size()), nullptr);
+      }
+      if (!object) {
+        throw py::error_already_set();
+      }
+      return py::reinterpret_steal<py::str>(object);
+    }
+
+    /// <summary>
+    /// Reuses the python strings made for short, often repeated text such as command verbs, item names and event
+    /// arguments, instead of allocating a new one for every dispatch.
+    /// A fixed number of slots in sets of two, each slot holding one string. A string seen again earns its slot a hit,
+    /// and a string missing from the set spends one, only taking the slot over once the hits run out, so frequent
+    /// strings stay while one-off chat lines pass through. Only used with the GIL held.
+    /// </summary>
+    class StringTable {
+    public:
+      static constexpr std::size_t kSlots = 1024;
+      static constexpr std::size_t kWays = 2;
+      static constexpr std::size_t kMaxLength = 32;
+      static constexpr std::uint32_t kMaxHits = 8;
+
+      static StringTable& instance() {
+        static StringTable table;
+        return table;
+      }
+
+      /// <summary>
+      /// A python string for the text, shared with earlier calls when the text is short and repeated.
+      /// </summary>
+      py::str get(const std::string_view text) {
+        if (text.size() > kMaxLength) {
+          return new_string(text);
+        }
+
+        const auto hash = hash_text(text);
+        const auto set = &slots_[(hash & (kSlots / kWays - 1)) * kWays];
+        for (std::size_t way = 0; way < kWays; ++way) {
+          auto& slot = set[way];
+          if (slot.text && slot.hash == hash && slot.length == text.size() && std::memcmp(slot.bytes, text.data(), text.size()) == 0) {
+            slot.hits = std::min(slot.hits + 1, kMaxHits);
+            ++hits_;
+            return py::reinterpret_borrow<py::str>(slot.text);
+          }
+        }
+
+        ++misses_;
+        auto object = new_string(text);
+        // The slot in the set with the fewest hits pays for the miss.
+        auto& slot = set[0].hits <= set[1].hits ? set[0] : set[1];
+        if (slot.text && slot.hits > 0) {
+          --slot.hits;
+          return object;
+        }
+        if (slot.text) {
+          Py_DECREF(slot.text);
+          ++evictions_;
+        }
+        else {
+          ++size_;
+        }
+        slot.text = object.inc_ref().ptr();
+        slot.hash = hash;
+        slot.length = static_cast<std::uint32_t>(text.size());
+        slot.hits = 0;
+        std::memcpy(slot.bytes, text.data(), text.size());
+        return object;
+      }
+
+      /// <summary>
+      /// Release every string. Must be called with the GIL held, before the interpreter is finalized.
+      /// </summary>
+      void clear() {
+        for (auto& slot : slots_) {
+          Py_XDECREF(slot.text);
+          slot = Slot();
+        }
+        size_ = 0;
+      }
+
+      std::size_t size() const { return size_; }
+      std::uint64_t hits() const { return hits_; }
+      std::uint64_t misses() const { return misses_; }
+      std::uint64_t evictions() const { return evictions_; }
+
+    private:
+      struct Slot {
+        PyObject* text = nullptr;
+        std::uint64_t hash = 0;
+        std::uint32_t length = 0;
+        std::uint32_t hits = 0;
+        char bytes[kMaxLength];
+      };
+
+      // Strings still held when the process exits are left to the interpreter, which may already be gone.
+      StringTable() = default;
+
+      /// <summary>
+      /// Mixes the text eight bytes at a time.
+      /// </summary>
+      static std::uint64_t hash_text(const std::string_view text) {
+        auto hash = text.size() * 0x9E3779B97F4A7C15ull;
+        for (std::size_t i = 0; i < text.size(); i += 8) {
+          std::uint64_t word = 0;
+          std::memcpy(&word, text.data() + i, std::min<std::size_t>(8, text.size() - i));
+          hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+          hash ^= hash >> 32;
+        }
+        return hash ^ (hash >> 29);
+      }
+
+      std::array<Slot, kSlots> slots_{};
+      std::size_t size_ = 0;
+      std::uint64_t hits_ = 0;
+      std::uint64_t misses_ = 0;
+      std::uint64_t evictions_ = 0;
+    };
+
+    template <typename T>
+    constexpr bool is_text_v = std::is_same_v<std::decay_t<T>, std::string> || std::is_same_v<std::decay_t<T>, std::string_view>
+      || std::is_same_v<std::decay_t<T>, const char*> || std::is_same_v<std::decay_t<T>, char*>;
+
+    /// <summary>
+    /// Convert an event argument to a python object, text through the string table. A null C string becomes None,
+    /// as pybind11 casts it. Must be called with the GIL held.
+    /// </summary>
+    template <typename T>
+    py::object to_python(T&& value) {
+      if constexpr (is_text_v<T>) {
+        if constexpr (std::is_pointer_v<std::remove_reference_t<T>>) {
+          if (!value) {
+            return py::none();
+          }
+        }
+        return StringTable::instance().get(std::string_view(value));
+      }
+      else {
+        return py::cast(std::forward<T>(value));
+      }
+    }
+
+    /// <summary>
+    /// Convert an event argument: text goes through to_python, anything else is passed on for pybind11 to convert.
+    /// Must be called with the GIL held.
+    /// </summary>
+    template <typename T>
+    decltype(auto) python_argument(T&& value) {
+      if constexpr (is_text_v<T>) {
+        return to_python(std::forward<T>(value));
+      }
+      else {
+        return std::forward<T>(value);
+      }
+    }
+
+    /// <summary>
+    /// The type an argument is kept as when the event is dispatched later: views become the strings they point to.
+    /// </summary>
+    template <typename T>
+    using owned_t = std::conditional_t<is_text_v<T>, std::string, std::decay_t<T>>;
+  }
+}
@@ -0,0 +1,169 @@
+#pragma once
+#include <typeinfo>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Gil\ThreadState.h"
+
+namespace scripting {
+  namespace wrappers {
+    inline PyObject* raise_detached(PyObject*, PyObject*) {
+      PyErr_SetString(PyExc_RuntimeError, "the C++ object behind this wrapper no longer exists");
+      return nullptr;
+    }
+
+    inline int raise_detached_set(PyObject*, PyObject*, PyObject*) {
+      raise_detached(nullptr, nullptr);
+      return -1;
+    }
+
+    /// <summary>
+    /// A type sharing the layout of every pybind11 instance, without garbage collector support as the wrappers were not
+    /// allocated with it, whose attribute lookups raise. Deriving from pybind11's base keeps its deallocation.
+    /// </summary>
+    inline py::object make_detached_type() {
+      static PyType_Slot slots[] = {
+        { Py_tp_getattro, reinterpret_cast<void*>(&raise_detached) },
+        { Py_tp_setattro, reinterpret_cast<void*>(&raise_detached_set) },
+        { 0, nullptr }
+      };
+      static PyType_Spec spec = {
+        "example_module.DetachedWrapper", static_cast<int>(sizeof(py::detail::instance)), 0, Py_TPFLAGS_DEFAULT, slots
+      };
+      const auto bases = py::make_tuple(py::reinterpret_borrow<py::object>(py::detail::get_internals().instance_base));
+      const auto type = PyType_FromSpecWithBases(&spec, bases.ptr());
+      if (!type) {
+        throw py::error_already_set();
+      }
+      return py::reinterpret_steal<py::object>(type);
+    }
+
+    /// <summary>
+    /// Cut a wrapper off from the C++ object it points to, which is about to be destroyed. Must be called with the GIL held.
+    /// The object is removed from pybind11's instance registry and the wrapper becomes an instance of a type with no
+    /// C++ object behind it, whose attribute lookups raise and which no bound function accepts.
+    /// </summary>
+    inline void detach_python_wrapper(PyObject* wrapper, const std::type_info& type) {
+      const auto type_info = py::detail::get_type_info(type);
+      const auto instance = reinterpret_cast<py::detail::instance*>(wrapper);
+      auto value_and_holder = instance->get_value_and_holder(type_info, false);
+      if (value_and_holder && value_and_holder.instance_registered()) {
+        py::detail::deregister_instance(instance, value_and_holder.value_ptr(), value_and_holder.type);
+        value_and_holder.set_instance_registered(false);
+      }
+
+      // Kept on the bound type so it lives as long as the interpreter.
+      const auto bound_type = py::reinterpret_borrow<py::object>(reinterpret_cast<PyObject*>(type_info->type));
+      if (!py::hasattr(bound_type, "_detached_type")) {
+        bound_type.attr("_detached_type") = make_detached_type();
+      }
+
+      const auto detached = bound_type.attr("_detached_type");
+      const auto previous = Py_TYPE(wrapper);
+      Py_INCREF(detached.ptr());
+      Py_SET_TYPE(wrapper, reinterpret_cast<PyTypeObject*>(detached.ptr()));
+      Py_DECREF(previous);
+    }
+
+    /// <summary>
+    /// Base for long lived C++ objects handed to python on every event, such as users.
+    /// The object keeps a strong reference to its python wrapper, created the first time it is passed and reused after,
+    /// so passing it again only adds a reference instead of searching pybind11's instance registry.
+    /// When the object is destroyed the wrapper is detached from it: scripts still holding the wrapper get an error
+    /// on use instead of reaching freed memory, and a new object at the same address gets a wrapper of its own.
+    /// Only for types bound without py::dynamic_attr. Objects created by scripts are owned by their wrapper, so theirs
+    /// is never cached: the object would keep its own wrapper, and so itself, alive.
+    /// </summary>
+    /// <typeparam name="T">The deriving class, bound with py::class_</typeparam>
+    template <typename T>
+    class CachedWrapper {
+    public:
+      /// <summary>
+      /// The object's python wrapper, created on first use and cached unless a script owns the object.
+      /// Must be called with the GIL held.
+      /// </summary>
+      py::object python_wrapper() {
+        if (wrapper_) {
+          return py::reinterpret_borrow<py::object>(wrapper_);
+        }
+        auto wrapper = py::cast(static_cast<T*>(this), py::return_value_policy::reference);
+        if (!reinterpret_cast<py::detail::instance*>(wrapper.ptr())->owned) {
+          wrapper_ = wrapper.inc_ref().ptr();
+        }
+        return wrapper;
+      }
+
+      bool has_python_wrapper() const { return wrapper_ != nullptr; }
+
+      /// <summary>
+      /// Detach the wrapper from this object and drop the cached reference. Takes the GIL if needed.
+      /// Called on destruction, and can be called earlier, for example when a user logs out.
+      /// </summary>
+      void invalidate_python_wrapper() {
+        if (!wrapper_) {
+          return;
+        }
+        // The interpreter has already freed every wrapper.
+        if (!Py_IsInitialized()) {
+          wrapper_ = nullptr;
+          return;
+        }
+
+        gil::GilAcquire acquire;
+        detach_python_wrapper(wrapper_, typeid(T));
+        Py_DECREF(wrapper_);
+        wrapper_ = nullptr;
+      }
+
+    protected:
+      CachedWrapper() = default;
+
+      // A copy is a different object and gets a wrapper of its own.
+      CachedWrapper(const CachedWrapper&) {}
+      CachedWrapper& operator=(const CachedWrapper&) { return *this; }
+
+      ~CachedWrapper() {
+        invalidate_python_wrapper();
+      }
+
+    private:
+      PyObject* wrapper_ = nullptr;
+    };
+
+    /// <summary>
+    /// Passes an object to python through its cached wrapper: dispatch_event("on_message", cached(user), text).
+    /// A null object is passed as None.
+    /// </summary>
+    template <typename T>
+    struct Cached {
+      T* object;
+    };
+
+    template <typename T>
+    Cached<T> cached(T* object) {
+      return { object };
+    }
+  }
+}
+
+namespace pybind11 {
+  namespace detail {
+    /// <summary>
+    /// Converts Cached arguments to python by reusing the object's wrapper.
+    /// </summary>
+    template <typename T>
+    struct type_caster<scripting::wrappers::Cached<T>> {
+      PYBIND11_TYPE_CASTER(scripting::wrappers::Cached<T>, const_name("object"));
+
+      // Only ever passed from C++ to python.
+      bool load(handle, bool) { return false; }
+
+      static handle cast(const scripting::wrappers::Cached<T>& value, return_value_policy, handle) {
+        if (!value.object) {
+          return none().release();
+        }
+        return value.object->python_wrapper().release();
+      }
+    };
+  }
+}
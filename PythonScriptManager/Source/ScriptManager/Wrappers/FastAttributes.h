@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <type_traits>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "..\Handles\EntityHandle.h"
+
+namespace scripting {
+  namespace wrappers {
+    /// <summary>
+    /// The C++ object behind a pybind11 instance. Objects of classes with a single bound base sit at a fixed place in
+    /// the instance; others are looked up by type.
+    /// </summary>
+    template <typename T>
+    T* instance_value(PyObject* self) {
+      const auto instance = reinterpret_cast<py::detail::instance*>(self);
+      if (instance->simple_layout) {
+        return static_cast<T*>(instance->simple_value_holder[0]);
+      }
+      const auto value_and_holder = instance->get_value_and_holder(py::detail::get_type_info(typeid(T)), false);
+      return value_and_holder ? value_and_holder.template value_ptr<T>() : nullptr;
+    }
+
+    template <typename V>
+    PyObject* fast_to_python(const V& value) {
+      if constexpr (std::is_same_v<V, bool>) {
+        return PyBool_FromLong(value);
+      }
+      else if constexpr (std::is_integral_v<V> && std::is_signed_v<V>) {
+        return PyLong_FromLongLong(value);
+      }
+      else if constexpr (std::is_integral_v<V>) {
+        return PyLong_FromUnsignedLongLong(value);
+      }
+      else if constexpr (std::is_floating_point_v<V>) {
+        return PyFloat_FromDouble(value);
+      }
+      else if constexpr (std::is_same_v<V, std::string>) {
+        return PyUnicode_FromStringAndSize(value.data(), static_cast<Py_ssize_t>(value.size()));
+      }
+      else if constexpr (std::is_same_v<V, handles::EntityHandle>) {
+        return handles::new_handle_object(value);
+      }
+      else {
+        return py::cast(value).release().ptr();
+      }
+    }
+
+    /// <summary>
+    /// Reads a field or calls a const getter on the object behind self. A getset slot, so python calls it directly
+    /// instead of going through pybind11's function dispatcher and argument loader.
+    /// </summary>
+    template <auto Member, typename T>
+    PyObject* fast_getter(PyObject* self, void*) {
+      const auto object = instance_value<T>(self);
+      if (!object) {
+        PyErr_SetString(PyExc_TypeError, "the object has not been initialized");
+        return nullptr;
+      }
+      try {
+        if constexpr (std::is_member_function_pointer_v<decltype(Member)>) {
+          return fast_to_python((object->*Member)());
+        }
+        else {
+          return fast_to_python(object->*Member);
+        }
+      }
+      catch (py::error_already_set& error) {
+        error.restore();
+      }
+      catch (const std::exception& exception) {
+        PyErr_SetString(PyExc_RuntimeError, exception.what());
+      }
+      return nullptr;
+    }
+
+    /// <summary>
+    /// Expose a field, or a const getter taking no arguments, as a read only attribute backed by a getset slot.
+    /// Reads skip pybind11's dispatcher entirely, which matters for attributes scripts read on every event.
+    /// Numbers, booleans, strings and entity handles are converted directly; other types through pybind11.
+    /// cls.def_property_readonly("id", &User::get_id) becomes def_fast_readonly&lt;&amp;User::get_id&gt;(cls, "id").
+    /// </summary>
+    /// <typeparam name="Member">Pointer to the field or getter</typeparam>
+    template <auto Member, typename T, typename... Options>
+    void def_fast_readonly(py::class_<T, Options...>& cls, const char* name, const char* doc = nullptr) {
+      // Python keeps a pointer to the definition for as long as the type exists. One per member, set up once.
+      static std::string stored_name = name;
+      static PyGetSetDef definition = { stored_name.c_str(), &fast_getter<Member, T>, nullptr, doc, nullptr };
+
+      const auto descriptor = py::reinterpret_steal<py::object>(PyDescr_NewGetSet(reinterpret_cast<PyTypeObject*>(cls.ptr()), &definition));
+      if (!descriptor) {
+        throw py::error_already_set();
+      }
+      cls.attr(name) = descriptor;
+    }
+  }
+}
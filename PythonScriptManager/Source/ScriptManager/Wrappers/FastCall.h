@@ -0,0 +1,221 @@
+#pragma once
+#include <limits>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "FastAttributes.h"
+
+namespace scripting {
+  namespace wrappers {
+    /// <summary>
+    /// Converts one python argument for a fastcall function. Types without a fast path use pybind11's caster.
+    /// </summary>
+    template <typename T, typename = void>
+    struct FastArgument {
+      py::detail::make_caster<T> caster;
+
+      bool load(PyObject* object) { return caster.load(object, true); }
+      T get() { return py::detail::cast_op<T>(caster); }
+    };
+
+    template <typename T>
+    struct FastArgument<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+      T value;
+
+      bool load(PyObject* object) {
+        if (!PyLong_Check(object)) {
+          return false;
+        }
+        if constexpr (std::is_signed_v<T>) {
+          const auto number = PyLong_AsLongLong(object);
+          if (number == -1 && PyErr_Occurred()) {
+            return false;
+          }
+          if (number < std::numeric_limits<T>::min() || number > std::numeric_limits<T>::max()) {
+            PyErr_SetString(PyExc_OverflowError, "integer out of range");
+            return false;
+          }
+          value = static_cast<T>(number);
+        }
+        else {
+          const auto number = PyLong_AsUnsignedLongLong(object);
+          if (number == static_cast<unsigned long long>(-1) && PyErr_Occurred()) {
+            return false;
+          }
+          if (number > std::numeric_limits<T>::max()) {
+            PyErr_SetString(PyExc_OverflowError, "integer out of range");
+            return false;
+          }
+          value = static_cast<T>(number);
+        }
+        return true;
+      }
+      T get() { return value; }
+    };
+
+    template <typename T>
+    struct FastArgument<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+      T value;
+
+      bool load(PyObject* object) {
+        if (PyFloat_CheckExact(object)) {
+          value = static_cast<T>(PyFloat_AS_DOUBLE(object));
+          return true;
+        }
+        if (!PyLong_Check(object) && !PyFloat_Check(object)) {
+          return false;
+        }
+        const auto number = PyFloat_AsDouble(object);
+        if (number == -1.0 && PyErr_Occurred()) {
+          return false;
+        }
+        value = static_cast<T>(number);
+        return true;
+      }
+      T get() { return value; }
+    };
+
+    template <>
+    struct FastArgument<bool> {
+      bool value;
+
+      bool load(PyObject* object) {
+        if (!PyBool_Check(object)) {
+          return false;
+        }
+        value = object == Py_True;
+        return true;
+      }
+      bool get() { return value; }
+    };
+
+    /// <summary>
+    /// Points in to the string's cached UTF-8, which lives as long as the argument.
+    /// </summary>
+    template <>
+    struct FastArgument<std::string_view> {
+      std::string_view value;
+
+      bool load(PyObject* object) {
+        if (!PyUnicode_Check(object)) {
+          return false;
+        }
+        Py_ssize_t size;
+        const auto data = PyUnicode_AsUTF8AndSize(object, &size);
+        if (!data) {
+          return false;
+        }
+        value = std::string_view(data, static_cast<std::size_t>(size));
+        return true;
+      }
+      std::string_view get() { return value; }
+    };
+
+    template <>
+    struct FastArgument<std::string> {
+      FastArgument<std::string_view> view;
+
+      bool load(PyObject* object) { return view.load(object); }
+      std::string get() { return std::string(view.value); }
+    };
+
+    template <typename Signature>
+    struct FastSignature;
+
+    template <typename Return, typename... Args>
+    struct FastSignature<Return(*)(Args...)> {
+      using result = Return;
+      using arguments = std::tuple<FastArgument<std::decay_t<Args>>...>;
+      static constexpr std::size_t count = sizeof...(Args);
+    };
+
+    /// <summary>
+    /// The name a fastcall function was registered under, for error messages.
+    /// </summary>
+    template <auto Function>
+    std::string& fastcall_name() {
+      static std::string name;
+      return name;
+    }
+
+    template <auto Function, std::size_t... Indexes>
+    PyObject* fastcall_invoke(PyObject* const* args, std::index_sequence<Indexes...>) {
+      using signature = FastSignature<decltype(Function)>;
+      typename signature::arguments arguments;
+      // Stops at the first argument that fails to convert.
+      const auto loaded = (std::get<Indexes>(arguments).load(args[Indexes]) && ...);
+      if (!loaded) {
+        return nullptr;
+      }
+
+      if constexpr (std::is_void_v<typename signature::result>) {
+        Function(std::get<Indexes>(arguments).get()...);
+        Py_RETURN_NONE;
+      }
+      else {
+        return fast_to_python(Function(std::get<Indexes>(arguments).get()...));
+      }
+    }
+
+    /// <summary>
+    /// The METH_FASTCALL entry point generated for a function: checks the argument count, converts each argument with
+    /// its FastArgument and turns C++ exceptions in to python ones.
+    /// </summary>
+    template <auto Function>
+    PyObject* fastcall_entry(PyObject*, PyObject* const* args, const Py_ssize_t nargs) {
+      using signature = FastSignature<decltype(Function)>;
+      if (nargs != static_cast<Py_ssize_t>(signature::count)) {
+        PyErr_Format(PyExc_TypeError, "%s() takes %zu positional arguments but %zd were given", fastcall_name<Function>().c_str(),
+          signature::count, nargs);
+        return nullptr;
+      }
+
+      try {
+        const auto result = fastcall_invoke<Function>(args, std::make_index_sequence<signature::count>());
+        if (!result && !PyErr_Occurred()) {
+          PyErr_Format(PyExc_TypeError, "%s() was given an argument of the wrong type", fastcall_name<Function>().c_str());
+        }
+        return result;
+      }
+      catch (py::error_already_set& error) {
+        error.restore();
+      }
+      catch (const py::builtin_exception& exception) {
+        exception.set_error();
+      }
+      catch (const std::exception& exception) {
+        PyErr_SetString(PyExc_RuntimeError, exception.what());
+      }
+      return nullptr;
+    }
+
+    /// <summary>
+    /// Register a free function as a raw METH_FASTCALL builtin instead of through module.def, for callbacks scripts
+    /// make on every event. The argument conversion is generated for the function's signature, so a call skips
+    /// pybind11's overload resolution and costs about as much as a builtin. Arguments are positional only and the
+    /// function cannot be overloaded.
+    /// </summary>
+    /// <typeparam name="Function">Pointer to the function</typeparam>
+    template <auto Function>
+    void def_fastcall(py::module& module, const char* name, const char* doc = nullptr) {
+      // Python keeps a pointer to the definition for as long as the function exists. One per function, set up once.
+      if (fastcall_name<Function>().empty()) {
+        fastcall_name<Function>() = name;
+      }
+      static PyMethodDef definition = {
+        fastcall_name<Function>().c_str(), reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(&fastcall_entry<Function>)), METH_FASTCALL, doc
+      };
+
+      const auto function = py::reinterpret_steal<py::object>(PyCFunction_NewEx(&definition, nullptr, module.attr("__name__").ptr()));
+      if (!function) {
+        throw py::error_already_set();
+      }
+      module.attr(name) = function;
+    }
+  }
+}
@@ -0,0 +1,404 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+#include <pybind11\embed.h>
+namespace py = pybind11;
+
+#include "FastAttributes.h"
+#include "..\Dispatch\DispatchScope.h"
+#include "..\Strings\StringTable.h"
+
+namespace scripting {
+  namespace wrappers {
+    struct LazyTable;
+
+    /// <summary>
+    /// One field scripts can read from a lazy proxy: its name and how to convert it from the object.
+    /// </summary>
+    struct LazyField {
+      const char* name;
+      PyObject* (*convert)(const void* object);
+      // For a field holding a struct with a field table of its own, or a pointer to one: the struct, or null, and
+      // its table, for owners that wrap nested structs themselves rather than as proxies. Null for other fields.
+      const void* (*nested)(const void* object);
+      LazyTable& (*nested_table)();
+    };
+
+    /// <summary>
+    /// The fields of T that lazy proxies expose. Specialize it with a name for repr and a table of fields:
+    /// template &lt;&gt; struct LazyFields&lt;Item&gt; {
+    ///   static constexpr const char* name = "Item";
+    ///   static constexpr LazyField fields[] = { lazy_field&lt;&amp;Item::id&gt;("id"), lazy_field&lt;&amp;Item::stats&gt;("stats") };
+    /// };
+    /// </summary>
+    template <typename T>
+    struct LazyFields {};
+
+    template <typename T, typename = void>
+    struct has_lazy_fields : std::false_type {};
+
+    template <typename T>
+    struct has_lazy_fields<T, std::void_t<decltype(LazyFields<T>::fields)>> : std::true_type {};
+
+    template <typename Member>
+    struct member_traits;
+
+    template <typename Owner, typename Value>
+    struct member_traits<Value Owner::*> {
+      using owner = Owner;
+    };
+
+    template <typename Owner, typename Value>
+    struct member_traits<Value(Owner::*)() const> {
+      using owner = Owner;
+    };
+
+    /// <summary>
+    /// A field table with its names as interned python strings, shared by every proxy of one type.
+    /// </summary>
+    struct LazyTable {
+      const char* name;
+      const LazyField* fields;
+      std::size_t count;
+      std::vector<PyObject*> names;
+    };
+
+    /// <summary>
+    /// The python object behind a lazy proxy. Converted fields are kept in the cache, one slot per field.
+    /// </summary>
+    struct LazyProxyObject {
+      PyObject_VAR_HEAD
+      const void* object;
+      const LazyTable* table;
+      PyObject* cache[1];
+    };
+
+    inline PyTypeObject*& lazy_proxy_type() {
+      static PyTypeObject* type = nullptr;
+      return type;
+    }
+
+    /// <summary>
+    /// The proxies handed out on the current thread, released once its outermost dispatch finishes.
+    /// Only touched with the GIL held.
+    /// </summary>
+    inline std::vector<PyObject*>& lent_proxies() {
+      thread_local std::vector<PyObject*> proxies;
+      return proxies;
+    }
+
+    /// <summary>
+    /// Number of ProxyLease objects open on the current thread.
+    /// </summary>
+    inline int& proxy_lease_depth() {
+      thread_local int depth = 0;
+      return depth;
+    }
+
+    /// <summary>
+    /// Whether a proxy made now on the current thread will be released: inside a dispatch, or a lease taken by
+    /// whatever is about to dispatch.
+    /// </summary>
+    inline bool lending_proxies() {
+      return proxy_lease_depth() > 0 || dispatch::DispatchScope::active();
+    }
+
+    template <typename T>
+    LazyTable& lazy_table() {
+      static LazyTable table = { LazyFields<T>::name, LazyFields<T>::fields, std::size(LazyFields<T>::fields), {} };
+      // Interned on first use, with the GIL held. Python interns attribute names in scripts as well, so most lookups
+      // find their field by pointer.
+      if (table.names.empty()) {
+        for (std::size_t i = 0; i < table.count; ++i) {
+          table.names.push_back(PyUnicode_InternFromString(table.fields[i].name));
+        }
+      }
+      return table;
+    }
+
+    /// <summary>
+    /// Make a proxy of an object, valid until the current thread's outermost dispatch, or lease, finishes.
+    /// Raises a RuntimeError when neither is open, as nothing would ever release the proxy.
+    /// Must be called with the GIL held.
+    /// </summary>
+    template <typename T>
+    PyObject* new_lazy_proxy(const T* object) {
+      if (!object) {
+        Py_RETURN_NONE;
+      }
+      auto& table = lazy_table<T>();
+      if (!lending_proxies()) {
+        PyErr_Format(PyExc_RuntimeError, "a %s proxy can only be made during a dispatch or a wrappers::ProxyLease", table.name);
+        return nullptr;
+      }
+      const auto proxy = PyObject_NewVar(LazyProxyObject, lazy_proxy_type(), static_cast<Py_ssize_t>(table.count));
+      if (!proxy) {
+        return nullptr;
+      }
+      proxy->object = object;
+      proxy->table = &table;
+      for (std::size_t i = 0; i < table.count; ++i) {
+        proxy->cache[i] = nullptr;
+      }
+      assert(lending_proxies());
+      Py_INCREF(proxy);
+      lent_proxies().push_back(reinterpret_cast<PyObject*>(proxy));
+      return reinterpret_cast<PyObject*>(proxy);
+    }
+
+    /// <summary>
+    /// Convert a field's value: structs and pointers to structs with a field table become nested proxies, and text,
+    /// including fixed size character arrays, goes through the string table.
+    /// </summary>
+    template <typename V>
+    PyObject* lazy_value(const V& value) {
+      if constexpr (std::is_pointer_v<V> && has_lazy_fields<std::remove_cv_t<std::remove_pointer_t<V>>>::value) {
+        return new_lazy_proxy<std::remove_cv_t<std::remove_pointer_t<V>>>(value);
+      }
+      else if constexpr (has_lazy_fields<V>::value) {
+        return new_lazy_proxy<V>(&value);
+      }
+      else if constexpr (std::is_array_v<V> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<V>>, char>) {
+        const auto length = std::find(value, value + std::extent_v<V>, '\0') - value;
+        return strings::StringTable::instance().get(std::string_view(value, static_cast<std::size_t>(length))).release().ptr();
+      }
+      else if constexpr (std::is_same_v<V, std::string> || std::is_same_v<V, std::string_view>) {
+        return strings::StringTable::instance().get(value).release().ptr();
+      }
+      else {
+        return fast_to_python(value);
+      }
+    }
+
+    template <auto Member>
+    PyObject* convert_lazy_field(const void* object) {
+      using owner = typename member_traits<decltype(Member)>::owner;
+      const auto typed = static_cast<const owner*>(object);
+      try {
+        if constexpr (std::is_member_function_pointer_v<decltype(Member)>) {
+          return lazy_value((typed->*Member)());
+        }
+        else {
+          return lazy_value(typed->*Member);
+        }
+      }
+      catch (py::error_already_set& error) {
+        error.restore();
+      }
+      catch (const std::exception& exception) {
+        PyErr_SetString(PyExc_RuntimeError, exception.what());
+      }
+      return nullptr;
+    }
+
+    template <auto Member>
+    using lazy_member_t = decltype(std::invoke(Member, std::declval<const typename member_traits<decltype(Member)>::owner&>()));
+
+    template <auto Member>
+    const void* nested_lazy_object(const void* object) {
+      using owner = typename member_traits<decltype(Member)>::owner;
+      const auto& value = std::invoke(Member, *static_cast<const owner*>(object));
+      if constexpr (std::is_pointer_v<std::remove_cv_t<std::remove_reference_t<lazy_member_t<Member>>>>) {
+        return value;
+      }
+      else {
+        return &value;
+      }
+    }
+
+    /// <summary>
+    /// An entry in a field table for a field, or a const getter taking no arguments.
+    /// </summary>
+    /// <typeparam name="Member">Pointer to the field or getter</typeparam>
+    template <auto Member>
+    constexpr LazyField lazy_field(const char* name) {
+      using value = std::remove_cv_t<std::remove_reference_t<lazy_member_t<Member>>>;
+      using pointee = std::remove_cv_t<std::remove_pointer_t<value>>;
+      if constexpr (std::is_pointer_v<value> && has_lazy_fields<pointee>::value) {
+        return { name, &convert_lazy_field<Member>, &nested_lazy_object<Member>, &lazy_table<pointee> };
+      }
+      // Structs returned by value have nothing to point at once the getter returns.
+      else if constexpr (std::is_reference_v<lazy_member_t<Member>> && has_lazy_fields<value>::value) {
+        return { name, &convert_lazy_field<Member>, &nested_lazy_object<Member>, &lazy_table<value> };
+      }
+      else {
+        return { name, &convert_lazy_field<Member>, nullptr, nullptr };
+      }
+    }
+
+    namespace lazy_slots {
+      inline void clear_cache(LazyProxyObject* proxy) {
+        for (Py_ssize_t i = 0; i < Py_SIZE(proxy); ++i) {
+          Py_CLEAR(proxy->cache[i]);
+        }
+      }
+
+      inline PyObject* get_attribute(PyObject* self, PyObject* name) {
+        const auto proxy = reinterpret_cast<LazyProxyObject*>(self);
+        const auto& table = *proxy->table;
+        auto index = table.count;
+        for (std::size_t i = 0; i < table.count; ++i) {
+          if (table.names[i] == name) {
+            index = i;
+            break;
+          }
+        }
+        if (index == table.count && PyUnicode_Check(name)) {
+          for (std::size_t i = 0; i < table.count; ++i) {
+            if (PyUnicode_Compare(table.names[i], name) == 0) {
+              index = i;
+              break;
+            }
+          }
+        }
+        if (index == table.count) {
+          return PyObject_GenericGetAttr(self, name);
+        }
+
+        if (!proxy->object) {
+          PyErr_Format(PyExc_ReferenceError, "this %s was only valid during the event it was passed to", table.name);
+          return nullptr;
+        }
+        if (!proxy->cache[index]) {
+          proxy->cache[index] = table.fields[index].convert(proxy->object);
+          if (!proxy->cache[index]) {
+            return nullptr;
+          }
+        }
+        Py_INCREF(proxy->cache[index]);
+        return proxy->cache[index];
+      }
+
+      inline PyObject* repr(PyObject* self) {
+        const auto proxy = reinterpret_cast<LazyProxyObject*>(self);
+        return PyUnicode_FromFormat(proxy->object ? "<%s proxy>" : "<%s proxy, released>", proxy->table->name);
+      }
+
+      inline PyObject* dir(PyObject* self, PyObject*) {
+        const auto& table = *reinterpret_cast<LazyProxyObject*>(self)->table;
+        const auto names = PyList_New(static_cast<Py_ssize_t>(table.count));
+        if (!names) {
+          return nullptr;
+        }
+        for (std::size_t i = 0; i < table.count; ++i) {
+          Py_INCREF(table.names[i]);
+          PyList_SET_ITEM(names, static_cast<Py_ssize_t>(i), table.names[i]);
+        }
+        return names;
+      }
+
+      inline void dealloc(PyObject* self) {
+        const auto type = Py_TYPE(self);
+        clear_cache(reinterpret_cast<LazyProxyObject*>(self));
+        PyObject_Free(self);
+        Py_DECREF(type);
+      }
+    }
+
+    /// <summary>
+    /// Release every proxy handed out on the current thread: each forgets its object and drops its converted fields,
+    /// so a script that kept one gets a ReferenceError instead of reading freed memory. Called by the script manager
+    /// once the outermost dispatch finishes. Must be called with the GIL held.
+    /// </summary>
+    inline void release_lazy_proxies() {
+      auto& proxies = lent_proxies();
+      for (const auto object : proxies) {
+        const auto proxy = reinterpret_cast<LazyProxyObject*>(object);
+        proxy->object = nullptr;
+        lazy_slots::clear_cache(proxy);
+        Py_DECREF(object);
+      }
+      proxies.clear();
+    }
+
+    /// <summary>
+    /// Lets the current thread make lazy proxies until the outermost lease closes, which releases them unless a
+    /// dispatch is still running to do so. The script manager takes one while it packs an event's arguments, ahead
+    /// of the dispatch; take one to call a handler with proxies directly. Must be made and destroyed with the GIL held.
+    /// </summary>
+    class ProxyLease {
+    public:
+      ProxyLease() { ++proxy_lease_depth(); }
+      ~ProxyLease() {
+        if (--proxy_lease_depth() == 0 && !dispatch::DispatchScope::active()) {
+          release_lazy_proxies();
+        }
+      }
+
+      ProxyLease(const ProxyLease&) = delete;
+      ProxyLease& operator=(const ProxyLease&) = delete;
+    };
+
+    /// <summary>
+    /// Create the proxy type. Scripts read fields from proxies as attributes and cannot create them.
+    /// </summary>
+    inline py::object make_lazy_proxy_type() {
+      static PyMethodDef methods[] = {
+        { "__dir__", &lazy_slots::dir, METH_NOARGS, nullptr },
+        { nullptr, nullptr, 0, nullptr }
+      };
+      static PyType_Slot slots[] = {
+        { Py_tp_dealloc, reinterpret_cast<void*>(&lazy_slots::dealloc) },
+        { Py_tp_getattro, reinterpret_cast<void*>(&lazy_slots::get_attribute) },
+        { Py_tp_repr, reinterpret_cast<void*>(&lazy_slots::repr) },
+        { Py_tp_methods, methods },
+        { 0, nullptr }
+      };
+      static PyType_Spec spec = {
+        "example_module.LazyProxy", static_cast<int>(offsetof(LazyProxyObject, cache)), static_cast<int>(sizeof(PyObject*)),
+        Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION, slots
+      };
+
+      const auto type = PyType_FromSpec(&spec);
+      if (!type) {
+        throw py::error_already_set();
+      }
+      lazy_proxy_type() = reinterpret_cast<PyTypeObject*>(type);
+      return py::reinterpret_steal<py::object>(type);
+    }
+
+    /// <summary>
+    /// Passes an object to python as a lazy proxy: dispatch_event("on_item_used", cached(user), lazy(item)).
+    /// Each field is converted the first time a handler reads it and kept for the rest of the dispatch, so events
+    /// for objects with many fields only pay for the ones scripts use. A null object is passed as None.
+    /// Converting one outside a dispatch or ProxyLease throws.
+    /// </summary>
+    template <typename T>
+    struct Lazy {
+      const T* object;
+    };
+
+    template <typename T>
+    Lazy<T> lazy(const T* object) {
+      return { object };
+    }
+  }
+}
+
+namespace pybind11 {
+  namespace detail {
+    /// <summary>
+    /// Converts Lazy arguments to a proxy of the object.
+    /// </summary>
+    template <typename T>
+    struct type_caster<scripting::wrappers::Lazy<T>> {
+      PYBIND11_TYPE_CASTER(scripting::wrappers::Lazy<T>, const_name("LazyProxy"));
+
+      // Only ever passed from C++ to python.
+      bool load(handle, bool) { return false; }
+
+      static handle cast(const scripting::wrappers::Lazy<T>& value, return_value_policy, handle) {
+        const auto proxy = scripting::wrappers::new_lazy_proxy(value.object);
+        if (!proxy) {
+          throw error_already_set();
+        }
+        return proxy;
+      }
+    };
+  }
+}
@@ -4,7 +4,12 @@
 #include <pybind11\functional.h>
 namespace py = pybind11;
 
-class User {
+#include "ScriptManager\Handles\HandleTable.h"
+#include "ScriptManager\Wrappers\CachedWrapper.h"
+#include "ScriptManager\Wrappers\FastAttributes.h"
+
+// Users are passed to python on most events, so each keeps its python wrapper for its whole life.
+class User : public scripting::wrappers::CachedWrapper<User> {
 public:
   User() {
     std::random_device rd;  // Seed
@@ -16,17 +21,38 @@ public:
     // Generate a random id
     id_ = dis(gen);
 
+    handle_ = handles().add(this);
+  }
+  User(const User& other) : CachedWrapper(other), id_(other.id_), handle_(handles().add(this)) {}
+  User& operator=(const User& other) {
+    id_ = other.id_;
+    return *this;
+  }
+  ~User() {
+    handles().remove(handle_);
   }
-  ~User() = default;
 
   unsigned long get_id() const { return id_; }
 
+  /// <summary>
+  /// A handle scripts can keep instead of the user, which resolves to nothing once the user is gone.
+  /// </summary>
+  scripting::handles::EntityHandle handle() const { return handle_; }
+
+  static scripting::handles::HandleTable<User>& handles() {
+    static scripting::handles::HandleTable<User> table;
+    return table;
+  }
+
   static void apply_class_definitions(const py::module& module) {
-    py::class_<User>(module, "User")
-      .def(py::init<>())
-      .def_property_readonly("id", &User::get_id);
+    py::class_<User> user(module, "User");
+    user.def(py::init<>());
+    // Read by scripts on most events.
+    scripting::wrappers::def_fast_readonly<&User::id_>(user, "id");
+    scripting::wrappers::def_fast_readonly<&User::handle_>(user, "handle");
   }
 
 private:
   unsigned long id_;
+  scripting::handles::EntityHandle handle_;
 };
\ No newline at end of file
@@ -0,0 +1,21 @@
+import example_module
+
+# The same tick handled one user at a time and as a whole batch.
+
+ticks = 0
+regenerated = 0.0
+
+def on_user_tick(user, elapsed):
+    global ticks, regenerated
+    ticks += 1
+    if user.id % 2 == 0:
+        regenerated += elapsed * 5.0
+
+@example_module.batch_handler
+def on_user_batch_tick(users, elapsed):
+    global ticks, regenerated
+    ticks += len(users)
+    regenerated += sum(seconds * 5.0 for user, seconds in zip(users, elapsed) if user.id % 2 == 0)
+
+def on_check_ticks():
+    example_module.send_message(f"{ticks} user ticks handled, {regenerated:.1f} hp regenerated")
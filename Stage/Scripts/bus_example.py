@@ -0,0 +1,24 @@
+import example_module
+
+bus = example_module.bus
+
+
+def on_level_up(payload):
+    user, level = payload
+    example_module.send_message(f"{user.id} reached level {level}")
+    # Deferred messages are delivered once the current event has finished dispatching.
+    bus.publish("quest.check", user, defer=True)
+
+
+def on_quest_check(user):
+    example_module.send_message(f"checking quests for {user.id}")
+
+
+def level_up(user, level):
+    delivered = bus.publish("player.level_up", (user, level))
+    example_module.send_message(f"level up delivered to {delivered} subscribers")
+
+
+bus.subscribe("player.level_up", on_level_up)
+bus.subscribe("quest.check", on_quest_check)
+example_module.register_command("levelup", level_up, ["int"])
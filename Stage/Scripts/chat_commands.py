@@ -0,0 +1,14 @@
+import example_module
+
+
+def reload(user, script_name):
+    example_module.reload_script(script_name)
+
+
+def echo(user, count, text):
+    for _ in range(count):
+        example_module.send_message(f"{user.id}: {text}")
+
+
+example_module.register_command("reload_script", reload, ["str"])
+example_module.register_command("echo", echo, ["int", "rest"])
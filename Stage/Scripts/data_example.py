@@ -0,0 +1,60 @@
+import sys
+import example_module
+
+# Tables are published by the server once its data is loaded, which may be after this module is, so they are looked
+# up when needed. The lookup returns the same table every time, reloads included.
+def items():
+    return example_module.table("items")
+
+def table_identity():
+    return id(items())
+
+def highest_level(table, ids):
+    highest = 0
+    for item_id in ids:
+        level = table[item_id].level
+        if level > highest:
+            highest = level
+    return highest
+
+def highest_level_dict(table, ids):
+    highest = 0
+    for item_id in ids:
+        level = table[item_id]["level"]
+        if level > highest:
+            highest = level
+    return highest
+
+def highest_price(table, ids):
+    highest = 0
+    for item_id in ids:
+        price = table[item_id].price
+        if price > highest:
+            highest = price
+    return highest
+
+def highest_price_dict(table, ids):
+    highest = 0
+    for item_id in ids:
+        price = table[item_id]["price"]
+        if price > highest:
+            highest = price
+    return highest
+
+def copy_table(table):
+    """The dict of dicts each module would hold if it loaded the definitions itself."""
+    return {item_id: {name: getattr(row, name) for name in dir(row)} for item_id, row in table.items()}
+
+def copy_size(copy):
+    size = sys.getsizeof(copy)
+    for row in copy.values():
+        size += sys.getsizeof(row) + sum(sys.getsizeof(value) for value in row.values())
+    return size
+
+def on_item_looted(user_id, item_id):
+    item = items().get(item_id)
+    if item is None:
+        example_module.send_message(f"user {user_id} looted unknown item {item_id}")
+        return
+    example_module.send_message(f"user {user_id} looted {item.name}, level {item.level}, worth {item.price}, "
+                                f"+{item.bonus.strength} strength ({item!r}, {item.bonus!r})")
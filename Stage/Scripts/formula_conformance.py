@@ -0,0 +1,97 @@
+import functools
+import example_module
+from example_module import native_formula
+
+
+@native_formula
+def damage(attack, defense, level):
+    base = attack * 2 - defense
+    if base < 1:
+        base = 1
+    return base * example_module.level_scale(level)
+
+
+@native_formula
+def crit_chance(dexterity, luck):
+    return min(max(dexterity / 400 + luck * 0.001, 0.0), 0.75)
+
+
+@native_formula
+def experience_share(experience, members):
+    return experience // members if members > 0 else experience
+
+
+@native_formula
+def in_range(value, low, high):
+    return low <= value < high
+
+
+@native_formula
+def wrap_angle(angle):
+    return angle % 360.0
+
+
+@native_formula
+def level_penalty(level_gap):
+    steps = abs(level_gap) // 3
+    return -steps if level_gap < 0 else steps
+
+
+@native_formula
+def first_truthy(a, b):
+    return a and b or not a
+
+
+@native_formula
+def name_length(name):
+    # Outside the native subset, this stays a python function.
+    return len(name)
+
+
+def doubled_formula(function):
+    # Marks a wrapper, whose source inspect reports as the wrapped function's, so it must not be compiled.
+    @functools.wraps(function)
+    def wrapper(*args):
+        return function(*args) * 2
+    return native_formula(wrapper)
+
+
+@doubled_formula
+def doubled_attack(attack):
+    return attack
+
+
+FORMULA_PYTHON_ONLY = ["name_length", "doubled_attack"]
+
+FORMULA_CONFORMANCE_CASES = [
+    ("damage", (10, 5, 1)),
+    ("damage", (1, 100, 60)),
+    ("damage", (2 ** 61, 0, 1)),
+    ("damage", (2 ** 62, 0, 1)),
+    ("damage", (7.5, 2, 3)),
+    ("crit_chance", (0, 0)),
+    ("crit_chance", (150, 35)),
+    ("crit_chance", (2 ** 60, 1)),
+    ("crit_chance", (float("nan"), 1)),
+    ("experience_share", (1000, 3)),
+    ("experience_share", (-1000, 3)),
+    ("experience_share", (1000.0, -3)),
+    ("experience_share", (-0.0, 7)),
+    ("experience_share", (55, 0)),
+    ("experience_share", (-2 ** 63, -1)),
+    ("in_range", (5, 0, 10)),
+    ("in_range", (10, 0, 10)),
+    ("in_range", (2 ** 53 + 1, 0, 2.0 ** 53 + 2)),
+    ("in_range", (float("nan"), 0, 1)),
+    ("wrap_angle", (725.5,)),
+    ("wrap_angle", (-30,)),
+    ("wrap_angle", (-0.0,)),
+    ("wrap_angle", (float("inf"),)),
+    ("level_penalty", (-10,)),
+    ("level_penalty", (7,)),
+    ("level_penalty", (True,)),
+    ("first_truthy", (0, 5)),
+    ("first_truthy", (3, 0.0)),
+    ("first_truthy", (2, 9)),
+    ("doubled_attack", (21,)),
+]
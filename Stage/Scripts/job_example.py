@@ -0,0 +1,28 @@
+import example_module
+
+# Native jobs run on the job pool without holding the GIL, see the "jobs" console command.
+
+pending_sorts = []
+
+
+def on_job_demo(count, size):
+    for request_id in range(count):
+        example_module.submit("find_path", (request_id, size), event="on_path_found")
+
+
+def on_path_found(job):
+    steps, visited = job.result()
+    if job.id % 250 == 0:
+        example_module.deferred.send_message(f"Job {job.id} found a path of {steps} steps after visiting {visited} cells")
+
+
+def on_sort_demo(count):
+    # Without an event the future is kept and checked on a later tick.
+    pending_sorts.append(example_module.submit("sort_numbers", [count, 7]))
+
+
+def on_sort_check():
+    for job in [job for job in pending_sorts if job.done()]:
+        pending_sorts.remove(job)
+        smallest, median, largest = job.result()
+        example_module.send_message(f"Job {job.id} sorted numbers, median {median:.4f}")
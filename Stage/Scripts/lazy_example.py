@@ -0,0 +1,20 @@
+import example_module
+
+kept_item = None
+
+def on_item_used(item):
+    global kept_item
+    kept_item = item
+    example_module.send_message(f"{item.name} +{item.refine} used, strength {item.stats.strength}, fields {dir(item)}")
+
+def on_check_item():
+    try:
+        kept_item.name
+    except ReferenceError as error:
+        example_module.send_message(f"Kept {kept_item!r}: {error}")
+
+def on_item_checked(item):
+    # Most checks only need the id, one item in a hundred reads its stats.
+    if item.id % 100 == 0:
+        return item.stats.strength + item.stats.stamina
+    return item.id
@@ -0,0 +1,8 @@
+import example_module
+
+
+def on_nested(depth):
+    example_module.send_message(f"enter on_nested {depth}")
+    if depth < 3:
+        example_module.dispatch_event("on_nested", depth + 1)
+    example_module.send_message(f"leave on_nested {depth}")
@@ -0,0 +1,36 @@
+import struct
+import example_module
+
+# Packets arrive as memoryviews of the game's buffers, valid only until the game recycles the buffer.
+bytes_seen = 0
+kept_view = None
+kept_header = None
+
+def on_packet(packet):
+    global bytes_seen
+    opcode, length = struct.unpack_from("<HI", packet, 0)
+    bytes_seen += length + packet[-1] - opcode
+
+def on_build_packet(packet):
+    # Writable views let a script fill in an outgoing packet without a copy.
+    struct.pack_into("<HI", packet, 0, 0x0102, len(packet) - 6)
+    packet[6:10] = b"ping"
+
+def on_keep_packet(packet):
+    global kept_view, kept_header
+    kept_view = packet
+    kept_header = packet[:6]
+
+def on_check_modes(read_only, writable):
+    # A view's obj lends the bytes the same way the view does.
+    with memoryview(read_only.obj) as again, memoryview(writable.obj) as writable_again:
+        example_module.send_message(f"Packet lent both ways: read only view re-exported read only {again.readonly}, writable view {not writable_again.readonly}")
+
+def on_check_kept():
+    try:
+        kept_view[0]
+        view = "still readable"
+    except ValueError:
+        view = "released"
+    opcode, length = struct.unpack_from("<HI", kept_header, 0)
+    example_module.send_message(f"Kept packet view: {view}. Its header slice still reads opcode {opcode:#06x}, length {length}")
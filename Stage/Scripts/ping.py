@@ -1,6 +1,18 @@
 import example_module
+
+# A handle rather than the user, so it is safe to keep after the user has gone.
+last_sender = None
+
 def on_message(user, message):
-    if user is not None:
-        example_module.send_message(f"Python recieved a message from user: {user.id}. message: {message}")
+    global last_sender
+    if message == "last" and last_sender is not None:
+        sender = example_module.resolve(last_sender)
+        if sender is not None:
+            example_module.deferred.send_message(f"The last message came from user: {sender.id}")
+        else:
+            example_module.deferred.send_message("The last message came from a user who has left")
+    elif user is not None:
+        example_module.deferred.send_message(f"Python recieved a message from user: {user.id}. message: {message}")
     else:
-        example_module.send_message(f"Python recieved a message from an unknown user. message: {message}")
\ No newline at end of file
+        example_module.deferred.send_message(f"Python recieved a message from an unknown user. message: {message}")
+    last_sender = user.handle if user is not None else None
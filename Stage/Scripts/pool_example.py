@@ -0,0 +1,19 @@
+import example_module
+
+trades = 0
+volume = 0
+kept = []
+
+def on_trade(user, trade):
+    global trades, volume
+    trades += 1
+    volume += trade["price"] * trade["count"] + trade["tax"]
+
+def on_trade_seen(user, trade):
+    pass
+
+def on_keep_trade(user, trade):
+    kept.append(trade)
+
+def on_check_trades():
+    example_module.send_message(f"{trades} trades worth {volume}, the kept trade still has price {kept[-1]['price']}")
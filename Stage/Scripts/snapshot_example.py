@@ -0,0 +1,23 @@
+import example_module
+
+# The same questions asked of bound mover objects and of a snapshot of their fields.
+
+def low_hp_objects(movers, threshold):
+    return [mover.id for mover in movers if mover.hp < threshold]
+
+def low_hp_snapshot(snapshot, threshold):
+    ids = snapshot["id"]
+    return [ids[i] for i, hp in enumerate(snapshot["hp"]) if hp < threshold]
+
+def guild_total_objects(movers):
+    return sum(mover.contribution for mover in movers)
+
+def guild_total_snapshot(snapshot):
+    return sum(snapshot["contribution"])
+
+def on_mover_snapshot(snapshot):
+    x = snapshot["x"]
+    z = snapshot["z"]
+    near = sum(1 for i in range(len(snapshot)) if x[i] * x[i] + z[i] * z[i] < 100.0 * 100.0)
+    example_module.send_message(f"Snapshot of {len(snapshot)} movers with columns {snapshot.names()}: {near} near the origin, "
+                                f"{len(low_hp_snapshot(snapshot, 100))} below 100 hp, guild contribution {guild_total_snapshot(snapshot)}")
@@ -0,0 +1,24 @@
+import example_module
+from collections import deque
+
+# Hosted in a worker process, see the "worker" console command. Searching here does not hold the game's GIL.
+
+def _blocked(x, y, seed):
+    return (x * 7 + y * 13 + seed) % 5 == 0 and x != y
+
+def on_path_request(request_id, size):
+    # Breadth first search across a grid with a repeating pattern of obstacles.
+    goal = (size - 1, size - 1)
+    distances = {(0, 0): 0}
+    frontier = deque([(0, 0)])
+    while frontier:
+        x, y = frontier.popleft()
+        if (x, y) == goal:
+            break
+        for next_x, next_y in ((x + 1, y), (x - 1, y), (x, y + 1), (x, y - 1)):
+            if 0 <= next_x < size and 0 <= next_y < size and (next_x, next_y) not in distances and not _blocked(next_x, next_y, request_id):
+                distances[(next_x, next_y)] = distances[(x, y)] + 1
+                frontier.append((next_x, next_y))
+
+    if request_id % 250 == 0:
+        example_module.deferred.send_message(f"Worker found path {request_id}: {distances.get(goal, -1)} steps")